@@ -0,0 +1,495 @@
+/* ctb_hash_bench - throughput of the ctb_hash kernels
+ *
+ * Measures every algorithm of ctb_hash.h at message sizes from 16 B up to
+ * 1 GiB, single-stream and batched (the `many` entry points), once per
+ * kernel set the CPU offers (scalar, SSE4.1, SHA-NI, AVX2, AVX-512, and
+ * everything detected). HMAC and PBKDF2 are measured the same way. Results
+ * are MB/s and cycles/byte (cycles/iteration for PBKDF2); with --json they
+ * are printed as one JSON document, so runs from two releases can be
+ * diffed.
+ *
+ * Build (no build system needed):
+ *
+ *     cc -O2 -pthread bench/ctb_hash_bench.c -o ctb_hash_bench
+ *
+ * Options:
+ *     --json               JSON instead of a table
+ *     --algo NAME          only this algorithm ("sha256", "ripemd160", ...)
+ *     --op NAME            only "hash", "hmac" or "pbkdf2"
+ *     --profile NAME       only this kernel set ("scalar", "avx2", ...)
+ *     --max-size BYTES     largest message (default 1 GiB; K/M/G suffixes)
+ *     --min-time SECONDS   measuring time per data point (default 0.1)
+ *     --iterations N       PBKDF2 iteration count (default 4096)
+ *
+ * Cycles come from the time-stamp counter on x86, which ticks at the
+ * nominal clock; with turbo or power saving active they are scaled by the
+ * ratio of actual to nominal frequency. Elsewhere cycles are not reported.
+ */
+
+/* clock_gettime and CLOCK_MONOTONIC under -std=c99; _DEFAULT_SOURCE keeps
+ * the glibc extensions ctb_hash.h uses (explicit_bzero) declared as well.
+ */
+#if !defined(_WIN32)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#endif
+
+#define CTB_HASH_IMPLEMENTATION
+#include "../ctb_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+
+#define BENCH_MIN_SIZE			16
+#define BENCH_BATCH_MAX_SIZE	(1u << 20)		/* batch mode stops here */
+#define BENCH_HMAC_MAX_SIZE		(1u << 20)		/* HMAC is the hash beyond this */
+#define BENCH_BATCH_COUNT		64				/* messages per batch call */
+#define BENCH_ROUNDS			3				/* best of */
+
+/* =========================================================================
+   TIMING
+   ========================================================================= */
+
+static double bench_now(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER f, c;
+
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (double) c.QuadPart / (double) f.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+static uint64_t bench_cycles(void)
+{
+#if BENCH_HAS_TSC
+	return (uint64_t) __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* =========================================================================
+   KERNEL PROFILES
+   ========================================================================= */
+
+#define BENCH_SSE4	(CTB_HASH_CPU_SSE2 | CTB_HASH_CPU_SSSE3 | CTB_HASH_CPU_SSE41 | CTB_HASH_CPU_SSE42)
+#define BENCH_AVX2	(BENCH_SSE4 | CTB_HASH_CPU_AVX | CTB_HASH_CPU_AVX2 | CTB_HASH_CPU_BMI2)
+
+typedef struct
+{
+	const char		*name;
+	unsigned int	mask;
+} bench_profile;
+
+static const bench_profile bench_profiles[] =
+{
+	{ "scalar",		0 },
+	{ "sse4.1",		BENCH_SSE4 },
+	{ "sha-ni",		BENCH_SSE4 | CTB_HASH_CPU_SHA },
+	{ "avx2",		BENCH_AVX2 },
+	{ "avx512",		BENCH_AVX2 | CTB_HASH_CPU_AVX512F | CTB_HASH_CPU_AVX512VL | CTB_HASH_CPU_AVX512BW },
+	{ "native",		~0u },
+};
+
+static const char *const bench_feature_names[] =
+{
+	"sse2", "ssse3", "sse4.1", "sse4.2", "avx", "avx2", "avx512f",
+	"avx512vl", "avx512bw", "sha", "pclmul", "bmi2",
+};
+
+/* =========================================================================
+   MEASUREMENT
+   ========================================================================= */
+
+typedef struct
+{
+	const char			*op;		/* "hash", "hmac", "pbkdf2" */
+	const char			*mode;		/* "single", "batch" */
+	const ctb_hash_algo	*algo;
+	size_t				size;		/* message (or derived key) length */
+	size_t				count;		/* messages per call */
+	uint32_t			iterations;	/* PBKDF2 only */
+} bench_case;
+
+typedef struct
+{
+	const uint8_t		*buf;
+	size_t				buf_size;
+	const uint8_t		*msg[BENCH_BATCH_COUNT];
+	size_t				len[BENCH_BATCH_COUNT];
+	uint8_t				digest[BENCH_BATCH_COUNT * CTB_HASH_MAX_DIGEST_SIZE];
+} bench_data;
+
+static volatile uint8_t bench_sink;
+
+static void bench_run_once(const bench_case *bc, bench_data *bd)
+{
+	static const uint8_t key[32] = "ctb_hash_bench hmac/pbkdf2 key";
+	static const uint8_t salt[16] = "ctb_hash_bench";
+	size_t i;
+
+	if (strcmp(bc->op, "hash") == 0) {
+		if (bc->count == 1)
+			ctb_hash_digest(bc->algo, bd->buf, bc->size, bd->digest);
+		else
+			bc->algo->many(bd->msg, bd->len, bd->digest, bc->count);
+	} else if (strcmp(bc->op, "hmac") == 0) {
+		ctb_hmac(bc->algo, key, sizeof(key), bd->buf, bc->size, bd->digest);
+	} else if (bc->count == 1) {
+		ctb_pbkdf2_hmac(bc->algo, key, sizeof(key), salt, sizeof(salt),
+						bc->iterations, bd->digest, bc->size);
+	} else {
+		const uint8_t *pw[BENCH_BATCH_COUNT], *sl[BENCH_BATCH_COUNT];
+		size_t pw_len[BENCH_BATCH_COUNT], sl_len[BENCH_BATCH_COUNT];
+
+		for (i = 0; i < bc->count; i++) {
+			pw[i] = bd->buf + i;
+			pw_len[i] = sizeof(key);
+			sl[i] = salt;
+			sl_len[i] = sizeof(salt);
+		}
+		if (bc->algo->id == CTB_HASH_SHA256)
+			ctb_pbkdf2_hmac_sha256_many(pw, pw_len, sl, sl_len, bc->iterations,
+										bd->digest, bc->size, bc->count);
+		else
+			ctb_pbkdf2_hmac_sha512_many(pw, pw_len, sl, sl_len, bc->iterations,
+										bd->digest, bc->size, bc->count);
+	}
+	bench_sink ^= bd->digest[0];
+}
+
+typedef struct
+{
+	uint64_t	reps;
+	double		seconds;	/* best round */
+	double		cycles;		/* cycles of that round */
+} bench_result;
+
+/* Double the repetitions until one round takes min_time / BENCH_ROUNDS,
+ * then keep the fastest of BENCH_ROUNDS rounds.
+ */
+static bench_result bench_measure(const bench_case *bc, bench_data *bd, double min_time)
+{
+	bench_result r;
+	double target = min_time / BENCH_ROUNDS, t0, t;
+	uint64_t c0, c, i;
+	int round;
+
+	r.reps = 1;
+	bench_run_once(bc, bd);		/* warm up caches and the kernel table */
+	for (;;) {
+		t0 = bench_now();
+		for (i = 0; i < r.reps; i++)
+			bench_run_once(bc, bd);
+		t = bench_now() - t0;
+		if (t >= target || r.reps >= ((uint64_t) 1 << 40))
+			break;
+		if (t <= 0 || target / t > 64)
+			r.reps *= 64;
+		else if (target / t > 2)
+			r.reps = (uint64_t) ((double) r.reps * target / t) + 1;
+		else
+			r.reps *= 2;
+	}
+
+	r.seconds = t;
+	r.cycles = 0;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t0 = bench_now();
+		c0 = bench_cycles();
+		for (i = 0; i < r.reps; i++)
+			bench_run_once(bc, bd);
+		c = bench_cycles() - c0;
+		t = bench_now() - t0;
+		if (round == 0 || t < r.seconds) {
+			r.seconds = t;
+			r.cycles = (double) c;
+		}
+	}
+	return r;
+}
+
+/* =========================================================================
+   REPORTING
+   ========================================================================= */
+
+typedef struct
+{
+	int		json;
+	int		first;		/* no JSON record printed yet */
+} bench_out;
+
+static void bench_report(bench_out *out, const bench_case *bc, const bench_profile *p,
+						 const bench_result *r)
+{
+	const ctb_hash_algo *a = bc->algo;
+	unsigned int features = ctb_hash_cpu_features();
+	int pbkdf2 = strcmp(bc->op, "pbkdf2") == 0;
+	double units, rate, cpu;
+
+	/* PBKDF2 is counted in iterations (of every key in a batch), the rest
+	 * in message bytes. */
+	units = (double) r->reps * (double) bc->count
+		* (pbkdf2 ? (double) bc->iterations : (double) bc->size);
+	rate = units / r->seconds;
+	cpu = BENCH_HAS_TSC ? r->cycles / units : 0;
+
+	if (out->json) {
+		printf("%s\n    {\"op\": \"%s\", \"algo\": \"%s\", \"mode\": \"%s\", "
+			   "\"profile\": \"%s\", \"features\": \"0x%03x\", \"kernel\": \"%s\", "
+			   "\"lanes\": %u, \"size\": %zu, \"count\": %zu, ",
+			   out->first ? "" : ",", bc->op, a->name, bc->mode, p->name, features,
+			   a->kernel, a->lanes, bc->size, bc->count);
+		if (pbkdf2)
+			printf("\"iterations\": %u, \"seconds\": %.6f, \"iterations_per_s\": %.1f, "
+				   "\"cycles_per_iteration\": ", bc->iterations, r->seconds, rate);
+		else
+			printf("\"seconds\": %.6f, \"mb_per_s\": %.2f, \"cycles_per_byte\": ",
+				   r->seconds, rate / 1e6);
+		if (BENCH_HAS_TSC)
+			printf("%.3f}", cpu);
+		else
+			printf("null}");
+		out->first = 0;
+	} else {
+		printf("%-6s %-9s %-6s %-7s %-7s %3u  %10zu x%-3zu ",
+			   bc->op, a->name, bc->mode, p->name, a->kernel, a->lanes, bc->size, bc->count);
+		if (pbkdf2)
+			printf("%12.0f it/s", rate);
+		else
+			printf("%10.1f MB/s", rate / 1e6);
+		if (BENCH_HAS_TSC)
+			printf("  %9.2f %s", cpu, pbkdf2 ? "cyc/it" : "cyc/B");
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/* =========================================================================
+   DRIVER
+   ========================================================================= */
+
+static size_t bench_parse_size(const char *s)
+{
+	char *end;
+	double v = strtod(s, &end);
+
+	switch (*end) {
+	case 'k': case 'K': v *= 1024.0; break;
+	case 'm': case 'M': v *= 1024.0 * 1024.0; break;
+	case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; break;
+	default: break;
+	}
+	return v < BENCH_MIN_SIZE ? BENCH_MIN_SIZE : (size_t) v;
+}
+
+static void bench_usage(const char *argv0)
+{
+	fprintf(stderr,
+			"usage: %s [--json] [--algo NAME] [--op hash|hmac|pbkdf2] [--profile NAME]\n"
+			"       [--max-size BYTES] [--min-time SECONDS] [--iterations N]\n", argv0);
+}
+
+static void bench_case_run(bench_out *out, bench_case *bc, bench_data *bd,
+						   const bench_profile *p, double min_time)
+{
+	bench_result r;
+	size_t i;
+
+	for (i = 0; i < bc->count; i++) {
+		size_t off = (i * bc->size) % (bd->buf_size - bc->size + 1);
+
+		bd->msg[i] = bd->buf + off;
+		bd->len[i] = bc->size;
+	}
+	r = bench_measure(bc, bd, min_time);
+	bench_report(out, bc, p, &r);
+}
+
+int main(int argc, char **argv)
+{
+	const char *only_algo = NULL, *only_op = NULL, *only_profile = NULL;
+	size_t max_size = (size_t) 1 << 30, size, i;
+	double min_time = 0.1;
+	uint32_t iterations = 4096;
+	unsigned int detected, seen[sizeof(bench_profiles) / sizeof(bench_profiles[0])];
+	size_t nseen = 0, pi;
+	bench_out out = { 0, 1 };
+	bench_data *bd;
+	uint8_t *buf = NULL;
+	int ai, k;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "--json") == 0)
+			out.json = 1;
+		else if (strcmp(argv[k], "--algo") == 0 && k + 1 < argc)
+			only_algo = argv[++k];
+		else if (strcmp(argv[k], "--op") == 0 && k + 1 < argc)
+			only_op = argv[++k];
+		else if (strcmp(argv[k], "--profile") == 0 && k + 1 < argc)
+			only_profile = argv[++k];
+		else if (strcmp(argv[k], "--max-size") == 0 && k + 1 < argc)
+			max_size = bench_parse_size(argv[++k]);
+		else if (strcmp(argv[k], "--min-time") == 0 && k + 1 < argc)
+			min_time = strtod(argv[++k], NULL);
+		else if (strcmp(argv[k], "--iterations") == 0 && k + 1 < argc)
+			iterations = (uint32_t) strtoul(argv[++k], NULL, 10);
+		else {
+			bench_usage(argv[0]);
+			return 2;
+		}
+	}
+	if (only_algo && !ctb_hash_algo_find(only_algo)) {
+		fprintf(stderr, "unknown algorithm '%s'\n", only_algo);
+		return 2;
+	}
+	if (min_time <= 0)
+		min_time = 0.1;
+	if (iterations == 0)
+		iterations = 1;
+
+	/* One buffer serves every size; a batch spreads its messages over it. */
+	while (max_size >= BENCH_MIN_SIZE) {
+		size_t want = max_size > (size_t) BENCH_BATCH_COUNT * BENCH_BATCH_MAX_SIZE
+			? max_size : (size_t) BENCH_BATCH_COUNT * BENCH_BATCH_MAX_SIZE;
+
+		if ((buf = (uint8_t *) malloc(want)) != NULL) {
+			for (i = 0; i < want; i++)
+				buf[i] = (uint8_t) (i * 131 + 7);
+			break;
+		}
+		max_size >>= 1;
+		fprintf(stderr, "out of memory, lowering --max-size to %zu\n", max_size);
+	}
+	bd = (bench_data *) calloc(1, sizeof(*bd));
+	if (!buf || !bd) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	bd->buf = buf;
+	bd->buf_size = max_size > (size_t) BENCH_BATCH_COUNT * BENCH_BATCH_MAX_SIZE
+		? max_size : (size_t) BENCH_BATCH_COUNT * BENCH_BATCH_MAX_SIZE;
+
+	detected = ctb_hash_cpu_features();
+	if (out.json) {
+		printf("{\n  \"benchmark\": \"ctb_hash\",\n  \"cpu_features\": \"0x%03x\",\n"
+			   "  \"cpu_feature_names\": [", detected);
+		for (k = 0, i = 0; i < sizeof(bench_feature_names) / sizeof(bench_feature_names[0]); i++)
+			if (detected & (1u << i))
+				printf("%s\"%s\"", k++ ? ", " : "", bench_feature_names[i]);
+		printf("],\n  \"tsc_cycles\": %s,\n  \"min_time\": %g,\n  \"results\": [",
+			   BENCH_HAS_TSC ? "true" : "false", min_time);
+	} else {
+		printf("cpu features 0x%03x:", detected);
+		for (i = 0; i < sizeof(bench_feature_names) / sizeof(bench_feature_names[0]); i++)
+			if (detected & (1u << i))
+				printf(" %s", bench_feature_names[i]);
+		printf("\n%-6s %-9s %-6s %-7s %-7s %3s  %10s %-4s %15s%s\n",
+			   "op", "algo", "mode", "profile", "kernel", "ln", "size", "n", "rate",
+			   BENCH_HAS_TSC ? "  cycles" : "");
+	}
+
+	for (pi = 0; pi < sizeof(bench_profiles) / sizeof(bench_profiles[0]); pi++) {
+		const bench_profile *p = &bench_profiles[pi];
+		unsigned int effective;
+		size_t s;
+		int dup = 0;
+
+		if (only_profile && strcmp(only_profile, p->name) != 0)
+			continue;
+		if ((detected & p->mask) != p->mask && p->mask != ~0u)
+			continue;
+		/* skip a profile that selects the same kernels as an earlier one */
+		effective = detected & p->mask;
+		for (s = 0; s < nseen; s++)
+			dup |= seen[s] == effective;
+		if (dup)
+			continue;
+		seen[nseen++] = effective;
+		ctb_hash_set_cpu_features(p->mask);
+
+		for (ai = 0; ai < CTB_HASH_ALGO_COUNT; ai++) {
+			const ctb_hash_algo *a = ctb_hash_algo_get((ctb_hash_id) ai);
+			bench_case bc;
+
+			if (!a || (only_algo && strcmp(only_algo, a->name) != 0))
+				continue;
+			bc.algo = a;
+			bc.iterations = iterations;
+
+			if (!only_op || strcmp(only_op, "hash") == 0) {
+				bc.op = "hash";
+				for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+					bc.mode = "single";
+					bc.size = size;
+					bc.count = 1;
+					bench_case_run(&out, &bc, bd, p, min_time);
+					if (size <= BENCH_BATCH_MAX_SIZE) {
+						bc.mode = "batch";
+						bc.count = BENCH_BATCH_COUNT;
+						bench_case_run(&out, &bc, bd, p, min_time);
+					}
+					if (size > max_size / 4)
+						break;
+				}
+			}
+			if (!only_op || strcmp(only_op, "hmac") == 0) {
+				bc.op = "hmac";
+				bc.mode = "single";
+				bc.count = 1;
+				for (size = BENCH_MIN_SIZE; size <= max_size && size <= BENCH_HMAC_MAX_SIZE; size *= 4) {
+					bc.size = size;
+					bench_case_run(&out, &bc, bd, p, min_time);
+				}
+			}
+			if (!only_op || strcmp(only_op, "pbkdf2") == 0) {
+				bc.op = "pbkdf2";
+				bc.mode = "single";
+				bc.size = a->digest_size;
+				bc.count = 1;
+				bench_case_run(&out, &bc, bd, p, min_time);
+				if (a->id == CTB_HASH_SHA256 || a->id == CTB_HASH_SHA512) {
+					bc.mode = "batch";
+					bc.count = 16;
+					bench_case_run(&out, &bc, bd, p, min_time);
+				}
+			}
+		}
+	}
+	ctb_hash_set_cpu_features(~0u);
+
+	if (out.json)
+		printf("\n  ]\n}\n");
+	free(bd);
+	free(buf);
+	return 0;
+}
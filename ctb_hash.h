@@ -15,10 +15,13 @@ typedef struct
 	unsigned char buffer[64];
 } ctb_sha1_ctx;
 
+/* Initial state, shared with the constexpr version (section 15) */
+#define _CTB_SHA1_H0 { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 }
+
 void ctb_sha1_init(ctb_sha1_ctx * context);
-void ctb_sha1_update(ctb_sha1_ctx * context, const unsigned char *data, uint32_t len);
+void ctb_sha1_update(ctb_sha1_ctx * context, const unsigned char *data, size_t len);
 void ctb_sha1_final(unsigned char digest[20], ctb_sha1_ctx * context);
-void ctb_sha1(char *hash_out, const char *str, uint32_t len);
+void ctb_sha1(char *hash_out, const char *str, size_t len);
 
 /* =========================================================================
    2. RIPEMD160 API
@@ -29,15 +32,24 @@ void ctb_sha1(char *hash_out, const char *str, uint32_t len);
 
 typedef struct _ctb_ripemd160_ctx
 {
+	uint8_t buffer[_CTB_RIPEMD160_BLOCK_LENGTH]; /*!< data block being processed */
 	uint32_t total[2];                      /*!< number of bytes processed  */
 	uint32_t state[5];                      /*!< intermediate digest state  */
-	uint8_t buffer[_CTB_RIPEMD160_BLOCK_LENGTH]; /*!< data block being processed */
 } ctb_ripemd160_ctx;
 
 void ctb_ripemd160_init(ctb_ripemd160_ctx *ctx);
-void ctb_ripemd160_update(ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_t ilen);
+void ctb_ripemd160_update(ctb_ripemd160_ctx *ctx, const uint8_t *input, size_t ilen);
 void ctb_ripemd160_final(ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_DIGEST_LENGTH]);
-void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH]);
+void ctb_ripemd160(const uint8_t *msg, size_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH]);
+
+/* Midstate after a whole number of 64-byte blocks: the five state words
+ * and the 64-bit byte count, little-endian like the digest. Same contract
+ * as the SHA-2 _export/_import (section 3).
+ */
+#define CTB_RIPEMD160_MIDSTATE_SIZE (5 * 4 + 8)
+
+int ctb_ripemd160_export(const ctb_ripemd160_ctx *ctx, uint8_t out[CTB_RIPEMD160_MIDSTATE_SIZE]);
+int ctb_ripemd160_import(ctb_ripemd160_ctx *ctx, const uint8_t in[CTB_RIPEMD160_MIDSTATE_SIZE]);
 
 
 /* =========================================================================
@@ -61,44 +73,156 @@ typedef unsigned int  uint32;
 typedef unsigned long long uint64;
 #endif
 
+/* FIPS 180-4 initial hash values and round constants. The C tables in
+ * the implementation and the constexpr C++ versions (section 15) are both
+ * initialized from these lists.
+ */
+#define _CTB_SHA224_H0 { \
+	0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, \
+	0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4 }
+
+#define _CTB_SHA256_H0 { \
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, \
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+
+#define _CTB_SHA384_H0 { \
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, \
+	0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL, \
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, \
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL }
+
+#define _CTB_SHA512_H0 { \
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, \
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL, \
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, \
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL }
+
+#define _CTB_SHA256_K { \
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, \
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, \
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, \
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, \
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, \
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, \
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, \
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, \
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, \
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, \
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, \
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, \
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, \
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, \
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, \
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 }
+
+#define _CTB_SHA512_K { \
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, \
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL, \
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, \
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, \
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, \
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL, \
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, \
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL, \
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, \
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, \
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, \
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL, \
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, \
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL, \
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, \
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, \
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, \
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL, \
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, \
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL, \
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, \
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, \
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, \
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL, \
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, \
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL, \
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, \
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, \
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, \
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL, \
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, \
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL, \
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, \
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, \
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, \
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL, \
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, \
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL, \
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, \
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL }
+
+/* One block buffer, placed first. Whole blocks of input are compressed
+ * straight from the caller's memory; only a partial block is ever copied
+ * into the context, and _final pads it in place. The contexts need no
+ * more than the natural alignment of their fields, so malloc'd copies
+ * are fine.
+ */
 typedef struct
 {
-	unsigned int tot_len;
-	unsigned int len;
-	unsigned char block[2 * _CTB_SHA256_BLOCK_SIZE];
+	unsigned char block[_CTB_SHA256_BLOCK_SIZE];
 	uint32 h[8];
+	uint64 tot_len;
+	unsigned int len;
 } ctb_sha256_ctx;
 
 typedef struct
 {
-	unsigned int tot_len;
-	unsigned int len;
-	unsigned char block[2 * _CTB_SHA512_BLOCK_SIZE];
+	unsigned char block[_CTB_SHA512_BLOCK_SIZE];
 	uint64 h[8];
+	uint64 tot_len;
+	unsigned int len;
 } ctb_sha512_ctx;
 
 typedef ctb_sha512_ctx ctb_sha384_ctx;
 typedef ctb_sha256_ctx ctb_sha224_ctx;
 
 void ctb_sha224_init(ctb_sha224_ctx *ctx);
-void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest);
-void ctb_sha224(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha224(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha256_init(ctb_sha256_ctx * ctx);
-void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest);
-void ctb_sha256(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha256(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha384_init(ctb_sha384_ctx *ctx);
-void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest);
-void ctb_sha384(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha384(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha512_init(ctb_sha512_ctx *ctx);
-void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest);
-void ctb_sha512(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha512(const unsigned char *message, size_t len, unsigned char *digest);
+
+/* Midstates, for messages that share a long prefix. Once a context has
+ * absorbed a whole number of blocks (64 bytes for SHA-224/256, 128 for
+ * SHA-384/512) it is nothing but its chaining value and byte count:
+ * _export writes those as a compact record (the state words big-endian,
+ * then the 64-bit count; no block buffer) and _import turns a record back
+ * into a context ready for _update and _final. Hash the prefix once, keep
+ * the record, and start each message from it; a record is plain bytes, so
+ * any number of threads may import the same one at once.
+ * SHA-224 and SHA-384 contexts go through the SHA-256 and SHA-512
+ * functions; the record does not say which variant produced it, so finish
+ * with the matching _final.
+ * Both return 0, or -1 when the context holds a partial block (export) or
+ * the count is not a whole number of blocks (import).
+ */
+#define CTB_SHA256_MIDSTATE_SIZE	(8 * 4 + 8)
+#define CTB_SHA512_MIDSTATE_SIZE	(8 * 8 + 8)
+
+int ctb_sha256_export(const ctb_sha256_ctx *ctx, unsigned char out[CTB_SHA256_MIDSTATE_SIZE]);
+int ctb_sha256_import(ctb_sha256_ctx *ctx, const unsigned char in[CTB_SHA256_MIDSTATE_SIZE]);
+int ctb_sha512_export(const ctb_sha512_ctx *ctx, unsigned char out[CTB_SHA512_MIDSTATE_SIZE]);
+int ctb_sha512_import(ctb_sha512_ctx *ctx, const unsigned char in[CTB_SHA512_MIDSTATE_SIZE]);
 
 
 /* =========================================================================
@@ -159,36 +283,87 @@ typedef struct
 
 void ctb_hmac_sha224_init(ctb_hmac_sha224_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha224_reinit(ctb_hmac_sha224_ctx *ctx);
-void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha224_final(ctb_hmac_sha224_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha224(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
+					 const unsigned char *message, size_t message_len,
 					 unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha256_init(ctb_hmac_sha256_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha256_reinit(ctb_hmac_sha256_ctx *ctx);
-void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha256_final(ctb_hmac_sha256_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha256(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
+					 const unsigned char *message, size_t message_len,
 					 unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha384_init(ctb_hmac_sha384_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha384_reinit(ctb_hmac_sha384_ctx *ctx);
-void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha384_final(ctb_hmac_sha384_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha384(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
+					 const unsigned char *message, size_t message_len,
 					 unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha512_init(ctb_hmac_sha512_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha512_reinit(ctb_hmac_sha512_ctx *ctx);
-void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha512_final(ctb_hmac_sha512_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha512(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
+					 const unsigned char *message, size_t message_len,
 					 unsigned char *mac, unsigned mac_size);
 
+/* Prepared keys: only the keyed inner and outer midstates (the state after
+ * the ipad and opad blocks), 64 bytes for SHA-224/256 and 128 for
+ * SHA-384/512, against four full contexts plus pad blocks above. A key is
+ * written once by _key_init and only read afterwards, so one instance can
+ * serve any number of threads. _mac writes the full-length MAC; _mac_many
+ * MACs count messages under one key, two multi-buffer passes (inner, then
+ * outer over the inner digests), MAC i going to mac[i].
+ */
+typedef struct
+{
+	uint32 inner[8];
+	uint32 outer[8];
+} ctb_hmac_sha256_key;
+
+typedef struct
+{
+	uint64 inner[8];
+	uint64 outer[8];
+} ctb_hmac_sha512_key;
+
+typedef ctb_hmac_sha256_key ctb_hmac_sha224_key;
+typedef ctb_hmac_sha512_key ctb_hmac_sha384_key;
+
+void ctb_hmac_sha224_key_init(ctb_hmac_sha224_key *pk, const unsigned char *key, size_t key_size);
+void ctb_hmac_sha224_mac(const ctb_hmac_sha224_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA224_DIGEST_SIZE]);
+void ctb_hmac_sha224_mac_many(const ctb_hmac_sha224_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA224_DIGEST_SIZE],
+							  size_t count);
+
+void ctb_hmac_sha256_key_init(ctb_hmac_sha256_key *pk, const unsigned char *key, size_t key_size);
+void ctb_hmac_sha256_mac(const ctb_hmac_sha256_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA256_DIGEST_SIZE]);
+void ctb_hmac_sha256_mac_many(const ctb_hmac_sha256_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA256_DIGEST_SIZE],
+							  size_t count);
+
+void ctb_hmac_sha384_key_init(ctb_hmac_sha384_key *pk, const unsigned char *key, size_t key_size);
+void ctb_hmac_sha384_mac(const ctb_hmac_sha384_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA384_DIGEST_SIZE]);
+void ctb_hmac_sha384_mac_many(const ctb_hmac_sha384_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA384_DIGEST_SIZE],
+							  size_t count);
+
+void ctb_hmac_sha512_key_init(ctb_hmac_sha512_key *pk, const unsigned char *key, size_t key_size);
+void ctb_hmac_sha512_mac(const ctb_hmac_sha512_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA512_DIGEST_SIZE]);
+void ctb_hmac_sha512_mac_many(const ctb_hmac_sha512_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA512_DIGEST_SIZE],
+							  size_t count);
+
 
 /* =========================================================================
    5. PBKDF2 API
@@ -219,6 +394,956 @@ void ctb_pbkdf2_hmac_sha512(const uint8_t *password, size_t password_len,
 							uint32_t iterations,
 							uint8_t *out, size_t out_len);
 
+/* Same as above with the output blocks T_1..T_n, which are independent,
+ * spread over up to `threads` threads (the caller counts as one; at most
+ * 64 and never more than the number of blocks). Worth it when out_len
+ * spans several digests and the iteration count is high. Built with
+ * CTB_HASH_NO_THREADS, or where no thread can be started, the blocks run
+ * on the calling thread.
+ */
+void ctb_pbkdf2_hmac_sha224_mt(const uint8_t *password, size_t password_len,
+							   const uint8_t *salt,     size_t salt_len,
+							   uint32_t iterations,
+							   uint8_t *out, size_t out_len,
+							   unsigned int threads);
+
+void ctb_pbkdf2_hmac_sha256_mt(const uint8_t *password, size_t password_len,
+							   const uint8_t *salt,     size_t salt_len,
+							   uint32_t iterations,
+							   uint8_t *out, size_t out_len,
+							   unsigned int threads);
+
+void ctb_pbkdf2_hmac_sha384_mt(const uint8_t *password, size_t password_len,
+							   const uint8_t *salt,     size_t salt_len,
+							   uint32_t iterations,
+							   uint8_t *out, size_t out_len,
+							   unsigned int threads);
+
+void ctb_pbkdf2_hmac_sha512_mt(const uint8_t *password, size_t password_len,
+							   const uint8_t *salt,     size_t salt_len,
+							   uint32_t iterations,
+							   uint8_t *out, size_t out_len,
+							   unsigned int threads);
+
+/* Batch PBKDF2: count independent derivations, one per SIMD lane (16 for
+ * SHA-256 on AVX-512, 8 on AVX2, 4 for SHA-512 on AVX2), all lanes running
+ * their iterations together. Key i is written to out + i * out_len; each
+ * output block of a long key takes its own lane.
+ */
+void ctb_pbkdf2_hmac_sha256_many(const uint8_t *const *password, const size_t *password_len,
+								 const uint8_t *const *salt,     const size_t *salt_len,
+								 uint32_t iterations,
+								 uint8_t *out, size_t out_len, size_t count);
+
+void ctb_pbkdf2_hmac_sha512_many(const uint8_t *const *password, const size_t *password_len,
+								 const uint8_t *const *salt,     const size_t *salt_len,
+								 uint32_t iterations,
+								 uint8_t *out, size_t out_len, size_t count);
+
+
+/* =========================================================================
+   6. CPU DISPATCH API
+   ========================================================================= */
+
+/* Instruction set extensions usable by the hash kernels. The fastest kernel
+ * for each algorithm is selected once, at startup, from the detected set.
+ * Define CTB_HASH_NO_SIMD to build the portable code paths only.
+ */
+#define CTB_HASH_CPU_SSE2		(1u << 0)
+#define CTB_HASH_CPU_SSSE3		(1u << 1)
+#define CTB_HASH_CPU_SSE41		(1u << 2)
+#define CTB_HASH_CPU_SSE42		(1u << 3)
+#define CTB_HASH_CPU_AVX		(1u << 4)
+#define CTB_HASH_CPU_AVX2		(1u << 5)
+#define CTB_HASH_CPU_AVX512F	(1u << 6)
+#define CTB_HASH_CPU_AVX512VL	(1u << 7)
+#define CTB_HASH_CPU_AVX512BW	(1u << 8)
+#define CTB_HASH_CPU_SHA		(1u << 9)
+#define CTB_HASH_CPU_PCLMUL		(1u << 10)
+#define CTB_HASH_CPU_BMI2		(1u << 11)
+
+/* Features currently used for kernel selection. */
+unsigned int ctb_hash_cpu_features(void);
+
+/* Restrict kernel selection to (detected & mask); 0 forces the scalar code.
+ * Must not be called while other threads are hashing.
+ */
+void ctb_hash_set_cpu_features(unsigned int mask);
+
+
+/* =========================================================================
+   7. MULTI-BUFFER API
+   ========================================================================= */
+
+/* Hash many independent messages at once. Each message occupies one SIMD
+ * lane (16 per AVX-512 register, 8 per AVX2 register); a lane whose message
+ * ends is refilled from the remaining ones, so ragged lengths keep every
+ * lane busy. Without a wide enough vector unit, or where the SHA extensions
+ * are faster, the messages are hashed one after the other with the
+ * single-stream kernel. The _x8/_x16 forms are fixed-count conveniences
+ * and work on any CPU.
+ */
+void ctb_sha256_x8(const unsigned char *const message[8], const size_t len[8],
+				   unsigned char digest[8][_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256_x16(const unsigned char *const message[16], const size_t len[16],
+					unsigned char digest[16][_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA256_DIGEST_SIZE], size_t count);
+
+void ctb_sha224_x16(const unsigned char *const message[16], const size_t len[16],
+					unsigned char digest[16][_CTB_SHA224_DIGEST_SIZE]);
+void ctb_sha224_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA224_DIGEST_SIZE], size_t count);
+
+/* SHA-512/384 batches run four messages per AVX2 register. */
+void ctb_sha512_x4(const unsigned char *const message[4], const size_t len[4],
+				   unsigned char digest[4][_CTB_SHA512_DIGEST_SIZE]);
+void ctb_sha512_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA512_DIGEST_SIZE], size_t count);
+
+void ctb_sha384_x4(const unsigned char *const message[4], const size_t len[4],
+				   unsigned char digest[4][_CTB_SHA384_DIGEST_SIZE]);
+void ctb_sha384_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA384_DIGEST_SIZE], size_t count);
+
+/* RIPEMD-160 batches: 8 lanes with AVX2, 4 with SSE4.1. The _32 form takes
+ * contiguous 32-byte messages (e.g. SHA-256 digests) and skips padding.
+ */
+void ctb_ripemd160_x4(const uint8_t *const msg[4], const size_t len[4],
+					  uint8_t hash[4][_CTB_RIPEMD160_DIGEST_LENGTH]);
+void ctb_ripemd160_x8(const uint8_t *const msg[8], const size_t len[8],
+					  uint8_t hash[8][_CTB_RIPEMD160_DIGEST_LENGTH]);
+void ctb_ripemd160_many(const uint8_t *const *msg, const size_t *len,
+						uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH], size_t count);
+void ctb_ripemd160_32_many(const uint8_t (*msg)[32], uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH],
+						   size_t count);
+
+
+/* =========================================================================
+   8. COMPOSITE HASH API
+   ========================================================================= */
+
+/* HASH160 = RIPEMD-160(SHA-256(msg)). The SHA-256 digest never goes
+ * through a context: it is handed to RIPEMD-160 as one pre-padded block.
+ * The batch form runs SHA-256 on the multi-buffer path and the second
+ * stage in RIPEMD-160 lanes.
+ */
+void ctb_hash160(const uint8_t *msg, size_t len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH]);
+void ctb_hash160_many(const uint8_t *const *msg, const size_t *len,
+					  uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH], size_t count);
+/* Double SHA-256, SHA-256(SHA-256(msg)). The fixed-length forms build
+ * their padding from constant words and run the second hash straight on
+ * the first digest's state words. The batch forms use vector lanes.
+ */
+void ctb_sha256d(const uint8_t *msg, size_t len, uint8_t hash[_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256d_32(const uint8_t msg[32], uint8_t hash[_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256d_64(const uint8_t msg[64], uint8_t hash[_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256d_80(const uint8_t msg[80], uint8_t hash[_CTB_SHA256_DIGEST_SIZE]);
+void ctb_sha256d_many(const uint8_t *const *msg, const size_t *len,
+					  uint8_t (*hash)[_CTB_SHA256_DIGEST_SIZE], size_t count);
+void ctb_sha256d_64_many(const uint8_t (*msg)[64], uint8_t (*hash)[_CTB_SHA256_DIGEST_SIZE],
+						 size_t count);
+
+/* =========================================================================
+   9. FILE HASHING API
+   ========================================================================= */
+
+typedef enum
+{
+	CTB_HASH_SHA1,
+	CTB_HASH_SHA224,
+	CTB_HASH_SHA256,
+	CTB_HASH_SHA384,
+	CTB_HASH_SHA512,
+	CTB_HASH_RIPEMD160,
+	CTB_HASH_BLAKE3,
+	CTB_HASH_BLAKE2B,
+	CTB_HASH_BLAKE2S,
+	CTB_HASH_BLAKE2BP,
+	CTB_HASH_BLAKE2SP
+} ctb_hash_id;
+
+#define CTB_HASH_MAX_DIGEST_SIZE	_CTB_SHA512_DIGEST_SIZE
+
+/* Digest length in bytes, 0 for an unknown id. */
+size_t ctb_hash_digest_size(ctb_hash_id id);
+/* Hashes the file at path into out (ctb_hash_digest_size(id) bytes).
+ * Regular files are memory-mapped and hashed in one pass; pipes, devices
+ * and files that cannot be mapped are read in 4 MiB chunks by one reader
+ * thread per file, which fills the next chunk while the current one is
+ * hashed.
+ * Returns 0 on success, -1 on an unknown id or an open/read error.
+ */
+int ctb_hash_file(const char *path, ctb_hash_id id, uint8_t *out);
+
+/* =========================================================================
+   10. TREE HASH API
+   ========================================================================= */
+
+/* Parallel tree mode over SHA-256 / SHA-512. The input is cut into
+ * CTB_HASH_TREE_CHUNK_SIZE-byte chunks (the last one may be shorter, an
+ * empty input is one empty chunk) and the chunk digests are combined in a
+ * left-balanced binary tree, as in RFC 6962:
+ *
+ *   leaf = H(0x00 || zero fill to one block || chunk)
+ *   node = H(0x01 || zero fill to one block || left || right)
+ *
+ * The root is the digest; it differs from the plain SHA-2 digest of the
+ * same input. Chunks are hashed on up to `threads` threads (0 = one per
+ * online CPU, at most 64) and in SIMD lanes within each thread.
+ */
+#define CTB_HASH_TREE_CHUNK_SIZE	65536
+#define _CTB_HASH_TREE_MAX_DEPTH	64
+
+typedef struct
+{
+	ctb_sha256_ctx	leaf;			/* chunk being filled */
+	unsigned int	leaf_len;
+	unsigned int	threads;
+	uint32			leaf_iv[8];
+	uint32			node_iv[8];
+	uint64_t		chunks;			/* full chunks folded into stack */
+	unsigned int	depth;
+	unsigned char	stack[_CTB_HASH_TREE_MAX_DEPTH][_CTB_SHA256_DIGEST_SIZE];
+} ctb_sha256_tree_ctx;
+
+typedef struct
+{
+	ctb_sha512_ctx	leaf;
+	unsigned int	leaf_len;
+	unsigned int	threads;
+	uint64			leaf_iv[8];
+	uint64			node_iv[8];
+	uint64_t		chunks;
+	unsigned int	depth;
+	unsigned char	stack[_CTB_HASH_TREE_MAX_DEPTH][_CTB_SHA512_DIGEST_SIZE];
+} ctb_sha512_tree_ctx;
+
+void ctb_sha256_tree_init(ctb_sha256_tree_ctx *ctx, unsigned int threads);
+void ctb_sha256_tree_update(ctb_sha256_tree_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_sha256_tree_final(ctb_sha256_tree_ctx *ctx, unsigned char *digest);
+void ctb_sha256_tree(const unsigned char *message, size_t len, unsigned char *digest,
+					 unsigned int threads);
+
+void ctb_sha512_tree_init(ctb_sha512_tree_ctx *ctx, unsigned int threads);
+void ctb_sha512_tree_update(ctb_sha512_tree_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_sha512_tree_final(ctb_sha512_tree_ctx *ctx, unsigned char *digest);
+void ctb_sha512_tree(const unsigned char *message, size_t len, unsigned char *digest,
+					 unsigned int threads);
+
+/* =========================================================================
+   11. MERKLE API
+   ========================================================================= */
+
+/* Append-only Merkle tree over 32-byte leaves (typically SHA-256d
+ * digests) with Bitcoin's node rule: parent = SHA-256d(left || right),
+ * and a level with an odd number of nodes pairs its last node with itself
+ * (so, as in Bitcoin, [a, b, c] and [a, b, c, c] share a root).
+ *
+ * Complete nodes are stored level by level (leaves, their parents, ...)
+ * in caller memory behind a 32-byte header holding the capacity and leaf
+ * count. Sibling pairs are adjacent, so appending a batch hashes each
+ * level's new pairs in place on the multi-lane SHA-256d path. The memory
+ * holds no pointers: it may come from malloc, an arena
+ * (ctb_arena_alloc_aligned) or a shared file mapping, and a formatted
+ * region can be picked up again with ctb_merkle_open. It must be 8-byte
+ * aligned. Append is amortised O(1); root and proof are O(log n).
+ */
+#define CTB_MERKLE_MAX_DEPTH	64
+
+typedef struct
+{
+	uint8_t			*mem;
+	uint64_t		capacity;
+	unsigned int	levels;
+	uint64_t		level[CTB_MERKLE_MAX_DEPTH];	/* first node of each level */
+} ctb_merkle;
+
+/* Bytes of memory needed for capacity leaves, 0 if it overflows size_t. */
+size_t ctb_merkle_size(uint64_t capacity);
+/* Formats mem as an empty tree. Returns 0, or -1 if size is too small. */
+int ctb_merkle_init(ctb_merkle *m, void *mem, size_t size, uint64_t capacity);
+/* Attaches to memory formatted by ctb_merkle_init. Returns 0, or -1 if
+ * the header is not valid for size.
+ */
+int ctb_merkle_open(ctb_merkle *m, void *mem, size_t size);
+uint64_t ctb_merkle_count(const ctb_merkle *m);
+/* Return 0, or -1 (appending nothing) if the leaves do not fit. */
+int ctb_merkle_append(ctb_merkle *m, const uint8_t leaf[32]);
+int ctb_merkle_append_many(ctb_merkle *m, const uint8_t (*leaf)[32], size_t count);
+/* Returns 0, or -1 if the tree is empty. */
+int ctb_merkle_root(const ctb_merkle *m, uint8_t root[32]);
+/* Writes the sibling path of leaf index, bottom up, and returns its
+ * length (at most CTB_MERKLE_MAX_DEPTH), or -1 if index is out of range.
+ */
+int ctb_merkle_proof(const ctb_merkle *m, uint64_t index, uint8_t (*proof)[32]);
+/* Returns 1 if proof links leaf at index to root, 0 otherwise. */
+int ctb_merkle_verify(const uint8_t leaf[32], uint64_t index,
+					  const uint8_t (*proof)[32], unsigned int depth, const uint8_t root[32]);
+
+/* =========================================================================
+   12. BLAKE3 API
+   ========================================================================= */
+
+/* BLAKE3 in its three modes: plain hash, keyed hash (a MAC/PRF under a
+ * 32-byte key) and key derivation from a fixed, application-specific
+ * context string. The input is cut into 1 KiB chunks that form the leaves
+ * of a binary tree, so one message is compressed several chunks at a
+ * time: 4 per SSE4.1 register, 8 per AVX2 and 16 per AVX-512.
+ * Same init/update/final shape as SHA-256. final and final_xof leave the
+ * context untouched, so more input may follow; final_xof writes out_len
+ * bytes of the extendable output starting `seek` bytes into it.
+ * ctb_blake3_update_parallel also splits large inputs between up to
+ * `threads` threads (0 = one per online CPU, at most 64). The output never
+ * depends on the thread count or on how the input is cut into updates.
+ */
+#define CTB_BLAKE3_DIGEST_SIZE	32
+#define CTB_BLAKE3_KEY_SIZE		32
+#define CTB_BLAKE3_BLOCK_SIZE	64
+#define CTB_BLAKE3_CHUNK_SIZE	1024
+#define _CTB_BLAKE3_MAX_DEPTH	54
+
+typedef struct
+{
+	unsigned char	block[CTB_BLAKE3_BLOCK_SIZE];	/* pending bytes of the current chunk */
+	uint32_t		key[8];
+	uint32_t		cv[8];			/* chaining value of the current chunk */
+	uint64_t		chunk;			/* index of the current chunk */
+	unsigned int	len;			/* bytes in block */
+	unsigned int	blocks;			/* blocks of the chunk already compressed */
+	unsigned int	flags;
+	unsigned int	depth;
+	unsigned char	stack[_CTB_BLAKE3_MAX_DEPTH + 1][CTB_BLAKE3_DIGEST_SIZE];
+} ctb_blake3_ctx;
+
+void ctb_blake3_init(ctb_blake3_ctx *ctx);
+void ctb_blake3_init_keyed(ctb_blake3_ctx *ctx, const unsigned char key[CTB_BLAKE3_KEY_SIZE]);
+void ctb_blake3_init_derive_key(ctb_blake3_ctx *ctx, const char *context);
+void ctb_blake3_update(ctb_blake3_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_blake3_update_parallel(ctb_blake3_ctx *ctx, const unsigned char *message, size_t len,
+								unsigned int threads);
+void ctb_blake3_final(const ctb_blake3_ctx *ctx, unsigned char *digest);
+void ctb_blake3_final_xof(const ctb_blake3_ctx *ctx, uint64_t seek, unsigned char *out, size_t out_len);
+void ctb_blake3(const unsigned char *message, size_t len, unsigned char *digest);
+
+/* =========================================================================
+   13. BLAKE2 API
+   ========================================================================= */
+
+/* BLAKE2b (64-bit words, up to 64-byte digests) and BLAKE2s (32-bit
+ * words, up to 32-byte digests) as in RFC 7693, plain or keyed: with a
+ * key the hash is a MAC/PRF, with no HMAC wrapper needed. outlen is the
+ * digest length in bytes, from 1 to the maximum, and is part of the hash.
+ * _init and _init_key return 0, or -1 for a bad outlen or keylen;
+ * keylen 0 is the plain hash. The one-shot functions take key = NULL,
+ * keylen = 0 for the plain hash and return the same codes.
+ * BLAKE2bp and BLAKE2sp are the parallel forms from the BLAKE2 paper:
+ * the input is dealt out block by block to 4 (bp) or 8 (sp) leaf
+ * hashes, which advance side by side in one AVX2 register, and a root
+ * hash combines the leaves. They give different digests from BLAKE2b/s.
+ * Same init/update/final shape as SHA-256; _final wipes the context.
+ */
+#define CTB_BLAKE2B_DIGEST_SIZE	64
+#define CTB_BLAKE2B_KEY_SIZE	64
+#define CTB_BLAKE2B_BLOCK_SIZE	128
+#define CTB_BLAKE2S_DIGEST_SIZE	32
+#define CTB_BLAKE2S_KEY_SIZE	32
+#define CTB_BLAKE2S_BLOCK_SIZE	64
+#define _CTB_BLAKE2BP_LEAVES	4
+#define _CTB_BLAKE2SP_LEAVES	8
+
+typedef struct
+{
+	unsigned char	block[CTB_BLAKE2B_BLOCK_SIZE];	/* last block, held back for _final */
+	uint64_t		h[8];
+	uint64_t		t[2];			/* bytes compressed, 128-bit */
+	unsigned int	len;			/* bytes in block */
+	unsigned int	outlen;
+	unsigned int	last_node;		/* tree hashing: the last node of its level */
+} ctb_blake2b_ctx;
+
+typedef struct
+{
+	unsigned char	block[CTB_BLAKE2S_BLOCK_SIZE];
+	uint32_t		h[8];
+	uint32_t		t[2];
+	unsigned int	len;
+	unsigned int	outlen;
+	unsigned int	last_node;
+} ctb_blake2s_ctx;
+
+/* The leaf states are kept word-major (h[word][leaf]) so the lane kernel
+ * loads them as they are. Up to two block rows (a block for every leaf)
+ * are held back: a row is only compressed once the input reaches the last
+ * leaf in the row after it, so every leaf's final block is still pending
+ * at _final.
+ */
+typedef struct
+{
+	unsigned char	buf[(2 * _CTB_BLAKE2BP_LEAVES - 1) * CTB_BLAKE2B_BLOCK_SIZE];
+	uint64_t		h[8][_CTB_BLAKE2BP_LEAVES];
+	uint64_t		count;			/* bytes compressed into each leaf */
+	unsigned int	len;			/* bytes in buf */
+	unsigned int	outlen;
+	unsigned int	keylen;
+} ctb_blake2bp_ctx;
+
+typedef struct
+{
+	unsigned char	buf[(2 * _CTB_BLAKE2SP_LEAVES - 1) * CTB_BLAKE2S_BLOCK_SIZE];
+	uint32_t		h[8][_CTB_BLAKE2SP_LEAVES];
+	uint64_t		count;
+	unsigned int	len;
+	unsigned int	outlen;
+	unsigned int	keylen;
+} ctb_blake2sp_ctx;
+
+int ctb_blake2b_init(ctb_blake2b_ctx *ctx, size_t outlen);
+int ctb_blake2b_init_key(ctb_blake2b_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen);
+void ctb_blake2b_update(ctb_blake2b_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_blake2b_final(ctb_blake2b_ctx *ctx, unsigned char *digest);
+int ctb_blake2b(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				unsigned char *digest, size_t outlen);
+
+int ctb_blake2s_init(ctb_blake2s_ctx *ctx, size_t outlen);
+int ctb_blake2s_init_key(ctb_blake2s_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen);
+void ctb_blake2s_update(ctb_blake2s_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_blake2s_final(ctb_blake2s_ctx *ctx, unsigned char *digest);
+int ctb_blake2s(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				unsigned char *digest, size_t outlen);
+
+int ctb_blake2bp_init(ctb_blake2bp_ctx *ctx, size_t outlen);
+int ctb_blake2bp_init_key(ctb_blake2bp_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen);
+void ctb_blake2bp_update(ctb_blake2bp_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_blake2bp_final(ctb_blake2bp_ctx *ctx, unsigned char *digest);
+int ctb_blake2bp(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				 unsigned char *digest, size_t outlen);
+
+int ctb_blake2sp_init(ctb_blake2sp_ctx *ctx, size_t outlen);
+int ctb_blake2sp_init_key(ctb_blake2sp_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen);
+void ctb_blake2sp_update(ctb_blake2sp_ctx *ctx, const unsigned char *message, size_t len);
+void ctb_blake2sp_final(ctb_blake2sp_ctx *ctx, unsigned char *digest);
+int ctb_blake2sp(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				 unsigned char *digest, size_t outlen);
+
+/* =========================================================================
+   14. GENERIC HASH API
+   ========================================================================= */
+
+/* One descriptor per ctb_hash_id, so code can be written once for every
+ * algorithm: contexts are void *, lengths size_t and the digest always
+ * comes last. The functions forward to each algorithm's own API, which
+ * runs the kernels picked for this CPU; `kernel` and `lanes` describe
+ * that pick and follow ctb_hash_set_cpu_features.
+ * The BLAKE3 and BLAKE2 descriptors are the plain hashes at their full
+ * digest length; keyed hashing, other digest lengths and the BLAKE3 XOF
+ * stay on their own APIs (sections 12 and 13). BLAKE3 keeps a stack of
+ * chaining values for its tree, which makes ctb_hash_ctx about 2 KiB;
+ * ctb_hmac_ctx and ctb_multihash_ctx hold several of them.
+ */
+typedef union
+{
+	ctb_sha1_ctx		sha1;
+	ctb_sha256_ctx		sha256;
+	ctb_sha512_ctx		sha512;
+	ctb_ripemd160_ctx	ripemd160;
+	ctb_blake3_ctx		blake3;
+	ctb_blake2b_ctx		blake2b;
+	ctb_blake2s_ctx		blake2s;
+	ctb_blake2bp_ctx	blake2bp;
+	ctb_blake2sp_ctx	blake2sp;
+} ctb_hash_ctx;		/* storage for any algorithm's context */
+
+typedef struct
+{
+	ctb_hash_id		id;
+	const char		*name;			/* "sha256", "ripemd160", ... */
+	size_t			ctx_size;
+	size_t			block_size;
+	size_t			digest_size;
+	void			(*init)(void *ctx);
+	void			(*update)(void *ctx, const uint8_t *data, size_t len);
+	void			(*final)(void *ctx, uint8_t *digest);
+	/* count messages; digest i is written to digest + i * digest_size */
+	void			(*many)(const uint8_t *const *msg, const size_t *len,
+							uint8_t *digest, size_t count);
+	const char		*kernel;		/* single-stream kernel: "scalar", "sha-ni", "avx2", ... */
+	unsigned int	lanes;			/* messages `many` hashes side by side */
+} ctb_hash_algo;
+
+#define CTB_HASH_ALGO_COUNT		11
+
+/* NULL for an unknown id or name. */
+const ctb_hash_algo *ctb_hash_algo_get(ctb_hash_id id);
+const ctb_hash_algo *ctb_hash_algo_find(const char *name);
+void ctb_hash_digest(const ctb_hash_algo *algo, const uint8_t *msg, size_t len, uint8_t *digest);
+
+/* HMAC (RFC 2104) over any descriptor. The context keeps the keyed inner
+ * and outer states, and final leaves it ready for the next message under
+ * the same key. PBKDF2 runs the midstate engines above for SHA-2 and HMAC
+ * contexts for the others.
+ */
+typedef struct
+{
+	const ctb_hash_algo	*algo;
+	ctb_hash_ctx		inner;
+	ctb_hash_ctx		outer;
+	ctb_hash_ctx		work;
+} ctb_hmac_ctx;
+
+void ctb_hmac_init(ctb_hmac_ctx *ctx, const ctb_hash_algo *algo, const uint8_t *key, size_t key_len);
+void ctb_hmac_update(ctb_hmac_ctx *ctx, const uint8_t *msg, size_t len);
+void ctb_hmac_final(ctb_hmac_ctx *ctx, uint8_t *mac);
+void ctb_hmac(const ctb_hash_algo *algo, const uint8_t *key, size_t key_len,
+			  const uint8_t *msg, size_t len, uint8_t *mac);
+void ctb_pbkdf2_hmac(const ctb_hash_algo *algo,
+					 const uint8_t *password, size_t password_len,
+					 const uint8_t *salt,     size_t salt_len,
+					 uint32_t iterations,
+					 uint8_t *out, size_t out_len);
+
+/* =========================================================================
+   15. CONSTEXPR HASHING (C++14)
+   ========================================================================= */
+
+/* SHA-1 and SHA-2 as constexpr functions, so C++ code can fold digests of
+ * constant data into the binary and start hashing from a precomputed
+ * midstate instead of re-absorbing a fixed prefix on every call:
+ *
+ *     static_assert(ctb_sha256_ct("abc")[0] == 0xba, "");
+ *
+ *     static constexpr ctb_sha256_ctx tag = ctb_sha256_ct_init("proto/v1");
+ *     ctb_sha256_ctx ctx = tag;                 // prefix already absorbed
+ *     ctb_sha256_update(&ctx, msg, len);
+ *
+ * The contexts are the C structs with the layout the C API expects, so a
+ * context built here continues on the runtime kernels, and the other way
+ * round. Constants come from the same lists as the C tables. A char array
+ * argument is taken as a string literal and its terminating NUL is not
+ * hashed; pass (pointer, length) for binary data. The code is scalar and
+ * meant for compile time, where compilers cap the work per constant
+ * expression: keep inputs to a few KiB.
+ */
+#if defined(__cplusplus) && (__cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L))
+
+template <size_t N>
+struct ctb_hash_ct_digest
+{
+	uint8_t bytes[N];
+
+	constexpr uint8_t operator[](size_t i) const { return bytes[i]; }
+	constexpr size_t size() const { return N; }
+	const uint8_t *data() const { return bytes; }
+};
+
+template <size_t N>
+constexpr bool operator==(const ctb_hash_ct_digest<N> &a, const ctb_hash_ct_digest<N> &b)
+{
+	for (size_t i = 0; i < N; i++)
+		if (a.bytes[i] != b.bytes[i])
+			return false;
+	return true;
+}
+
+template <size_t N>
+constexpr bool operator!=(const ctb_hash_ct_digest<N> &a, const ctb_hash_ct_digest<N> &b)
+{
+	return !(a == b);
+}
+
+/* Static members of a class template, so every translation unit shares one
+ * definition of each table. */
+template <typename T = void>
+struct _ctb_hash_ct_tables
+{
+	static constexpr uint32_t sha1_h0[5] = _CTB_SHA1_H0;
+	static constexpr uint32_t sha1_k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+	static constexpr uint32 sha224_h0[8] = _CTB_SHA224_H0;
+	static constexpr uint32 sha256_h0[8] = _CTB_SHA256_H0;
+	static constexpr uint64 sha384_h0[8] = _CTB_SHA384_H0;
+	static constexpr uint64 sha512_h0[8] = _CTB_SHA512_H0;
+	static constexpr uint32 sha256_k[64] = _CTB_SHA256_K;
+	static constexpr uint64 sha512_k[80] = _CTB_SHA512_K;
+};
+
+template <typename T> constexpr uint32_t _ctb_hash_ct_tables<T>::sha1_h0[5];
+template <typename T> constexpr uint32_t _ctb_hash_ct_tables<T>::sha1_k[4];
+template <typename T> constexpr uint32 _ctb_hash_ct_tables<T>::sha224_h0[8];
+template <typename T> constexpr uint32 _ctb_hash_ct_tables<T>::sha256_h0[8];
+template <typename T> constexpr uint64 _ctb_hash_ct_tables<T>::sha384_h0[8];
+template <typename T> constexpr uint64 _ctb_hash_ct_tables<T>::sha512_h0[8];
+template <typename T> constexpr uint32 _ctb_hash_ct_tables<T>::sha256_k[64];
+template <typename T> constexpr uint64 _ctb_hash_ct_tables<T>::sha512_k[80];
+
+typedef _ctb_hash_ct_tables<> _ctb_hash_ct_k;
+
+constexpr uint32 _ctb_ct_rotr32(uint32 x, unsigned int n) { return (x >> n) | (x << (32 - n)); }
+constexpr uint64 _ctb_ct_rotr64(uint64 x, unsigned int n) { return (x >> n) | (x << (64 - n)); }
+
+/* SHA-1: the context counts bits in count[1]:count[0] and buffers the
+ * partial block in buffer[], exactly as ctb_sha1_update does. */
+constexpr void _ctb_ct_sha1_block(uint32_t state[5], const unsigned char *p)
+{
+	uint32_t w[80] = {};
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+			| (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
+	for (int i = 16; i < 80; i++)
+		w[i] = _ctb_ct_rotr32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 31);
+
+	for (int i = 0; i < 80; i++) {
+		uint32_t f = i < 20 ? (b & c) | (~b & d)
+			: i < 40 ? b ^ c ^ d
+			: i < 60 ? (b & c) | (b & d) | (c & d)
+			: b ^ c ^ d;
+		uint32_t t = _ctb_ct_rotr32(a, 27) + f + e + _ctb_hash_ct_k::sha1_k[i / 20] + w[i];
+
+		e = d;
+		d = c;
+		c = _ctb_ct_rotr32(b, 2);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+constexpr ctb_sha1_ctx _ctb_ct_sha1_start(const uint32_t *h0)
+{
+	ctb_sha1_ctx ctx = {};
+
+	for (int i = 0; i < 5; i++)
+		ctx.state[i] = h0[i];
+	return ctx;
+}
+
+constexpr void _ctb_ct_sha1_push(ctb_sha1_ctx &ctx, unsigned char byte)
+{
+	uint32_t pos = (ctx.count[0] >> 3) & 63;
+
+	ctx.buffer[pos] = byte;
+	if ((ctx.count[0] += 8) < 8)
+		ctx.count[1]++;
+	if (pos == 63)
+		_ctb_ct_sha1_block(ctx.state, ctx.buffer);
+}
+
+template <size_t N>
+constexpr ctb_hash_ct_digest<N> _ctb_ct_sha1_out(ctb_sha1_ctx ctx)
+{
+	ctb_hash_ct_digest<N> digest = {};
+	uint64 bits = (uint64) ctx.count[1] << 32 | ctx.count[0];
+
+	_ctb_ct_sha1_push(ctx, 0x80);
+	while (((ctx.count[0] >> 3) & 63) != 56)
+		_ctb_ct_sha1_push(ctx, 0);
+	for (int i = 7; i >= 0; i--)
+		_ctb_ct_sha1_push(ctx, (unsigned char) (bits >> (8 * i)));
+
+	for (size_t i = 0; i < N; i++)
+		digest.bytes[i] = (uint8_t) (ctx.state[i >> 2] >> (24 - 8 * (i & 3)));
+	return digest;
+}
+
+/* SHA-256 / SHA-224: tot_len counts the bytes of absorbed blocks and len
+ * the bytes waiting in block[], as in ctb_sha256_update. */
+constexpr void _ctb_ct_sha256_block(uint32 h[8], const unsigned char *p)
+{
+	uint32 w[64] = {};
+	uint32 v[8] = {};
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32) p[4 * i] << 24 | (uint32) p[4 * i + 1] << 16
+			| (uint32) p[4 * i + 2] << 8 | (uint32) p[4 * i + 3];
+	for (int i = 16; i < 64; i++)
+		w[i] = (_ctb_ct_rotr32(w[i - 2], 17) ^ _ctb_ct_rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10))
+			+ w[i - 7]
+			+ (_ctb_ct_rotr32(w[i - 15], 7) ^ _ctb_ct_rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3))
+			+ w[i - 16];
+
+	for (int i = 0; i < 8; i++)
+		v[i] = h[i];
+	for (int i = 0; i < 64; i++) {
+		uint32 t1 = v[7]
+			+ (_ctb_ct_rotr32(v[4], 6) ^ _ctb_ct_rotr32(v[4], 11) ^ _ctb_ct_rotr32(v[4], 25))
+			+ ((v[4] & v[5]) ^ (~v[4] & v[6]))
+			+ _ctb_hash_ct_k::sha256_k[i] + w[i];
+		uint32 t2 = (_ctb_ct_rotr32(v[0], 2) ^ _ctb_ct_rotr32(v[0], 13) ^ _ctb_ct_rotr32(v[0], 22))
+			+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+		for (int j = 7; j > 0; j--)
+			v[j] = v[j - 1];
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i = 0; i < 8; i++)
+		h[i] += v[i];
+}
+
+constexpr ctb_sha256_ctx _ctb_ct_sha256_start(const uint32 *h0)
+{
+	ctb_sha256_ctx ctx = {};
+
+	for (int i = 0; i < 8; i++)
+		ctx.h[i] = h0[i];
+	return ctx;
+}
+
+constexpr void _ctb_ct_sha256_push(ctb_sha256_ctx &ctx, unsigned char byte)
+{
+	ctx.block[ctx.len++] = byte;
+	if (ctx.len == _CTB_SHA256_BLOCK_SIZE) {
+		_ctb_ct_sha256_block(ctx.h, ctx.block);
+		ctx.tot_len += _CTB_SHA256_BLOCK_SIZE;
+		ctx.len = 0;
+	}
+}
+
+template <size_t N>
+constexpr ctb_hash_ct_digest<N> _ctb_ct_sha256_out(ctb_sha256_ctx ctx)
+{
+	ctb_hash_ct_digest<N> digest = {};
+	uint64 bits = (ctx.tot_len + ctx.len) << 3;
+
+	_ctb_ct_sha256_push(ctx, 0x80);
+	while (ctx.len != _CTB_SHA256_BLOCK_SIZE - 8)
+		_ctb_ct_sha256_push(ctx, 0);
+	for (int i = 7; i >= 0; i--)
+		_ctb_ct_sha256_push(ctx, (unsigned char) (bits >> (8 * i)));
+
+	for (size_t i = 0; i < N; i++)
+		digest.bytes[i] = (uint8_t) (ctx.h[i >> 2] >> (24 - 8 * (i & 3)));
+	return digest;
+}
+
+/* SHA-512 / SHA-384 */
+constexpr void _ctb_ct_sha512_block(uint64 h[8], const unsigned char *p)
+{
+	uint64 w[80] = {};
+	uint64 v[8] = {};
+
+	for (int i = 0; i < 16; i++)
+		for (int j = 0; j < 8; j++)
+			w[i] = w[i] << 8 | p[8 * i + j];
+	for (int i = 16; i < 80; i++)
+		w[i] = (_ctb_ct_rotr64(w[i - 2], 19) ^ _ctb_ct_rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6))
+			+ w[i - 7]
+			+ (_ctb_ct_rotr64(w[i - 15], 1) ^ _ctb_ct_rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7))
+			+ w[i - 16];
+
+	for (int i = 0; i < 8; i++)
+		v[i] = h[i];
+	for (int i = 0; i < 80; i++) {
+		uint64 t1 = v[7]
+			+ (_ctb_ct_rotr64(v[4], 14) ^ _ctb_ct_rotr64(v[4], 18) ^ _ctb_ct_rotr64(v[4], 41))
+			+ ((v[4] & v[5]) ^ (~v[4] & v[6]))
+			+ _ctb_hash_ct_k::sha512_k[i] + w[i];
+		uint64 t2 = (_ctb_ct_rotr64(v[0], 28) ^ _ctb_ct_rotr64(v[0], 34) ^ _ctb_ct_rotr64(v[0], 39))
+			+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+		for (int j = 7; j > 0; j--)
+			v[j] = v[j - 1];
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i = 0; i < 8; i++)
+		h[i] += v[i];
+}
+
+constexpr ctb_sha512_ctx _ctb_ct_sha512_start(const uint64 *h0)
+{
+	ctb_sha512_ctx ctx = {};
+
+	for (int i = 0; i < 8; i++)
+		ctx.h[i] = h0[i];
+	return ctx;
+}
+
+constexpr void _ctb_ct_sha512_push(ctb_sha512_ctx &ctx, unsigned char byte)
+{
+	ctx.block[ctx.len++] = byte;
+	if (ctx.len == _CTB_SHA512_BLOCK_SIZE) {
+		_ctb_ct_sha512_block(ctx.h, ctx.block);
+		ctx.tot_len += _CTB_SHA512_BLOCK_SIZE;
+		ctx.len = 0;
+	}
+}
+
+template <size_t N>
+constexpr ctb_hash_ct_digest<N> _ctb_ct_sha512_out(ctb_sha512_ctx ctx)
+{
+	ctb_hash_ct_digest<N> digest = {};
+	uint64 bytes = ctx.tot_len + ctx.len;
+
+	_ctb_ct_sha512_push(ctx, 0x80);
+	while (ctx.len != _CTB_SHA512_BLOCK_SIZE - 16)
+		_ctb_ct_sha512_push(ctx, 0);
+	for (int i = 7; i >= 0; i--)
+		_ctb_ct_sha512_push(ctx, (unsigned char) ((bytes >> 61) >> (8 * i)));
+	for (int i = 7; i >= 0; i--)
+		_ctb_ct_sha512_push(ctx, (unsigned char) ((bytes << 3) >> (8 * i)));
+
+	for (size_t i = 0; i < N; i++)
+		digest.bytes[i] = (uint8_t) (ctx.h[i >> 3] >> (56 - 8 * (i & 7)));
+	return digest;
+}
+
+/* ctb_<name>_ct_init()            fresh context
+ * ctb_<name>_ct_init(prefix, len)  context with prefix absorbed (midstate)
+ * ctb_<name>_ct_update(ctx, msg, len)
+ * ctb_<name>_ct_final(ctx)         digest
+ * ctb_<name>_ct(msg, len)          one-shot
+ * plus string-literal overloads of the ones taking (msg, len).
+ */
+#define _CTB_HASH_CT_DEFINE(NAME, FAMILY, CTX_T, DIGEST_LEN)                      \
+constexpr CTX_T ctb_##NAME##_ct_init()                                            \
+{                                                                                 \
+	return _ctb_ct_##FAMILY##_start(_ctb_hash_ct_k::NAME##_h0);                   \
+}                                                                                 \
+template <typename T>                                                             \
+constexpr CTX_T ctb_##NAME##_ct_update(CTX_T ctx, const T *msg, size_t len)      \
+{                                                                                 \
+	for (size_t i = 0; i < len; i++)                                              \
+		_ctb_ct_##FAMILY##_push(ctx, (unsigned char) msg[i]);                     \
+	return ctx;                                                                   \
+}                                                                                 \
+template <size_t L>                                                               \
+constexpr CTX_T ctb_##NAME##_ct_update(CTX_T ctx, const char (&str)[L])          \
+{                                                                                 \
+	return ctb_##NAME##_ct_update(ctx, str, L - 1);                               \
+}                                                                                 \
+template <typename T>                                                             \
+constexpr CTX_T ctb_##NAME##_ct_init(const T *prefix, size_t len)                \
+{                                                                                 \
+	return ctb_##NAME##_ct_update(ctb_##NAME##_ct_init(), prefix, len);           \
+}                                                                                 \
+template <size_t L>                                                               \
+constexpr CTX_T ctb_##NAME##_ct_init(const char (&prefix)[L])                    \
+{                                                                                 \
+	return ctb_##NAME##_ct_init(prefix, L - 1);                                   \
+}                                                                                 \
+constexpr ctb_hash_ct_digest<DIGEST_LEN> ctb_##NAME##_ct_final(const CTX_T &ctx) \
+{                                                                                 \
+	return _ctb_ct_##FAMILY##_out<DIGEST_LEN>(ctx);                               \
+}                                                                                 \
+template <typename T>                                                             \
+constexpr ctb_hash_ct_digest<DIGEST_LEN> ctb_##NAME##_ct(const T *msg, size_t len) \
+{                                                                                 \
+	return ctb_##NAME##_ct_final(ctb_##NAME##_ct_init(msg, len));                 \
+}                                                                                 \
+template <size_t L>                                                               \
+constexpr ctb_hash_ct_digest<DIGEST_LEN> ctb_##NAME##_ct(const char (&str)[L])  \
+{                                                                                 \
+	return ctb_##NAME##_ct(str, L - 1);                                           \
+}
+
+_CTB_HASH_CT_DEFINE(sha1,   sha1,   ctb_sha1_ctx,   20)
+_CTB_HASH_CT_DEFINE(sha224, sha256, ctb_sha224_ctx, _CTB_SHA224_DIGEST_SIZE)
+_CTB_HASH_CT_DEFINE(sha256, sha256, ctb_sha256_ctx, _CTB_SHA256_DIGEST_SIZE)
+_CTB_HASH_CT_DEFINE(sha384, sha512, ctb_sha384_ctx, _CTB_SHA384_DIGEST_SIZE)
+_CTB_HASH_CT_DEFINE(sha512, sha512, ctb_sha512_ctx, _CTB_SHA512_DIGEST_SIZE)
+
+#undef _CTB_HASH_CT_DEFINE
+
+#endif /* C++14 */
+
+/* =========================================================================
+   16. FAST HASH API (XXH3)
+   ========================================================================= */
+
+/* XXH3 from xxHash 0.8, 64 and 128 bits, for hash tables, deduplication
+ * and sharding, where a cryptographic hash costs far more than needed.
+ * The output is that of the reference XXH3_64bits_withSeed and
+ * XXH3_128bits_withSeed, identical on every platform and kernel, so it
+ * may be persisted or compared with other xxHash implementations; write
+ * it out with the _canonical functions (big-endian). Seed 0 is the
+ * unseeded hash. Inputs up to 16 bytes cost a few multiplies and no loop;
+ * past 240 bytes the bulk loop runs on SSE2, AVX2 or AVX-512.
+ * Not a cryptographic hash: whoever chooses the input can make it collide,
+ * seeded or not.
+ */
+typedef struct
+{
+	uint64_t low64;
+	uint64_t high64;
+} ctb_hash128;
+
+uint64_t ctb_xxh3_64(const uint8_t *data, size_t len, uint64_t seed);
+ctb_hash128 ctb_xxh3_128(const uint8_t *data, size_t len, uint64_t seed);
+void ctb_xxh3_64_canonical(uint64_t hash, uint8_t out[8]);
+void ctb_xxh3_128_canonical(ctb_hash128 hash, uint8_t out[16]);
+
+/* =========================================================================
+   17. CHECKSUM API (CRC)
+   ========================================================================= */
+
+/* CRC-32C (Castagnoli: iSCSI, ext4, SCTP), CRC-32 (IEEE 802.3: zlib, gzip,
+ * PNG) and CRC-64/XZ (ECMA-182 polynomial, reflected: xz, Go's crc64.ECMA).
+ * The running value is passed the way zlib's crc32() takes it: start from
+ * 0 and hand back the previous result to continue, so
+ * ctb_crc32c(ctb_crc32c(0, a, la), b, lb) is the CRC of a followed by b.
+ * The _combine functions compute that same value from the CRC of a, the
+ * CRC of b and the length of b alone, in O(log len2), so chunks
+ * checksummed separately (on several threads, or as they were written)
+ * can be merged.
+ * CRC-32C runs on the SSE4.2 crc32 instruction, over three interleaved
+ * streams when PCLMULQDQ is there to merge them; CRC-32 and CRC-64 fold
+ * 64 bytes per step with PCLMULQDQ; anything else takes slicing-by-8.
+ * These catch accidental corruption only; anyone can forge a match.
+ */
+uint32_t ctb_crc32c(uint32_t crc, const uint8_t *data, size_t len);
+uint32_t ctb_crc32(uint32_t crc, const uint8_t *data, size_t len);
+uint64_t ctb_crc64(uint64_t crc, const uint8_t *data, size_t len);
+uint32_t ctb_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint32_t ctb_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint64_t ctb_crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2);
+
+/* =========================================================================
+   18. MULTI-HASH API
+   ========================================================================= */
+
+/* Several digests of one input in a single pass over it. The algorithms
+ * are chosen with a mask of CTB_HASH_MASK(id) bits, and the input is fed
+ * to them in CTB_MULTIHASH_TILE-byte tiles: each selected algorithm hashes
+ * a tile while it is still in L1, so the data comes in from memory once
+ * instead of once per algorithm.
+ * With threads > 1 (0 = one per online CPU) the algorithms are dealt out
+ * to up to `threads` threads, one each when there are enough. The threads
+ * walk the input together a 1 MiB window at a time, so a window pulled in
+ * by one of them is still in the shared cache for the others. Updates
+ * under 64 KiB stay on the calling thread.
+ * Final writes the digest of each selected id to digest[id] and leaves the
+ * other rows alone; the digests are those of the single-algorithm APIs.
+ */
+#define CTB_HASH_MASK(id)		(1u << (id))
+#define CTB_HASH_MASK_ALL		((1u << CTB_HASH_ALGO_COUNT) - 1)
+#define CTB_MULTIHASH_TILE		16384
+
+typedef struct
+{
+	ctb_hash_ctx	ctx[CTB_HASH_ALGO_COUNT];	/* indexed by ctb_hash_id */
+	uint64_t		total;
+	unsigned int	mask;
+	unsigned int	threads;
+} ctb_multihash_ctx;
+
+void ctb_multihash_init(ctb_multihash_ctx *ctx, unsigned int mask, unsigned int threads);
+void ctb_multihash_update(ctb_multihash_ctx *ctx, const uint8_t *data, size_t len);
+void ctb_multihash_final(ctb_multihash_ctx *ctx, uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE]);
+void ctb_multihash(const uint8_t *msg, size_t len, unsigned int mask, unsigned int threads,
+				   uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE]);
+/* Reads the file as ctb_hash_file (section 9) does. Returns 0 on success,
+ * -1 on an open/read error.
+ */
+int ctb_multihash_file(const char *path, unsigned int mask, unsigned int threads,
+					   uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE]);
+
 #ifdef CTB_HASH_NOPREFIX
 /* SHA1 */
 typedef	ctb_sha1_ctx	sha1_ctx;
@@ -234,6 +1359,8 @@ typedef ctb_ripemd160_ctx	ripemd160_ctx;
 #define ripemd160_update	ctb_ripemd160_update
 #define ripemd160_final		ctb_ripemd160_final
 #define ripemd160			ctb_ripemd160
+#define ripemd160_export	ctb_ripemd160_export
+#define ripemd160_import	ctb_ripemd160_import
 
 /* SHA2 */
 typedef ctb_sha224_ctx	sha224_ctx;
@@ -247,6 +1374,8 @@ typedef ctb_sha256_ctx	sha256_ctx;
 #define sha256_update	ctb_sha256_update
 #define sha256_final	ctb_sha256_final
 #define sha256			ctb_sha256
+#define sha256_export	ctb_sha256_export
+#define sha256_import	ctb_sha256_import
 
 typedef ctb_sha384_ctx	sha384_ctx;
 #define sha384_init		ctb_sha384_init
@@ -259,6 +1388,8 @@ typedef ctb_sha512_ctx	sha512_ctx;
 #define sha512_update	ctb_sha512_update
 #define sha512_final	ctb_sha512_final
 #define sha512			ctb_sha512
+#define sha512_export	ctb_sha512_export
+#define sha512_import	ctb_sha512_import
 
 /* HMAC */
 typedef ctb_hmac_sha224_ctx	hmac_sha224_ctx;
@@ -289,11 +1420,185 @@ typedef ctb_hmac_sha512_ctx	hmac_sha512_ctx;
 #define hmac_sha512_final	ctb_hmac_sha512_final
 #define hmac_sha512			ctb_hmac_sha512
 
+/* HMAC prepared keys */
+typedef ctb_hmac_sha224_key	hmac_sha224_key;
+#define hmac_sha224_key_init	ctb_hmac_sha224_key_init
+#define hmac_sha224_mac		ctb_hmac_sha224_mac
+#define hmac_sha224_mac_many	ctb_hmac_sha224_mac_many
+
+typedef ctb_hmac_sha256_key	hmac_sha256_key;
+#define hmac_sha256_key_init	ctb_hmac_sha256_key_init
+#define hmac_sha256_mac		ctb_hmac_sha256_mac
+#define hmac_sha256_mac_many	ctb_hmac_sha256_mac_many
+
+typedef ctb_hmac_sha384_key	hmac_sha384_key;
+#define hmac_sha384_key_init	ctb_hmac_sha384_key_init
+#define hmac_sha384_mac		ctb_hmac_sha384_mac
+#define hmac_sha384_mac_many	ctb_hmac_sha384_mac_many
+
+typedef ctb_hmac_sha512_key	hmac_sha512_key;
+#define hmac_sha512_key_init	ctb_hmac_sha512_key_init
+#define hmac_sha512_mac		ctb_hmac_sha512_mac
+#define hmac_sha512_mac_many	ctb_hmac_sha512_mac_many
+
 /* PBKDF2 */
 #define pbkdf2_hmac_sha224 ctb_pbkdf2_hmac_sha224
 #define pbkdf2_hmac_sha256 ctb_pbkdf2_hmac_sha256
 #define pbkdf2_hmac_sha384 ctb_pbkdf2_hmac_sha384
 #define pbkdf2_hmac_sha512 ctb_pbkdf2_hmac_sha512
+#define pbkdf2_hmac_sha224_mt ctb_pbkdf2_hmac_sha224_mt
+#define pbkdf2_hmac_sha256_mt ctb_pbkdf2_hmac_sha256_mt
+#define pbkdf2_hmac_sha384_mt ctb_pbkdf2_hmac_sha384_mt
+#define pbkdf2_hmac_sha512_mt ctb_pbkdf2_hmac_sha512_mt
+#define pbkdf2_hmac_sha256_many ctb_pbkdf2_hmac_sha256_many
+#define pbkdf2_hmac_sha512_many ctb_pbkdf2_hmac_sha512_many
+
+/* CPU dispatch */
+#define hash_cpu_features		ctb_hash_cpu_features
+#define hash_set_cpu_features	ctb_hash_set_cpu_features
+
+/* Multi-buffer */
+#define sha256_x8		ctb_sha256_x8
+#define sha256_x16		ctb_sha256_x16
+#define sha256_many		ctb_sha256_many
+#define sha224_x16		ctb_sha224_x16
+#define sha224_many		ctb_sha224_many
+#define sha512_x4		ctb_sha512_x4
+#define sha512_many		ctb_sha512_many
+#define sha384_x4		ctb_sha384_x4
+#define sha384_many		ctb_sha384_many
+#define ripemd160_x4		ctb_ripemd160_x4
+#define ripemd160_x8		ctb_ripemd160_x8
+#define ripemd160_many		ctb_ripemd160_many
+#define ripemd160_32_many	ctb_ripemd160_32_many
+
+/* Composite */
+#define hash160				ctb_hash160
+#define hash160_many		ctb_hash160_many
+#define sha256d				ctb_sha256d
+#define sha256d_32			ctb_sha256d_32
+#define sha256d_64			ctb_sha256d_64
+#define sha256d_80			ctb_sha256d_80
+#define sha256d_many		ctb_sha256d_many
+#define sha256d_64_many		ctb_sha256d_64_many
+
+/* File hashing */
+#define hash_digest_size	ctb_hash_digest_size
+#define hash_file			ctb_hash_file
+
+/* Tree hash */
+#define sha256_tree_init	ctb_sha256_tree_init
+#define sha256_tree_update	ctb_sha256_tree_update
+#define sha256_tree_final	ctb_sha256_tree_final
+#define sha256_tree			ctb_sha256_tree
+#define sha512_tree_init	ctb_sha512_tree_init
+#define sha512_tree_update	ctb_sha512_tree_update
+#define sha512_tree_final	ctb_sha512_tree_final
+#define sha512_tree			ctb_sha512_tree
+
+/* Merkle */
+#define merkle_size			ctb_merkle_size
+#define merkle_init			ctb_merkle_init
+#define merkle_open			ctb_merkle_open
+#define merkle_count		ctb_merkle_count
+#define merkle_append		ctb_merkle_append
+#define merkle_append_many	ctb_merkle_append_many
+#define merkle_root			ctb_merkle_root
+#define merkle_proof		ctb_merkle_proof
+#define merkle_verify		ctb_merkle_verify
+
+/* Generic */
+#define hash_algo_get		ctb_hash_algo_get
+#define hash_algo_find		ctb_hash_algo_find
+#define hash_digest			ctb_hash_digest
+#define hmac_init			ctb_hmac_init
+#define hmac_update			ctb_hmac_update
+#define hmac_final			ctb_hmac_final
+#define hmac				ctb_hmac
+#define pbkdf2_hmac			ctb_pbkdf2_hmac
+
+/* Constexpr (C++14) */
+#define sha1_ct_init	ctb_sha1_ct_init
+#define sha1_ct_update	ctb_sha1_ct_update
+#define sha1_ct_final	ctb_sha1_ct_final
+#define sha1_ct			ctb_sha1_ct
+#define sha224_ct_init	ctb_sha224_ct_init
+#define sha224_ct_update	ctb_sha224_ct_update
+#define sha224_ct_final	ctb_sha224_ct_final
+#define sha224_ct		ctb_sha224_ct
+#define sha256_ct_init	ctb_sha256_ct_init
+#define sha256_ct_update	ctb_sha256_ct_update
+#define sha256_ct_final	ctb_sha256_ct_final
+#define sha256_ct		ctb_sha256_ct
+#define sha384_ct_init	ctb_sha384_ct_init
+#define sha384_ct_update	ctb_sha384_ct_update
+#define sha384_ct_final	ctb_sha384_ct_final
+#define sha384_ct		ctb_sha384_ct
+#define sha512_ct_init	ctb_sha512_ct_init
+#define sha512_ct_update	ctb_sha512_ct_update
+#define sha512_ct_final	ctb_sha512_ct_final
+#define sha512_ct		ctb_sha512_ct
+
+/* XXH3 */
+typedef ctb_hash128		hash128;
+#define xxh3_64				ctb_xxh3_64
+#define xxh3_128			ctb_xxh3_128
+#define xxh3_64_canonical	ctb_xxh3_64_canonical
+#define xxh3_128_canonical	ctb_xxh3_128_canonical
+
+/* CRC */
+#define crc32c				ctb_crc32c
+#define crc32				ctb_crc32
+#define crc64				ctb_crc64
+#define crc32c_combine		ctb_crc32c_combine
+#define crc32_combine		ctb_crc32_combine
+#define crc64_combine		ctb_crc64_combine
+
+/* Multi-hash */
+#define multihash_init		ctb_multihash_init
+#define multihash_update	ctb_multihash_update
+#define multihash_final		ctb_multihash_final
+#define multihash			ctb_multihash
+#define multihash_file		ctb_multihash_file
+
+/* BLAKE3 */
+#define blake3_init				ctb_blake3_init
+#define blake3_init_keyed		ctb_blake3_init_keyed
+#define blake3_init_derive_key	ctb_blake3_init_derive_key
+#define blake3_update			ctb_blake3_update
+#define blake3_update_parallel	ctb_blake3_update_parallel
+#define blake3_final			ctb_blake3_final
+#define blake3_final_xof		ctb_blake3_final_xof
+#define blake3					ctb_blake3
+
+/* BLAKE2 */
+typedef ctb_blake2b_ctx		blake2b_ctx;
+#define blake2b_init		ctb_blake2b_init
+#define blake2b_init_key	ctb_blake2b_init_key
+#define blake2b_update		ctb_blake2b_update
+#define blake2b_final		ctb_blake2b_final
+#define blake2b				ctb_blake2b
+
+typedef ctb_blake2s_ctx		blake2s_ctx;
+#define blake2s_init		ctb_blake2s_init
+#define blake2s_init_key	ctb_blake2s_init_key
+#define blake2s_update		ctb_blake2s_update
+#define blake2s_final		ctb_blake2s_final
+#define blake2s				ctb_blake2s
+
+typedef ctb_blake2bp_ctx	blake2bp_ctx;
+#define blake2bp_init		ctb_blake2bp_init
+#define blake2bp_init_key	ctb_blake2bp_init_key
+#define blake2bp_update		ctb_blake2bp_update
+#define blake2bp_final		ctb_blake2bp_final
+#define blake2bp			ctb_blake2bp
+
+typedef ctb_blake2sp_ctx	blake2sp_ctx;
+#define blake2sp_init		ctb_blake2sp_init
+#define blake2sp_init_key	ctb_blake2sp_init_key
+#define blake2sp_update		ctb_blake2sp_update
+#define blake2sp_final		ctb_blake2sp_final
+#define blake2sp			ctb_blake2sp
 
 #endif
 
@@ -307,55 +1612,507 @@ typedef ctb_hmac_sha512_ctx	hmac_sha512_ctx;
 #include <stdlib.h>
 
 /* =========================================================================
-   SHA1 IMPLEMENTATION
+   KERNEL DISPATCH TABLE
    ========================================================================= */
-#define CTB_SHA1_HANDSOFF
 
-#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+#if !defined(CTB_HASH_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) \
+	|| defined(__i386__) || defined(_M_IX86))
+	#define _CTB_HASH_X86 1
+#else
+	#define _CTB_HASH_X86 0
+#endif
 
-/* blk0() and blk() perform the initial expand. */
-/* I got the idea of expanding during the round function from SSLeay */
-#define blk0_le(i) (block->l[i] = (rol(block->l[i],24)&0xFF00FF00) \
-	|(rol(block->l[i],8)&0x00FF00FF))
-#define blk0_be(i) block->l[i]
-#if BYTE_ORDER == LITTLE_ENDIAN
-#define blk0(i) blk0_le(i)
-#elif BYTE_ORDER == BIG_ENDIAN
-#define blk0(i) blk0_be(i)
+#if _CTB_HASH_X86
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
+
+/* Native threads, for the one-time kernel resolve and the fan-out (see
+ * THREAD FAN-OUT). Define CTB_HASH_NO_THREADS to build without them.
+ */
+#if !defined(CTB_HASH_NO_THREADS) && defined(_WIN32)
+	#define _CTB_HASH_THREADS 1
+	#include <windows.h>
+#elif !defined(CTB_HASH_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+	#define _CTB_HASH_THREADS 1
+	#include <pthread.h>
+	#include <unistd.h>
 #else
-/* Fall back to a runtime endian check */
-static const union {
-	long l;
-	char c;
-} sha1_endian = { 1 };
-#define blk0(i) (sha1_endian.c == 0 ? blk0_be(i) : blk0_le(i))
+	#define _CTB_HASH_THREADS 0
 #endif
 
-#define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15] \
-									 ^block->l[(i+2)&15]^block->l[i&15],1))
+#if defined(__GNUC__) || defined(__clang__)
+	#define _CTB_HASH_LOAD_ACQUIRE(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+	#define _CTB_HASH_STORE_RELEASE(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+	#include <intrin.h>
+	#define _CTB_HASH_LOAD_ACQUIRE(p)		_InterlockedCompareExchange((volatile long *) (p), 0, 0)
+	#define _CTB_HASH_STORE_RELEASE(p, v)	_InterlockedExchange((volatile long *) (p), v)
+#else
+	#define _CTB_HASH_LOAD_ACQUIRE(p)		(*(volatile int *) (p))
+	#define _CTB_HASH_STORE_RELEASE(p, v)	(*(volatile int *) (p) = (v))
+#endif
 
-/* (R0+R1), R2, R3, R4 are the different operations used in ctb_sha1 */
-#define R0(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk0(i)+0x5A827999+rol(v,5);w=rol(w,30);
-#define R1(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk(i)+0x5A827999+rol(v,5);w=rol(w,30);
-#define R2(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0x6ED9EBA1+rol(v,5);w=rol(w,30);
-#define R3(v,w,x,y,z,i) z+=(((w|x)&y)|(w&x))+blk(i)+0x8F1BBCDC+rol(v,5);w=rol(w,30);
-#define R4(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0xCA62C1D6+rol(v,5);w=rol(w,30);
+/* Kernels are compiled for their instruction set through function
+ * attributes, so the header needs no -m flags and still runs anywhere.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+	#define _CTB_HASH_TARGET(isa) __attribute__((target(isa)))
+#else
+	#define _CTB_HASH_TARGET(isa)
+#endif
 
+/* g++ 12 flags the undefined pass-through operand inside many AVX-512
+ * intrinsics as -Wuninitialized or -Wmaybe-uninitialized (GCC bug
+ * 105593); nothing is read from it. The AVX-512 kernels are bracketed by
+ * these two.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+	#define _CTB_HASH_AVX512_DIAG_BEGIN										\
+		_Pragma("GCC diagnostic push")										\
+		_Pragma("GCC diagnostic ignored \"-Wuninitialized\"")				\
+		_Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+	#define _CTB_HASH_AVX512_DIAG_END	_Pragma("GCC diagnostic pop")
+#else
+	#define _CTB_HASH_AVX512_DIAG_BEGIN
+	#define _CTB_HASH_AVX512_DIAG_END
+#endif
 
-/* Hash a single 512-bit block. This is the core of the algorithm. */
+/* Byte order, decided at compile time. _CTB_HASH_LITTLE_ENDIAN is 1 or 0
+ * when known and left undefined otherwise (callers then use byte loads).
+ */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	#define _CTB_HASH_LITTLE_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	#define _CTB_HASH_LITTLE_ENDIAN 0
+#elif defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64) \
+	|| defined(__x86_64__) || defined(__i386__)
+	#define _CTB_HASH_LITTLE_ENDIAN 1
+#endif
 
-void ctb_sha1_transform(
-	uint32_t state[5],
-	const unsigned char buffer[64]
-)
+typedef void (*_ctb_sha1_compress_fn)(uint32_t state[5], const unsigned char *data, size_t block_nb);
+typedef void (*_ctb_sha256_compress_fn)(uint32 h[8], const unsigned char *message, size_t block_nb);
+typedef void (*_ctb_sha256_words_fn)(uint32 h[8], const uint32 w[16]);
+typedef void (*_ctb_sha512_compress_fn)(uint64 h[8], const unsigned char *message, size_t block_nb);
+typedef void (*_ctb_mb_kernel_fn)(void *state, const unsigned char *const *blocks, unsigned int active);
+typedef void (*_ctb_mb_fixed_fn)(const unsigned char *msg, unsigned char *digest);
+typedef void (*_ctb_pbkdf2_iter_fn)(const void *istate, const void *ostate,
+									void *u, void *t, uint32_t rounds);
+typedef void (*_ctb_xxh3_accumulate_fn)(uint64_t acc[8], const unsigned char *input,
+										const unsigned char *secret, size_t nb_stripes);
+typedef void (*_ctb_xxh3_scramble_fn)(uint64_t acc[8], const unsigned char *secret);
+typedef uint32_t (*_ctb_crc32_fn)(uint32_t crc, const unsigned char *data, size_t len);
+typedef uint64_t (*_ctb_crc64_fn)(uint64_t crc, const unsigned char *data, size_t len);
+typedef void (*_ctb_blake3_compress_fn)(const uint32_t cv[8], const unsigned char block[64],
+										uint32_t block_len, uint64_t counter, uint32_t flags,
+										uint32_t out[16]);
+typedef void (*_ctb_blake3_many_fn)(const unsigned char *const *input, size_t blocks,
+									const uint32_t key[8], uint64_t counter, int increment,
+									uint32_t flags, uint32_t flags_start, uint32_t flags_end,
+									unsigned char *out);
+typedef void (*_ctb_blake2b_compress_fn)(uint64_t h[8], const unsigned char block[128],
+										 uint64_t t0, uint64_t t1, uint64_t f0, uint64_t f1);
+typedef void (*_ctb_blake2s_compress_fn)(uint32_t h[8], const unsigned char block[64],
+										 uint32_t t0, uint32_t t1, uint32_t f0, uint32_t f1);
+typedef void (*_ctb_blake2bp_many_fn)(uint64_t h[8][4], const unsigned char *in, size_t rows,
+									  uint64_t count);
+typedef void (*_ctb_blake2sp_many_fn)(uint32_t h[8][8], const unsigned char *in, size_t rows,
+									  uint64_t count);
+
+/* One entry per hot primitive; filled by _ctb_hash_resolve(). Multi-buffer
+ * kernels are NULL when the CPU has no suitable vector unit.
+ */
+typedef struct
 {
-	uint32_t a, b, c, d, e;
-
-	typedef union
-	{
-		unsigned char c[64];
-		uint32_t l[16];
-	} CHAR64LONG16;
+	unsigned int			features;
+	_ctb_sha1_compress_fn	sha1_compress;
+	_ctb_sha256_compress_fn	sha256_compress;
+	_ctb_sha256_words_fn	sha256_words;	/* one block from host-order words */
+	_ctb_mb_kernel_fn		sha256_mb;
+	unsigned int			sha256_mb_lanes;
+	_ctb_sha512_compress_fn	sha512_compress;
+	_ctb_mb_kernel_fn		sha512_mb;
+	unsigned int			sha512_mb_lanes;
+	_ctb_mb_kernel_fn		ripemd160_mb;
+	unsigned int			ripemd160_mb_lanes;
+	_ctb_mb_fixed_fn		ripemd160_32;	/* ripemd160_mb_lanes 32-byte messages */
+	_ctb_pbkdf2_iter_fn		pbkdf2_sha256;	/* PBKDF2-HMAC iterations, see PBKDF2 */
+	unsigned int			pbkdf2_sha256_lanes;
+	_ctb_pbkdf2_iter_fn		pbkdf2_sha512;
+	unsigned int			pbkdf2_sha512_lanes;
+	_ctb_xxh3_accumulate_fn	xxh3_accumulate;	/* 64-byte stripes into the accumulators */
+	_ctb_xxh3_scramble_fn	xxh3_scramble;
+	_ctb_crc32_fn			crc32c;		/* CRC register in and out, not inverted */
+	_ctb_crc32_fn			crc32;
+	_ctb_crc64_fn			crc64;
+	_ctb_blake3_compress_fn	blake3_compress;	/* one block, 16-word extended output */
+	_ctb_blake3_many_fn		blake3_many;		/* exactly blake3_lanes inputs */
+	unsigned int			blake3_lanes;
+	_ctb_blake2b_compress_fn	blake2b_compress;	/* counter after the block, final flags */
+	_ctb_blake2s_compress_fn	blake2s_compress;
+	_ctb_blake2bp_many_fn	blake2bp_many;		/* block rows into all BLAKE2bp leaves */
+	_ctb_blake2sp_many_fn	blake2sp_many;
+} _ctb_hash_kernel_table;
+
+static _ctb_hash_kernel_table	_ctb_hash_kt;
+static int						_ctb_hash_kt_ready;
+
+static void _ctb_hash_resolve(unsigned int mask);
+
+/* The first use resolves the table for the detected CPU under a
+ * once-guard, so threads may race to their first hash. The ready flag is
+ * published with release/acquire ordering, and later calls only load it.
+ */
+#if _CTB_HASH_THREADS && defined(_WIN32)
+static INIT_ONCE _ctb_hash_kt_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK _ctb_hash_kt_init(PINIT_ONCE once, PVOID arg, PVOID *ctx)
+{
+	(void) once; (void) arg; (void) ctx;
+	_ctb_hash_resolve(~0u);
+	return TRUE;
+}
+#elif _CTB_HASH_THREADS
+static pthread_once_t _ctb_hash_kt_once = PTHREAD_ONCE_INIT;
+
+static void _ctb_hash_kt_init(void)
+{
+	_ctb_hash_resolve(~0u);
+}
+#endif
+
+static void _ctb_hash_kernels_init(void)
+{
+#if _CTB_HASH_THREADS && defined(_WIN32)
+	InitOnceExecuteOnce(&_ctb_hash_kt_once, _ctb_hash_kt_init, NULL, NULL);
+#elif _CTB_HASH_THREADS
+	pthread_once(&_ctb_hash_kt_once, _ctb_hash_kt_init);
+#else
+	_ctb_hash_resolve(~0u);
+#endif
+}
+
+static inline const _ctb_hash_kernel_table *_ctb_hash_kernels(void)
+{
+	if (!_CTB_HASH_LOAD_ACQUIRE(&_ctb_hash_kt_ready))
+		_ctb_hash_kernels_init();
+	return &_ctb_hash_kt;
+}
+
+/* =========================================================================
+   MULTI-BUFFER SCHEDULER
+   ========================================================================= */
+
+/* Drives a SIMD kernel that compresses one block in each of `lanes`
+ * independent messages. The kernel state is kept transposed (word-major,
+ * state[word][lane]) so each state word is one vector register. Lanes
+ * walk their message in place and only the padded tail is staged in a
+ * per-lane buffer; a lane that finishes is reported through `done` and
+ * reloaded with the next message. Inactive lanes are fed a dummy block
+ * and masked out of the kernel's state update.
+ */
+#define _CTB_MB_MAX_LANES	16
+#define _CTB_MB_MAX_BLOCK	128
+#define _CTB_MB_MAX_STATE	(8 * 8 * _CTB_MB_MAX_LANES)
+
+typedef struct
+{
+	_ctb_mb_kernel_fn	kernel;
+	unsigned int		lanes;
+	unsigned int		block_size;
+	unsigned int		word_size;		/* 4 or 8 */
+	unsigned int		state_words;
+	unsigned int		len_size;		/* bytes of length trailer, 8 or 16 */
+	int					big_endian;
+	const void			*iv;			/* state_words words */
+	uint64_t			prefix_len;		/* bytes already absorbed into iv */
+
+	/* optional single-stream kernel used to finish the last few lanes */
+	void				(*single)(void *h, const unsigned char *message, size_t block_nb);
+	unsigned int		drain_below;
+
+	/* receives the final chaining words (native order) of message index */
+	void				(*done)(const void *h, size_t index, void *user);
+	void				*user;
+} _ctb_mb_job;
+
+typedef struct
+{
+	const unsigned char	*msg;
+	size_t				blocks;		/* whole blocks left in msg */
+	unsigned int		tail_nb;	/* padded tail blocks */
+	unsigned int		tail_pos;
+	size_t				index;
+	unsigned char		tail[2 * _CTB_MB_MAX_BLOCK];
+} _ctb_mb_lane;
+
+static const unsigned char _ctb_mb_zero_block[_CTB_MB_MAX_BLOCK] = {0};
+
+static void _ctb_mb_lane_load(const _ctb_mb_job *job, _ctb_mb_lane *lane,
+							  const unsigned char *msg, size_t len, size_t index)
+{
+	unsigned int bs = job->block_size;
+	unsigned int rem = (unsigned int) (len % bs);
+	unsigned int end, i;
+	uint64_t bits = (job->prefix_len + (uint64_t) len) << 3;
+	uint64_t bits_hi = (job->prefix_len + (uint64_t) len) >> 61;
+
+	lane->msg = msg;
+	lane->blocks = len / bs;
+	lane->index = index;
+	lane->tail_pos = 0;
+	lane->tail_nb = (rem + 1 + job->len_size <= bs) ? 1 : 2;
+
+	end = lane->tail_nb * bs;
+	if (rem)
+		memcpy(lane->tail, msg + len - rem, rem);
+	lane->tail[rem] = 0x80;
+	memset(lane->tail + rem + 1, 0, end - rem - 1);
+
+	for (i = 0; i < 8; i++) {
+		unsigned char byte = (unsigned char) (bits >> (i << 3));
+
+		if (job->big_endian)
+			lane->tail[end - 1 - i] = byte;
+		else
+			lane->tail[end - 8 + i] = byte;
+	}
+	if (job->len_size == 16) {
+		for (i = 0; i < 8; i++)
+			lane->tail[end - 9 - i] = (unsigned char) (bits_hi >> (i << 3));
+	}
+}
+
+static void _ctb_mb_set_state(const _ctb_mb_job *job, unsigned char *state,
+							  unsigned int lane, const void *words)
+{
+	unsigned int i;
+
+	if (job->word_size == 8) {
+		for (i = 0; i < job->state_words; i++)
+			((uint64_t *) state)[i * job->lanes + lane] = ((const uint64_t *) words)[i];
+	} else {
+		for (i = 0; i < job->state_words; i++)
+			((uint32_t *) state)[i * job->lanes + lane] = ((const uint32_t *) words)[i];
+	}
+}
+
+static void _ctb_mb_get_state(const _ctb_mb_job *job, const unsigned char *state,
+							  unsigned int lane, void *words)
+{
+	unsigned int i;
+
+	if (job->word_size == 8) {
+		for (i = 0; i < job->state_words; i++)
+			((uint64_t *) words)[i] = ((const uint64_t *) state)[i * job->lanes + lane];
+	} else {
+		for (i = 0; i < job->state_words; i++)
+			((uint32_t *) words)[i] = ((const uint32_t *) state)[i * job->lanes + lane];
+	}
+}
+
+static void _ctb_mb_run(const _ctb_mb_job *job, const unsigned char *const *message,
+						const size_t *len, size_t count)
+{
+	union { unsigned char b[_CTB_MB_MAX_STATE]; uint64_t align[_CTB_MB_MAX_STATE / 8]; } state;
+	uint64_t words[8];
+	_ctb_mb_lane lane[_CTB_MB_MAX_LANES];
+	const unsigned char *blocks[_CTB_MB_MAX_LANES];
+	unsigned int bs = job->block_size;
+	unsigned int active = 0, n_active = 0, l;
+	size_t next = 0;
+
+	for (l = 0; l < job->lanes && next < count; l++, next++) {
+		_ctb_mb_lane_load(job, &lane[l], message[next], len[next], next);
+		_ctb_mb_set_state(job, state.b, l, job->iv);
+		active |= 1u << l;
+		n_active++;
+	}
+
+	while (active) {
+		if (next == count && job->single && n_active < job->drain_below) {
+			for (l = 0; l < job->lanes; l++) {
+				if (!(active & (1u << l)))
+					continue;
+				_ctb_mb_get_state(job, state.b, l, words);
+				job->single(words, lane[l].msg, lane[l].blocks);
+				job->single(words, lane[l].tail + lane[l].tail_pos * bs,
+							lane[l].tail_nb - lane[l].tail_pos);
+				job->done(words, lane[l].index, job->user);
+			}
+			break;
+		}
+
+		for (l = 0; l < job->lanes; l++) {
+			if (!(active & (1u << l)))
+				blocks[l] = _ctb_mb_zero_block;
+			else if (lane[l].blocks)
+				blocks[l] = lane[l].msg;
+			else
+				blocks[l] = lane[l].tail + lane[l].tail_pos * bs;
+		}
+
+		job->kernel(state.b, blocks, active);
+
+		for (l = 0; l < job->lanes; l++) {
+			if (!(active & (1u << l)))
+				continue;
+			if (lane[l].blocks) {
+				lane[l].blocks--;
+				lane[l].msg += bs;
+				continue;
+			}
+			if (++lane[l].tail_pos < lane[l].tail_nb)
+				continue;
+
+			_ctb_mb_get_state(job, state.b, l, words);
+			job->done(words, lane[l].index, job->user);
+
+			if (next < count) {
+				_ctb_mb_lane_load(job, &lane[l], message[next], len[next], next);
+				_ctb_mb_set_state(job, state.b, l, job->iv);
+				next++;
+			} else {
+				active &= ~(1u << l);
+				n_active--;
+			}
+		}
+	}
+}
+
+#if _CTB_HASH_X86
+/* Transpose 4 rows of four 32-bit words: r[lane] -> r[word]. */
+_CTB_HASH_TARGET("sse2")
+static inline void _ctb_transpose4x4_epi32(__m128i r[4])
+{
+	__m128i t0 = _mm_unpacklo_epi32(r[0], r[1]), t1 = _mm_unpackhi_epi32(r[0], r[1]);
+	__m128i t2 = _mm_unpacklo_epi32(r[2], r[3]), t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+	r[0] = _mm_unpacklo_epi64(t0, t2);
+	r[1] = _mm_unpackhi_epi64(t0, t2);
+	r[2] = _mm_unpacklo_epi64(t1, t3);
+	r[3] = _mm_unpackhi_epi64(t1, t3);
+}
+
+/* Transpose 8 rows of eight 32-bit words: r[lane] -> r[word]. */
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_transpose8x8_epi32(__m256i r[8])
+{
+	__m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+#endif /* _CTB_HASH_X86 */
+
+/* Default `done`: store the leading digest_len bytes of the state words. */
+typedef struct
+{
+	unsigned char	*out;
+	size_t			stride;
+	unsigned int	digest_len;
+	unsigned int	word_size;
+	int				big_endian;
+} _ctb_mb_digest_out;
+
+static void _ctb_mb_store_digest(const void *h, size_t index, void *user)
+{
+	const _ctb_mb_digest_out *o = (const _ctb_mb_digest_out *) user;
+	unsigned char *dst = o->out + index * o->stride;
+	unsigned int i, b, ws = o->word_size, n = o->digest_len / o->word_size;
+
+	if (ws == 4 && o->big_endian) {
+		for (i = 0; i < n; i++, dst += 4) {
+			uint32_t v = ((const uint32_t *) h)[i];
+
+			dst[0] = (unsigned char) (v >> 24); dst[1] = (unsigned char) (v >> 16);
+			dst[2] = (unsigned char) (v >>  8); dst[3] = (unsigned char) v;
+		}
+		return;
+	}
+	if (ws == 4) {
+		for (i = 0; i < n; i++, dst += 4) {
+			uint32_t v = ((const uint32_t *) h)[i];
+
+			dst[0] = (unsigned char) v;         dst[1] = (unsigned char) (v >>  8);
+			dst[2] = (unsigned char) (v >> 16); dst[3] = (unsigned char) (v >> 24);
+		}
+		return;
+	}
+	for (i = 0; i < n; i++, dst += ws) {
+		uint64_t v = (ws == 8) ? ((const uint64_t *) h)[i] : ((const uint32_t *) h)[i];
+
+		for (b = 0; b < ws; b++)
+			dst[o->big_endian ? ws - 1 - b : b] = (unsigned char) (v >> (b << 3));
+	}
+}
+
+/* =========================================================================
+   SHA1 IMPLEMENTATION
+   ========================================================================= */
+#define CTB_SHA1_HANDSOFF
+
+#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/* blk0() and blk() perform the initial expand. */
+/* I got the idea of expanding during the round function from SSLeay */
+#define blk0_le(i) (block->l[i] = (rol(block->l[i],24)&0xFF00FF00) \
+	|(rol(block->l[i],8)&0x00FF00FF))
+#define blk0_be(i) block->l[i]
+#define blk0_bytes(i) (block->l[i] = ((uint32_t) block->c[(i) * 4] << 24) \
+	| ((uint32_t) block->c[(i) * 4 + 1] << 16) | ((uint32_t) block->c[(i) * 4 + 2] << 8) \
+	| (uint32_t) block->c[(i) * 4 + 3])
+#if !defined(_CTB_HASH_LITTLE_ENDIAN)
+/* Unknown byte order: assemble the big-endian words byte by byte */
+#define blk0(i) blk0_bytes(i)
+#elif _CTB_HASH_LITTLE_ENDIAN
+#define blk0(i) blk0_le(i)
+#else
+#define blk0(i) blk0_be(i)
+#endif
+
+#define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15] \
+									 ^block->l[(i+2)&15]^block->l[i&15],1))
+
+/* (R0+R1), R2, R3, R4 are the different operations used in ctb_sha1 */
+#define R0(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk0(i)+0x5A827999+rol(v,5);w=rol(w,30);
+#define R1(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk(i)+0x5A827999+rol(v,5);w=rol(w,30);
+#define R2(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0x6ED9EBA1+rol(v,5);w=rol(w,30);
+#define R3(v,w,x,y,z,i) z+=(((w|x)&y)|(w&x))+blk(i)+0x8F1BBCDC+rol(v,5);w=rol(w,30);
+#define R4(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0xCA62C1D6+rol(v,5);w=rol(w,30);
+
+
+/* Hash a single 512-bit block. This is the core of the algorithm. */
+
+static void _ctb_sha1_transform_scalar(
+	uint32_t state[5],
+	const unsigned char buffer[64]
+)
+{
+	uint32_t a, b, c, d, e;
+
+	typedef union
+	{
+		unsigned char c[64];
+		uint32_t l[16];
+	} CHAR64LONG16;
 
 #ifdef CTB_SHA1_HANDSOFF
 	CHAR64LONG16 block[1];      /* use array to appear as a pointer */
@@ -469,6 +2226,92 @@ void ctb_sha1_transform(
 #endif
 }
 
+static void _ctb_sha1_compress_scalar(uint32_t state[5], const unsigned char *data, size_t block_nb)
+{
+	for (; block_nb > 0; block_nb--, data += 64)
+		_ctb_sha1_transform_scalar(state, data);
+}
+
+#if _CTB_HASH_X86
+/* SHA-NI: four rounds per sha1rnds4. E is carried in the top lane of
+ * e0/e1 and folded into the next schedule group with sha1nexte; the
+ * schedule is expanded in place with sha1msg1/xor/sha1msg2.
+ */
+#define _CTB_SHA1_NI_GROUP(g, ecur, enext, cur, prev, next, next2)           \
+{                                                                             \
+	if ((g) == 0)                                                             \
+		ecur = _mm_add_epi32(ecur, cur);                                      \
+	else                                                                      \
+		ecur = _mm_sha1nexte_epu32(ecur, cur);                                \
+	enext = abcd;                                                             \
+	if ((g) >= 3 && (g) <= 18)                                                \
+		next = _mm_sha1msg2_epu32(next, cur);                                 \
+	abcd = _mm_sha1rnds4_epu32(abcd, ecur, (g) / 5);                          \
+	if ((g) >= 1 && (g) <= 16)                                                \
+		prev = _mm_sha1msg1_epu32(prev, cur);                                 \
+	if ((g) >= 2 && (g) <= 17)                                                \
+		next2 = _mm_xor_si128(next2, cur);                                    \
+}
+
+_CTB_HASH_TARGET("sha,sse4.1")
+static void _ctb_sha1_compress_shani(uint32_t state[5], const unsigned char *data, size_t block_nb)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+	e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+
+	for (; block_nb > 0; block_nb--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data +  0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), bswap);
+
+		_CTB_SHA1_NI_GROUP( 0, e0, e1, m0, m3, m1, m2);
+		_CTB_SHA1_NI_GROUP( 1, e1, e0, m1, m0, m2, m3);
+		_CTB_SHA1_NI_GROUP( 2, e0, e1, m2, m1, m3, m0);
+		_CTB_SHA1_NI_GROUP( 3, e1, e0, m3, m2, m0, m1);
+		_CTB_SHA1_NI_GROUP( 4, e0, e1, m0, m3, m1, m2);
+		_CTB_SHA1_NI_GROUP( 5, e1, e0, m1, m0, m2, m3);
+		_CTB_SHA1_NI_GROUP( 6, e0, e1, m2, m1, m3, m0);
+		_CTB_SHA1_NI_GROUP( 7, e1, e0, m3, m2, m0, m1);
+		_CTB_SHA1_NI_GROUP( 8, e0, e1, m0, m3, m1, m2);
+		_CTB_SHA1_NI_GROUP( 9, e1, e0, m1, m0, m2, m3);
+		_CTB_SHA1_NI_GROUP(10, e0, e1, m2, m1, m3, m0);
+		_CTB_SHA1_NI_GROUP(11, e1, e0, m3, m2, m0, m1);
+		_CTB_SHA1_NI_GROUP(12, e0, e1, m0, m3, m1, m2);
+		_CTB_SHA1_NI_GROUP(13, e1, e0, m1, m0, m2, m3);
+		_CTB_SHA1_NI_GROUP(14, e0, e1, m2, m1, m3, m0);
+		_CTB_SHA1_NI_GROUP(15, e1, e0, m3, m2, m0, m1);
+		_CTB_SHA1_NI_GROUP(16, e0, e1, m0, m3, m1, m2);
+		_CTB_SHA1_NI_GROUP(17, e1, e0, m1, m0, m2, m3);
+		_CTB_SHA1_NI_GROUP(18, e0, e1, m2, m1, m3, m0);
+		_CTB_SHA1_NI_GROUP(19, e1, e0, m3, m2, m0, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+#undef _CTB_SHA1_NI_GROUP
+#endif /* _CTB_HASH_X86 */
+
+void ctb_sha1_transform(
+	uint32_t state[5],
+	const unsigned char buffer[64]
+)
+{
+	_ctb_hash_kernels()->sha1_compress(state, buffer, 1);
+}
+
 
 /* ctb_sha1_init - Initialize new context */
 
@@ -477,11 +2320,9 @@ void ctb_sha1_init(
 )
 {
 	/* ctb_sha1 initialization constants */
-	context->state[0] = 0x67452301;
-	context->state[1] = 0xEFCDAB89;
-	context->state[2] = 0x98BADCFE;
-	context->state[3] = 0x10325476;
-	context->state[4] = 0xC3D2E1F0;
+	static const uint32_t h0[5] = _CTB_SHA1_H0;
+
+	memcpy(context->state, h0, sizeof(h0));
 	context->count[0] = context->count[1] = 0;
 }
 
@@ -491,25 +2332,28 @@ void ctb_sha1_init(
 void ctb_sha1_update(
 	ctb_sha1_ctx * context,
 	const unsigned char *data,
-	uint32_t len
+	size_t len
 )
 {
-	uint32_t i;
+	size_t i;
 
 	uint32_t j;
 
 	j = context->count[0];
-	if ((context->count[0] += len << 3) < j)
+	if ((context->count[0] += (uint32_t) (len << 3)) < j)
 		context->count[1]++;
-	context->count[1] += (len >> 29);
+	context->count[1] += (uint32_t) ((uint64_t) len >> 29);
 	j = (j >> 3) & 63;
 	if ((j + len) > 63)
 	{
+		const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+
 		memcpy(&context->buffer[j], data, (i = 64 - j));
-		ctb_sha1_transform(context->state, context->buffer);
-		for (; i + 63 < len; i += 64)
+		kt->sha1_compress(context->state, context->buffer, 1);
+		if (len - i >= 64)
 		{
-			ctb_sha1_transform(context->state, &data[i]);
+			kt->sha1_compress(context->state, &data[i], (len - i) >> 6);
+			i += (len - i) & ~(size_t) 63;
 		}
 		j = 0;
 	}
@@ -526,11 +2370,11 @@ void ctb_sha1_final(
 	ctb_sha1_ctx * context
 )
 {
-	unsigned i;
+	static const unsigned char padding[64] = { 0200 };
 
-	unsigned char finalcount[8];
+	unsigned i, j;
 
-	unsigned char c;
+	unsigned char finalcount[8];
 
 #if 0    /* untested "improvement" by DHR */
 	/* Convert context->count to a sequence of bytes
@@ -554,13 +2398,9 @@ void ctb_sha1_final(
 		finalcount[i] = (unsigned char) ((context->count[(i >= 4 ? 0 : 1)] >> ((3 - (i & 3)) * 8)) & 255);      /* Endian independent */
 	}
 #endif
-	c = 0200;
-	ctb_sha1_update(context, &c, 1);
-	while ((context->count[0] & 504) != 448)
-	{
-		c = 0000;
-		ctb_sha1_update(context, &c, 1);
-	}
+	/* 0x80, then zeros up to 56 mod 64 */
+	j = (context->count[0] >> 3) & 63;
+	ctb_sha1_update(context, padding, (j < 56) ? 56 - j : 120 - j);
 	ctb_sha1_update(context, finalcount, 8); /* Should cause a ctb_sha1_transform() */
 	for (i = 0; i < 20; i++)
 	{
@@ -575,14 +2415,12 @@ void ctb_sha1_final(
 void ctb_sha1(
 	char *hash_out,
 	const char *str,
-	uint32_t len)
+	size_t len)
 {
 	ctb_sha1_ctx ctx;
-	unsigned int ii;
 
 	ctb_sha1_init(&ctx);
-	for (ii=0; ii<len; ii+=1)
-		ctb_sha1_update(&ctx, (const unsigned char*)str + ii, 1);
+	ctb_sha1_update(&ctx, (const unsigned char*)str, len);
 	ctb_sha1_final((unsigned char *)hash_out, &ctx);
 }
 
@@ -593,6 +2431,9 @@ void ctb_sha1(
 #undef R4
 #undef rol
 #undef blk0
+#undef blk0_le
+#undef blk0_be
+#undef blk0_bytes
 #undef blk
 
 /* =========================================================================
@@ -890,7 +2731,7 @@ void ripemd160_process( ctb_ripemd160_ctx *ctx, const uint8_t data[_CTB_RIPEMD16
 /*
  * RIPEMD-160 process buffer
  */
-void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_t ilen )
+void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, size_t ilen )
 {
 	uint32_t fill;
 	uint32_t left;
@@ -906,6 +2747,7 @@ void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_
 
 	if( ctx->total[0] < (uint32_t) ilen )
 		ctx->total[1]++;
+	ctx->total[1] += (uint32_t) ( (uint64_t) ilen >> 32 );
 
 	if( left && ilen >= fill )
 	{
@@ -929,35 +2771,32 @@ void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_
 	}
 }
 
-static const uint8_t ripemd160_padding[_CTB_RIPEMD160_BLOCK_LENGTH] =
-	{
-		0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-	};
-
 /*
- * RIPEMD-160 final digest
+ * RIPEMD-160 final digest (padded in place, in ctx->buffer)
  */
 void ctb_ripemd160_final( ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_DIGEST_LENGTH] )
 {
-	uint32_t last, padn;
+	uint32_t last;
 	uint32_t high, low;
-	uint8_t msglen[8];
 
 	high = ( ctx->total[0] >> 29 )
 		| ( ctx->total[1] <<  3 );
 	low  = ( ctx->total[0] <<  3 );
 
-	PUT_UINT32_LE( low,  msglen, 0 );
-	PUT_UINT32_LE( high, msglen, 4 );
-
 	last = ctx->total[0] & 0x3F;
-	padn = ( last < 56 ) ? ( 56 - last ) : ( 120 - last );
+	ctx->buffer[last++] = 0x80;
+
+	if( last > 56 )
+	{
+		memset( ctx->buffer + last, 0, _CTB_RIPEMD160_BLOCK_LENGTH - last );
+		ripemd160_process( ctx, ctx->buffer );
+		last = 0;
+	}
 
-	ctb_ripemd160_update( ctx, ripemd160_padding, padn );
-	ctb_ripemd160_update( ctx, msglen, 8 );
+	memset( ctx->buffer + last, 0, 56 - last );
+	PUT_UINT32_LE( low,  ctx->buffer, 56 );
+	PUT_UINT32_LE( high, ctx->buffer, 60 );
+	ripemd160_process( ctx, ctx->buffer );
 
 	PUT_UINT32_LE( ctx->state[0], output,  0 );
 	PUT_UINT32_LE( ctx->state[1], output,  4 );
@@ -971,7 +2810,7 @@ void ctb_ripemd160_final( ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_
 /*
  * output = RIPEMD-160( input buffer )
  */
-void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH])
+void ctb_ripemd160(const uint8_t *msg, size_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH])
 {
 	ctb_ripemd160_ctx ctx;
 	ctb_ripemd160_init( &ctx );
@@ -979,6 +2818,37 @@ void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEM
 	ctb_ripemd160_final( &ctx, hash );
 }
 
+/*
+ * RIPEMD-160 midstate export / import
+ */
+int ctb_ripemd160_export( const ctb_ripemd160_ctx *ctx, uint8_t out[CTB_RIPEMD160_MIDSTATE_SIZE] )
+{
+	int i;
+
+	if( ctx->total[0] & 0x3F )
+		return( -1 );
+
+	for( i = 0; i < 5; i++ )
+		PUT_UINT32_LE( ctx->state[i], out, 4 * i );
+	PUT_UINT32_LE( ctx->total[0], out, 20 );
+	PUT_UINT32_LE( ctx->total[1], out, 24 );
+	return( 0 );
+}
+
+int ctb_ripemd160_import( ctb_ripemd160_ctx *ctx, const uint8_t in[CTB_RIPEMD160_MIDSTATE_SIZE] )
+{
+	int i;
+
+	if( in[20] & 0x3F )
+		return( -1 );
+
+	for( i = 0; i < 5; i++ )
+		GET_UINT32_LE( ctx->state[i], in, 4 * i );
+	GET_UINT32_LE( ctx->total[0], in, 20 );
+	GET_UINT32_LE( ctx->total[1], in, 24 );
+	return( 0 );
+}
+
 #undef F1
 #undef F2
 #undef F3
@@ -987,6 +2857,375 @@ void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEM
 #undef P
 #undef P2
 
+/* =========================================================================
+   RIPEMD160 MULTI-BUFFER
+   ========================================================================= */
+
+static const uint32_t _ctb_ripemd160_iv[5] =
+	{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+#if _CTB_HASH_X86
+/* One message per 32-bit lane. RIPEMD-160 is little-endian, so lanes only
+ * need a transpose on load. The round listing below is the scalar P2 list
+ * above, shared by the SSE4.1 and AVX2 kernels through the _CTB_RV_* ops.
+ */
+#define _CTB_RMD160_VF1(x, y, z)	_CTB_RV_XOR(_CTB_RV_XOR(x, y), z)
+#define _CTB_RMD160_VF2(x, y, z)	_CTB_RV_OR(_CTB_RV_AND(x, y), _CTB_RV_ANDNOT(x, z))
+#define _CTB_RMD160_VF3(x, y, z)	_CTB_RV_XOR(_CTB_RV_OR(x, _CTB_RV_XOR(y, ones)), z)
+#define _CTB_RMD160_VF4(x, y, z)	_CTB_RV_OR(_CTB_RV_AND(x, z), _CTB_RV_ANDNOT(z, y))
+#define _CTB_RMD160_VF5(x, y, z)	_CTB_RV_XOR(x, _CTB_RV_OR(y, _CTB_RV_XOR(z, ones)))
+
+#define _CTB_RMD160_VP(a, b, c, d, e, r, s, f, k)                            \
+{                                                                             \
+	a = _CTB_RV_ADD(_CTB_RV_ADD(a, _CTB_RMD160_VF##f(b, c, d)),               \
+		_CTB_RV_ADD(x[r], _CTB_RV_SET1((int) (k))));                          \
+	a = _CTB_RV_ADD(_CTB_RV_ROL(a, s), e);                                    \
+	c = _CTB_RV_ROL(c, 10);                                                   \
+}
+
+#define _CTB_RMD160_VP2(a, b, c, d, e, r, s, rp, sp, f, k, fp, kp)           \
+	_CTB_RMD160_VP(a, b, c, d, e, r, s, f, k);                                \
+	_CTB_RMD160_VP(a##p, b##p, c##p, d##p, e##p, rp, sp, fp, kp)
+
+#define _CTB_RMD160_V_ROUNDS                                                  \
+	_CTB_RMD160_VP2(A, B, C, D, E,  0, 11,  5,  8, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  1, 14, 14,  9, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  2, 15,  7,  9, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  3, 12,  0, 11, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  4,  5,  9, 13, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  5,  8,  2, 15, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  6,  7, 11, 15, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  7,  9,  4,  5, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  8, 11, 13,  7, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  9, 13,  6,  7, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 10, 14, 15,  8, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(E, A, B, C, D, 11, 15,  8, 11, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(D, E, A, B, C, 12,  6,  1, 14, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(C, D, E, A, B, 13,  7, 10, 14, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 14,  9,  3, 12, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 15,  8, 12,  6, 1, 0x00000000, 5, 0x50A28BE6); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  7,  7,  6,  9, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  4,  6, 11, 13, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(C, D, E, A, B, 13,  8,  3, 15, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  1, 13,  7,  7, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 10, 11,  0, 12, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  6,  9, 13,  8, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(D, E, A, B, C, 15,  7,  5,  9, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  3, 15, 10, 11, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 12,  7, 14,  7, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  0, 12, 15,  7, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  9, 15,  8, 12, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  5,  9, 12,  7, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  2, 11,  4,  6, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 14,  7,  9, 15, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 11, 13,  1, 13, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  8, 12,  2, 11, 2, 0x5A827999, 4, 0x5C4DD124); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  3, 11, 15,  9, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(C, D, E, A, B, 10, 13,  5,  7, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 14,  6,  1, 15, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  4,  7,  3, 11, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  9, 14,  7,  8, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(D, E, A, B, C, 15,  9, 14,  6, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  8, 13,  6,  6, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  1, 15,  9, 14, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  2, 14, 11, 12, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  7,  8,  8, 13, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  0, 13, 12,  5, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  6,  6,  2, 14, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 13,  5, 10, 13, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 11, 12,  0, 13, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  5,  7,  4,  7, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(D, E, A, B, C, 12,  5, 13,  5, 3, 0x6ED9EBA1, 3, 0x6D703EF3); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  1, 11,  8, 15, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  9, 12,  6,  5, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 11, 14,  4,  8, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(E, A, B, C, D, 10, 15,  1, 11, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  0, 14,  3, 14, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  8, 15, 11, 14, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 12,  9, 15,  6, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  4,  8,  0, 14, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(E, A, B, C, D, 13,  9,  5,  6, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  3, 14, 12,  9, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  7,  5,  2, 12, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 15,  6, 13,  9, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(A, B, C, D, E, 14,  8,  9, 12, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  5,  6,  7,  5, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  6,  5, 10, 15, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  2, 12, 14,  8, 4, 0x8F1BBCDC, 2, 0x7A6D76E9); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  4,  9, 12,  8, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  0, 15, 15,  5, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(E, A, B, C, D,  5,  5, 10, 12, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  9, 11,  4,  9, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  7,  6,  1, 12, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 12,  8,  5,  5, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  2, 13,  8, 14, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(E, A, B, C, D, 10, 12,  7,  6, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(D, E, A, B, C, 14,  5,  6,  8, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(C, D, E, A, B,  1, 12,  2, 13, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(B, C, D, E, A,  3, 13, 13,  6, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(A, B, C, D, E,  8, 14, 14,  5, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(E, A, B, C, D, 11, 11,  0, 15, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(D, E, A, B, C,  6,  8,  3, 13, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(C, D, E, A, B, 15,  5,  9, 11, 5, 0xA953FD4E, 1, 0x00000000); \
+	_CTB_RMD160_VP2(B, C, D, E, A, 13,  6, 11, 11, 5, 0xA953FD4E, 1, 0x00000000);
+
+/* Both lines over one block, with feed-forward into s. */
+#define _CTB_RMD160_V_COMPRESS                                                \
+{                                                                             \
+	A = Ap = s[0]; B = Bp = s[1]; C = Cp = s[2]; D = Dp = s[3]; E = Ep = s[4]; \
+	_CTB_RMD160_V_ROUNDS;                                                     \
+	T    = _CTB_RV_ADD(_CTB_RV_ADD(s[1], C), Dp);                             \
+	s[1] = _CTB_RV_ADD(_CTB_RV_ADD(s[2], D), Ep);                             \
+	s[2] = _CTB_RV_ADD(_CTB_RV_ADD(s[3], E), Ap);                             \
+	s[3] = _CTB_RV_ADD(_CTB_RV_ADD(s[4], A), Bp);                             \
+	s[4] = _CTB_RV_ADD(_CTB_RV_ADD(s[0], B), Cp);                             \
+	s[0] = T;                                                                 \
+}
+
+/* SSE4.1: four lanes */
+#define _CTB_RV_ADD(a, b)		_mm_add_epi32(a, b)
+#define _CTB_RV_XOR(a, b)		_mm_xor_si128(a, b)
+#define _CTB_RV_OR(a, b)		_mm_or_si128(a, b)
+#define _CTB_RV_AND(a, b)		_mm_and_si128(a, b)
+#define _CTB_RV_ANDNOT(a, b)	_mm_andnot_si128(a, b)
+#define _CTB_RV_SET1(k)			_mm_set1_epi32(k)
+#define _CTB_RV_ROL(x, n)		_mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+_CTB_HASH_TARGET("sse4.1")
+static inline void _ctb_ripemd160_x4_rounds(__m128i s[5], const __m128i x[16])
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	__m128i A, B, C, D, E, Ap, Bp, Cp, Dp, Ep, T;
+
+	_CTB_RMD160_V_COMPRESS;
+}
+
+#undef _CTB_RV_ADD
+#undef _CTB_RV_XOR
+#undef _CTB_RV_OR
+#undef _CTB_RV_AND
+#undef _CTB_RV_ANDNOT
+#undef _CTB_RV_SET1
+#undef _CTB_RV_ROL
+
+/* AVX2: eight lanes */
+#define _CTB_RV_ADD(a, b)		_mm256_add_epi32(a, b)
+#define _CTB_RV_XOR(a, b)		_mm256_xor_si256(a, b)
+#define _CTB_RV_OR(a, b)		_mm256_or_si256(a, b)
+#define _CTB_RV_AND(a, b)		_mm256_and_si256(a, b)
+#define _CTB_RV_ANDNOT(a, b)	_mm256_andnot_si256(a, b)
+#define _CTB_RV_SET1(k)			_mm256_set1_epi32(k)
+#define _CTB_RV_ROL(x, n)		_mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_ripemd160_x8_rounds(__m256i s[5], const __m256i x[16])
+{
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i A, B, C, D, E, Ap, Bp, Cp, Dp, Ep, T;
+
+	_CTB_RMD160_V_COMPRESS;
+}
+
+#undef _CTB_RV_ADD
+#undef _CTB_RV_XOR
+#undef _CTB_RV_OR
+#undef _CTB_RV_AND
+#undef _CTB_RV_ANDNOT
+#undef _CTB_RV_SET1
+#undef _CTB_RV_ROL
+#undef _CTB_RMD160_V_COMPRESS
+#undef _CTB_RMD160_V_ROUNDS
+#undef _CTB_RMD160_VP2
+#undef _CTB_RMD160_VP
+#undef _CTB_RMD160_VF1
+#undef _CTB_RMD160_VF2
+#undef _CTB_RMD160_VF3
+#undef _CTB_RMD160_VF4
+#undef _CTB_RMD160_VF5
+
+_CTB_HASH_TARGET("sse4.1")
+static void _ctb_ripemd160_x4_sse41(void *state, const unsigned char *const *blocks, unsigned int active)
+{
+	__m128i *st = (__m128i *) state;
+	const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int) active), bit), bit);
+	__m128i s[5], x[16];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		x[(i << 2) + 0] = _mm_loadu_si128((const __m128i *) (blocks[0] + (i << 4)));
+		x[(i << 2) + 1] = _mm_loadu_si128((const __m128i *) (blocks[1] + (i << 4)));
+		x[(i << 2) + 2] = _mm_loadu_si128((const __m128i *) (blocks[2] + (i << 4)));
+		x[(i << 2) + 3] = _mm_loadu_si128((const __m128i *) (blocks[3] + (i << 4)));
+		_ctb_transpose4x4_epi32(&x[i << 2]);
+	}
+	for (i = 0; i < 5; i++)
+		s[i] = _mm_loadu_si128(&st[i]);
+	_ctb_ripemd160_x4_rounds(s, x);
+	for (i = 0; i < 5; i++)
+		_mm_storeu_si128(&st[i], _mm_blendv_epi8(_mm_loadu_si128(&st[i]), s[i], mask));
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_ripemd160_x8_avx2(void *state, const unsigned char *const *blocks, unsigned int active)
+{
+	__m256i *st = (__m256i *) state;
+	const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) active), bit), bit);
+	__m256i s[5], x[16];
+	int i, half;
+
+	for (half = 0; half < 2; half++) {
+		for (i = 0; i < 8; i++)
+			x[(half << 3) + i] = _mm256_loadu_si256((const __m256i *) (blocks[i] + (half << 5)));
+		_ctb_transpose8x8_epi32(&x[half << 3]);
+	}
+	for (i = 0; i < 5; i++)
+		s[i] = _mm256_loadu_si256(&st[i]);
+	_ctb_ripemd160_x8_rounds(s, x);
+	for (i = 0; i < 5; i++)
+		_mm256_storeu_si256(&st[i], _mm256_blendv_epi8(_mm256_loadu_si256(&st[i]), s[i], mask));
+}
+
+/* Fixed 32-byte messages: the padded block is constant past word 7, so
+ * the lanes skip the scheduler and load straight from msg[lane][32].
+ */
+_CTB_HASH_TARGET("sse4.1")
+static void _ctb_ripemd160_32_x4_sse41(const unsigned char *msg, unsigned char *digest)
+{
+	uint32_t out[5][4];
+	__m128i s[5], x[16];
+	int i, l;
+
+	for (i = 0; i < 2; i++) {
+		for (l = 0; l < 4; l++)
+			x[(i << 2) + l] = _mm_loadu_si128((const __m128i *) (msg + (l << 5) + (i << 4)));
+		_ctb_transpose4x4_epi32(&x[i << 2]);
+	}
+	x[8] = _mm_set1_epi32(0x80);
+	for (i = 9; i < 16; i++)
+		x[i] = _mm_setzero_si128();
+	x[14] = _mm_set1_epi32(32 << 3);
+	for (i = 0; i < 5; i++)
+		s[i] = _mm_set1_epi32((int) _ctb_ripemd160_iv[i]);
+	_ctb_ripemd160_x4_rounds(s, x);
+	for (i = 0; i < 5; i++)
+		_mm_storeu_si128((__m128i *) out[i], s[i]);
+	for (l = 0; l < 4; l++)
+		for (i = 0; i < 5; i++)
+			PUT_UINT32_LE(out[i][l], digest, l * _CTB_RIPEMD160_DIGEST_LENGTH + (i << 2));
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_ripemd160_32_x8_avx2(const unsigned char *msg, unsigned char *digest)
+{
+	uint32_t out[5][8];
+	__m256i s[5], x[16];
+	int i, l;
+
+	for (l = 0; l < 8; l++)
+		x[l] = _mm256_loadu_si256((const __m256i *) (msg + (l << 5)));
+	_ctb_transpose8x8_epi32(x);
+	x[8] = _mm256_set1_epi32(0x80);
+	for (i = 9; i < 16; i++)
+		x[i] = _mm256_setzero_si256();
+	x[14] = _mm256_set1_epi32(32 << 3);
+	for (i = 0; i < 5; i++)
+		s[i] = _mm256_set1_epi32((int) _ctb_ripemd160_iv[i]);
+	_ctb_ripemd160_x8_rounds(s, x);
+	for (i = 0; i < 5; i++)
+		_mm256_storeu_si256((__m256i *) out[i], s[i]);
+	for (l = 0; l < 8; l++)
+		for (i = 0; i < 5; i++)
+			PUT_UINT32_LE(out[i][l], digest, l * _CTB_RIPEMD160_DIGEST_LENGTH + (i << 2));
+}
+#endif /* _CTB_HASH_X86 */
+
+static void _ctb_ripemd160_compress_words(void *h, const unsigned char *message, size_t block_nb)
+{
+	ctb_ripemd160_ctx ctx;
+
+	memcpy(ctx.state, h, sizeof(ctx.state));
+	for (; block_nb > 0; block_nb--, message += _CTB_RIPEMD160_BLOCK_LENGTH)
+		ripemd160_process(&ctx, message);
+	memcpy(h, ctx.state, sizeof(ctx.state));
+}
+
+void ctb_ripemd160_many(const uint8_t *const *msg, const size_t *len,
+						uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH], size_t count)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	_ctb_mb_digest_out out;
+	_ctb_mb_job job;
+	size_t i;
+
+	if (!kt->ripemd160_mb) {
+		for (i = 0; i < count; i++)
+			ctb_ripemd160(msg[i], len[i], hash[i]);
+		return;
+	}
+
+	out.out = (unsigned char *) hash;
+	out.stride = _CTB_RIPEMD160_DIGEST_LENGTH;
+	out.digest_len = _CTB_RIPEMD160_DIGEST_LENGTH;
+	out.word_size = 4;
+	out.big_endian = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.kernel = kt->ripemd160_mb;
+	job.lanes = kt->ripemd160_mb_lanes;
+	job.block_size = _CTB_RIPEMD160_BLOCK_LENGTH;
+	job.word_size = 4;
+	job.state_words = 5;
+	job.len_size = 8;
+	job.big_endian = 0;
+	job.iv = _ctb_ripemd160_iv;
+	job.single = _ctb_ripemd160_compress_words;
+	job.drain_below = 2;
+	job.done = _ctb_mb_store_digest;
+	job.user = &out;
+
+	_ctb_mb_run(&job, msg, len, count);
+}
+
+void ctb_ripemd160_x4(const uint8_t *const msg[4], const size_t len[4],
+					  uint8_t hash[4][_CTB_RIPEMD160_DIGEST_LENGTH])
+{
+	ctb_ripemd160_many(msg, len, hash, 4);
+}
+
+void ctb_ripemd160_x8(const uint8_t *const msg[8], const size_t len[8],
+					  uint8_t hash[8][_CTB_RIPEMD160_DIGEST_LENGTH])
+{
+	ctb_ripemd160_many(msg, len, hash, 8);
+}
+
+void ctb_ripemd160_32_many(const uint8_t (*msg)[32], uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH],
+						   size_t count)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	unsigned int lanes = kt->ripemd160_mb_lanes;
+	size_t i = 0;
+
+	if (kt->ripemd160_32) {
+		unsigned char in[_CTB_MB_MAX_LANES][32];
+		unsigned char out[_CTB_MB_MAX_LANES][_CTB_RIPEMD160_DIGEST_LENGTH];
+
+		for (; i + lanes <= count; i += lanes)
+			kt->ripemd160_32(msg[i], hash[i]);
+		/* a short tail still beats the scalar path from two messages up */
+		if (count - i >= 2) {
+			memset(in, 0, sizeof(in));
+			memcpy(in, msg[i], (count - i) * 32);
+			kt->ripemd160_32(in[0], out[0]);
+			memcpy(hash[i], out, (count - i) * _CTB_RIPEMD160_DIGEST_LENGTH);
+			return;
+		}
+	}
+	for (; i < count; i++)
+		ctb_ripemd160(msg[i], 32, hash[i]);
+}
+
 /* =========================================================================
    SHA2 IMPLEMENTATION
    ========================================================================= */
@@ -1082,209 +3321,275 @@ void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEM
 	wv[h] = t1 + t2;                                        \
 }
 
-uint32 sha224_h0[8] =
-	{0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
-		0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4};
-
-uint32 sha256_h0[8] =
-	{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
-
-uint64 sha384_h0[8] =
-	{0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
-		0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
-		0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
-		0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL};
-
-uint64 sha512_h0[8] =
-	{0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
-		0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
-		0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
-		0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
-
-uint32 sha256_k[64] =
-	{0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-		0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-		0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-		0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-		0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-		0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
-
-uint64 sha512_k[80] =
-	{0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
-		0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
-		0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
-		0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
-		0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
-		0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
-		0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
-		0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
-		0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
-		0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
-		0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
-		0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
-		0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
-		0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
-		0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
-		0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
-		0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
-		0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
-		0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
-		0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
-		0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
-		0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
-		0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
-		0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
-		0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
-		0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
-		0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
-		0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
-		0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
-		0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
-		0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
-		0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
-		0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
-		0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
-		0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
-		0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
-		0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
-		0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
-		0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
-		0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
+uint32 sha224_h0[8] = _CTB_SHA224_H0;
+uint32 sha256_h0[8] = _CTB_SHA256_H0;
+uint64 sha384_h0[8] = _CTB_SHA384_H0;
+uint64 sha512_h0[8] = _CTB_SHA512_H0;
+
+uint32 sha256_k[64] = _CTB_SHA256_K;
+uint64 sha512_k[80] = _CTB_SHA512_K;
 
 /* SHA-256 functions */
 
-void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int block_nb)
+/* One block from schedule words w[0..15] (host order); w is expanded in place. */
+static inline void _ctb_sha256_rounds_scalar(uint32 h[8], uint32 w[64])
 {
-	uint32 w[64];
 	uint32 wv[8];
 	uint32 t1, t2;
-	const unsigned char *sub_block;
-	int i;
-
 #ifndef UNROLL_LOOPS
 	int j;
-#endif
 
-	for (i = 0; i < (int) block_nb; i++) {
-		sub_block = message + (i << 6);
-
-#ifndef UNROLL_LOOPS
-		for (j = 0; j < 16; j++) {
-			PACK32(&sub_block[j << 2], &w[j]);
-		}
-
-		for (j = 16; j < 64; j++) {
-			SHA256_SCR(j);
-		}
+	for (j = 16; j < 64; j++) {
+		SHA256_SCR(j);
+	}
 
-		for (j = 0; j < 8; j++) {
-			wv[j] = ctx->h[j];
-		}
+	for (j = 0; j < 8; j++) {
+		wv[j] = h[j];
+	}
 
-		for (j = 0; j < 64; j++) {
-			t1 = wv[7] + SHA256_F2(wv[4]) + CH(wv[4], wv[5], wv[6])
-				+ sha256_k[j] + w[j];
-			t2 = SHA256_F1(wv[0]) + MAJ(wv[0], wv[1], wv[2]);
-			wv[7] = wv[6];
-			wv[6] = wv[5];
-			wv[5] = wv[4];
-			wv[4] = wv[3] + t1;
-			wv[3] = wv[2];
-			wv[2] = wv[1];
-			wv[1] = wv[0];
-			wv[0] = t1 + t2;
-		}
+	for (j = 0; j < 64; j++) {
+		t1 = wv[7] + SHA256_F2(wv[4]) + CH(wv[4], wv[5], wv[6])
+			+ sha256_k[j] + w[j];
+		t2 = SHA256_F1(wv[0]) + MAJ(wv[0], wv[1], wv[2]);
+		wv[7] = wv[6];
+		wv[6] = wv[5];
+		wv[5] = wv[4];
+		wv[4] = wv[3] + t1;
+		wv[3] = wv[2];
+		wv[2] = wv[1];
+		wv[1] = wv[0];
+		wv[0] = t1 + t2;
+	}
 
-		for (j = 0; j < 8; j++) {
-			ctx->h[j] += wv[j];
-		}
+	for (j = 0; j < 8; j++) {
+		h[j] += wv[j];
+	}
 #else
-		PACK32(&sub_block[ 0], &w[ 0]); PACK32(&sub_block[ 4], &w[ 1]);
-		PACK32(&sub_block[ 8], &w[ 2]); PACK32(&sub_block[12], &w[ 3]);
-		PACK32(&sub_block[16], &w[ 4]); PACK32(&sub_block[20], &w[ 5]);
-		PACK32(&sub_block[24], &w[ 6]); PACK32(&sub_block[28], &w[ 7]);
-		PACK32(&sub_block[32], &w[ 8]); PACK32(&sub_block[36], &w[ 9]);
-		PACK32(&sub_block[40], &w[10]); PACK32(&sub_block[44], &w[11]);
-		PACK32(&sub_block[48], &w[12]); PACK32(&sub_block[52], &w[13]);
-		PACK32(&sub_block[56], &w[14]); PACK32(&sub_block[60], &w[15]);
-
-		SHA256_SCR(16); SHA256_SCR(17); SHA256_SCR(18); SHA256_SCR(19);
-		SHA256_SCR(20); SHA256_SCR(21); SHA256_SCR(22); SHA256_SCR(23);
-		SHA256_SCR(24); SHA256_SCR(25); SHA256_SCR(26); SHA256_SCR(27);
-		SHA256_SCR(28); SHA256_SCR(29); SHA256_SCR(30); SHA256_SCR(31);
-		SHA256_SCR(32); SHA256_SCR(33); SHA256_SCR(34); SHA256_SCR(35);
-		SHA256_SCR(36); SHA256_SCR(37); SHA256_SCR(38); SHA256_SCR(39);
-		SHA256_SCR(40); SHA256_SCR(41); SHA256_SCR(42); SHA256_SCR(43);
-		SHA256_SCR(44); SHA256_SCR(45); SHA256_SCR(46); SHA256_SCR(47);
-		SHA256_SCR(48); SHA256_SCR(49); SHA256_SCR(50); SHA256_SCR(51);
-		SHA256_SCR(52); SHA256_SCR(53); SHA256_SCR(54); SHA256_SCR(55);
-		SHA256_SCR(56); SHA256_SCR(57); SHA256_SCR(58); SHA256_SCR(59);
-		SHA256_SCR(60); SHA256_SCR(61); SHA256_SCR(62); SHA256_SCR(63);
-
-		wv[0] = ctx->h[0]; wv[1] = ctx->h[1];
-		wv[2] = ctx->h[2]; wv[3] = ctx->h[3];
-		wv[4] = ctx->h[4]; wv[5] = ctx->h[5];
-		wv[6] = ctx->h[6]; wv[7] = ctx->h[7];
-
-		SHA256_EXP(0,1,2,3,4,5,6,7, 0); SHA256_EXP(7,0,1,2,3,4,5,6, 1);
-		SHA256_EXP(6,7,0,1,2,3,4,5, 2); SHA256_EXP(5,6,7,0,1,2,3,4, 3);
-		SHA256_EXP(4,5,6,7,0,1,2,3, 4); SHA256_EXP(3,4,5,6,7,0,1,2, 5);
-		SHA256_EXP(2,3,4,5,6,7,0,1, 6); SHA256_EXP(1,2,3,4,5,6,7,0, 7);
-		SHA256_EXP(0,1,2,3,4,5,6,7, 8); SHA256_EXP(7,0,1,2,3,4,5,6, 9);
-		SHA256_EXP(6,7,0,1,2,3,4,5,10); SHA256_EXP(5,6,7,0,1,2,3,4,11);
-		SHA256_EXP(4,5,6,7,0,1,2,3,12); SHA256_EXP(3,4,5,6,7,0,1,2,13);
-		SHA256_EXP(2,3,4,5,6,7,0,1,14); SHA256_EXP(1,2,3,4,5,6,7,0,15);
-		SHA256_EXP(0,1,2,3,4,5,6,7,16); SHA256_EXP(7,0,1,2,3,4,5,6,17);
-		SHA256_EXP(6,7,0,1,2,3,4,5,18); SHA256_EXP(5,6,7,0,1,2,3,4,19);
-		SHA256_EXP(4,5,6,7,0,1,2,3,20); SHA256_EXP(3,4,5,6,7,0,1,2,21);
-		SHA256_EXP(2,3,4,5,6,7,0,1,22); SHA256_EXP(1,2,3,4,5,6,7,0,23);
-		SHA256_EXP(0,1,2,3,4,5,6,7,24); SHA256_EXP(7,0,1,2,3,4,5,6,25);
-		SHA256_EXP(6,7,0,1,2,3,4,5,26); SHA256_EXP(5,6,7,0,1,2,3,4,27);
-		SHA256_EXP(4,5,6,7,0,1,2,3,28); SHA256_EXP(3,4,5,6,7,0,1,2,29);
-		SHA256_EXP(2,3,4,5,6,7,0,1,30); SHA256_EXP(1,2,3,4,5,6,7,0,31);
-		SHA256_EXP(0,1,2,3,4,5,6,7,32); SHA256_EXP(7,0,1,2,3,4,5,6,33);
-		SHA256_EXP(6,7,0,1,2,3,4,5,34); SHA256_EXP(5,6,7,0,1,2,3,4,35);
-		SHA256_EXP(4,5,6,7,0,1,2,3,36); SHA256_EXP(3,4,5,6,7,0,1,2,37);
-		SHA256_EXP(2,3,4,5,6,7,0,1,38); SHA256_EXP(1,2,3,4,5,6,7,0,39);
-		SHA256_EXP(0,1,2,3,4,5,6,7,40); SHA256_EXP(7,0,1,2,3,4,5,6,41);
-		SHA256_EXP(6,7,0,1,2,3,4,5,42); SHA256_EXP(5,6,7,0,1,2,3,4,43);
-		SHA256_EXP(4,5,6,7,0,1,2,3,44); SHA256_EXP(3,4,5,6,7,0,1,2,45);
-		SHA256_EXP(2,3,4,5,6,7,0,1,46); SHA256_EXP(1,2,3,4,5,6,7,0,47);
-		SHA256_EXP(0,1,2,3,4,5,6,7,48); SHA256_EXP(7,0,1,2,3,4,5,6,49);
-		SHA256_EXP(6,7,0,1,2,3,4,5,50); SHA256_EXP(5,6,7,0,1,2,3,4,51);
-		SHA256_EXP(4,5,6,7,0,1,2,3,52); SHA256_EXP(3,4,5,6,7,0,1,2,53);
-		SHA256_EXP(2,3,4,5,6,7,0,1,54); SHA256_EXP(1,2,3,4,5,6,7,0,55);
-		SHA256_EXP(0,1,2,3,4,5,6,7,56); SHA256_EXP(7,0,1,2,3,4,5,6,57);
-		SHA256_EXP(6,7,0,1,2,3,4,5,58); SHA256_EXP(5,6,7,0,1,2,3,4,59);
-		SHA256_EXP(4,5,6,7,0,1,2,3,60); SHA256_EXP(3,4,5,6,7,0,1,2,61);
-		SHA256_EXP(2,3,4,5,6,7,0,1,62); SHA256_EXP(1,2,3,4,5,6,7,0,63);
-
-		ctx->h[0] += wv[0]; ctx->h[1] += wv[1];
-		ctx->h[2] += wv[2]; ctx->h[3] += wv[3];
-		ctx->h[4] += wv[4]; ctx->h[5] += wv[5];
-		ctx->h[6] += wv[6]; ctx->h[7] += wv[7];
+	SHA256_SCR(16); SHA256_SCR(17); SHA256_SCR(18); SHA256_SCR(19);
+	SHA256_SCR(20); SHA256_SCR(21); SHA256_SCR(22); SHA256_SCR(23);
+	SHA256_SCR(24); SHA256_SCR(25); SHA256_SCR(26); SHA256_SCR(27);
+	SHA256_SCR(28); SHA256_SCR(29); SHA256_SCR(30); SHA256_SCR(31);
+	SHA256_SCR(32); SHA256_SCR(33); SHA256_SCR(34); SHA256_SCR(35);
+	SHA256_SCR(36); SHA256_SCR(37); SHA256_SCR(38); SHA256_SCR(39);
+	SHA256_SCR(40); SHA256_SCR(41); SHA256_SCR(42); SHA256_SCR(43);
+	SHA256_SCR(44); SHA256_SCR(45); SHA256_SCR(46); SHA256_SCR(47);
+	SHA256_SCR(48); SHA256_SCR(49); SHA256_SCR(50); SHA256_SCR(51);
+	SHA256_SCR(52); SHA256_SCR(53); SHA256_SCR(54); SHA256_SCR(55);
+	SHA256_SCR(56); SHA256_SCR(57); SHA256_SCR(58); SHA256_SCR(59);
+	SHA256_SCR(60); SHA256_SCR(61); SHA256_SCR(62); SHA256_SCR(63);
+
+	wv[0] = h[0]; wv[1] = h[1];
+	wv[2] = h[2]; wv[3] = h[3];
+	wv[4] = h[4]; wv[5] = h[5];
+	wv[6] = h[6]; wv[7] = h[7];
+
+	SHA256_EXP(0,1,2,3,4,5,6,7, 0); SHA256_EXP(7,0,1,2,3,4,5,6, 1);
+	SHA256_EXP(6,7,0,1,2,3,4,5, 2); SHA256_EXP(5,6,7,0,1,2,3,4, 3);
+	SHA256_EXP(4,5,6,7,0,1,2,3, 4); SHA256_EXP(3,4,5,6,7,0,1,2, 5);
+	SHA256_EXP(2,3,4,5,6,7,0,1, 6); SHA256_EXP(1,2,3,4,5,6,7,0, 7);
+	SHA256_EXP(0,1,2,3,4,5,6,7, 8); SHA256_EXP(7,0,1,2,3,4,5,6, 9);
+	SHA256_EXP(6,7,0,1,2,3,4,5,10); SHA256_EXP(5,6,7,0,1,2,3,4,11);
+	SHA256_EXP(4,5,6,7,0,1,2,3,12); SHA256_EXP(3,4,5,6,7,0,1,2,13);
+	SHA256_EXP(2,3,4,5,6,7,0,1,14); SHA256_EXP(1,2,3,4,5,6,7,0,15);
+	SHA256_EXP(0,1,2,3,4,5,6,7,16); SHA256_EXP(7,0,1,2,3,4,5,6,17);
+	SHA256_EXP(6,7,0,1,2,3,4,5,18); SHA256_EXP(5,6,7,0,1,2,3,4,19);
+	SHA256_EXP(4,5,6,7,0,1,2,3,20); SHA256_EXP(3,4,5,6,7,0,1,2,21);
+	SHA256_EXP(2,3,4,5,6,7,0,1,22); SHA256_EXP(1,2,3,4,5,6,7,0,23);
+	SHA256_EXP(0,1,2,3,4,5,6,7,24); SHA256_EXP(7,0,1,2,3,4,5,6,25);
+	SHA256_EXP(6,7,0,1,2,3,4,5,26); SHA256_EXP(5,6,7,0,1,2,3,4,27);
+	SHA256_EXP(4,5,6,7,0,1,2,3,28); SHA256_EXP(3,4,5,6,7,0,1,2,29);
+	SHA256_EXP(2,3,4,5,6,7,0,1,30); SHA256_EXP(1,2,3,4,5,6,7,0,31);
+	SHA256_EXP(0,1,2,3,4,5,6,7,32); SHA256_EXP(7,0,1,2,3,4,5,6,33);
+	SHA256_EXP(6,7,0,1,2,3,4,5,34); SHA256_EXP(5,6,7,0,1,2,3,4,35);
+	SHA256_EXP(4,5,6,7,0,1,2,3,36); SHA256_EXP(3,4,5,6,7,0,1,2,37);
+	SHA256_EXP(2,3,4,5,6,7,0,1,38); SHA256_EXP(1,2,3,4,5,6,7,0,39);
+	SHA256_EXP(0,1,2,3,4,5,6,7,40); SHA256_EXP(7,0,1,2,3,4,5,6,41);
+	SHA256_EXP(6,7,0,1,2,3,4,5,42); SHA256_EXP(5,6,7,0,1,2,3,4,43);
+	SHA256_EXP(4,5,6,7,0,1,2,3,44); SHA256_EXP(3,4,5,6,7,0,1,2,45);
+	SHA256_EXP(2,3,4,5,6,7,0,1,46); SHA256_EXP(1,2,3,4,5,6,7,0,47);
+	SHA256_EXP(0,1,2,3,4,5,6,7,48); SHA256_EXP(7,0,1,2,3,4,5,6,49);
+	SHA256_EXP(6,7,0,1,2,3,4,5,50); SHA256_EXP(5,6,7,0,1,2,3,4,51);
+	SHA256_EXP(4,5,6,7,0,1,2,3,52); SHA256_EXP(3,4,5,6,7,0,1,2,53);
+	SHA256_EXP(2,3,4,5,6,7,0,1,54); SHA256_EXP(1,2,3,4,5,6,7,0,55);
+	SHA256_EXP(0,1,2,3,4,5,6,7,56); SHA256_EXP(7,0,1,2,3,4,5,6,57);
+	SHA256_EXP(6,7,0,1,2,3,4,5,58); SHA256_EXP(5,6,7,0,1,2,3,4,59);
+	SHA256_EXP(4,5,6,7,0,1,2,3,60); SHA256_EXP(3,4,5,6,7,0,1,2,61);
+	SHA256_EXP(2,3,4,5,6,7,0,1,62); SHA256_EXP(1,2,3,4,5,6,7,0,63);
+
+	h[0] += wv[0]; h[1] += wv[1];
+	h[2] += wv[2]; h[3] += wv[3];
+	h[4] += wv[4]; h[5] += wv[5];
+	h[6] += wv[6]; h[7] += wv[7];
 #endif /* !UNROLL_LOOPS */
-	}
 }
 
-void ctb_sha256(const unsigned char *message, unsigned int len, unsigned char *digest)
+static void _ctb_sha256_compress_scalar(uint32 h[8], const unsigned char *message, size_t block_nb)
 {
-	ctb_sha256_ctx ctx;
+	uint32 w[64];
+	int j;
+
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA256_BLOCK_SIZE) {
+		for (j = 0; j < 16; j++) {
+			PACK32(&message[j << 2], &w[j]);
+		}
+		_ctb_sha256_rounds_scalar(h, w);
+	}
+}
+
+static void _ctb_sha256_words_scalar(uint32 h[8], const uint32 w16[16])
+{
+	uint32 w[64];
+
+	memcpy(w, w16, 16 * sizeof(uint32));
+	_ctb_sha256_rounds_scalar(h, w);
+}
+
+#if _CTB_HASH_X86
+/* SHA-NI: four rounds per group, two sha256rnds2 each. The state lives as
+ * ABEF/CDGH pairs for the whole call and the schedule is expanded in place
+ * with sha256msg1/sha256msg2, one group ahead of the rounds.
+ */
+#define _CTB_SHA256_NI_GROUP(g, cur, prev, next)                              \
+{                                                                             \
+	msg = _mm_add_epi32(cur,                                                  \
+		_mm_loadu_si128((const __m128i *) &sha256_k[(g) << 2]));              \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                      \
+	if ((g) >= 3 && (g) <= 14) {                                              \
+		tmp = _mm_alignr_epi8(cur, prev, 4);                                  \
+		next = _mm_add_epi32(next, tmp);                                      \
+		next = _mm_sha256msg2_epu32(next, cur);                               \
+	}                                                                         \
+	msg = _mm_shuffle_epi32(msg, 0x0E);                                       \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                      \
+	if ((g) >= 1 && (g) <= 12)                                                \
+		prev = _mm_sha256msg1_epu32(prev, cur);                               \
+}
+
+/* Rounds for one block already in host word order; m0..m3 are clobbered. */
+_CTB_HASH_TARGET("sha,sse4.1")
+static inline void _ctb_sha256_shani_block(__m128i *s0, __m128i *s1,
+										   __m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+	__m128i state0 = *s0, state1 = *s1, msg, tmp;
+
+	_CTB_SHA256_NI_GROUP( 0, m0, m3, m1);
+	_CTB_SHA256_NI_GROUP( 1, m1, m0, m2);
+	_CTB_SHA256_NI_GROUP( 2, m2, m1, m3);
+	_CTB_SHA256_NI_GROUP( 3, m3, m2, m0);
+	_CTB_SHA256_NI_GROUP( 4, m0, m3, m1);
+	_CTB_SHA256_NI_GROUP( 5, m1, m0, m2);
+	_CTB_SHA256_NI_GROUP( 6, m2, m1, m3);
+	_CTB_SHA256_NI_GROUP( 7, m3, m2, m0);
+	_CTB_SHA256_NI_GROUP( 8, m0, m3, m1);
+	_CTB_SHA256_NI_GROUP( 9, m1, m0, m2);
+	_CTB_SHA256_NI_GROUP(10, m2, m1, m3);
+	_CTB_SHA256_NI_GROUP(11, m3, m2, m0);
+	_CTB_SHA256_NI_GROUP(12, m0, m3, m1);
+	_CTB_SHA256_NI_GROUP(13, m1, m0, m2);
+	_CTB_SHA256_NI_GROUP(14, m2, m1, m3);
+	_CTB_SHA256_NI_GROUP(15, m3, m2, m0);
+
+	*s0 = _mm_add_epi32(state0, *s0);
+	*s1 = _mm_add_epi32(state1, *s1);
+}
+
+/* h[] <-> ABEF/CDGH */
+_CTB_HASH_TARGET("sha,sse4.1")
+static inline void _ctb_sha256_shani_load(const uint32 h[8], __m128i *state0, __m128i *state1)
+{
+	__m128i tmp = _mm_loadu_si128((const __m128i *) &h[0]);
+
+	*state1 = _mm_loadu_si128((const __m128i *) &h[4]);
+	tmp     = _mm_shuffle_epi32(tmp, 0xB1);          /* CDAB */
+	*state1 = _mm_shuffle_epi32(*state1, 0x1B);      /* EFGH */
+	*state0 = _mm_alignr_epi8(tmp, *state1, 8);      /* ABEF */
+	*state1 = _mm_blend_epi16(*state1, tmp, 0xF0);   /* CDGH */
+}
+
+_CTB_HASH_TARGET("sha,sse4.1")
+static inline void _ctb_sha256_shani_store(uint32 h[8], __m128i state0, __m128i state1)
+{
+	__m128i tmp = _mm_shuffle_epi32(state0, 0x1B);  /* FEBA */
+
+	state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);       /* HGFE */
+
+	_mm_storeu_si128((__m128i *) &h[0], state0);
+	_mm_storeu_si128((__m128i *) &h[4], state1);
+}
+
+_CTB_HASH_TARGET("sha,sse4.1")
+static void _ctb_sha256_compress_shani(uint32 h[8], const unsigned char *message, size_t block_nb)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1;
+
+	_ctb_sha256_shani_load(h, &state0, &state1);
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA256_BLOCK_SIZE) {
+		_ctb_sha256_shani_block(&state0, &state1,
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message +  0)), bswap),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 16)), bswap),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 32)), bswap),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 48)), bswap));
+	}
+	_ctb_sha256_shani_store(h, state0, state1);
+}
+
+_CTB_HASH_TARGET("sha,sse4.1")
+static void _ctb_sha256_words_shani(uint32 h[8], const uint32 w[16])
+{
+	__m128i state0, state1;
+
+	_ctb_sha256_shani_load(h, &state0, &state1);
+	_ctb_sha256_shani_block(&state0, &state1,
+		_mm_loadu_si128((const __m128i *) &w[ 0]), _mm_loadu_si128((const __m128i *) &w[ 4]),
+		_mm_loadu_si128((const __m128i *) &w[ 8]), _mm_loadu_si128((const __m128i *) &w[12]));
+	_ctb_sha256_shani_store(h, state0, state1);
+}
+
+#undef _CTB_SHA256_NI_GROUP
+#endif /* _CTB_HASH_X86 */
+
+void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, size_t block_nb)
+{
+	_ctb_hash_kernels()->sha256_compress(ctx->h, message, block_nb);
+}
+
+/* Whole-message SHA-256 into state words: full blocks are compressed in
+ * place and only the padded tail is staged, no context copy.
+ */
+static void _ctb_sha256_oneshot(const uint32 iv[8], uint64_t prefix_len,
+								const unsigned char *message, size_t len, uint32 h[8])
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	unsigned char tail[2 * _CTB_SHA256_BLOCK_SIZE];
+	size_t block_nb = len / _CTB_SHA256_BLOCK_SIZE;
+	unsigned int rem = (unsigned int) (len % _CTB_SHA256_BLOCK_SIZE);
+	unsigned int pm_len = (rem < _CTB_SHA256_BLOCK_SIZE - 8) ? 64 : 128;
+	uint64_t len_b = (prefix_len + len) << 3;
+
+	memcpy(h, iv, 8 * sizeof(uint32));
+	if (block_nb)
+		kt->sha256_compress(h, message, block_nb);
+
+	if (rem)
+		memcpy(tail, message + (block_nb << 6), rem);
+	tail[rem] = 0x80;
+	memset(tail + rem + 1, 0, pm_len - rem - 1);
+	UNPACK32((uint32) (len_b >> 32), tail + pm_len - 8);
+	UNPACK32((uint32) len_b, tail + pm_len - 4);
+	kt->sha256_compress(h, tail, pm_len >> 6);
+}
+
+void ctb_sha256(const unsigned char *message, size_t len, unsigned char *digest)
+{
+	uint32 h[8];
+	int i;
 
-	ctb_sha256_init(&ctx);
-	ctb_sha256_update(&ctx, message, len);
-	ctb_sha256_final(&ctx, digest);
+	_ctb_sha256_oneshot(sha256_h0, 0, message, len, h);
+	for (i = 0; i < 8; i++)
+		UNPACK32(h[i], &digest[i << 2]);
 }
 
 void ctb_sha256_init(ctb_sha256_ctx *ctx)
@@ -1305,60 +3610,65 @@ void ctb_sha256_init(ctb_sha256_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int len)
+/* Pads in place: 0x80, zeros and the bit count go into ctx->block, with
+ * one extra compression when fewer than 9 bytes of it are free.
+ */
+static void _ctb_sha256_pad(ctb_sha256_ctx *ctx)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA256_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA256_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	uint64 len_b = (ctx->tot_len + ctx->len) << 3;
+	unsigned int n = ctx->len;
+
+	ctx->block[n++] = 0x80;
+	if (n > _CTB_SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->block + n, 0, _CTB_SHA256_BLOCK_SIZE - n);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		n = 0;
 	}
-
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA256_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
+	memset(ctx->block + n, 0, _CTB_SHA256_BLOCK_SIZE - 8 - n);
+	UNPACK32((uint32) (len_b >> 32), ctx->block + _CTB_SHA256_BLOCK_SIZE - 8);
+	UNPACK32((uint32) len_b, ctx->block + _CTB_SHA256_BLOCK_SIZE - 4);
 	_ctb_sha256_transf(ctx, ctx->block, 1);
-	_ctb_sha256_transf(ctx, shifted_message, block_nb);
+}
 
-	rem_len = new_len % _CTB_SHA256_BLOCK_SIZE;
+void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, size_t len)
+{
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA256_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA256_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
+	}
 
-	memcpy(ctx->block, &shifted_message[block_nb << 6],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA256_BLOCK_SIZE;
+	if (block_nb) {
+		_ctb_sha256_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 6;
+		message += block_nb << 6;
+		len -= block_nb << 6;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 6;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA256_BLOCK_SIZE - 9)
-		< (ctx->len % _CTB_SHA256_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 6;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	_ctb_sha256_transf(ctx, ctx->block, block_nb);
+	_ctb_sha256_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 8; i++) {
@@ -1376,18 +3686,357 @@ void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest)
 #endif /* !UNROLL_LOOPS */
 }
 
+#if _CTB_HASH_X86
+/* AVX2: eight independent SHA-256 states, one message per 32-bit lane. */
+#define _CTB_V8_ADD(a, b)		_mm256_add_epi32(a, b)
+#define _CTB_V8_XOR3(a, b, c)	_mm256_xor_si256(_mm256_xor_si256(a, b), c)
+#define _CTB_V8_ROTR(x, n)		_mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define _CTB_V8_SHA256_F1(x)	_CTB_V8_XOR3(_CTB_V8_ROTR(x,  2), _CTB_V8_ROTR(x, 13), _CTB_V8_ROTR(x, 22))
+#define _CTB_V8_SHA256_F2(x)	_CTB_V8_XOR3(_CTB_V8_ROTR(x,  6), _CTB_V8_ROTR(x, 11), _CTB_V8_ROTR(x, 25))
+#define _CTB_V8_SHA256_F3(x)	_CTB_V8_XOR3(_CTB_V8_ROTR(x,  7), _CTB_V8_ROTR(x, 18), _mm256_srli_epi32(x,  3))
+#define _CTB_V8_SHA256_F4(x)	_CTB_V8_XOR3(_CTB_V8_ROTR(x, 17), _CTB_V8_ROTR(x, 19), _mm256_srli_epi32(x, 10))
+#define _CTB_V8_CH(x, y, z)		_mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define _CTB_V8_MAJ(x, y, z)	_mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+#define _CTB_SHA256_V8_EXP(a, b, c, d, e, f, g, h, j)                        \
+{                                                                             \
+	t1 = _CTB_V8_ADD(_CTB_V8_ADD(h, _CTB_V8_SHA256_F2(e)),                    \
+		 _CTB_V8_ADD(_CTB_V8_CH(e, f, g),                                     \
+		 _CTB_V8_ADD(_mm256_set1_epi32((int) sha256_k[j]), w[(j) & 15])));    \
+	t2 = _CTB_V8_ADD(_CTB_V8_SHA256_F1(a), _CTB_V8_MAJ(a, b, c));             \
+	d = _CTB_V8_ADD(d, t1);                                                   \
+	h = _CTB_V8_ADD(t1, t2);                                                  \
+}
+
+#define _CTB_SHA256_V8_SCR(j)                                                 \
+{                                                                             \
+	w[(j) & 15] = _CTB_V8_ADD(_CTB_V8_ADD(_CTB_V8_SHA256_F4(w[((j) - 2) & 15]), \
+		w[((j) - 7) & 15]), _CTB_V8_ADD(_CTB_V8_SHA256_F3(w[((j) - 15) & 15]), \
+		w[(j) & 15]));                                                        \
+}
+
+#define _CTB_SHA256_V8_SCHED(j)                                               \
+{                                                                             \
+	_CTB_SHA256_V8_SCR((j) + 0); _CTB_SHA256_V8_SCR((j) + 1);                 \
+	_CTB_SHA256_V8_SCR((j) + 2); _CTB_SHA256_V8_SCR((j) + 3);                 \
+	_CTB_SHA256_V8_SCR((j) + 4); _CTB_SHA256_V8_SCR((j) + 5);                 \
+	_CTB_SHA256_V8_SCR((j) + 6); _CTB_SHA256_V8_SCR((j) + 7);                 \
+}
+
+#define _CTB_SHA256_V8_EIGHT(j)                                               \
+{                                                                             \
+	_CTB_SHA256_V8_EXP(a, b, c, d, e, f, g, h, (j) + 0);                      \
+	_CTB_SHA256_V8_EXP(h, a, b, c, d, e, f, g, (j) + 1);                      \
+	_CTB_SHA256_V8_EXP(g, h, a, b, c, d, e, f, (j) + 2);                      \
+	_CTB_SHA256_V8_EXP(f, g, h, a, b, c, d, e, (j) + 3);                      \
+	_CTB_SHA256_V8_EXP(e, f, g, h, a, b, c, d, (j) + 4);                      \
+	_CTB_SHA256_V8_EXP(d, e, f, g, h, a, b, c, (j) + 5);                      \
+	_CTB_SHA256_V8_EXP(c, d, e, f, g, h, a, b, (j) + 6);                      \
+	_CTB_SHA256_V8_EXP(b, c, d, e, f, g, h, a, (j) + 7);                      \
+}
+
+/* 64 rounds over eight lanes. s holds the chaining words and receives the
+ * result without feed-forward; w (16 words per lane) is clobbered.
+ */
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_sha256_x8_rounds(__m256i s[8], __m256i w[16])
+{
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+	__m256i t1, t2;
+
+	_CTB_SHA256_V8_EIGHT( 0);
+	_CTB_SHA256_V8_EIGHT( 8);
+	_CTB_SHA256_V8_SCHED( 16); _CTB_SHA256_V8_EIGHT(16);
+	_CTB_SHA256_V8_SCHED( 24); _CTB_SHA256_V8_EIGHT(24);
+	_CTB_SHA256_V8_SCHED( 32); _CTB_SHA256_V8_EIGHT(32);
+	_CTB_SHA256_V8_SCHED( 40); _CTB_SHA256_V8_EIGHT(40);
+	_CTB_SHA256_V8_SCHED( 48); _CTB_SHA256_V8_EIGHT(48);
+	_CTB_SHA256_V8_SCHED( 56); _CTB_SHA256_V8_EIGHT(56);
+
+	s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+	s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+/* Load one 64-byte block per lane as big-endian message words. */
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_sha256_x8_load(__m256i w[16], const unsigned char *const *blocks)
+{
+	const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+										  12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	int i, half;
+
+	for (half = 0; half < 2; half++) {
+		for (i = 0; i < 8; i++)
+			w[(half << 3) + i] = _mm256_loadu_si256((const __m256i *) (blocks[i] + (half << 5)));
+		_ctb_transpose8x8_epi32(&w[half << 3]);
+		for (i = 0; i < 8; i++)
+			w[(half << 3) + i] = _mm256_shuffle_epi8(w[(half << 3) + i], bswap);
+	}
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_sha256_x8_avx2(void *state, const unsigned char *const *blocks, unsigned int active)
+{
+	__m256i *st = (__m256i *) state;
+	const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) active), bit), bit);
+	__m256i s[8], w[16];
+	int i;
+
+	_ctb_sha256_x8_load(w, blocks);
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256(&st[i]);
+	_ctb_sha256_x8_rounds(s, w);
+	for (i = 0; i < 8; i++) {
+		__m256i prev = _mm256_loadu_si256(&st[i]);
+
+		_mm256_storeu_si256(&st[i], _mm256_blendv_epi8(prev, _mm256_add_epi32(prev, s[i]), mask));
+	}
+}
+
+_CTB_HASH_AVX512_DIAG_BEGIN
+
+/* AVX-512F: sixteen SHA-256 states, one message per 32-bit lane. Rotates
+ * are single vprord and the three-input boolean functions one vpternlogd;
+ * lane retirement uses a mask register instead of a blend.
+ */
+#define _CTB_V16_ADD(a, b)		_mm512_add_epi32(a, b)
+#define _CTB_V16_XOR3(a, b, c)	_mm512_ternarylogic_epi32(a, b, c, 0x96)
+#define _CTB_V16_ROTR(x, n)		_mm512_ror_epi32(x, n)
+#define _CTB_V16_SHA256_F1(x)	_CTB_V16_XOR3(_CTB_V16_ROTR(x,  2), _CTB_V16_ROTR(x, 13), _CTB_V16_ROTR(x, 22))
+#define _CTB_V16_SHA256_F2(x)	_CTB_V16_XOR3(_CTB_V16_ROTR(x,  6), _CTB_V16_ROTR(x, 11), _CTB_V16_ROTR(x, 25))
+#define _CTB_V16_SHA256_F3(x)	_CTB_V16_XOR3(_CTB_V16_ROTR(x,  7), _CTB_V16_ROTR(x, 18), _mm512_srli_epi32(x,  3))
+#define _CTB_V16_SHA256_F4(x)	_CTB_V16_XOR3(_CTB_V16_ROTR(x, 17), _CTB_V16_ROTR(x, 19), _mm512_srli_epi32(x, 10))
+#define _CTB_V16_CH(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xCA)
+#define _CTB_V16_MAJ(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xE8)
+
+#define _CTB_SHA256_V16_EXP(a, b, c, d, e, f, g, h, j)                       \
+{                                                                             \
+	t1 = _CTB_V16_ADD(_CTB_V16_ADD(h, _CTB_V16_SHA256_F2(e)),                 \
+		 _CTB_V16_ADD(_CTB_V16_CH(e, f, g),                                   \
+		 _CTB_V16_ADD(_mm512_set1_epi32((int) sha256_k[j]), w[(j) & 15])));   \
+	t2 = _CTB_V16_ADD(_CTB_V16_SHA256_F1(a), _CTB_V16_MAJ(a, b, c));          \
+	d = _CTB_V16_ADD(d, t1);                                                  \
+	h = _CTB_V16_ADD(t1, t2);                                                 \
+}
+
+#define _CTB_SHA256_V16_SCR(j)                                                \
+{                                                                             \
+	w[(j) & 15] = _CTB_V16_ADD(_CTB_V16_ADD(_CTB_V16_SHA256_F4(w[((j) - 2) & 15]), \
+		w[((j) - 7) & 15]), _CTB_V16_ADD(_CTB_V16_SHA256_F3(w[((j) - 15) & 15]), \
+		w[(j) & 15]));                                                        \
+}
+
+#define _CTB_SHA256_V16_SCHED(j)                                              \
+{                                                                             \
+	_CTB_SHA256_V16_SCR((j) + 0); _CTB_SHA256_V16_SCR((j) + 1);               \
+	_CTB_SHA256_V16_SCR((j) + 2); _CTB_SHA256_V16_SCR((j) + 3);               \
+	_CTB_SHA256_V16_SCR((j) + 4); _CTB_SHA256_V16_SCR((j) + 5);               \
+	_CTB_SHA256_V16_SCR((j) + 6); _CTB_SHA256_V16_SCR((j) + 7);               \
+}
+
+#define _CTB_SHA256_V16_EIGHT(j)                                              \
+{                                                                             \
+	_CTB_SHA256_V16_EXP(a, b, c, d, e, f, g, h, (j) + 0);                     \
+	_CTB_SHA256_V16_EXP(h, a, b, c, d, e, f, g, (j) + 1);                     \
+	_CTB_SHA256_V16_EXP(g, h, a, b, c, d, e, f, (j) + 2);                     \
+	_CTB_SHA256_V16_EXP(f, g, h, a, b, c, d, e, (j) + 3);                     \
+	_CTB_SHA256_V16_EXP(e, f, g, h, a, b, c, d, (j) + 4);                     \
+	_CTB_SHA256_V16_EXP(d, e, f, g, h, a, b, c, (j) + 5);                     \
+	_CTB_SHA256_V16_EXP(c, d, e, f, g, h, a, b, (j) + 6);                     \
+	_CTB_SHA256_V16_EXP(b, c, d, e, f, g, h, a, (j) + 7);                     \
+}
+
+_CTB_HASH_TARGET("avx512f")
+static inline void _ctb_sha256_x16_rounds(__m512i s[8], __m512i w[16])
+{
+	__m512i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m512i e = s[4], f = s[5], g = s[6], h = s[7];
+	__m512i t1, t2;
+
+	_CTB_SHA256_V16_EIGHT( 0);
+	_CTB_SHA256_V16_EIGHT( 8);
+	_CTB_SHA256_V16_SCHED( 16); _CTB_SHA256_V16_EIGHT(16);
+	_CTB_SHA256_V16_SCHED( 24); _CTB_SHA256_V16_EIGHT(24);
+	_CTB_SHA256_V16_SCHED( 32); _CTB_SHA256_V16_EIGHT(32);
+	_CTB_SHA256_V16_SCHED( 40); _CTB_SHA256_V16_EIGHT(40);
+	_CTB_SHA256_V16_SCHED( 48); _CTB_SHA256_V16_EIGHT(48);
+	_CTB_SHA256_V16_SCHED( 56); _CTB_SHA256_V16_EIGHT(56);
+
+	s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+	s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+/* Transpose 16 rows of sixteen 32-bit words: r[lane] -> r[word]. */
+_CTB_HASH_TARGET("avx512f")
+static inline void _ctb_transpose16x16_epi32(__m512i r[16])
+{
+	__m512i t[16], u[16];
+	int i, c;
+
+	for (i = 0; i < 16; i += 4) {
+		t[i + 0] = _mm512_unpacklo_epi32(r[i + 0], r[i + 1]);
+		t[i + 1] = _mm512_unpackhi_epi32(r[i + 0], r[i + 1]);
+		t[i + 2] = _mm512_unpacklo_epi32(r[i + 2], r[i + 3]);
+		t[i + 3] = _mm512_unpackhi_epi32(r[i + 2], r[i + 3]);
+		u[i + 0] = _mm512_unpacklo_epi64(t[i + 0], t[i + 2]);
+		u[i + 1] = _mm512_unpackhi_epi64(t[i + 0], t[i + 2]);
+		u[i + 2] = _mm512_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm512_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	/* u[4g + c] holds column 4k + c of rows 4g..4g+3 in 128-bit lane k */
+	for (c = 0; c < 4; c++) {
+		__m512i x0 = _mm512_shuffle_i32x4(u[c], u[4 + c], 0x88);
+		__m512i x1 = _mm512_shuffle_i32x4(u[c], u[4 + c], 0xDD);
+		__m512i y0 = _mm512_shuffle_i32x4(u[8 + c], u[12 + c], 0x88);
+		__m512i y1 = _mm512_shuffle_i32x4(u[8 + c], u[12 + c], 0xDD);
+
+		r[ 0 + c] = _mm512_shuffle_i32x4(x0, y0, 0x88);
+		r[ 4 + c] = _mm512_shuffle_i32x4(x1, y1, 0x88);
+		r[ 8 + c] = _mm512_shuffle_i32x4(x0, y0, 0xDD);
+		r[12 + c] = _mm512_shuffle_i32x4(x1, y1, 0xDD);
+	}
+}
+
+/* Load one 64-byte block per lane as big-endian message words. The byte
+ * swap is done with two rotates and a bit-select so only AVX-512F is
+ * needed (vpshufb on zmm would require AVX-512BW).
+ */
+_CTB_HASH_TARGET("avx512f")
+static inline void _ctb_sha256_x16_load(__m512i w[16], const unsigned char *const *blocks)
+{
+	const __m512i sel = _mm512_set1_epi32(0x00FF00FF);
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = _mm512_loadu_si512((const void *) blocks[i]);
+	_ctb_transpose16x16_epi32(w);
+	for (i = 0; i < 16; i++)
+		w[i] = _mm512_ternarylogic_epi32(sel, _mm512_rol_epi32(w[i], 8), _mm512_ror_epi32(w[i], 8), 0xCA);
+}
+
+_CTB_HASH_TARGET("avx512f")
+static void _ctb_sha256_x16_avx512(void *state, const unsigned char *const *blocks, unsigned int active)
+{
+	__m512i *st = (__m512i *) state;
+	__mmask16 mask = (__mmask16) active;
+	__m512i s[8], w[16];
+	int i;
+
+	_ctb_sha256_x16_load(w, blocks);
+	for (i = 0; i < 8; i++)
+		s[i] = _mm512_loadu_si512((const void *) &st[i]);
+	_ctb_sha256_x16_rounds(s, w);
+	for (i = 0; i < 8; i++) {
+		__m512i prev = _mm512_loadu_si512((const void *) &st[i]);
+
+		_mm512_storeu_si512((void *) &st[i], _mm512_mask_add_epi32(prev, mask, prev, s[i]));
+	}
+}
+
+_CTB_HASH_AVX512_DIAG_END
+#endif /* _CTB_HASH_X86 */
+
+/* SHA-256 multi-buffer functions */
+
+static void _ctb_sha256_compress_words(void *h, const unsigned char *message, size_t block_nb)
+{
+	_ctb_hash_kernels()->sha256_compress((uint32 *) h, message, block_nb);
+}
+
+static void _ctb_sha256_mb_job(const uint32 iv[8], uint64_t prefix_len,
+							   const unsigned char *const *message, const size_t *len, size_t count,
+							   void (*done)(const void *h, size_t index, void *user), void *user)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	_ctb_mb_job job;
+	size_t i;
+
+	if (!kt->sha256_mb) {
+		for (i = 0; i < count; i++) {
+			uint32 h[8];
+
+			_ctb_sha256_oneshot(iv, prefix_len, message[i], len[i], h);
+			done(h, i, user);
+		}
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.kernel = kt->sha256_mb;
+	job.lanes = kt->sha256_mb_lanes;
+	job.block_size = _CTB_SHA256_BLOCK_SIZE;
+	job.word_size = 4;
+	job.state_words = 8;
+	job.len_size = 8;
+	job.big_endian = 1;
+	job.iv = iv;
+	job.prefix_len = prefix_len;
+	job.single = _ctb_sha256_compress_words;
+	job.drain_below = 2;
+	job.done = done;
+	job.user = user;
+
+	_ctb_mb_run(&job, message, len, count);
+}
+
+static void _ctb_sha256_mb(const uint32 iv[8], uint64_t prefix_len, unsigned int digest_len,
+						   const unsigned char *const *message, const size_t *len,
+						   unsigned char *digest, size_t count)
+{
+	_ctb_mb_digest_out out;
+
+	out.out = digest;
+	out.stride = digest_len;
+	out.digest_len = digest_len;
+	out.word_size = 4;
+	out.big_endian = 1;
+	_ctb_sha256_mb_job(iv, prefix_len, message, len, count, _ctb_mb_store_digest, &out);
+}
+
+void ctb_sha256_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA256_DIGEST_SIZE], size_t count)
+{
+	_ctb_sha256_mb(sha256_h0, 0, _CTB_SHA256_DIGEST_SIZE, message, len, (unsigned char *) digest, count);
+}
+
+void ctb_sha256_x8(const unsigned char *const message[8], const size_t len[8],
+				   unsigned char digest[8][_CTB_SHA256_DIGEST_SIZE])
+{
+	ctb_sha256_many(message, len, digest, 8);
+}
+
+void ctb_sha256_x16(const unsigned char *const message[16], const size_t len[16],
+					unsigned char digest[16][_CTB_SHA256_DIGEST_SIZE])
+{
+	ctb_sha256_many(message, len, digest, 16);
+}
+
+void ctb_sha224_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA224_DIGEST_SIZE], size_t count)
+{
+	_ctb_sha256_mb(sha224_h0, 0, _CTB_SHA224_DIGEST_SIZE, message, len, (unsigned char *) digest, count);
+}
+
+void ctb_sha224_x16(const unsigned char *const message[16], const size_t len[16],
+					unsigned char digest[16][_CTB_SHA224_DIGEST_SIZE])
+{
+	ctb_sha224_many(message, len, digest, 16);
+}
+
 /* SHA-512 functions */
 
-void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int block_nb)
+static void _ctb_sha512_compress_scalar(uint64 h[8], const unsigned char *message, size_t block_nb)
 {
 	uint64 w[80];
 	uint64 wv[8];
 	uint64 t1, t2;
 	const unsigned char *sub_block;
-	int i, j;
+	int j;
 
-	for (i = 0; i < (int) block_nb; i++) {
-		sub_block = message + (i << 7);
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA512_BLOCK_SIZE) {
+		sub_block = message;
 
 #ifndef UNROLL_LOOPS
 		for (j = 0; j < 16; j++) {
@@ -1399,7 +4048,7 @@ void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsign
 		}
 
 		for (j = 0; j < 8; j++) {
-			wv[j] = ctx->h[j];
+			wv[j] = h[j];
 		}
 
 		for (j = 0; j < 80; j++) {
@@ -1417,7 +4066,7 @@ void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsign
 		}
 
 		for (j = 0; j < 8; j++) {
-			ctx->h[j] += wv[j];
+			h[j] += wv[j];
 		}
 #else
 		PACK64(&sub_block[  0], &w[ 0]); PACK64(&sub_block[  8], &w[ 1]);
@@ -1446,10 +4095,10 @@ void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsign
 		SHA512_SCR(72); SHA512_SCR(73); SHA512_SCR(74); SHA512_SCR(75);
 		SHA512_SCR(76); SHA512_SCR(77); SHA512_SCR(78); SHA512_SCR(79);
 
-		wv[0] = ctx->h[0]; wv[1] = ctx->h[1];
-		wv[2] = ctx->h[2]; wv[3] = ctx->h[3];
-		wv[4] = ctx->h[4]; wv[5] = ctx->h[5];
-		wv[6] = ctx->h[6]; wv[7] = ctx->h[7];
+		wv[0] = h[0]; wv[1] = h[1];
+		wv[2] = h[2]; wv[3] = h[3];
+		wv[4] = h[4]; wv[5] = h[5];
+		wv[6] = h[6]; wv[7] = h[7];
 
 		j = 0;
 
@@ -1464,15 +4113,93 @@ void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsign
 			SHA512_EXP(1,2,3,4,5,6,7,0,j); j++;
 		} while (j < 80);
 
-		ctx->h[0] += wv[0]; ctx->h[1] += wv[1];
-		ctx->h[2] += wv[2]; ctx->h[3] += wv[3];
-		ctx->h[4] += wv[4]; ctx->h[5] += wv[5];
-		ctx->h[6] += wv[6]; ctx->h[7] += wv[7];
+		h[0] += wv[0]; h[1] += wv[1];
+		h[2] += wv[2]; h[3] += wv[3];
+		h[4] += wv[4]; h[5] += wv[5];
+		h[6] += wv[6]; h[7] += wv[7];
 #endif /* !UNROLL_LOOPS */
 	}
 }
 
-void ctb_sha512(const unsigned char *message, unsigned int len, unsigned char *digest)
+#if _CTB_HASH_X86
+/* AVX2: the message schedule is expanded four words per ymm register and
+ * stored pre-added to the round constants; the rounds stay scalar (rorx
+ * with BMI2). Within a group of four, W[t+2..t+3] depend on W[t..t+1], so
+ * sigma1 is applied to the low half first and then to the fresh words.
+ */
+#define _CTB_V4Q_ROTR(x, n)		_mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#define _CTB_V4Q_XOR3(a, b, c)	_mm256_xor_si256(_mm256_xor_si256(a, b), c)
+#define _CTB_V4Q_SHA512_F3(x)	_CTB_V4Q_XOR3(_CTB_V4Q_ROTR(x,  1), _CTB_V4Q_ROTR(x,  8), _mm256_srli_epi64(x,  7))
+#define _CTB_V4Q_SHA512_F4(x)	_CTB_V4Q_XOR3(_CTB_V4Q_ROTR(x, 19), _CTB_V4Q_ROTR(x, 61), _mm256_srli_epi64(x,  6))
+
+#define _CTB_SHA512_WK_EXP(a, b, c, d, e, f, g, h, j)                        \
+{                                                                             \
+	t1 = wv[h] + SHA512_F2(wv[e]) + CH(wv[e], wv[f], wv[g]) + wk[j];          \
+	t2 = SHA512_F1(wv[a]) + MAJ(wv[a], wv[b], wv[c]);                         \
+	wv[d] += t1;                                                              \
+	wv[h] = t1 + t2;                                                          \
+}
+
+_CTB_HASH_TARGET("avx2,bmi2")
+static void _ctb_sha512_compress_avx2(uint64 h[8], const unsigned char *message, size_t block_nb)
+{
+	const __m256i bswap = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+										  8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	uint64 wk[80];
+	uint64 wv[8];
+	uint64 t1, t2;
+	__m256i x[4];
+	int i, j;
+
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA512_BLOCK_SIZE) {
+		for (i = 0; i < 4; i++) {
+			x[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (message + (i << 5))), bswap);
+			_mm256_storeu_si256((__m256i *) &wk[i << 2],
+				_mm256_add_epi64(x[i], _mm256_loadu_si256((const __m256i *) &sha512_k[i << 2])));
+		}
+
+		for (j = 16; j < 80; j += 4) {
+			/* x[0..3] hold W[j-16..j-1] */
+			__m256i w15 = _mm256_permute4x64_epi64(_mm256_blend_epi32(x[0], x[1], 0x03), 0x39);
+			__m256i w7  = _mm256_permute4x64_epi64(_mm256_blend_epi32(x[2], x[3], 0x03), 0x39);
+			__m256i t   = _mm256_add_epi64(_mm256_add_epi64(x[0], w7), _CTB_V4Q_SHA512_F3(w15));
+			__m256i lo  = _mm256_add_epi64(t, _CTB_V4Q_SHA512_F4(_mm256_permute4x64_epi64(x[3], 0x0E)));
+			__m256i hi  = _mm256_add_epi64(t, _CTB_V4Q_SHA512_F4(_mm256_permute4x64_epi64(lo, 0x40)));
+			__m256i nw  = _mm256_blend_epi32(lo, hi, 0xF0);
+
+			x[0] = x[1]; x[1] = x[2]; x[2] = x[3]; x[3] = nw;
+			_mm256_storeu_si256((__m256i *) &wk[j],
+				_mm256_add_epi64(nw, _mm256_loadu_si256((const __m256i *) &sha512_k[j])));
+		}
+
+		for (j = 0; j < 8; j++)
+			wv[j] = h[j];
+
+		for (j = 0; j < 80; j += 8) {
+			_CTB_SHA512_WK_EXP(0,1,2,3,4,5,6,7,j + 0);
+			_CTB_SHA512_WK_EXP(7,0,1,2,3,4,5,6,j + 1);
+			_CTB_SHA512_WK_EXP(6,7,0,1,2,3,4,5,j + 2);
+			_CTB_SHA512_WK_EXP(5,6,7,0,1,2,3,4,j + 3);
+			_CTB_SHA512_WK_EXP(4,5,6,7,0,1,2,3,j + 4);
+			_CTB_SHA512_WK_EXP(3,4,5,6,7,0,1,2,j + 5);
+			_CTB_SHA512_WK_EXP(2,3,4,5,6,7,0,1,j + 6);
+			_CTB_SHA512_WK_EXP(1,2,3,4,5,6,7,0,j + 7);
+		}
+
+		for (j = 0; j < 8; j++)
+			h[j] += wv[j];
+	}
+}
+
+#undef _CTB_SHA512_WK_EXP
+#endif /* _CTB_HASH_X86 */
+
+void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, size_t block_nb)
+{
+	_ctb_hash_kernels()->sha512_compress(ctx->h, message, block_nb);
+}
+
+void ctb_sha512(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha512_ctx ctx;
 
@@ -1499,60 +4226,63 @@ void ctb_sha512_init(ctb_sha512_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int len)
+/* As _ctb_sha256_pad, with a 128-bit bit count. */
+static void _ctb_sha512_pad(ctb_sha512_ctx *ctx)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA512_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA512_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	uint64 len_b = (ctx->tot_len + ctx->len) << 3;
+	unsigned int n = ctx->len;
+
+	ctx->block[n++] = 0x80;
+	if (n > _CTB_SHA512_BLOCK_SIZE - 16) {
+		memset(ctx->block + n, 0, _CTB_SHA512_BLOCK_SIZE - n);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		n = 0;
 	}
-
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA512_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
+	memset(ctx->block + n, 0, _CTB_SHA512_BLOCK_SIZE - 16 - n);
+	UNPACK64((ctx->tot_len + ctx->len) >> 61, ctx->block + _CTB_SHA512_BLOCK_SIZE - 16);
+	UNPACK64(len_b, ctx->block + _CTB_SHA512_BLOCK_SIZE - 8);
 	ctb_sha512_transf(ctx, ctx->block, 1);
-	ctb_sha512_transf(ctx, shifted_message, block_nb);
+}
 
-	rem_len = new_len % _CTB_SHA512_BLOCK_SIZE;
+void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, size_t len)
+{
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA512_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA512_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
+	}
 
-	memcpy(ctx->block, &shifted_message[block_nb << 7],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA512_BLOCK_SIZE;
+	if (block_nb) {
+		ctb_sha512_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 7;
+		message += block_nb << 7;
+		len -= block_nb << 7;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 7;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = 1 + ((_CTB_SHA512_BLOCK_SIZE - 17)
-		< (ctx->len % _CTB_SHA512_BLOCK_SIZE));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 7;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	ctb_sha512_transf(ctx, ctx->block, block_nb);
+	_ctb_sha512_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 8; i++) {
@@ -1570,9 +4300,199 @@ void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest)
 #endif /* !UNROLL_LOOPS */
 }
 
+#if _CTB_HASH_X86
+/* AVX2: four independent SHA-512 states, one message per 64-bit lane. */
+#define _CTB_V4Q_ADD(a, b)		_mm256_add_epi64(a, b)
+#define _CTB_V4Q_SHA512_F1(x)	_CTB_V4Q_XOR3(_CTB_V4Q_ROTR(x, 28), _CTB_V4Q_ROTR(x, 34), _CTB_V4Q_ROTR(x, 39))
+#define _CTB_V4Q_SHA512_F2(x)	_CTB_V4Q_XOR3(_CTB_V4Q_ROTR(x, 14), _CTB_V4Q_ROTR(x, 18), _CTB_V4Q_ROTR(x, 41))
+#define _CTB_V4Q_CH(x, y, z)	_mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define _CTB_V4Q_MAJ(x, y, z)	_mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+#define _CTB_SHA512_V4_EXP(a, b, c, d, e, f, g, h, j)                        \
+{                                                                             \
+	t1 = _CTB_V4Q_ADD(_CTB_V4Q_ADD(h, _CTB_V4Q_SHA512_F2(e)),                 \
+		 _CTB_V4Q_ADD(_CTB_V4Q_CH(e, f, g),                                   \
+		 _CTB_V4Q_ADD(_mm256_set1_epi64x((long long) sha512_k[j]), w[(j) & 15]))); \
+	t2 = _CTB_V4Q_ADD(_CTB_V4Q_SHA512_F1(a), _CTB_V4Q_MAJ(a, b, c));          \
+	d = _CTB_V4Q_ADD(d, t1);                                                  \
+	h = _CTB_V4Q_ADD(t1, t2);                                                 \
+}
+
+#define _CTB_SHA512_V4_SCR(j)                                                 \
+{                                                                             \
+	w[(j) & 15] = _CTB_V4Q_ADD(_CTB_V4Q_ADD(_CTB_V4Q_SHA512_F4(w[((j) - 2) & 15]), \
+		w[((j) - 7) & 15]), _CTB_V4Q_ADD(_CTB_V4Q_SHA512_F3(w[((j) - 15) & 15]), \
+		w[(j) & 15]));                                                        \
+}
+
+#define _CTB_SHA512_V4_SCHED(j)                                               \
+{                                                                             \
+	_CTB_SHA512_V4_SCR((j) + 0); _CTB_SHA512_V4_SCR((j) + 1);                 \
+	_CTB_SHA512_V4_SCR((j) + 2); _CTB_SHA512_V4_SCR((j) + 3);                 \
+	_CTB_SHA512_V4_SCR((j) + 4); _CTB_SHA512_V4_SCR((j) + 5);                 \
+	_CTB_SHA512_V4_SCR((j) + 6); _CTB_SHA512_V4_SCR((j) + 7);                 \
+}
+
+#define _CTB_SHA512_V4_EIGHT(j)                                               \
+{                                                                             \
+	_CTB_SHA512_V4_EXP(a, b, c, d, e, f, g, h, (j) + 0);                      \
+	_CTB_SHA512_V4_EXP(h, a, b, c, d, e, f, g, (j) + 1);                      \
+	_CTB_SHA512_V4_EXP(g, h, a, b, c, d, e, f, (j) + 2);                      \
+	_CTB_SHA512_V4_EXP(f, g, h, a, b, c, d, e, (j) + 3);                      \
+	_CTB_SHA512_V4_EXP(e, f, g, h, a, b, c, d, (j) + 4);                      \
+	_CTB_SHA512_V4_EXP(d, e, f, g, h, a, b, c, (j) + 5);                      \
+	_CTB_SHA512_V4_EXP(c, d, e, f, g, h, a, b, (j) + 6);                      \
+	_CTB_SHA512_V4_EXP(b, c, d, e, f, g, h, a, (j) + 7);                      \
+}
+
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_sha512_x4_rounds(__m256i s[8], __m256i w[16])
+{
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+	__m256i t1, t2;
+
+	_CTB_SHA512_V4_EIGHT( 0);
+	_CTB_SHA512_V4_EIGHT( 8);
+	_CTB_SHA512_V4_SCHED( 16); _CTB_SHA512_V4_EIGHT(16);
+	_CTB_SHA512_V4_SCHED( 24); _CTB_SHA512_V4_EIGHT(24);
+	_CTB_SHA512_V4_SCHED( 32); _CTB_SHA512_V4_EIGHT(32);
+	_CTB_SHA512_V4_SCHED( 40); _CTB_SHA512_V4_EIGHT(40);
+	_CTB_SHA512_V4_SCHED( 48); _CTB_SHA512_V4_EIGHT(48);
+	_CTB_SHA512_V4_SCHED( 56); _CTB_SHA512_V4_EIGHT(56);
+	_CTB_SHA512_V4_SCHED( 64); _CTB_SHA512_V4_EIGHT(64);
+	_CTB_SHA512_V4_SCHED( 72); _CTB_SHA512_V4_EIGHT(72);
+
+	s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+	s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+/* Load one 128-byte block per lane as big-endian 64-bit message words. */
+_CTB_HASH_TARGET("avx2")
+static inline void _ctb_sha512_x4_load(__m256i w[16], const unsigned char *const *blocks)
+{
+	const __m256i bswap = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+										  8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	int q;
+
+	for (q = 0; q < 4; q++) {
+		__m256i r0 = _mm256_loadu_si256((const __m256i *) (blocks[0] + (q << 5)));
+		__m256i r1 = _mm256_loadu_si256((const __m256i *) (blocks[1] + (q << 5)));
+		__m256i r2 = _mm256_loadu_si256((const __m256i *) (blocks[2] + (q << 5)));
+		__m256i r3 = _mm256_loadu_si256((const __m256i *) (blocks[3] + (q << 5)));
+		__m256i t0 = _mm256_unpacklo_epi64(r0, r1), t1 = _mm256_unpackhi_epi64(r0, r1);
+		__m256i t2 = _mm256_unpacklo_epi64(r2, r3), t3 = _mm256_unpackhi_epi64(r2, r3);
+
+		w[(q << 2) + 0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t0, t2, 0x20), bswap);
+		w[(q << 2) + 1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t1, t3, 0x20), bswap);
+		w[(q << 2) + 2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t0, t2, 0x31), bswap);
+		w[(q << 2) + 3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t1, t3, 0x31), bswap);
+	}
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_sha512_x4_avx2(void *state, const unsigned char *const *blocks, unsigned int active)
+{
+	__m256i *st = (__m256i *) state;
+	const __m256i bit = _mm256_setr_epi64x(1, 2, 4, 8);
+	__m256i mask = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x((long long) active), bit), bit);
+	__m256i s[8], w[16];
+	int i;
+
+	_ctb_sha512_x4_load(w, blocks);
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256(&st[i]);
+	_ctb_sha512_x4_rounds(s, w);
+	for (i = 0; i < 8; i++) {
+		__m256i prev = _mm256_loadu_si256(&st[i]);
+
+		_mm256_storeu_si256(&st[i], _mm256_blendv_epi8(prev, _mm256_add_epi64(prev, s[i]), mask));
+	}
+}
+#endif /* _CTB_HASH_X86 */
+
+/* SHA-512 multi-buffer functions */
+
+static void _ctb_sha512_compress_words(void *h, const unsigned char *message, size_t block_nb)
+{
+	_ctb_hash_kernels()->sha512_compress((uint64 *) h, message, block_nb);
+}
+
+static void _ctb_sha512_mb(const uint64 iv[8], uint64_t prefix_len, unsigned int digest_len,
+						   const unsigned char *const *message, const size_t *len,
+						   unsigned char *digest, size_t count)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	_ctb_mb_digest_out out;
+	_ctb_mb_job job;
+	size_t i;
+
+	if (!kt->sha512_mb) {
+		for (i = 0; i < count; i++) {
+			ctb_sha512_ctx ctx;
+			unsigned char d[_CTB_SHA512_DIGEST_SIZE];
+
+			memcpy(ctx.h, iv, sizeof(ctx.h));
+			ctx.len = 0;
+			ctx.tot_len = prefix_len;
+			ctb_sha512_update(&ctx, message[i], len[i]);
+			ctb_sha512_final(&ctx, d);
+			memcpy(digest + i * digest_len, d, digest_len);
+		}
+		return;
+	}
+
+	out.out = digest;
+	out.stride = digest_len;
+	out.digest_len = digest_len;
+	out.word_size = 8;
+	out.big_endian = 1;
+
+	memset(&job, 0, sizeof(job));
+	job.kernel = kt->sha512_mb;
+	job.lanes = kt->sha512_mb_lanes;
+	job.block_size = _CTB_SHA512_BLOCK_SIZE;
+	job.word_size = 8;
+	job.state_words = 8;
+	job.len_size = 16;
+	job.big_endian = 1;
+	job.iv = iv;
+	job.prefix_len = prefix_len;
+	job.single = _ctb_sha512_compress_words;
+	job.drain_below = 2;
+	job.done = _ctb_mb_store_digest;
+	job.user = &out;
+
+	_ctb_mb_run(&job, message, len, count);
+}
+
+void ctb_sha512_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA512_DIGEST_SIZE], size_t count)
+{
+	_ctb_sha512_mb(sha512_h0, 0, _CTB_SHA512_DIGEST_SIZE, message, len, (unsigned char *) digest, count);
+}
+
+void ctb_sha512_x4(const unsigned char *const message[4], const size_t len[4],
+				   unsigned char digest[4][_CTB_SHA512_DIGEST_SIZE])
+{
+	ctb_sha512_many(message, len, digest, 4);
+}
+
+void ctb_sha384_many(const unsigned char *const *message, const size_t *len,
+					 unsigned char (*digest)[_CTB_SHA384_DIGEST_SIZE], size_t count)
+{
+	_ctb_sha512_mb(sha384_h0, 0, _CTB_SHA384_DIGEST_SIZE, message, len, (unsigned char *) digest, count);
+}
+
+void ctb_sha384_x4(const unsigned char *const message[4], const size_t len[4],
+				   unsigned char digest[4][_CTB_SHA384_DIGEST_SIZE])
+{
+	ctb_sha384_many(message, len, digest, 4);
+}
+
 /* SHA-384 functions */
 
-void ctb_sha384(const unsigned char *message, unsigned int len, unsigned char *digest)
+void ctb_sha384(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha384_ctx ctx;
 
@@ -1599,60 +4519,45 @@ void ctb_sha384_init(ctb_sha384_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, unsigned int len)
+void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, size_t len)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA384_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA384_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA384_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA384_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
 	}
 
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA384_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
-	ctb_sha512_transf(ctx, ctx->block, 1);
-	ctb_sha512_transf(ctx, shifted_message, block_nb);
-
-	rem_len = new_len % _CTB_SHA384_BLOCK_SIZE;
-
-	memcpy(ctx->block, &shifted_message[block_nb << 7],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA384_BLOCK_SIZE;
+	if (block_nb) {
+		ctb_sha512_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 7;
+		message += block_nb << 7;
+		len -= block_nb << 7;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 7;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA384_BLOCK_SIZE - 17)
-		< (ctx->len % _CTB_SHA384_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 7;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	ctb_sha512_transf(ctx, ctx->block, block_nb);
+	_ctb_sha512_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 6; i++) {
@@ -1670,7 +4575,7 @@ void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest)
 
 /* SHA-224 functions */
 
-void ctb_sha224(const unsigned char *message, unsigned int len, unsigned char *digest)
+void ctb_sha224(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha224_ctx ctx;
 
@@ -1697,60 +4602,45 @@ void ctb_sha224_init(ctb_sha224_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, unsigned int len)
+void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, size_t len)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA224_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA224_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA224_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA224_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
 	}
 
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA224_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
-	_ctb_sha256_transf(ctx, ctx->block, 1);
-	_ctb_sha256_transf(ctx, shifted_message, block_nb);
-
-	rem_len = new_len % _CTB_SHA224_BLOCK_SIZE;
-
-	memcpy(ctx->block, &shifted_message[block_nb << 6],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA224_BLOCK_SIZE;
+	if (block_nb) {
+		_ctb_sha256_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 6;
+		message += block_nb << 6;
+		len -= block_nb << 6;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 6;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA224_BLOCK_SIZE - 9)
-		< (ctx->len % _CTB_SHA224_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 6;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	_ctb_sha256_transf(ctx, ctx->block, block_nb);
+	_ctb_sha256_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 7; i++) {
@@ -1767,6 +4657,60 @@ void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest)
 #endif /* !UNROLL_LOOPS */
 }
 
+int ctb_sha256_export(const ctb_sha256_ctx *ctx, unsigned char out[CTB_SHA256_MIDSTATE_SIZE])
+{
+	int i;
+
+	if (ctx->len != 0)
+		return -1;
+	for (i = 0; i < 8; i++)
+		UNPACK32(ctx->h[i], &out[i << 2]);
+	UNPACK64(ctx->tot_len, &out[32]);
+	return 0;
+}
+
+int ctb_sha256_import(ctb_sha256_ctx *ctx, const unsigned char in[CTB_SHA256_MIDSTATE_SIZE])
+{
+	uint64 tot_len;
+	int i;
+
+	PACK64(&in[32], &tot_len);
+	if (tot_len % _CTB_SHA256_BLOCK_SIZE)
+		return -1;
+	for (i = 0; i < 8; i++)
+		PACK32(&in[i << 2], &ctx->h[i]);
+	ctx->tot_len = tot_len;
+	ctx->len = 0;
+	return 0;
+}
+
+int ctb_sha512_export(const ctb_sha512_ctx *ctx, unsigned char out[CTB_SHA512_MIDSTATE_SIZE])
+{
+	int i;
+
+	if (ctx->len != 0)
+		return -1;
+	for (i = 0; i < 8; i++)
+		UNPACK64(ctx->h[i], &out[i << 3]);
+	UNPACK64(ctx->tot_len, &out[64]);
+	return 0;
+}
+
+int ctb_sha512_import(ctb_sha512_ctx *ctx, const unsigned char in[CTB_SHA512_MIDSTATE_SIZE])
+{
+	uint64 tot_len;
+	int i;
+
+	PACK64(&in[64], &tot_len);
+	if (tot_len % _CTB_SHA512_BLOCK_SIZE)
+		return -1;
+	for (i = 0; i < 8; i++)
+		PACK64(&in[i << 3], &ctx->h[i]);
+	ctx->tot_len = tot_len;
+	ctx->len = 0;
+	return 0;
+}
+
 #undef ROTR
 #undef ROTL
 #undef CH
@@ -1774,290 +4718,1170 @@ void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest)
 #undef SHFR
 
 /* =========================================================================
-   HMAC IMPLEMENTATION
+   BLAKE2 IMPLEMENTATION
    ========================================================================= */
 
-void ctb_hmac_sha224_init(ctb_hmac_sha224_ctx *ctx, const unsigned char *key,
-						  unsigned int key_size)
+/* RFC 7693. The IVs are the SHA-512 and SHA-256 initial hash values. */
+static const uint64_t _ctb_blake2b_iv[8] = _CTB_SHA512_H0;
+static const uint32_t _ctb_blake2s_iv[8] = _CTB_SHA256_H0;
+
+/* Message schedule; BLAKE2b's rounds 10 and 11 reuse rows 0 and 1. */
+static const unsigned char _ctb_blake2_sigma[12][16] =
 {
-	unsigned int fill;
-	unsigned int num;
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+static inline uint32_t _ctb_blake2_load32(const unsigned char *p)
+{
+#if defined(_CTB_HASH_LITTLE_ENDIAN) && _CTB_HASH_LITTLE_ENDIAN
+	uint32_t v;
 
-	const unsigned char *key_used;
-	unsigned char key_temp[_CTB_SHA224_DIGEST_SIZE];
-	int i;
+	memcpy(&v, p, 4);
+	return v;
+#else
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+#endif
+}
 
-	if (key_size == _CTB_SHA224_BLOCK_SIZE) {
-		key_used = key;
-		num = _CTB_SHA224_BLOCK_SIZE;
-	} else {
-		if (key_size > _CTB_SHA224_BLOCK_SIZE){
-			num = _CTB_SHA224_DIGEST_SIZE;
-			ctb_sha224(key, key_size, key_temp);
-			key_used = key_temp;
-		} else { /* key_size > _CTB_SHA224_BLOCK_SIZE */
-			key_used = key;
-			num = key_size;
-		}
-		fill = _CTB_SHA224_BLOCK_SIZE - num;
+static inline uint64_t _ctb_blake2_load64(const unsigned char *p)
+{
+#if defined(_CTB_HASH_LITTLE_ENDIAN) && _CTB_HASH_LITTLE_ENDIAN
+	uint64_t v;
 
-		memset(ctx->block_ipad + num, 0x36, fill);
-		memset(ctx->block_opad + num, 0x5c, fill);
+	memcpy(&v, p, 8);
+	return v;
+#else
+	return (uint64_t) _ctb_blake2_load32(p) | (uint64_t) _ctb_blake2_load32(p + 4) << 32;
+#endif
+}
+
+#define _CTB_BLAKE2_ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define _CTB_BLAKE2_ROTR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+#define _CTB_BLAKE2B_G(a, b, c, d, x, y)                                      \
+{                                                                             \
+	v[a] = v[a] + v[b] + (x);                                                 \
+	v[d] = _CTB_BLAKE2_ROTR64(v[d] ^ v[a], 32);                               \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE2_ROTR64(v[b] ^ v[c], 24);                               \
+	v[a] = v[a] + v[b] + (y);                                                 \
+	v[d] = _CTB_BLAKE2_ROTR64(v[d] ^ v[a], 16);                               \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE2_ROTR64(v[b] ^ v[c], 63);                               \
+}
+
+#define _CTB_BLAKE2S_G(a, b, c, d, x, y)                                      \
+{                                                                             \
+	v[a] = v[a] + v[b] + (x);                                                 \
+	v[d] = _CTB_BLAKE2_ROTR32(v[d] ^ v[a], 16);                               \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE2_ROTR32(v[b] ^ v[c], 12);                               \
+	v[a] = v[a] + v[b] + (y);                                                 \
+	v[d] = _CTB_BLAKE2_ROTR32(v[d] ^ v[a], 8);                                \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE2_ROTR32(v[b] ^ v[c], 7);                                \
+}
+
+/* One block. t0/t1 is the byte count including this block, f0/f1 the
+ * last-block and last-node flags.
+ */
+static void _ctb_blake2b_compress_scalar(uint64_t h[8], const unsigned char block[128],
+										 uint64_t t0, uint64_t t1, uint64_t f0, uint64_t f1)
+{
+	uint64_t v[16], m[16];
+	int r, i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = _ctb_blake2_load64(block + 8 * i);
+	for (i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i + 8] = _ctb_blake2b_iv[i];
+	}
+	v[12] ^= t0;
+	v[13] ^= t1;
+	v[14] ^= f0;
+	v[15] ^= f1;
+
+	for (r = 0; r < 12; r++) {
+		const unsigned char *s = _ctb_blake2_sigma[r];
+
+		_CTB_BLAKE2B_G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+		_CTB_BLAKE2B_G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+		_CTB_BLAKE2B_G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+		_CTB_BLAKE2B_G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+		_CTB_BLAKE2B_G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+		_CTB_BLAKE2B_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+		_CTB_BLAKE2B_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+		_CTB_BLAKE2B_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
 	}
 
-	for (i = 0; i < (int) num; i++) {
-		ctx->block_ipad[i] = key_used[i] ^ 0x36;
-		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+	for (i = 0; i < 8; i++)
+		h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void _ctb_blake2s_compress_scalar(uint32_t h[8], const unsigned char block[64],
+										 uint32_t t0, uint32_t t1, uint32_t f0, uint32_t f1)
+{
+	uint32_t v[16], m[16];
+	int r, i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = _ctb_blake2_load32(block + 4 * i);
+	for (i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i + 8] = _ctb_blake2s_iv[i];
+	}
+	v[12] ^= t0;
+	v[13] ^= t1;
+	v[14] ^= f0;
+	v[15] ^= f1;
+
+	for (r = 0; r < 10; r++) {
+		const unsigned char *s = _ctb_blake2_sigma[r];
+
+		_CTB_BLAKE2S_G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+		_CTB_BLAKE2S_G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+		_CTB_BLAKE2S_G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+		_CTB_BLAKE2S_G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+		_CTB_BLAKE2S_G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+		_CTB_BLAKE2S_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+		_CTB_BLAKE2S_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+		_CTB_BLAKE2S_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
 	}
 
-	ctb_sha224_init(&ctx->ctx_inside);
-	ctb_sha224_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA224_BLOCK_SIZE);
+	for (i = 0; i < 8; i++)
+		h[i] ^= v[i] ^ v[i + 8];
+}
 
-	ctb_sha224_init(&ctx->ctx_outside);
-	ctb_sha224_update(&ctx->ctx_outside, ctx->block_opad,
-				   _CTB_SHA224_BLOCK_SIZE);
+#undef _CTB_BLAKE2B_G
+#undef _CTB_BLAKE2S_G
+#undef _CTB_BLAKE2_ROTR32
+#undef _CTB_BLAKE2_ROTR64
+
+#if _CTB_HASH_X86
+/* The G function is listed once over the _CTB_BV_* ops. ROTR1-4 are its
+ * four rotations: 16, 12, 8, 7 for BLAKE2s and 32, 24, 16, 63 for
+ * BLAKE2b; the byte-multiple ones are a byte shuffle.
+ * Row-wise (_RG, one block): each row of the 4x4 state is a register, so
+ * the four G calls of the column step run at once, and the diagonal step
+ * runs on rows 1-3 rotated into place. A BLAKE2s row is 4 x 32 bits
+ * (SSE4.1), a BLAKE2b row 4 x 64 bits (AVX2).
+ * Lane-wise (_VG, BLAKE2bp/sp): one leaf per lane and one register per
+ * state word, as in the BLAKE3 lane kernels.
+ */
+#define _CTB_BLAKE2_RG(x, y)                                                  \
+{                                                                             \
+	r0 = _CTB_BV_ADD(_CTB_BV_ADD(r0, r1), x);                                 \
+	r3 = _CTB_BV_ROTR1(_CTB_BV_XOR(r3, r0));                                  \
+	r2 = _CTB_BV_ADD(r2, r3);                                                 \
+	r1 = _CTB_BV_ROTR2(_CTB_BV_XOR(r1, r2));                                  \
+	r0 = _CTB_BV_ADD(_CTB_BV_ADD(r0, r1), y);                                 \
+	r3 = _CTB_BV_ROTR3(_CTB_BV_XOR(r3, r0));                                  \
+	r2 = _CTB_BV_ADD(r2, r3);                                                 \
+	r1 = _CTB_BV_ROTR4(_CTB_BV_XOR(r1, r2));                                  \
+}
 
-	/* for hmac_reinit */
-	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
-		sizeof(ctb_sha224_ctx));
-	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
-		sizeof(ctb_sha224_ctx));
+#define _CTB_BLAKE2_VG(a, b, c, d, x, y)                                      \
+{                                                                             \
+	v[a] = _CTB_BV_ADD(_CTB_BV_ADD(v[a], v[b]), m[x]);                        \
+	v[d] = _CTB_BV_ROTR1(_CTB_BV_XOR(v[d], v[a]));                            \
+	v[c] = _CTB_BV_ADD(v[c], v[d]);                                           \
+	v[b] = _CTB_BV_ROTR2(_CTB_BV_XOR(v[b], v[c]));                            \
+	v[a] = _CTB_BV_ADD(_CTB_BV_ADD(v[a], v[b]), m[y]);                        \
+	v[d] = _CTB_BV_ROTR3(_CTB_BV_XOR(v[d], v[a]));                            \
+	v[c] = _CTB_BV_ADD(v[c], v[d]);                                           \
+	v[b] = _CTB_BV_ROTR4(_CTB_BV_XOR(v[b], v[c]));                            \
 }
 
-void ctb_hmac_sha224_reinit(ctb_hmac_sha224_ctx *ctx)
+#define _CTB_BLAKE2_V_ROUND(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15) \
+	_CTB_BLAKE2_VG(0, 4,  8, 12, s0,  s1);                                    \
+	_CTB_BLAKE2_VG(1, 5,  9, 13, s2,  s3);                                    \
+	_CTB_BLAKE2_VG(2, 6, 10, 14, s4,  s5);                                    \
+	_CTB_BLAKE2_VG(3, 7, 11, 15, s6,  s7);                                    \
+	_CTB_BLAKE2_VG(0, 5, 10, 15, s8,  s9);                                    \
+	_CTB_BLAKE2_VG(1, 6, 11, 12, s10, s11);                                   \
+	_CTB_BLAKE2_VG(2, 7,  8, 13, s12, s13);                                   \
+	_CTB_BLAKE2_VG(3, 4,  9, 14, s14, s15)
+
+#define _CTB_BLAKE2_V_ROUNDS10                                                \
+	_CTB_BLAKE2_V_ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15); \
+	_CTB_BLAKE2_V_ROUND(14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3); \
+	_CTB_BLAKE2_V_ROUND(11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4); \
+	_CTB_BLAKE2_V_ROUND( 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8); \
+	_CTB_BLAKE2_V_ROUND( 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13); \
+	_CTB_BLAKE2_V_ROUND( 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9); \
+	_CTB_BLAKE2_V_ROUND(12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11); \
+	_CTB_BLAKE2_V_ROUND(13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10); \
+	_CTB_BLAKE2_V_ROUND( 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5); \
+	_CTB_BLAKE2_V_ROUND(10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0)
+
+/* SSE4.1: BLAKE2s rows */
+#define _CTB_BV_ADD(a, b)	_mm_add_epi32(a, b)
+#define _CTB_BV_XOR(a, b)	_mm_xor_si128(a, b)
+#define _CTB_BV_ROTR1(x)	_mm_shuffle_epi8(x, rot16)
+#define _CTB_BV_ROTR2(x)	_mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20))
+#define _CTB_BV_ROTR3(x)	_mm_shuffle_epi8(x, rot8)
+#define _CTB_BV_ROTR4(x)	_mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25))
+
+_CTB_HASH_TARGET("sse4.1")
+static void _ctb_blake2s_compress_sse41(uint32_t h[8], const unsigned char block[64],
+										uint32_t t0, uint32_t t1, uint32_t f0, uint32_t f1)
 {
-	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
-		sizeof(ctb_sha224_ctx));
-	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
-		sizeof(ctb_sha224_ctx));
+	const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	const __m128i h0 = _mm_loadu_si128((const __m128i *) h);
+	const __m128i h1 = _mm_loadu_si128((const __m128i *) (h + 4));
+	__m128i r0 = h0, r1 = h1, r2 = _mm_loadu_si128((const __m128i *) _ctb_blake2s_iv), r3;
+	uint32_t m[16];
+	int r, i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = _ctb_blake2_load32(block + 4 * i);
+	r3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (_ctb_blake2s_iv + 4)),
+					   _mm_setr_epi32((int) t0, (int) t1, (int) f0, (int) f1));
+
+	for (r = 0; r < 10; r++) {
+		const unsigned char *s = _ctb_blake2_sigma[r];
+
+		_CTB_BLAKE2_RG(_mm_setr_epi32((int) m[s[0]], (int) m[s[2]], (int) m[s[4]], (int) m[s[6]]),
+					   _mm_setr_epi32((int) m[s[1]], (int) m[s[3]], (int) m[s[5]], (int) m[s[7]]));
+		r1 = _mm_shuffle_epi32(r1, 0x39);
+		r2 = _mm_shuffle_epi32(r2, 0x4E);
+		r3 = _mm_shuffle_epi32(r3, 0x93);
+		_CTB_BLAKE2_RG(_mm_setr_epi32((int) m[s[8]], (int) m[s[10]], (int) m[s[12]], (int) m[s[14]]),
+					   _mm_setr_epi32((int) m[s[9]], (int) m[s[11]], (int) m[s[13]], (int) m[s[15]]));
+		r1 = _mm_shuffle_epi32(r1, 0x93);
+		r2 = _mm_shuffle_epi32(r2, 0x4E);
+		r3 = _mm_shuffle_epi32(r3, 0x39);
+	}
+
+	_mm_storeu_si128((__m128i *) h, _mm_xor_si128(h0, _mm_xor_si128(r0, r2)));
+	_mm_storeu_si128((__m128i *) (h + 4), _mm_xor_si128(h1, _mm_xor_si128(r1, r3)));
 }
 
-void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message,
-							unsigned int message_len)
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR1
+#undef _CTB_BV_ROTR2
+#undef _CTB_BV_ROTR3
+#undef _CTB_BV_ROTR4
+
+/* AVX2, 64-bit words: BLAKE2b rows and four BLAKE2bp leaves */
+#define _CTB_BV_ADD(a, b)	_mm256_add_epi64(a, b)
+#define _CTB_BV_XOR(a, b)	_mm256_xor_si256(a, b)
+#define _CTB_BV_ROTR1(x)	_mm256_shuffle_epi32(x, 0xB1)
+#define _CTB_BV_ROTR2(x)	_mm256_shuffle_epi8(x, rot24)
+#define _CTB_BV_ROTR3(x)	_mm256_shuffle_epi8(x, rot16)
+#define _CTB_BV_ROTR4(x)	_mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+
+#define _CTB_BLAKE2B_ROT_MASKS                                                \
+	const __m256i rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, \
+										   3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10); \
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, \
+										   2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9)
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_blake2b_compress_avx2(uint64_t h[8], const unsigned char block[128],
+									   uint64_t t0, uint64_t t1, uint64_t f0, uint64_t f1)
 {
-	ctb_sha224_update(&ctx->ctx_inside, message, message_len);
+	_CTB_BLAKE2B_ROT_MASKS;
+	const __m256i h0 = _mm256_loadu_si256((const __m256i *) h);
+	const __m256i h1 = _mm256_loadu_si256((const __m256i *) (h + 4));
+	__m256i r0 = h0, r1 = h1, r2 = _mm256_loadu_si256((const __m256i *) _ctb_blake2b_iv), r3;
+	uint64_t m[16];
+	int r, i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = _ctb_blake2_load64(block + 8 * i);
+	r3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (_ctb_blake2b_iv + 4)),
+						  _mm256_setr_epi64x((long long) t0, (long long) t1, (long long) f0, (long long) f1));
+
+	for (r = 0; r < 12; r++) {
+		const unsigned char *s = _ctb_blake2_sigma[r];
+
+		_CTB_BLAKE2_RG(_mm256_setr_epi64x((long long) m[s[0]], (long long) m[s[2]],
+										  (long long) m[s[4]], (long long) m[s[6]]),
+					   _mm256_setr_epi64x((long long) m[s[1]], (long long) m[s[3]],
+										  (long long) m[s[5]], (long long) m[s[7]]));
+		r1 = _mm256_permute4x64_epi64(r1, 0x39);
+		r2 = _mm256_permute4x64_epi64(r2, 0x4E);
+		r3 = _mm256_permute4x64_epi64(r3, 0x93);
+		_CTB_BLAKE2_RG(_mm256_setr_epi64x((long long) m[s[8]], (long long) m[s[10]],
+										  (long long) m[s[12]], (long long) m[s[14]]),
+					   _mm256_setr_epi64x((long long) m[s[9]], (long long) m[s[11]],
+										  (long long) m[s[13]], (long long) m[s[15]]));
+		r1 = _mm256_permute4x64_epi64(r1, 0x93);
+		r2 = _mm256_permute4x64_epi64(r2, 0x4E);
+		r3 = _mm256_permute4x64_epi64(r3, 0x39);
+	}
+
+	_mm256_storeu_si256((__m256i *) h, _mm256_xor_si256(h0, _mm256_xor_si256(r0, r2)));
+	_mm256_storeu_si256((__m256i *) (h + 4), _mm256_xor_si256(h1, _mm256_xor_si256(r1, r3)));
 }
 
-void ctb_hmac_sha224_final(ctb_hmac_sha224_ctx *ctx, unsigned char *mac,
-						   unsigned int mac_size)
+/* `rows` rows of four 128-byte blocks, block i of a row going to leaf i.
+ * Leaf states are word-major; count is the per-leaf byte count so far.
+ */
+_CTB_HASH_TARGET("avx2")
+static void _ctb_blake2bp_x4_avx2(uint64_t h[8][4], const unsigned char *in, size_t rows,
+								  uint64_t count)
 {
-	unsigned char digest_inside[_CTB_SHA224_DIGEST_SIZE];
-	unsigned char mac_temp[_CTB_SHA224_DIGEST_SIZE];
+	_CTB_BLAKE2B_ROT_MASKS;
+	__m256i s[8], v[16], m[16];
+	size_t row;
+	int i, q;
 
-	ctb_sha224_final(&ctx->ctx_inside, digest_inside);
-	ctb_sha224_update(&ctx->ctx_outside, digest_inside, _CTB_SHA224_DIGEST_SIZE);
-	ctb_sha224_final(&ctx->ctx_outside, mac_temp);
-	memcpy(mac, mac_temp, mac_size);
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *) h[i]);
+
+	for (row = 0; row < rows; row++, in += 4 * 128) {
+		count += 128;
+		for (q = 0; q < 4; q++) {
+			__m256i b0 = _mm256_loadu_si256((const __m256i *) (in + 0 * 128 + (q << 5)));
+			__m256i b1 = _mm256_loadu_si256((const __m256i *) (in + 1 * 128 + (q << 5)));
+			__m256i b2 = _mm256_loadu_si256((const __m256i *) (in + 2 * 128 + (q << 5)));
+			__m256i b3 = _mm256_loadu_si256((const __m256i *) (in + 3 * 128 + (q << 5)));
+			__m256i t0 = _mm256_unpacklo_epi64(b0, b1), t1 = _mm256_unpackhi_epi64(b0, b1);
+			__m256i t2 = _mm256_unpacklo_epi64(b2, b3), t3 = _mm256_unpackhi_epi64(b2, b3);
+
+			m[(q << 2) + 0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+			m[(q << 2) + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+			m[(q << 2) + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+			m[(q << 2) + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+		}
+		for (i = 0; i < 8; i++) {
+			v[i] = s[i];
+			v[i + 8] = _mm256_set1_epi64x((long long) _ctb_blake2b_iv[i]);
+		}
+		v[12] = _mm256_xor_si256(v[12], _mm256_set1_epi64x((long long) count));
+		_CTB_BLAKE2_V_ROUNDS10;
+		_CTB_BLAKE2_V_ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15);
+		_CTB_BLAKE2_V_ROUND(14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3);
+		for (i = 0; i < 8; i++)
+			s[i] = _mm256_xor_si256(s[i], _mm256_xor_si256(v[i], v[i + 8]));
+	}
+
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *) h[i], s[i]);
 }
 
-void ctb_hmac_sha224(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
-					 unsigned char *mac, unsigned mac_size)
+#undef _CTB_BLAKE2B_ROT_MASKS
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR1
+#undef _CTB_BV_ROTR2
+#undef _CTB_BV_ROTR3
+#undef _CTB_BV_ROTR4
+
+/* AVX2, 32-bit words: eight BLAKE2sp leaves */
+#define _CTB_BV_ADD(a, b)	_mm256_add_epi32(a, b)
+#define _CTB_BV_XOR(a, b)	_mm256_xor_si256(a, b)
+#define _CTB_BV_ROTR1(x)	_mm256_shuffle_epi8(x, rot16)
+#define _CTB_BV_ROTR2(x)	_mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20))
+#define _CTB_BV_ROTR3(x)	_mm256_shuffle_epi8(x, rot8)
+#define _CTB_BV_ROTR4(x)	_mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25))
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_blake2sp_x8_avx2(uint32_t h[8][8], const unsigned char *in, size_t rows,
+								  uint64_t count)
 {
-	ctb_hmac_sha224_ctx ctx;
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+										   2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+										  1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	__m256i s[8], v[16], m[16];
+	size_t row;
+	int i, half;
 
-	ctb_hmac_sha224_init(&ctx, key, key_size);
-	ctb_hmac_sha224_update(&ctx, message, message_len);
-	ctb_hmac_sha224_final(&ctx, mac, mac_size);
-}
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *) h[i]);
+
+	for (row = 0; row < rows; row++, in += 8 * 64) {
+		count += 64;
+		for (half = 0; half < 2; half++) {
+			for (i = 0; i < 8; i++)
+				m[(half << 3) + i] = _mm256_loadu_si256((const __m256i *) (in + (i << 6) + (half << 5)));
+			_ctb_transpose8x8_epi32(&m[half << 3]);
+		}
+		for (i = 0; i < 8; i++) {
+			v[i] = s[i];
+			v[i + 8] = _mm256_set1_epi32((int) _ctb_blake2s_iv[i]);
+		}
+		v[12] = _mm256_xor_si256(v[12], _mm256_set1_epi32((int) (uint32_t) count));
+		v[13] = _mm256_xor_si256(v[13], _mm256_set1_epi32((int) (uint32_t) (count >> 32)));
+		_CTB_BLAKE2_V_ROUNDS10;
+		for (i = 0; i < 8; i++)
+			s[i] = _mm256_xor_si256(s[i], _mm256_xor_si256(v[i], v[i + 8]));
+	}
 
-/* HMAC-SHA-256 functions */
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *) h[i], s[i]);
+}
 
-void ctb_hmac_sha256_init(ctb_hmac_sha256_ctx *ctx, const unsigned char *key,
-						  unsigned int key_size)
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR1
+#undef _CTB_BV_ROTR2
+#undef _CTB_BV_ROTR3
+#undef _CTB_BV_ROTR4
+
+#undef _CTB_BLAKE2_V_ROUNDS10
+#undef _CTB_BLAKE2_V_ROUND
+#undef _CTB_BLAKE2_VG
+#undef _CTB_BLAKE2_RG
+#endif /* _CTB_HASH_X86 */
+
+/* Parameter block (RFC 7693 section 2.5) folded into the IV. leaf_length,
+ * salt and personalization are always zero here; the tree fields are
+ * only set for the BLAKE2bp/sp nodes.
+ */
+static void _ctb_blake2b_init_param(ctb_blake2b_ctx *ctx, unsigned int outlen, unsigned int keylen,
+									unsigned int fanout, unsigned int depth, uint64_t node_offset,
+									unsigned int node_depth, unsigned int inner_len)
 {
-	unsigned int fill;
-	unsigned int num;
+	int i;
 
-	const unsigned char *key_used;
-	unsigned char key_temp[_CTB_SHA256_DIGEST_SIZE];
+	for (i = 0; i < 8; i++)
+		ctx->h[i] = _ctb_blake2b_iv[i];
+	ctx->h[0] ^= (uint64_t) (outlen | keylen << 8 | fanout << 16 | depth << 24);
+	ctx->h[1] ^= node_offset;
+	ctx->h[2] ^= (uint64_t) (node_depth | inner_len << 8);
+	ctx->t[0] = ctx->t[1] = 0;
+	ctx->len = 0;
+	ctx->outlen = outlen;
+	ctx->last_node = 0;
+}
+
+static void _ctb_blake2s_init_param(ctb_blake2s_ctx *ctx, unsigned int outlen, unsigned int keylen,
+									unsigned int fanout, unsigned int depth, uint64_t node_offset,
+									unsigned int node_depth, unsigned int inner_len)
+{
 	int i;
 
-	if (key_size == _CTB_SHA256_BLOCK_SIZE) {
-		key_used = key;
-		num = _CTB_SHA256_BLOCK_SIZE;
-	} else {
-		if (key_size > _CTB_SHA256_BLOCK_SIZE){
-			num = _CTB_SHA256_DIGEST_SIZE;
-			ctb_sha256(key, key_size, key_temp);
-			key_used = key_temp;
-		} else { /* key_size > _CTB_SHA256_BLOCK_SIZE */
-			key_used = key;
-			num = key_size;
-		}
-		fill = _CTB_SHA256_BLOCK_SIZE - num;
+	for (i = 0; i < 8; i++)
+		ctx->h[i] = _ctb_blake2s_iv[i];
+	ctx->h[0] ^= (uint32_t) (outlen | keylen << 8 | fanout << 16 | (uint32_t) depth << 24);
+	ctx->h[2] ^= (uint32_t) node_offset;
+	ctx->h[3] ^= (uint32_t) ((node_offset >> 32) & 0xFFFF) | node_depth << 16 | (uint32_t) inner_len << 24;
+	ctx->t[0] = ctx->t[1] = 0;
+	ctx->len = 0;
+	ctx->outlen = outlen;
+	ctx->last_node = 0;
+}
 
-		memset(ctx->block_ipad + num, 0x36, fill);
-		memset(ctx->block_opad + num, 0x5c, fill);
+/* BLAKE2b */
+
+int ctb_blake2b_init_key(ctb_blake2b_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen)
+{
+	if (outlen == 0 || outlen > CTB_BLAKE2B_DIGEST_SIZE || keylen > CTB_BLAKE2B_KEY_SIZE
+		|| (keylen && !key))
+		return -1;
+
+	_ctb_blake2b_init_param(ctx, (unsigned int) outlen, (unsigned int) keylen, 1, 1, 0, 0, 0);
+	if (keylen) {
+		/* the key, zero-padded, is the first block */
+		memset(ctx->block, 0, CTB_BLAKE2B_BLOCK_SIZE);
+		memcpy(ctx->block, key, keylen);
+		ctx->len = CTB_BLAKE2B_BLOCK_SIZE;
 	}
+	return 0;
+}
 
-	for (i = 0; i < (int) num; i++) {
-		ctx->block_ipad[i] = key_used[i] ^ 0x36;
-		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+int ctb_blake2b_init(ctb_blake2b_ctx *ctx, size_t outlen)
+{
+	return ctb_blake2b_init_key(ctx, outlen, NULL, 0);
+}
+
+static inline void _ctb_blake2b_count(ctb_blake2b_ctx *ctx, uint64_t n)
+{
+	ctx->t[0] += n;
+	if (ctx->t[0] < n)
+		ctx->t[1]++;
+}
+
+/* The last block is only compressed by _final, with the last-block flag,
+ * so a block is held back until input beyond it arrives.
+ */
+void ctb_blake2b_update(ctb_blake2b_ctx *ctx, const unsigned char *message, size_t len)
+{
+	_ctb_blake2b_compress_fn compress;
+	size_t fill;
+
+	if (len <= CTB_BLAKE2B_BLOCK_SIZE - ctx->len) {
+		if (len)
+			memcpy(ctx->block + ctx->len, message, len);
+		ctx->len += (unsigned int) len;
+		return;
 	}
 
-	ctb_sha256_init(&ctx->ctx_inside);
-	ctb_sha256_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA256_BLOCK_SIZE);
+	compress = _ctb_hash_kernels()->blake2b_compress;
+	if (ctx->len) {
+		fill = CTB_BLAKE2B_BLOCK_SIZE - ctx->len;
+		memcpy(ctx->block + ctx->len, message, fill);
+		message += fill;
+		len -= fill;
+		_ctb_blake2b_count(ctx, CTB_BLAKE2B_BLOCK_SIZE);
+		compress(ctx->h, ctx->block, ctx->t[0], ctx->t[1], 0, 0);
+	}
+	while (len > CTB_BLAKE2B_BLOCK_SIZE) {
+		_ctb_blake2b_count(ctx, CTB_BLAKE2B_BLOCK_SIZE);
+		compress(ctx->h, message, ctx->t[0], ctx->t[1], 0, 0);
+		message += CTB_BLAKE2B_BLOCK_SIZE;
+		len -= CTB_BLAKE2B_BLOCK_SIZE;
+	}
+	memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
+}
 
-	ctb_sha256_init(&ctx->ctx_outside);
-	ctb_sha256_update(&ctx->ctx_outside, ctx->block_opad,
-				   _CTB_SHA256_BLOCK_SIZE);
+void ctb_blake2b_final(ctb_blake2b_ctx *ctx, unsigned char *digest)
+{
+	unsigned char out[CTB_BLAKE2B_DIGEST_SIZE];
+	int i, j;
 
-	/* for hmac_reinit */
-	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
-		sizeof(ctb_sha256_ctx));
-	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
-		sizeof(ctb_sha256_ctx));
+	_ctb_blake2b_count(ctx, ctx->len);
+	memset(ctx->block + ctx->len, 0, CTB_BLAKE2B_BLOCK_SIZE - ctx->len);
+	_ctb_hash_kernels()->blake2b_compress(ctx->h, ctx->block, ctx->t[0], ctx->t[1], ~(uint64_t) 0,
+										  ctx->last_node ? ~(uint64_t) 0 : 0);
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			out[8 * i + j] = (unsigned char) (ctx->h[i] >> (8 * j));
+	memcpy(digest, out, ctx->outlen);
+	ctb__memzero(ctx, sizeof(ctb_blake2b_ctx));
 }
 
-void ctb_hmac_sha256_reinit(ctb_hmac_sha256_ctx *ctx)
+int ctb_blake2b(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				unsigned char *digest, size_t outlen)
 {
-	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
-		sizeof(ctb_sha256_ctx));
-	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
-		sizeof(ctb_sha256_ctx));
+	ctb_blake2b_ctx ctx;
+
+	if (ctb_blake2b_init_key(&ctx, outlen, key, keylen))
+		return -1;
+	ctb_blake2b_update(&ctx, message, len);
+	ctb_blake2b_final(&ctx, digest);
+	return 0;
 }
 
-void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message,
-							unsigned int message_len)
+/* BLAKE2s */
+
+int ctb_blake2s_init_key(ctb_blake2s_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen)
 {
-	ctb_sha256_update(&ctx->ctx_inside, message, message_len);
+	if (outlen == 0 || outlen > CTB_BLAKE2S_DIGEST_SIZE || keylen > CTB_BLAKE2S_KEY_SIZE
+		|| (keylen && !key))
+		return -1;
+
+	_ctb_blake2s_init_param(ctx, (unsigned int) outlen, (unsigned int) keylen, 1, 1, 0, 0, 0);
+	if (keylen) {
+		memset(ctx->block, 0, CTB_BLAKE2S_BLOCK_SIZE);
+		memcpy(ctx->block, key, keylen);
+		ctx->len = CTB_BLAKE2S_BLOCK_SIZE;
+	}
+	return 0;
 }
 
-void ctb_hmac_sha256_final(ctb_hmac_sha256_ctx *ctx, unsigned char *mac,
-						   unsigned int mac_size)
+int ctb_blake2s_init(ctb_blake2s_ctx *ctx, size_t outlen)
 {
-	unsigned char digest_inside[_CTB_SHA256_DIGEST_SIZE];
-	unsigned char mac_temp[_CTB_SHA256_DIGEST_SIZE];
+	return ctb_blake2s_init_key(ctx, outlen, NULL, 0);
+}
 
-	ctb_sha256_final(&ctx->ctx_inside, digest_inside);
-	ctb_sha256_update(&ctx->ctx_outside, digest_inside, _CTB_SHA256_DIGEST_SIZE);
-	ctb_sha256_final(&ctx->ctx_outside, mac_temp);
-	memcpy(mac, mac_temp, mac_size);
+static inline void _ctb_blake2s_count(ctb_blake2s_ctx *ctx, uint32_t n)
+{
+	ctx->t[0] += n;
+	if (ctx->t[0] < n)
+		ctx->t[1]++;
 }
 
-void ctb_hmac_sha256(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
-					 unsigned char *mac, unsigned mac_size)
+void ctb_blake2s_update(ctb_blake2s_ctx *ctx, const unsigned char *message, size_t len)
 {
-	ctb_hmac_sha256_ctx ctx;
+	_ctb_blake2s_compress_fn compress;
+	size_t fill;
 
-	ctb_hmac_sha256_init(&ctx, key, key_size);
-	ctb_hmac_sha256_update(&ctx, message, message_len);
-	ctb_hmac_sha256_final(&ctx, mac, mac_size);
-}
+	if (len <= CTB_BLAKE2S_BLOCK_SIZE - ctx->len) {
+		if (len)
+			memcpy(ctx->block + ctx->len, message, len);
+		ctx->len += (unsigned int) len;
+		return;
+	}
 
-/* HMAC-SHA-384 functions */
+	compress = _ctb_hash_kernels()->blake2s_compress;
+	if (ctx->len) {
+		fill = CTB_BLAKE2S_BLOCK_SIZE - ctx->len;
+		memcpy(ctx->block + ctx->len, message, fill);
+		message += fill;
+		len -= fill;
+		_ctb_blake2s_count(ctx, CTB_BLAKE2S_BLOCK_SIZE);
+		compress(ctx->h, ctx->block, ctx->t[0], ctx->t[1], 0, 0);
+	}
+	while (len > CTB_BLAKE2S_BLOCK_SIZE) {
+		_ctb_blake2s_count(ctx, CTB_BLAKE2S_BLOCK_SIZE);
+		compress(ctx->h, message, ctx->t[0], ctx->t[1], 0, 0);
+		message += CTB_BLAKE2S_BLOCK_SIZE;
+		len -= CTB_BLAKE2S_BLOCK_SIZE;
+	}
+	memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
+}
 
-void ctb_hmac_sha384_init(ctb_hmac_sha384_ctx *ctx, const unsigned char *key,
-						  unsigned int key_size)
+void ctb_blake2s_final(ctb_blake2s_ctx *ctx, unsigned char *digest)
 {
-	unsigned int fill;
-	unsigned int num;
+	unsigned char out[CTB_BLAKE2S_DIGEST_SIZE];
+	int i, j;
 
-	const unsigned char *key_used;
-	unsigned char key_temp[_CTB_SHA384_DIGEST_SIZE];
-	int i;
+	_ctb_blake2s_count(ctx, ctx->len);
+	memset(ctx->block + ctx->len, 0, CTB_BLAKE2S_BLOCK_SIZE - ctx->len);
+	_ctb_hash_kernels()->blake2s_compress(ctx->h, ctx->block, ctx->t[0], ctx->t[1], ~(uint32_t) 0,
+										  ctx->last_node ? ~(uint32_t) 0 : 0);
 
-	if (key_size == _CTB_SHA384_BLOCK_SIZE) {
-		key_used = key;
-		num = _CTB_SHA384_BLOCK_SIZE;
-	} else {
-		if (key_size > _CTB_SHA384_BLOCK_SIZE){
-			num = _CTB_SHA384_DIGEST_SIZE;
-			ctb_sha384(key, key_size, key_temp);
-			key_used = key_temp;
-		} else { /* key_size > _CTB_SHA384_BLOCK_SIZE */
-			key_used = key;
-			num = key_size;
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 4; j++)
+			out[4 * i + j] = (unsigned char) (ctx->h[i] >> (8 * j));
+	memcpy(digest, out, ctx->outlen);
+	ctb__memzero(ctx, sizeof(ctb_blake2s_ctx));
+}
+
+int ctb_blake2s(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				unsigned char *digest, size_t outlen)
+{
+	ctb_blake2s_ctx ctx;
+
+	if (ctb_blake2s_init_key(&ctx, outlen, key, keylen))
+		return -1;
+	ctb_blake2s_update(&ctx, message, len);
+	ctb_blake2s_final(&ctx, digest);
+	return 0;
+}
+
+/* BLAKE2bp / BLAKE2sp. The leaves are fanout-4 (8), depth-2 nodes that
+ * differ only in node_offset, and each outputs a full-size digest; the
+ * root hashes the leaf digests in order. The last leaf and the root carry
+ * the last-node flag. A keyed tree starts every leaf with the key block
+ * (and only tells the root the key length), so the key goes in as one
+ * full row of the buffer.
+ */
+#define _CTB_BLAKE2BP_ROW	(_CTB_BLAKE2BP_LEAVES * CTB_BLAKE2B_BLOCK_SIZE)
+#define _CTB_BLAKE2SP_ROW	(_CTB_BLAKE2SP_LEAVES * CTB_BLAKE2S_BLOCK_SIZE)
+
+int ctb_blake2bp_init_key(ctb_blake2bp_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen)
+{
+	ctb_blake2b_ctx leaf;
+	unsigned int i, w;
+
+	if (outlen == 0 || outlen > CTB_BLAKE2B_DIGEST_SIZE || keylen > CTB_BLAKE2B_KEY_SIZE
+		|| (keylen && !key))
+		return -1;
+
+	for (i = 0; i < _CTB_BLAKE2BP_LEAVES; i++) {
+		_ctb_blake2b_init_param(&leaf, (unsigned int) outlen, (unsigned int) keylen,
+								_CTB_BLAKE2BP_LEAVES, 2, i, 0, CTB_BLAKE2B_DIGEST_SIZE);
+		for (w = 0; w < 8; w++)
+			ctx->h[w][i] = leaf.h[w];
+	}
+	ctx->count = 0;
+	ctx->len = 0;
+	ctx->outlen = (unsigned int) outlen;
+	ctx->keylen = (unsigned int) keylen;
+	if (keylen) {
+		memset(ctx->buf, 0, _CTB_BLAKE2BP_ROW);
+		for (i = 0; i < _CTB_BLAKE2BP_LEAVES; i++)
+			memcpy(ctx->buf + i * CTB_BLAKE2B_BLOCK_SIZE, key, keylen);
+		ctx->len = _CTB_BLAKE2BP_ROW;
+	}
+	return 0;
+}
+
+int ctb_blake2bp_init(ctb_blake2bp_ctx *ctx, size_t outlen)
+{
+	return ctb_blake2bp_init_key(ctx, outlen, NULL, 0);
+}
+
+/* Whole rows, none holding a leaf's last block */
+static void _ctb_blake2bp_rows(ctb_blake2bp_ctx *ctx, const unsigned char *in, size_t rows)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	uint64_t h[8];
+	size_t r;
+	unsigned int i, w;
+
+	if (kt->blake2bp_many) {
+		kt->blake2bp_many(ctx->h, in, rows, ctx->count);
+		ctx->count += (uint64_t) rows * CTB_BLAKE2B_BLOCK_SIZE;
+		return;
+	}
+	for (r = 0; r < rows; r++, in += _CTB_BLAKE2BP_ROW) {
+		ctx->count += CTB_BLAKE2B_BLOCK_SIZE;
+		for (i = 0; i < _CTB_BLAKE2BP_LEAVES; i++) {
+			for (w = 0; w < 8; w++)
+				h[w] = ctx->h[w][i];
+			kt->blake2b_compress(h, in + i * CTB_BLAKE2B_BLOCK_SIZE, ctx->count, 0, 0, 0);
+			for (w = 0; w < 8; w++)
+				ctx->h[w][i] = h[w];
 		}
-		fill = _CTB_SHA384_BLOCK_SIZE - num;
+	}
+}
 
-		memset(ctx->block_ipad + num, 0x36, fill);
-		memset(ctx->block_opad + num, 0x5c, fill);
+/* A row may be compressed once more than ROW - BLOCK bytes follow it,
+ * i.e. every leaf has input in the next row; buf holds the rest.
+ */
+void ctb_blake2bp_update(ctb_blake2bp_ctx *ctx, const unsigned char *message, size_t len)
+{
+	const size_t hold = sizeof(ctx->buf);
+	size_t n;
+
+	while (ctx->len && len > hold - ctx->len) {
+		if (ctx->len < _CTB_BLAKE2BP_ROW) {
+			n = _CTB_BLAKE2BP_ROW - ctx->len;
+			memcpy(ctx->buf + ctx->len, message, n);
+			message += n;
+			len -= n;
+			ctx->len = _CTB_BLAKE2BP_ROW;
+		}
+		_ctb_blake2bp_rows(ctx, ctx->buf, 1);
+		ctx->len -= _CTB_BLAKE2BP_ROW;
+		memmove(ctx->buf, ctx->buf + _CTB_BLAKE2BP_ROW, ctx->len);
 	}
+	if (!ctx->len && len > hold) {
+		n = (len - hold + _CTB_BLAKE2BP_ROW - 1) / _CTB_BLAKE2BP_ROW;
+		_ctb_blake2bp_rows(ctx, message, n);
+		message += n * _CTB_BLAKE2BP_ROW;
+		len -= n * _CTB_BLAKE2BP_ROW;
+	}
+	if (len) {
+		memcpy(ctx->buf + ctx->len, message, len);
+		ctx->len += (unsigned int) len;
+	}
+}
 
-	for (i = 0; i < (int) num; i++) {
-		ctx->block_ipad[i] = key_used[i] ^ 0x36;
-		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+void ctb_blake2bp_final(ctb_blake2bp_ctx *ctx, unsigned char *digest)
+{
+	unsigned char leaves[_CTB_BLAKE2BP_LEAVES * CTB_BLAKE2B_DIGEST_SIZE];
+	ctb_blake2b_ctx node;
+	size_t off;
+	unsigned int i, w;
+
+	for (i = 0; i < _CTB_BLAKE2BP_LEAVES; i++) {
+		for (w = 0; w < 8; w++)
+			node.h[w] = ctx->h[w][i];
+		node.t[0] = ctx->count;
+		node.t[1] = 0;
+		node.len = 0;
+		node.outlen = CTB_BLAKE2B_DIGEST_SIZE;
+		node.last_node = (i == _CTB_BLAKE2BP_LEAVES - 1);
+		for (off = i * CTB_BLAKE2B_BLOCK_SIZE; off < ctx->len; off += _CTB_BLAKE2BP_ROW)
+			ctb_blake2b_update(&node, ctx->buf + off, ctx->len - off < CTB_BLAKE2B_BLOCK_SIZE
+							   ? ctx->len - off : CTB_BLAKE2B_BLOCK_SIZE);
+		ctb_blake2b_final(&node, leaves + i * CTB_BLAKE2B_DIGEST_SIZE);
 	}
 
-	ctb_sha384_init(&ctx->ctx_inside);
-	ctb_sha384_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA384_BLOCK_SIZE);
+	_ctb_blake2b_init_param(&node, ctx->outlen, ctx->keylen, _CTB_BLAKE2BP_LEAVES, 2, 0, 1,
+							CTB_BLAKE2B_DIGEST_SIZE);
+	node.last_node = 1;
+	ctb_blake2b_update(&node, leaves, sizeof(leaves));
+	ctb_blake2b_final(&node, digest);
+	ctb__memzero(ctx, sizeof(ctb_blake2bp_ctx));
+}
 
-	ctb_sha384_init(&ctx->ctx_outside);
-	ctb_sha384_update(&ctx->ctx_outside, ctx->block_opad,
-				   _CTB_SHA384_BLOCK_SIZE);
+int ctb_blake2bp(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				 unsigned char *digest, size_t outlen)
+{
+	ctb_blake2bp_ctx ctx;
 
-	/* for hmac_reinit */
-	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
-		sizeof(ctb_sha384_ctx));
-	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
-		sizeof(ctb_sha384_ctx));
+	if (ctb_blake2bp_init_key(&ctx, outlen, key, keylen))
+		return -1;
+	ctb_blake2bp_update(&ctx, message, len);
+	ctb_blake2bp_final(&ctx, digest);
+	return 0;
 }
 
-void ctb_hmac_sha384_reinit(ctb_hmac_sha384_ctx *ctx)
+int ctb_blake2sp_init_key(ctb_blake2sp_ctx *ctx, size_t outlen, const unsigned char *key, size_t keylen)
 {
-	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
-		sizeof(ctb_sha384_ctx));
-	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
-		sizeof(ctb_sha384_ctx));
+	ctb_blake2s_ctx leaf;
+	unsigned int i, w;
+
+	if (outlen == 0 || outlen > CTB_BLAKE2S_DIGEST_SIZE || keylen > CTB_BLAKE2S_KEY_SIZE
+		|| (keylen && !key))
+		return -1;
+
+	for (i = 0; i < _CTB_BLAKE2SP_LEAVES; i++) {
+		_ctb_blake2s_init_param(&leaf, (unsigned int) outlen, (unsigned int) keylen,
+								_CTB_BLAKE2SP_LEAVES, 2, i, 0, CTB_BLAKE2S_DIGEST_SIZE);
+		for (w = 0; w < 8; w++)
+			ctx->h[w][i] = leaf.h[w];
+	}
+	ctx->count = 0;
+	ctx->len = 0;
+	ctx->outlen = (unsigned int) outlen;
+	ctx->keylen = (unsigned int) keylen;
+	if (keylen) {
+		memset(ctx->buf, 0, _CTB_BLAKE2SP_ROW);
+		for (i = 0; i < _CTB_BLAKE2SP_LEAVES; i++)
+			memcpy(ctx->buf + i * CTB_BLAKE2S_BLOCK_SIZE, key, keylen);
+		ctx->len = _CTB_BLAKE2SP_ROW;
+	}
+	return 0;
 }
 
-void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message,
-							unsigned int message_len)
+int ctb_blake2sp_init(ctb_blake2sp_ctx *ctx, size_t outlen)
 {
-	ctb_sha384_update(&ctx->ctx_inside, message, message_len);
+	return ctb_blake2sp_init_key(ctx, outlen, NULL, 0);
 }
 
-void ctb_hmac_sha384_final(ctb_hmac_sha384_ctx *ctx, unsigned char *mac,
-						   unsigned int mac_size)
+static void _ctb_blake2sp_rows(ctb_blake2sp_ctx *ctx, const unsigned char *in, size_t rows)
 {
-	unsigned char digest_inside[_CTB_SHA384_DIGEST_SIZE];
-	unsigned char mac_temp[_CTB_SHA384_DIGEST_SIZE];
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	uint32_t h[8];
+	size_t r;
+	unsigned int i, w;
+
+	if (kt->blake2sp_many) {
+		kt->blake2sp_many(ctx->h, in, rows, ctx->count);
+		ctx->count += (uint64_t) rows * CTB_BLAKE2S_BLOCK_SIZE;
+		return;
+	}
+	for (r = 0; r < rows; r++, in += _CTB_BLAKE2SP_ROW) {
+		ctx->count += CTB_BLAKE2S_BLOCK_SIZE;
+		for (i = 0; i < _CTB_BLAKE2SP_LEAVES; i++) {
+			for (w = 0; w < 8; w++)
+				h[w] = ctx->h[w][i];
+			kt->blake2s_compress(h, in + i * CTB_BLAKE2S_BLOCK_SIZE, (uint32_t) ctx->count,
+								 (uint32_t) (ctx->count >> 32), 0, 0);
+			for (w = 0; w < 8; w++)
+				ctx->h[w][i] = h[w];
+		}
+	}
+}
 
-	ctb_sha384_final(&ctx->ctx_inside, digest_inside);
-	ctb_sha384_update(&ctx->ctx_outside, digest_inside, _CTB_SHA384_DIGEST_SIZE);
-	ctb_sha384_final(&ctx->ctx_outside, mac_temp);
-	memcpy(mac, mac_temp, mac_size);
+void ctb_blake2sp_update(ctb_blake2sp_ctx *ctx, const unsigned char *message, size_t len)
+{
+	const size_t hold = sizeof(ctx->buf);
+	size_t n;
+
+	while (ctx->len && len > hold - ctx->len) {
+		if (ctx->len < _CTB_BLAKE2SP_ROW) {
+			n = _CTB_BLAKE2SP_ROW - ctx->len;
+			memcpy(ctx->buf + ctx->len, message, n);
+			message += n;
+			len -= n;
+			ctx->len = _CTB_BLAKE2SP_ROW;
+		}
+		_ctb_blake2sp_rows(ctx, ctx->buf, 1);
+		ctx->len -= _CTB_BLAKE2SP_ROW;
+		memmove(ctx->buf, ctx->buf + _CTB_BLAKE2SP_ROW, ctx->len);
+	}
+	if (!ctx->len && len > hold) {
+		n = (len - hold + _CTB_BLAKE2SP_ROW - 1) / _CTB_BLAKE2SP_ROW;
+		_ctb_blake2sp_rows(ctx, message, n);
+		message += n * _CTB_BLAKE2SP_ROW;
+		len -= n * _CTB_BLAKE2SP_ROW;
+	}
+	if (len) {
+		memcpy(ctx->buf + ctx->len, message, len);
+		ctx->len += (unsigned int) len;
+	}
 }
 
-void ctb_hmac_sha384(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
-					 unsigned char *mac, unsigned mac_size)
+void ctb_blake2sp_final(ctb_blake2sp_ctx *ctx, unsigned char *digest)
 {
-	ctb_hmac_sha384_ctx ctx;
+	unsigned char leaves[_CTB_BLAKE2SP_LEAVES * CTB_BLAKE2S_DIGEST_SIZE];
+	ctb_blake2s_ctx node;
+	size_t off;
+	unsigned int i, w;
+
+	for (i = 0; i < _CTB_BLAKE2SP_LEAVES; i++) {
+		for (w = 0; w < 8; w++)
+			node.h[w] = ctx->h[w][i];
+		node.t[0] = (uint32_t) ctx->count;
+		node.t[1] = (uint32_t) (ctx->count >> 32);
+		node.len = 0;
+		node.outlen = CTB_BLAKE2S_DIGEST_SIZE;
+		node.last_node = (i == _CTB_BLAKE2SP_LEAVES - 1);
+		for (off = i * CTB_BLAKE2S_BLOCK_SIZE; off < ctx->len; off += _CTB_BLAKE2SP_ROW)
+			ctb_blake2s_update(&node, ctx->buf + off, ctx->len - off < CTB_BLAKE2S_BLOCK_SIZE
+							   ? ctx->len - off : CTB_BLAKE2S_BLOCK_SIZE);
+		ctb_blake2s_final(&node, leaves + i * CTB_BLAKE2S_DIGEST_SIZE);
+	}
 
-	ctb_hmac_sha384_init(&ctx, key, key_size);
-	ctb_hmac_sha384_update(&ctx, message, message_len);
-	ctb_hmac_sha384_final(&ctx, mac, mac_size);
+	_ctb_blake2s_init_param(&node, ctx->outlen, ctx->keylen, _CTB_BLAKE2SP_LEAVES, 2, 0, 1,
+							CTB_BLAKE2S_DIGEST_SIZE);
+	node.last_node = 1;
+	ctb_blake2s_update(&node, leaves, sizeof(leaves));
+	ctb_blake2s_final(&node, digest);
+	ctb__memzero(ctx, sizeof(ctb_blake2sp_ctx));
 }
 
-/* HMAC-SHA-512 functions */
+int ctb_blake2sp(const unsigned char *message, size_t len, const unsigned char *key, size_t keylen,
+				 unsigned char *digest, size_t outlen)
+{
+	ctb_blake2sp_ctx ctx;
 
-void ctb_hmac_sha512_init(ctb_hmac_sha512_ctx *ctx, const unsigned char *key,
+	if (ctb_blake2sp_init_key(&ctx, outlen, key, keylen))
+		return -1;
+	ctb_blake2sp_update(&ctx, message, len);
+	ctb_blake2sp_final(&ctx, digest);
+	return 0;
+}
+
+#undef _CTB_BLAKE2BP_ROW
+#undef _CTB_BLAKE2SP_ROW
+
+/* =========================================================================
+   HASH160 IMPLEMENTATION
+   ========================================================================= */
+
+/* RIPEMD-160 padding for a 32-byte message: 0x80, zeros, 256 bits LE. */
+static const uint8_t _ctb_ripemd160_pad32[32] =
+	{
+		0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0x00, 0x01, 0, 0, 0, 0, 0, 0
+	};
+
+#define _CTB_HASH160_CHUNK	64
+
+void ctb_hash160(const uint8_t *msg, size_t len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH])
+{
+	ctb_ripemd160_ctx ctx;
+	uint8_t block[_CTB_RIPEMD160_BLOCK_LENGTH];
+	uint32 h[8];
+	int i;
+
+	_ctb_sha256_oneshot(sha256_h0, 0, msg, len, h);
+	for (i = 0; i < 8; i++)
+		UNPACK32(h[i], &block[i << 2]);
+	memcpy(block + 32, _ctb_ripemd160_pad32, 32);
+
+	memcpy(ctx.state, _ctb_ripemd160_iv, sizeof(ctx.state));
+	ripemd160_process(&ctx, block);
+	for (i = 0; i < 5; i++)
+		PUT_UINT32_LE(ctx.state[i], hash, i << 2);
+}
+
+void ctb_hash160_many(const uint8_t *const *msg, const size_t *len,
+					  uint8_t (*hash)[_CTB_RIPEMD160_DIGEST_LENGTH], size_t count)
+{
+	/* SHA-256 digests of one chunk stay in L1 between the two stages */
+	uint8_t mid[_CTB_HASH160_CHUNK][_CTB_SHA256_DIGEST_SIZE];
+	size_t i, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < _CTB_HASH160_CHUNK ? count - i : _CTB_HASH160_CHUNK;
+		_ctb_sha256_mb(sha256_h0, 0, _CTB_SHA256_DIGEST_SIZE, msg + i, len + i, mid[0], n);
+		ctb_ripemd160_32_many((const uint8_t (*)[32]) mid, hash + i, n);
+	}
+}
+
+#undef _CTB_HASH160_CHUNK
+
+/* =========================================================================
+   SHA256D IMPLEMENTATION
+   ========================================================================= */
+
+/* Padding words of a one-block message whose data ends at word n: 0x80
+ * marker, zeros, bit length. _CTB_SHA256D_PAD(w, n, bits) fills w[n..15].
+ */
+#define _CTB_SHA256D_PAD(w, n, bits)              \
+{                                                 \
+	int _k;                                       \
+	(w)[n] = 0x80000000;                          \
+	for (_k = (n) + 1; _k < 15; _k++)             \
+		(w)[_k] = 0;                              \
+	(w)[15] = (bits);                             \
+}
+
+#define _CTB_SHA256D_CHUNK	64
+
+/* Second hash: the first digest's words are the message, no bytes needed. */
+static void _ctb_sha256d_finish(const _ctb_hash_kernel_table *kt, const uint32 h1[8],
+								uint8_t hash[_CTB_SHA256_DIGEST_SIZE])
+{
+	uint32 w[16], h[8];
+	int i;
+
+	memcpy(w, h1, 8 * sizeof(uint32));
+	_CTB_SHA256D_PAD(w, 8, 256);
+	memcpy(h, sha256_h0, sizeof(h));
+	kt->sha256_words(h, w);
+	for (i = 0; i < 8; i++)
+		UNPACK32(h[i], &hash[i << 2]);
+}
+
+void ctb_sha256d(const uint8_t *msg, size_t len, uint8_t hash[_CTB_SHA256_DIGEST_SIZE])
+{
+	uint32 h[8];
+
+	_ctb_sha256_oneshot(sha256_h0, 0, msg, len, h);
+	_ctb_sha256d_finish(_ctb_hash_kernels(), h, hash);
+}
+
+void ctb_sha256d_32(const uint8_t msg[32], uint8_t hash[_CTB_SHA256_DIGEST_SIZE])
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	uint32 w[16], h[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		PACK32(&msg[i << 2], &w[i]);
+	_CTB_SHA256D_PAD(w, 8, 256);
+	memcpy(h, sha256_h0, sizeof(h));
+	kt->sha256_words(h, w);
+	_ctb_sha256d_finish(kt, h, hash);
+}
+
+void ctb_sha256d_64(const uint8_t msg[64], uint8_t hash[_CTB_SHA256_DIGEST_SIZE])
+{
+	static const uint32 pad[16] = {0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512};
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	uint32 h[8];
+
+	memcpy(h, sha256_h0, sizeof(h));
+	kt->sha256_compress(h, msg, 1);
+	kt->sha256_words(h, pad);
+	_ctb_sha256d_finish(kt, h, hash);
+}
+
+void ctb_sha256d_80(const uint8_t msg[80], uint8_t hash[_CTB_SHA256_DIGEST_SIZE])
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	uint32 w[16], h[8];
+	int i;
+
+	memcpy(h, sha256_h0, sizeof(h));
+	kt->sha256_compress(h, msg, 1);
+	for (i = 0; i < 4; i++)
+		PACK32(&msg[64 + (i << 2)], &w[i]);
+	_CTB_SHA256D_PAD(w, 4, 640);
+	kt->sha256_words(h, w);
+	_ctb_sha256d_finish(kt, h, hash);
+}
+
+/* Batches run the first hash on the multi-buffer path, storing each digest
+ * straight into a block that already carries the 32-byte padding. The
+ * second hash is then exactly one block per lane, so the lanes are fed to
+ * the kernel directly without the scheduler.
+ */
+static void _ctb_sha256d_mb(const _ctb_hash_kernel_table *kt, const uint8_t *const *msg,
+							const size_t *len, uint8_t (*hash)[_CTB_SHA256_DIGEST_SIZE], size_t n)
+{
+	uint8_t blk[_CTB_SHA256D_CHUNK][_CTB_SHA256_BLOCK_SIZE];
+	uint32 st[8 * _CTB_MB_MAX_LANES], w[8];
+	const unsigned char *blocks[_CTB_MB_MAX_LANES];
+	unsigned int lanes = kt->sha256_mb_lanes;
+	_ctb_mb_digest_out out;
+	size_t i, g, k;
+
+	for (i = 0; i < n; i++) {
+		memset(blk[i] + 32, 0, 32);
+		blk[i][32] = 0x80;
+		blk[i][62] = 0x01;	/* 256 bits */
+	}
+	out.out = blk[0];
+	out.stride = _CTB_SHA256_BLOCK_SIZE;
+	out.digest_len = _CTB_SHA256_DIGEST_SIZE;
+	out.word_size = 4;
+	out.big_endian = 1;
+	_ctb_sha256_mb_job(sha256_h0, 0, msg, len, n, _ctb_mb_store_digest, &out);
+
+	for (g = 0; g < n; g += lanes) {
+		size_t m = n - g < lanes ? n - g : lanes;
+
+		if (m == 1) {
+			for (i = 0; i < 8; i++)
+				PACK32(&blk[g][i << 2], &w[i]);
+			_ctb_sha256d_finish(kt, w, hash[g]);
+			break;
+		}
+		for (k = 0; k < lanes; k++) {
+			blocks[k] = k < m ? blk[g + k] : _ctb_mb_zero_block;
+			for (i = 0; i < 8; i++)
+				st[i * lanes + k] = sha256_h0[i];
+		}
+		kt->sha256_mb(st, blocks, (1u << m) - 1);
+		for (k = 0; k < m; k++) {
+			for (i = 0; i < 8; i++)
+				UNPACK32(st[i * lanes + k], &hash[g + k][i << 2]);
+		}
+	}
+}
+
+void ctb_sha256d_many(const uint8_t *const *msg, const size_t *len,
+					  uint8_t (*hash)[_CTB_SHA256_DIGEST_SIZE], size_t count)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	size_t i, n;
+
+	if (!kt->sha256_mb) {
+		for (i = 0; i < count; i++)
+			ctb_sha256d(msg[i], len[i], hash[i]);
+		return;
+	}
+	for (i = 0; i < count; i += n) {
+		n = count - i < _CTB_SHA256D_CHUNK ? count - i : _CTB_SHA256D_CHUNK;
+		_ctb_sha256d_mb(kt, msg + i, len + i, hash + i, n);
+	}
+}
+
+void ctb_sha256d_64_many(const uint8_t (*msg)[64], uint8_t (*hash)[_CTB_SHA256_DIGEST_SIZE],
+						 size_t count)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	const uint8_t *ptr[_CTB_SHA256D_CHUNK];
+	size_t len[_CTB_SHA256D_CHUNK];
+	size_t i, k, n;
+
+	if (!kt->sha256_mb) {
+		for (i = 0; i < count; i++)
+			ctb_sha256d_64(msg[i], hash[i]);
+		return;
+	}
+	for (i = 0; i < count; i += n) {
+		n = count - i < _CTB_SHA256D_CHUNK ? count - i : _CTB_SHA256D_CHUNK;
+		for (k = 0; k < n; k++) {
+			ptr[k] = msg[i + k];
+			len[k] = 64;
+		}
+		_ctb_sha256d_mb(kt, ptr, len, hash + i, n);
+	}
+}
+
+#undef _CTB_SHA256D_PAD
+#undef _CTB_SHA256D_CHUNK
+
+/* =========================================================================
+   HMAC IMPLEMENTATION
+   ========================================================================= */
+
+void ctb_hmac_sha224_init(ctb_hmac_sha224_ctx *ctx, const unsigned char *key,
 						  unsigned int key_size)
 {
 	unsigned int fill;
 	unsigned int num;
 
 	const unsigned char *key_used;
-	unsigned char key_temp[_CTB_SHA512_DIGEST_SIZE];
+	unsigned char key_temp[_CTB_SHA224_DIGEST_SIZE];
 	int i;
 
-	if (key_size == _CTB_SHA512_BLOCK_SIZE) {
+	if (key_size == _CTB_SHA224_BLOCK_SIZE) {
 		key_used = key;
-		num = _CTB_SHA512_BLOCK_SIZE;
+		num = _CTB_SHA224_BLOCK_SIZE;
 	} else {
-		if (key_size > _CTB_SHA512_BLOCK_SIZE){
-			num = _CTB_SHA512_DIGEST_SIZE;
-			ctb_sha512(key, key_size, key_temp);
+		if (key_size > _CTB_SHA224_BLOCK_SIZE){
+			num = _CTB_SHA224_DIGEST_SIZE;
+			ctb_sha224(key, key_size, key_temp);
 			key_used = key_temp;
-		} else { /* key_size > _CTB_SHA512_BLOCK_SIZE */
+		} else { /* key_size > _CTB_SHA224_BLOCK_SIZE */
 			key_used = key;
 			num = key_size;
 		}
-		fill = _CTB_SHA512_BLOCK_SIZE - num;
+		fill = _CTB_SHA224_BLOCK_SIZE - num;
 
 		memset(ctx->block_ipad + num, 0x36, fill);
 		memset(ctx->block_opad + num, 0x5c, fill);
@@ -2068,159 +5892,6379 @@ void ctb_hmac_sha512_init(ctb_hmac_sha512_ctx *ctx, const unsigned char *key,
 		ctx->block_opad[i] = key_used[i] ^ 0x5c;
 	}
 
-	ctb_sha512_init(&ctx->ctx_inside);
-	ctb_sha512_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA512_BLOCK_SIZE);
+	ctb_sha224_init(&ctx->ctx_inside);
+	ctb_sha224_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA224_BLOCK_SIZE);
 
-	ctb_sha512_init(&ctx->ctx_outside);
-	ctb_sha512_update(&ctx->ctx_outside, ctx->block_opad,
-				   _CTB_SHA512_BLOCK_SIZE);
+	ctb_sha224_init(&ctx->ctx_outside);
+	ctb_sha224_update(&ctx->ctx_outside, ctx->block_opad,
+				   _CTB_SHA224_BLOCK_SIZE);
 
 	/* for hmac_reinit */
 	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
-		sizeof(ctb_sha512_ctx));
+		sizeof(ctb_sha224_ctx));
 	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
-		sizeof(ctb_sha512_ctx));
+		sizeof(ctb_sha224_ctx));
 }
 
-void ctb_hmac_sha512_reinit(ctb_hmac_sha512_ctx *ctx)
+void ctb_hmac_sha224_reinit(ctb_hmac_sha224_ctx *ctx)
 {
 	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
-		sizeof(ctb_sha512_ctx));
+		sizeof(ctb_sha224_ctx));
 	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
-		sizeof(ctb_sha512_ctx));
+		sizeof(ctb_sha224_ctx));
 }
 
-void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message,
-							unsigned int message_len)
+void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message,
+							size_t message_len)
 {
-	ctb_sha512_update(&ctx->ctx_inside, message, message_len);
+	ctb_sha224_update(&ctx->ctx_inside, message, message_len);
 }
 
-void ctb_hmac_sha512_final(ctb_hmac_sha512_ctx *ctx, unsigned char *mac,
+void ctb_hmac_sha224_final(ctb_hmac_sha224_ctx *ctx, unsigned char *mac,
 						   unsigned int mac_size)
 {
-	unsigned char digest_inside[_CTB_SHA512_DIGEST_SIZE];
-	unsigned char mac_temp[_CTB_SHA512_DIGEST_SIZE];
+	unsigned char digest_inside[_CTB_SHA224_DIGEST_SIZE];
+	unsigned char mac_temp[_CTB_SHA224_DIGEST_SIZE];
 
-	ctb_sha512_final(&ctx->ctx_inside, digest_inside);
-	ctb_sha512_update(&ctx->ctx_outside, digest_inside, _CTB_SHA512_DIGEST_SIZE);
-	ctb_sha512_final(&ctx->ctx_outside, mac_temp);
+	ctb_sha224_final(&ctx->ctx_inside, digest_inside);
+	ctb_sha224_update(&ctx->ctx_outside, digest_inside, _CTB_SHA224_DIGEST_SIZE);
+	ctb_sha224_final(&ctx->ctx_outside, mac_temp);
 	memcpy(mac, mac_temp, mac_size);
 }
 
-void ctb_hmac_sha512(const unsigned char *key, unsigned int key_size,
-					 const unsigned char *message, unsigned int message_len,
+void ctb_hmac_sha224(const unsigned char *key, unsigned int key_size,
+					 const unsigned char *message, size_t message_len,
 					 unsigned char *mac, unsigned mac_size)
 {
-	ctb_hmac_sha512_ctx ctx;
+	ctb_hmac_sha224_ctx ctx;
 
-	ctb_hmac_sha512_init(&ctx, key, key_size);
-	ctb_hmac_sha512_update(&ctx, message, message_len);
-	ctb_hmac_sha512_final(&ctx, mac, mac_size);
+	ctb_hmac_sha224_init(&ctx, key, key_size);
+	ctb_hmac_sha224_update(&ctx, message, message_len);
+	ctb_hmac_sha224_final(&ctx, mac, mac_size);
 }
 
+/* HMAC-SHA-256 functions */
 
-/* =========================================================================
-   PBKDF2 IMPLEMENTATION
-   ========================================================================= */
+void ctb_hmac_sha256_init(ctb_hmac_sha256_ctx *ctx, const unsigned char *key,
+						  unsigned int key_size)
+{
+	unsigned int fill;
+	unsigned int num;
 
-/* write 32-bit big-endian integer */
-static inline void be32(uint32_t x, uint8_t out[4]) {
-	out[0] = (uint8_t)(x >> 24);
-	out[1] = (uint8_t)(x >> 16);
+	const unsigned char *key_used;
+	unsigned char key_temp[_CTB_SHA256_DIGEST_SIZE];
+	int i;
+
+	if (key_size == _CTB_SHA256_BLOCK_SIZE) {
+		key_used = key;
+		num = _CTB_SHA256_BLOCK_SIZE;
+	} else {
+		if (key_size > _CTB_SHA256_BLOCK_SIZE){
+			num = _CTB_SHA256_DIGEST_SIZE;
+			ctb_sha256(key, key_size, key_temp);
+			key_used = key_temp;
+		} else { /* key_size > _CTB_SHA256_BLOCK_SIZE */
+			key_used = key;
+			num = key_size;
+		}
+		fill = _CTB_SHA256_BLOCK_SIZE - num;
+
+		memset(ctx->block_ipad + num, 0x36, fill);
+		memset(ctx->block_opad + num, 0x5c, fill);
+	}
+
+	for (i = 0; i < (int) num; i++) {
+		ctx->block_ipad[i] = key_used[i] ^ 0x36;
+		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+	}
+
+	ctb_sha256_init(&ctx->ctx_inside);
+	ctb_sha256_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA256_BLOCK_SIZE);
+
+	ctb_sha256_init(&ctx->ctx_outside);
+	ctb_sha256_update(&ctx->ctx_outside, ctx->block_opad,
+				   _CTB_SHA256_BLOCK_SIZE);
+
+	/* for hmac_reinit */
+	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
+		sizeof(ctb_sha256_ctx));
+	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
+		sizeof(ctb_sha256_ctx));
+}
+
+void ctb_hmac_sha256_reinit(ctb_hmac_sha256_ctx *ctx)
+{
+	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
+		sizeof(ctb_sha256_ctx));
+	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
+		sizeof(ctb_sha256_ctx));
+}
+
+void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message,
+							size_t message_len)
+{
+	ctb_sha256_update(&ctx->ctx_inside, message, message_len);
+}
+
+void ctb_hmac_sha256_final(ctb_hmac_sha256_ctx *ctx, unsigned char *mac,
+						   unsigned int mac_size)
+{
+	unsigned char digest_inside[_CTB_SHA256_DIGEST_SIZE];
+	unsigned char mac_temp[_CTB_SHA256_DIGEST_SIZE];
+
+	ctb_sha256_final(&ctx->ctx_inside, digest_inside);
+	ctb_sha256_update(&ctx->ctx_outside, digest_inside, _CTB_SHA256_DIGEST_SIZE);
+	ctb_sha256_final(&ctx->ctx_outside, mac_temp);
+	memcpy(mac, mac_temp, mac_size);
+}
+
+void ctb_hmac_sha256(const unsigned char *key, unsigned int key_size,
+					 const unsigned char *message, size_t message_len,
+					 unsigned char *mac, unsigned mac_size)
+{
+	ctb_hmac_sha256_ctx ctx;
+
+	ctb_hmac_sha256_init(&ctx, key, key_size);
+	ctb_hmac_sha256_update(&ctx, message, message_len);
+	ctb_hmac_sha256_final(&ctx, mac, mac_size);
+}
+
+/* HMAC-SHA-384 functions */
+
+void ctb_hmac_sha384_init(ctb_hmac_sha384_ctx *ctx, const unsigned char *key,
+						  unsigned int key_size)
+{
+	unsigned int fill;
+	unsigned int num;
+
+	const unsigned char *key_used;
+	unsigned char key_temp[_CTB_SHA384_DIGEST_SIZE];
+	int i;
+
+	if (key_size == _CTB_SHA384_BLOCK_SIZE) {
+		key_used = key;
+		num = _CTB_SHA384_BLOCK_SIZE;
+	} else {
+		if (key_size > _CTB_SHA384_BLOCK_SIZE){
+			num = _CTB_SHA384_DIGEST_SIZE;
+			ctb_sha384(key, key_size, key_temp);
+			key_used = key_temp;
+		} else { /* key_size > _CTB_SHA384_BLOCK_SIZE */
+			key_used = key;
+			num = key_size;
+		}
+		fill = _CTB_SHA384_BLOCK_SIZE - num;
+
+		memset(ctx->block_ipad + num, 0x36, fill);
+		memset(ctx->block_opad + num, 0x5c, fill);
+	}
+
+	for (i = 0; i < (int) num; i++) {
+		ctx->block_ipad[i] = key_used[i] ^ 0x36;
+		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+	}
+
+	ctb_sha384_init(&ctx->ctx_inside);
+	ctb_sha384_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA384_BLOCK_SIZE);
+
+	ctb_sha384_init(&ctx->ctx_outside);
+	ctb_sha384_update(&ctx->ctx_outside, ctx->block_opad,
+				   _CTB_SHA384_BLOCK_SIZE);
+
+	/* for hmac_reinit */
+	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
+		sizeof(ctb_sha384_ctx));
+	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
+		sizeof(ctb_sha384_ctx));
+}
+
+void ctb_hmac_sha384_reinit(ctb_hmac_sha384_ctx *ctx)
+{
+	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
+		sizeof(ctb_sha384_ctx));
+	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
+		sizeof(ctb_sha384_ctx));
+}
+
+void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message,
+							size_t message_len)
+{
+	ctb_sha384_update(&ctx->ctx_inside, message, message_len);
+}
+
+void ctb_hmac_sha384_final(ctb_hmac_sha384_ctx *ctx, unsigned char *mac,
+						   unsigned int mac_size)
+{
+	unsigned char digest_inside[_CTB_SHA384_DIGEST_SIZE];
+	unsigned char mac_temp[_CTB_SHA384_DIGEST_SIZE];
+
+	ctb_sha384_final(&ctx->ctx_inside, digest_inside);
+	ctb_sha384_update(&ctx->ctx_outside, digest_inside, _CTB_SHA384_DIGEST_SIZE);
+	ctb_sha384_final(&ctx->ctx_outside, mac_temp);
+	memcpy(mac, mac_temp, mac_size);
+}
+
+void ctb_hmac_sha384(const unsigned char *key, unsigned int key_size,
+					 const unsigned char *message, size_t message_len,
+					 unsigned char *mac, unsigned mac_size)
+{
+	ctb_hmac_sha384_ctx ctx;
+
+	ctb_hmac_sha384_init(&ctx, key, key_size);
+	ctb_hmac_sha384_update(&ctx, message, message_len);
+	ctb_hmac_sha384_final(&ctx, mac, mac_size);
+}
+
+/* HMAC-SHA-512 functions */
+
+void ctb_hmac_sha512_init(ctb_hmac_sha512_ctx *ctx, const unsigned char *key,
+						  unsigned int key_size)
+{
+	unsigned int fill;
+	unsigned int num;
+
+	const unsigned char *key_used;
+	unsigned char key_temp[_CTB_SHA512_DIGEST_SIZE];
+	int i;
+
+	if (key_size == _CTB_SHA512_BLOCK_SIZE) {
+		key_used = key;
+		num = _CTB_SHA512_BLOCK_SIZE;
+	} else {
+		if (key_size > _CTB_SHA512_BLOCK_SIZE){
+			num = _CTB_SHA512_DIGEST_SIZE;
+			ctb_sha512(key, key_size, key_temp);
+			key_used = key_temp;
+		} else { /* key_size > _CTB_SHA512_BLOCK_SIZE */
+			key_used = key;
+			num = key_size;
+		}
+		fill = _CTB_SHA512_BLOCK_SIZE - num;
+
+		memset(ctx->block_ipad + num, 0x36, fill);
+		memset(ctx->block_opad + num, 0x5c, fill);
+	}
+
+	for (i = 0; i < (int) num; i++) {
+		ctx->block_ipad[i] = key_used[i] ^ 0x36;
+		ctx->block_opad[i] = key_used[i] ^ 0x5c;
+	}
+
+	ctb_sha512_init(&ctx->ctx_inside);
+	ctb_sha512_update(&ctx->ctx_inside, ctx->block_ipad, _CTB_SHA512_BLOCK_SIZE);
+
+	ctb_sha512_init(&ctx->ctx_outside);
+	ctb_sha512_update(&ctx->ctx_outside, ctx->block_opad,
+				   _CTB_SHA512_BLOCK_SIZE);
+
+	/* for hmac_reinit */
+	memcpy(&ctx->ctx_inside_reinit, &ctx->ctx_inside,
+		sizeof(ctb_sha512_ctx));
+	memcpy(&ctx->ctx_outside_reinit, &ctx->ctx_outside,
+		sizeof(ctb_sha512_ctx));
+}
+
+void ctb_hmac_sha512_reinit(ctb_hmac_sha512_ctx *ctx)
+{
+	memcpy(&ctx->ctx_inside, &ctx->ctx_inside_reinit,
+		sizeof(ctb_sha512_ctx));
+	memcpy(&ctx->ctx_outside, &ctx->ctx_outside_reinit,
+		sizeof(ctb_sha512_ctx));
+}
+
+void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message,
+							size_t message_len)
+{
+	ctb_sha512_update(&ctx->ctx_inside, message, message_len);
+}
+
+void ctb_hmac_sha512_final(ctb_hmac_sha512_ctx *ctx, unsigned char *mac,
+						   unsigned int mac_size)
+{
+	unsigned char digest_inside[_CTB_SHA512_DIGEST_SIZE];
+	unsigned char mac_temp[_CTB_SHA512_DIGEST_SIZE];
+
+	ctb_sha512_final(&ctx->ctx_inside, digest_inside);
+	ctb_sha512_update(&ctx->ctx_outside, digest_inside, _CTB_SHA512_DIGEST_SIZE);
+	ctb_sha512_final(&ctx->ctx_outside, mac_temp);
+	memcpy(mac, mac_temp, mac_size);
+}
+
+void ctb_hmac_sha512(const unsigned char *key, unsigned int key_size,
+					 const unsigned char *message, size_t message_len,
+					 unsigned char *mac, unsigned mac_size)
+{
+	ctb_hmac_sha512_ctx ctx;
+
+	ctb_hmac_sha512_init(&ctx, key, key_size);
+	ctb_hmac_sha512_update(&ctx, message, message_len);
+	ctb_hmac_sha512_final(&ctx, mac, mac_size);
+}
+
+/* Prepared-key HMAC. Both stages start from a keyed midstate, so a MAC is
+ * the message blocks plus two tail compressions and never copies a
+ * context. The batch form runs the inner pass for a chunk of messages
+ * and then the outer pass over their inner digests while those are still
+ * in L1.
+ */
+#define _CTB_HMAC_MANY_CHUNK	64
+
+static void _ctb_hmac_sha256_key_init(const uint32 iv[8], unsigned int digest_len,
+									  ctb_hmac_sha256_key *pk,
+									  const unsigned char *key, size_t key_size)
+{
+	_ctb_sha256_compress_fn compress = _ctb_hash_kernels()->sha256_compress;
+	unsigned char block[_CTB_SHA256_BLOCK_SIZE];
+	unsigned char key_temp[_CTB_SHA256_DIGEST_SIZE];
+	uint32 h[8];
+	size_t i;
+
+	if (key_size > _CTB_SHA256_BLOCK_SIZE) {
+		_ctb_sha256_oneshot(iv, 0, key, key_size, h);
+		for (i = 0; i < 8; i++)
+			UNPACK32(h[i], &key_temp[i << 2]);
+		key = key_temp;
+		key_size = digest_len;
+	}
+
+	memset(block, 0x36, sizeof(block));
+	for (i = 0; i < key_size; i++)
+		block[i] ^= key[i];
+	memcpy(pk->inner, iv, sizeof(pk->inner));
+	compress(pk->inner, block, 1);
+
+	for (i = 0; i < sizeof(block); i++)
+		block[i] ^= 0x36 ^ 0x5c;
+	memcpy(pk->outer, iv, sizeof(pk->outer));
+	compress(pk->outer, block, 1);
+
+	ctb__memzero(block, sizeof(block));
+	ctb__memzero(key_temp, sizeof(key_temp));
+	ctb__memzero(h, sizeof(h));
+}
+
+static void _ctb_hmac_sha256_mac(const ctb_hmac_sha256_key *pk, unsigned int digest_len,
+								 const unsigned char *message, size_t message_len,
+								 unsigned char *mac)
+{
+	unsigned char digest[_CTB_SHA256_DIGEST_SIZE];
+	uint32 h[8];
+	int i;
+
+	_ctb_sha256_oneshot(pk->inner, _CTB_SHA256_BLOCK_SIZE, message, message_len, h);
+	for (i = 0; i < 8; i++)
+		UNPACK32(h[i], &digest[i << 2]);
+	_ctb_sha256_oneshot(pk->outer, _CTB_SHA256_BLOCK_SIZE, digest, digest_len, h);
+	for (i = 0; i < 8; i++)
+		UNPACK32(h[i], &digest[i << 2]);
+	memcpy(mac, digest, digest_len);
+}
+
+static void _ctb_hmac_sha256_mac_many(const ctb_hmac_sha256_key *pk, unsigned int digest_len,
+									  const unsigned char *const *message, const size_t *message_len,
+									  unsigned char *mac, size_t count)
+{
+	unsigned char mid[_CTB_HMAC_MANY_CHUNK * _CTB_SHA256_DIGEST_SIZE];
+	const unsigned char *mid_msg[_CTB_HMAC_MANY_CHUNK];
+	size_t mid_len[_CTB_HMAC_MANY_CHUNK];
+	size_t i, n;
+
+	for (i = 0; i < _CTB_HMAC_MANY_CHUNK; i++) {
+		mid_msg[i] = mid + i * digest_len;
+		mid_len[i] = digest_len;
+	}
+	for (i = 0; i < count; i += n) {
+		n = count - i < _CTB_HMAC_MANY_CHUNK ? count - i : _CTB_HMAC_MANY_CHUNK;
+		_ctb_sha256_mb(pk->inner, _CTB_SHA256_BLOCK_SIZE, digest_len,
+					   message + i, message_len + i, mid, n);
+		_ctb_sha256_mb(pk->outer, _CTB_SHA256_BLOCK_SIZE, digest_len,
+					   mid_msg, mid_len, mac + i * digest_len, n);
+	}
+}
+
+/* SHA-512 has no one-shot on state words; a context seeded with the
+ * midstate and the one block it stands for does the same job. */
+static void _ctb_hmac_sha512_digest(const uint64 iv[8], uint64 prefix_len,
+									const unsigned char *message, size_t message_len,
+									unsigned char digest[_CTB_SHA512_DIGEST_SIZE])
+{
+	ctb_sha512_ctx ctx;
+
+	memcpy(ctx.h, iv, sizeof(ctx.h));
+	ctx.len = 0;
+	ctx.tot_len = prefix_len;
+	ctb_sha512_update(&ctx, message, message_len);
+	ctb_sha512_final(&ctx, digest);
+	ctb__memzero(&ctx, sizeof(ctx));
+}
+
+static void _ctb_hmac_sha512_key_init(const uint64 iv[8], unsigned int digest_len,
+									  ctb_hmac_sha512_key *pk,
+									  const unsigned char *key, size_t key_size)
+{
+	_ctb_sha512_compress_fn compress = _ctb_hash_kernels()->sha512_compress;
+	unsigned char block[_CTB_SHA512_BLOCK_SIZE];
+	unsigned char key_temp[_CTB_SHA512_DIGEST_SIZE];
+	size_t i;
+
+	if (key_size > _CTB_SHA512_BLOCK_SIZE) {
+		_ctb_hmac_sha512_digest(iv, 0, key, key_size, key_temp);
+		key = key_temp;
+		key_size = digest_len;
+	}
+
+	memset(block, 0x36, sizeof(block));
+	for (i = 0; i < key_size; i++)
+		block[i] ^= key[i];
+	memcpy(pk->inner, iv, sizeof(pk->inner));
+	compress(pk->inner, block, 1);
+
+	for (i = 0; i < sizeof(block); i++)
+		block[i] ^= 0x36 ^ 0x5c;
+	memcpy(pk->outer, iv, sizeof(pk->outer));
+	compress(pk->outer, block, 1);
+
+	ctb__memzero(block, sizeof(block));
+	ctb__memzero(key_temp, sizeof(key_temp));
+}
+
+static void _ctb_hmac_sha512_mac(const ctb_hmac_sha512_key *pk, unsigned int digest_len,
+								 const unsigned char *message, size_t message_len,
+								 unsigned char *mac)
+{
+	unsigned char digest[_CTB_SHA512_DIGEST_SIZE];
+
+	_ctb_hmac_sha512_digest(pk->inner, _CTB_SHA512_BLOCK_SIZE, message, message_len, digest);
+	_ctb_hmac_sha512_digest(pk->outer, _CTB_SHA512_BLOCK_SIZE, digest, digest_len, digest);
+	memcpy(mac, digest, digest_len);
+}
+
+static void _ctb_hmac_sha512_mac_many(const ctb_hmac_sha512_key *pk, unsigned int digest_len,
+									  const unsigned char *const *message, const size_t *message_len,
+									  unsigned char *mac, size_t count)
+{
+	unsigned char mid[_CTB_HMAC_MANY_CHUNK * _CTB_SHA512_DIGEST_SIZE];
+	const unsigned char *mid_msg[_CTB_HMAC_MANY_CHUNK];
+	size_t mid_len[_CTB_HMAC_MANY_CHUNK];
+	size_t i, n;
+
+	for (i = 0; i < _CTB_HMAC_MANY_CHUNK; i++) {
+		mid_msg[i] = mid + i * digest_len;
+		mid_len[i] = digest_len;
+	}
+	for (i = 0; i < count; i += n) {
+		n = count - i < _CTB_HMAC_MANY_CHUNK ? count - i : _CTB_HMAC_MANY_CHUNK;
+		_ctb_sha512_mb(pk->inner, _CTB_SHA512_BLOCK_SIZE, digest_len,
+					   message + i, message_len + i, mid, n);
+		_ctb_sha512_mb(pk->outer, _CTB_SHA512_BLOCK_SIZE, digest_len,
+					   mid_msg, mid_len, mac + i * digest_len, n);
+	}
+}
+
+#undef _CTB_HMAC_MANY_CHUNK
+
+void ctb_hmac_sha224_key_init(ctb_hmac_sha224_key *pk, const unsigned char *key, size_t key_size)
+{
+	_ctb_hmac_sha256_key_init(sha224_h0, _CTB_SHA224_DIGEST_SIZE, pk, key, key_size);
+}
+
+void ctb_hmac_sha224_mac(const ctb_hmac_sha224_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA224_DIGEST_SIZE])
+{
+	_ctb_hmac_sha256_mac(pk, _CTB_SHA224_DIGEST_SIZE, message, message_len, mac);
+}
+
+void ctb_hmac_sha224_mac_many(const ctb_hmac_sha224_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA224_DIGEST_SIZE],
+							  size_t count)
+{
+	_ctb_hmac_sha256_mac_many(pk, _CTB_SHA224_DIGEST_SIZE, message, message_len,
+							  (unsigned char *) mac, count);
+}
+
+void ctb_hmac_sha256_key_init(ctb_hmac_sha256_key *pk, const unsigned char *key, size_t key_size)
+{
+	_ctb_hmac_sha256_key_init(sha256_h0, _CTB_SHA256_DIGEST_SIZE, pk, key, key_size);
+}
+
+void ctb_hmac_sha256_mac(const ctb_hmac_sha256_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA256_DIGEST_SIZE])
+{
+	_ctb_hmac_sha256_mac(pk, _CTB_SHA256_DIGEST_SIZE, message, message_len, mac);
+}
+
+void ctb_hmac_sha256_mac_many(const ctb_hmac_sha256_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA256_DIGEST_SIZE],
+							  size_t count)
+{
+	_ctb_hmac_sha256_mac_many(pk, _CTB_SHA256_DIGEST_SIZE, message, message_len,
+							  (unsigned char *) mac, count);
+}
+
+void ctb_hmac_sha384_key_init(ctb_hmac_sha384_key *pk, const unsigned char *key, size_t key_size)
+{
+	_ctb_hmac_sha512_key_init(sha384_h0, _CTB_SHA384_DIGEST_SIZE, pk, key, key_size);
+}
+
+void ctb_hmac_sha384_mac(const ctb_hmac_sha384_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA384_DIGEST_SIZE])
+{
+	_ctb_hmac_sha512_mac(pk, _CTB_SHA384_DIGEST_SIZE, message, message_len, mac);
+}
+
+void ctb_hmac_sha384_mac_many(const ctb_hmac_sha384_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA384_DIGEST_SIZE],
+							  size_t count)
+{
+	_ctb_hmac_sha512_mac_many(pk, _CTB_SHA384_DIGEST_SIZE, message, message_len,
+							  (unsigned char *) mac, count);
+}
+
+void ctb_hmac_sha512_key_init(ctb_hmac_sha512_key *pk, const unsigned char *key, size_t key_size)
+{
+	_ctb_hmac_sha512_key_init(sha512_h0, _CTB_SHA512_DIGEST_SIZE, pk, key, key_size);
+}
+
+void ctb_hmac_sha512_mac(const ctb_hmac_sha512_key *pk, const unsigned char *message, size_t message_len,
+						 unsigned char mac[_CTB_SHA512_DIGEST_SIZE])
+{
+	_ctb_hmac_sha512_mac(pk, _CTB_SHA512_DIGEST_SIZE, message, message_len, mac);
+}
+
+void ctb_hmac_sha512_mac_many(const ctb_hmac_sha512_key *pk, const unsigned char *const *message,
+							  const size_t *message_len, unsigned char (*mac)[_CTB_SHA512_DIGEST_SIZE],
+							  size_t count)
+{
+	_ctb_hmac_sha512_mac_many(pk, _CTB_SHA512_DIGEST_SIZE, message, message_len,
+							  (unsigned char *) mac, count);
+}
+
+
+/* =========================================================================
+   THREAD FAN-OUT
+   ========================================================================= */
+
+/* Minimal fork/join over native threads, for work that splits into a few
+ * equal independent parts. With CTB_HASH_NO_THREADS (_CTB_HASH_THREADS 0,
+ * see KERNEL DISPATCH TABLE) every part runs on the calling thread.
+ */
+
+#define _CTB_HASH_MAX_THREADS	64
+
+typedef void (*_ctb_hash_task_fn)(void *arg, unsigned int index);
+
+typedef struct
+{
+	_ctb_hash_task_fn	fn;
+	void				*arg;
+	unsigned int		index;
+} _ctb_hash_task;
+
+#if _CTB_HASH_THREADS && defined(_WIN32)
+static DWORD WINAPI _ctb_hash_thread_main(LPVOID p)
+{
+	_ctb_hash_task *t = (_ctb_hash_task *) p;
+
+	t->fn(t->arg, t->index);
+	return 0;
+}
+#elif _CTB_HASH_THREADS
+static void *_ctb_hash_thread_main(void *p)
+{
+	_ctb_hash_task *t = (_ctb_hash_task *) p;
+
+	t->fn(t->arg, t->index);
+	return NULL;
+}
+#endif
+
+/* Runs fn(arg, i) for i in 0..n-1 and returns when all have finished.
+ * Index 0 runs on the calling thread, the others on new threads; an index
+ * whose thread cannot be started runs on the caller after index 0.
+ */
+static void _ctb_hash_parallel(_ctb_hash_task_fn fn, void *arg, unsigned int n)
+{
+	_ctb_hash_task task[_CTB_HASH_MAX_THREADS];
+	int started[_CTB_HASH_MAX_THREADS];
+#if _CTB_HASH_THREADS && defined(_WIN32)
+	HANDLE th[_CTB_HASH_MAX_THREADS];
+#elif _CTB_HASH_THREADS
+	pthread_t th[_CTB_HASH_MAX_THREADS];
+#endif
+	unsigned int i;
+
+	if (n > _CTB_HASH_MAX_THREADS)
+		n = _CTB_HASH_MAX_THREADS;
+
+	for (i = 1; i < n; i++) {
+		task[i].fn = fn;
+		task[i].arg = arg;
+		task[i].index = i;
+#if _CTB_HASH_THREADS && defined(_WIN32)
+		th[i] = CreateThread(NULL, 0, _ctb_hash_thread_main, &task[i], 0, NULL);
+		started[i] = th[i] != NULL;
+#elif _CTB_HASH_THREADS
+		started[i] = pthread_create(&th[i], NULL, _ctb_hash_thread_main, &task[i]) == 0;
+#else
+		started[i] = 0;
+#endif
+	}
+
+	if (n > 0)
+		fn(arg, 0);
+
+	for (i = 1; i < n; i++) {
+		if (!started[i]) {
+			fn(arg, i);
+			continue;
+		}
+#if _CTB_HASH_THREADS && defined(_WIN32)
+		WaitForSingleObject(th[i], INFINITE);
+		CloseHandle(th[i]);
+#elif _CTB_HASH_THREADS
+		pthread_join(th[i], NULL);
+#endif
+	}
+}
+
+/* Online CPUs, at least 1 and at most _CTB_HASH_MAX_THREADS. */
+static unsigned int _ctb_hash_cpu_count(void)
+{
+	long n = 1;
+
+#if _CTB_HASH_THREADS && defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	n = (long) si.dwNumberOfProcessors;
+#elif _CTB_HASH_THREADS && defined(_SC_NPROCESSORS_ONLN)
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n < 1)
+		n = 1;
+	if (n > _CTB_HASH_MAX_THREADS)
+		n = _CTB_HASH_MAX_THREADS;
+	return (unsigned int) n;
+}
+
+
+/* =========================================================================
+   PBKDF2 IMPLEMENTATION
+   ========================================================================= */
+
+/* write 32-bit big-endian integer */
+static inline void be32(uint32_t x, uint8_t out[4]) {
+	out[0] = (uint8_t)(x >> 24);
+	out[1] = (uint8_t)(x >> 16);
 	out[2] = (uint8_t)(x >> 8);
 	out[3] = (uint8_t)(x);
 }
 
-/* Core PBKDF2 loop using the provided HMAC context API (init/reinit/update/final).
- * We use *_reinit so the keyed ipad/opad are reused for each HMAC invocation.
+/* Midstate iteration loops. istate/ostate are the keyed ipad/opad
+ * midstates; each iteration runs two raw compressions over a block that
+ * holds U (dw words) followed by constant padding, set up once:
+ *     u = H(ostate, H(istate, u || pad) || pad),  t ^= u
+ * u must have room for a full 8-word state.
+ */
+static void _ctb_pbkdf2_sha256_loop(const uint32 istate[8], const uint32 ostate[8],
+									uint32 u[8], uint32 t[8], uint32_t rounds, unsigned int dw)
+{
+	_ctb_sha256_words_fn words = _ctb_hash_kernels()->sha256_words;
+	uint32 w[16];
+	unsigned int i;
+
+	memset(w, 0, sizeof(w));
+	w[dw] = 0x80000000;
+	w[15] = (uint32) (_CTB_SHA256_BLOCK_SIZE + (dw << 2)) << 3;
+	for (; rounds > 0; rounds--) {
+		memcpy(w, u, dw * sizeof(uint32));
+		memcpy(u, istate, 8 * sizeof(uint32));
+		words(u, w);
+
+		memcpy(w, u, dw * sizeof(uint32));
+		memcpy(u, ostate, 8 * sizeof(uint32));
+		words(u, w);
+		for (i = 0; i < dw; i++)
+			t[i] ^= u[i];
+	}
+	memset(w, 0, sizeof(w));
+}
+
+static void _ctb_pbkdf2_sha512_loop(const uint64 istate[8], const uint64 ostate[8],
+									uint64 u[8], uint64 t[8], uint32_t rounds, unsigned int dw)
+{
+	_ctb_sha512_compress_fn compress = _ctb_hash_kernels()->sha512_compress;
+	unsigned char block[_CTB_SHA512_BLOCK_SIZE];
+	unsigned int i;
+
+	memset(block, 0, sizeof(block));
+	block[dw << 3] = 0x80;
+	UNPACK64((uint64) (_CTB_SHA512_BLOCK_SIZE + (dw << 3)) << 3, &block[120]);
+	for (; rounds > 0; rounds--) {
+		for (i = 0; i < dw; i++)
+			UNPACK64(u[i], &block[i << 3]);
+		memcpy(u, istate, 8 * sizeof(uint64));
+		compress(u, block, 1);
+
+		for (i = 0; i < dw; i++)
+			UNPACK64(u[i], &block[i << 3]);
+		memcpy(u, ostate, 8 * sizeof(uint64));
+		compress(u, block, 1);
+		for (i = 0; i < dw; i++)
+			t[i] ^= u[i];
+	}
+	memset(block, 0, sizeof(block));
+}
+
+/* PBKDF2 on the keyed midstates. HMAC init runs once per call and the
+ * context API is used for U1 only (it covers the salt); U2..Uc run in the
+ * midstate loop with no context copies and no heap.
+ *
+ * NAME##_blocks derives T_first, T_first+step, ... from a keyed context
+ * (copied, so concurrent callers can share it); NAME##_mt hands block
+ * residues to _ctb_hash_parallel.
+ */
+typedef struct
+{
+	const void		*key;	/* keyed HMAC context */
+	const uint8_t	*salt;
+	size_t			salt_len;
+	uint32_t		iterations;
+	uint8_t			*out;
+	size_t			out_len;
+	uint32_t		step;
+} _ctb_pbkdf2_job;
+
+#define DECL_PBKDF2_FN(NAME,                        \
+HMAC_CTX_T,                  \
+HMAC_INIT, HMAC_REINIT,      \
+HMAC_UPDATE, HMAC_FINAL,     \
+DIGEST_LEN,                  \
+WORD_T, PACK, UNPACK, LOOP)  \
+static void NAME##_blocks(const HMAC_CTX_T *key,        \
+						  const uint8_t *salt, size_t salt_len, \
+						  uint32_t iterations,          \
+						  uint8_t *out, size_t out_len, \
+						  uint32_t first, uint32_t step) \
+{                                                       \
+const size_t hLen = (size_t)(DIGEST_LEN);           \
+const size_t ws = sizeof(WORD_T);                   \
+const unsigned int dw = (unsigned int)(hLen / ws);  \
+\
+HMAC_CTX_T ctx = *key;                              \
+WORD_T U[8], T[8];                                  \
+uint8_t mac[DIGEST_LEN], cnt[4];                    \
+\
+for (uint32_t i = first; (size_t)(i - 1) * hLen < out_len; i += step) { \
+	size_t off = (size_t)(i - 1) * hLen;            \
+	be32(i, cnt);                                   \
+	\
+	/* U1 = PRF(P, S || INT(i)) */                  \
+	HMAC_REINIT(&ctx);                              \
+	if (salt_len)                                   \
+		HMAC_UPDATE(&ctx, salt, salt_len); \
+	HMAC_UPDATE(&ctx, cnt, 4);                      \
+	HMAC_FINAL(&ctx, mac, (unsigned int)hLen);      \
+	for (unsigned int j = 0; j < dw; ++j) {         \
+		PACK(&mac[j * ws], &U[j]);                  \
+		T[j] = U[j];                                \
+	}                                               \
+	\
+	/* U2..Uc */                                    \
+	if (iterations > 1)                             \
+		LOOP(ctx.ctx_inside_reinit.h, ctx.ctx_outside_reinit.h, \
+			 U, T, iterations - 1, dw);             \
+	\
+	for (unsigned int j = 0; j < dw; ++j)           \
+		UNPACK(T[j], &mac[j * ws]);                 \
+	size_t take = (out_len - off < hLen) ? (out_len - off) : hLen; \
+	memcpy(out + off, mac, take);                   \
+}                                                   \
+\
+/* wipe */                                          \
+memset(U, 0, sizeof(U));                            \
+memset(T, 0, sizeof(T));                            \
+memset(mac, 0, sizeof(mac));                        \
+memset(&ctx, 0, sizeof(ctx));                       \
+}                                                       \
+\
+static void NAME##_worker(void *arg, unsigned int index) \
+{                                                       \
+const _ctb_pbkdf2_job *job = (const _ctb_pbkdf2_job *) arg; \
+\
+NAME##_blocks((const HMAC_CTX_T *) job->key, job->salt, job->salt_len, \
+			  job->iterations, job->out, job->out_len, index + 1, job->step); \
+}                                                       \
+\
+void NAME(const uint8_t *password, size_t password_len, \
+		  const uint8_t *salt,     size_t salt_len,     \
+		  uint32_t iterations,                          \
+		  uint8_t *out, size_t out_len)                 \
+{                                                       \
+NAME##_mt(password, password_len, salt, salt_len, iterations, out, out_len, 1); \
+}                                                       \
+\
+void NAME##_mt(const uint8_t *password, size_t password_len, \
+			   const uint8_t *salt,     size_t salt_len,     \
+			   uint32_t iterations,                          \
+			   uint8_t *out, size_t out_len,                 \
+			   unsigned int threads)                         \
+{                                                       \
+if (!out || out_len == 0 || iterations == 0)        \
+	return;                                         \
+\
+const size_t hLen = (size_t)(DIGEST_LEN);           \
+size_t blocks = (out_len + hLen - 1) / hLen;        \
+unsigned int n = threads ? threads : 1;             \
+if (n > blocks) n = (unsigned int) blocks;          \
+if (n > _CTB_HASH_MAX_THREADS) n = _CTB_HASH_MAX_THREADS; \
+\
+HMAC_CTX_T ctx;                                     \
+HMAC_INIT(&ctx, password, (unsigned int)password_len); \
+\
+if (n == 1) {                                       \
+	NAME##_blocks(&ctx, salt, salt_len, iterations, out, out_len, 1, 1); \
+} else {                                            \
+	_ctb_pbkdf2_job job;                            \
+	job.key = &ctx;                                 \
+	job.salt = salt;                                \
+	job.salt_len = salt_len;                        \
+	job.iterations = iterations;                    \
+	job.out = out;                                  \
+	job.out_len = out_len;                          \
+	job.step = n;                                   \
+	_ctb_hash_parallel(NAME##_worker, &job, n);     \
+}                                                   \
+\
+memset(&ctx, 0, sizeof(ctx));                       \
+}
+
+/* Instantiate four PBKDF2 functions (HMAC-SHA2 variants) */
+DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha224,
+			   ctb_hmac_sha224_ctx,
+			   ctb_hmac_sha224_init, ctb_hmac_sha224_reinit,
+			   ctb_hmac_sha224_update, ctb_hmac_sha224_final,
+			   _CTB_SHA224_DIGEST_SIZE,
+			   uint32, PACK32, UNPACK32, _ctb_pbkdf2_sha256_loop)
+
+DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha256,
+			   ctb_hmac_sha256_ctx,
+			   ctb_hmac_sha256_init, ctb_hmac_sha256_reinit,
+			   ctb_hmac_sha256_update, ctb_hmac_sha256_final,
+			   _CTB_SHA256_DIGEST_SIZE,
+			   uint32, PACK32, UNPACK32, _ctb_pbkdf2_sha256_loop)
+
+DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha384,
+			   ctb_hmac_sha384_ctx,
+			   ctb_hmac_sha384_init, ctb_hmac_sha384_reinit,
+			   ctb_hmac_sha384_update, ctb_hmac_sha384_final,
+			   _CTB_SHA384_DIGEST_SIZE,
+			   uint64, PACK64, UNPACK64, _ctb_pbkdf2_sha512_loop)
+
+DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha512,
+			   ctb_hmac_sha512_ctx,
+			   ctb_hmac_sha512_init, ctb_hmac_sha512_reinit,
+			   ctb_hmac_sha512_update, ctb_hmac_sha512_final,
+			   _CTB_SHA512_DIGEST_SIZE,
+			   uint64, PACK64, UNPACK64, _ctb_pbkdf2_sha512_loop)
+
+/* Multi-lane iteration kernels: the midstate loop above with one
+ * independent derivation (password, block index) per lane. All lanes run
+ * the same number of iterations, so they advance in lock step. State
+ * arrays are word-major (x[word * lanes + lane]); the x1 forms are the
+ * table's fallback when there is no vector kernel.
+ */
+static void _ctb_pbkdf2_sha256_x1(const void *istate, const void *ostate,
+								  void *u, void *t, uint32_t rounds)
+{
+	_ctb_pbkdf2_sha256_loop((const uint32 *) istate, (const uint32 *) ostate,
+							(uint32 *) u, (uint32 *) t, rounds, 8);
+}
+
+static void _ctb_pbkdf2_sha512_x1(const void *istate, const void *ostate,
+								  void *u, void *t, uint32_t rounds)
+{
+	_ctb_pbkdf2_sha512_loop((const uint64 *) istate, (const uint64 *) ostate,
+							(uint64 *) u, (uint64 *) t, rounds, 8);
+}
+
+#if _CTB_HASH_X86
+_CTB_HASH_TARGET("avx2")
+static void _ctb_pbkdf2_sha256_x8_avx2(const void *istate, const void *ostate,
+									   void *u, void *t, uint32_t rounds)
+{
+	const __m256i *is = (const __m256i *) istate, *os = (const __m256i *) ostate;
+	__m256i *pu = (__m256i *) u, *pt = (__m256i *) t;
+	__m256i ih[8], oh[8], uv[8], tv[8], s[8], w[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		ih[i] = _mm256_loadu_si256(&is[i]);
+		oh[i] = _mm256_loadu_si256(&os[i]);
+		uv[i] = _mm256_loadu_si256(&pu[i]);
+		tv[i] = _mm256_loadu_si256(&pt[i]);
+	}
+	for (; rounds > 0; rounds--) {
+		for (i = 0; i < 8; i++) {
+			w[i] = uv[i];
+			s[i] = ih[i];
+			w[8 + i] = _mm256_setzero_si256();
+		}
+		w[8] = _mm256_set1_epi32((int) 0x80000000);
+		w[15] = _mm256_set1_epi32((_CTB_SHA256_BLOCK_SIZE + _CTB_SHA256_DIGEST_SIZE) * 8);
+		_ctb_sha256_x8_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			w[i] = _mm256_add_epi32(s[i], ih[i]);
+			s[i] = oh[i];
+			w[8 + i] = _mm256_setzero_si256();
+		}
+		w[8] = _mm256_set1_epi32((int) 0x80000000);
+		w[15] = _mm256_set1_epi32((_CTB_SHA256_BLOCK_SIZE + _CTB_SHA256_DIGEST_SIZE) * 8);
+		_ctb_sha256_x8_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			uv[i] = _mm256_add_epi32(s[i], oh[i]);
+			tv[i] = _mm256_xor_si256(tv[i], uv[i]);
+		}
+	}
+	for (i = 0; i < 8; i++) {
+		_mm256_storeu_si256(&pu[i], uv[i]);
+		_mm256_storeu_si256(&pt[i], tv[i]);
+	}
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_pbkdf2_sha512_x4_avx2(const void *istate, const void *ostate,
+									   void *u, void *t, uint32_t rounds)
+{
+	const __m256i *is = (const __m256i *) istate, *os = (const __m256i *) ostate;
+	__m256i *pu = (__m256i *) u, *pt = (__m256i *) t;
+	__m256i ih[8], oh[8], uv[8], tv[8], s[8], w[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		ih[i] = _mm256_loadu_si256(&is[i]);
+		oh[i] = _mm256_loadu_si256(&os[i]);
+		uv[i] = _mm256_loadu_si256(&pu[i]);
+		tv[i] = _mm256_loadu_si256(&pt[i]);
+	}
+	for (; rounds > 0; rounds--) {
+		for (i = 0; i < 8; i++) {
+			w[i] = uv[i];
+			s[i] = ih[i];
+			w[8 + i] = _mm256_setzero_si256();
+		}
+		w[8] = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+		w[15] = _mm256_set1_epi64x((_CTB_SHA512_BLOCK_SIZE + _CTB_SHA512_DIGEST_SIZE) * 8);
+		_ctb_sha512_x4_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			w[i] = _mm256_add_epi64(s[i], ih[i]);
+			s[i] = oh[i];
+			w[8 + i] = _mm256_setzero_si256();
+		}
+		w[8] = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+		w[15] = _mm256_set1_epi64x((_CTB_SHA512_BLOCK_SIZE + _CTB_SHA512_DIGEST_SIZE) * 8);
+		_ctb_sha512_x4_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			uv[i] = _mm256_add_epi64(s[i], oh[i]);
+			tv[i] = _mm256_xor_si256(tv[i], uv[i]);
+		}
+	}
+	for (i = 0; i < 8; i++) {
+		_mm256_storeu_si256(&pu[i], uv[i]);
+		_mm256_storeu_si256(&pt[i], tv[i]);
+	}
+}
+
+_CTB_HASH_AVX512_DIAG_BEGIN
+
+_CTB_HASH_TARGET("avx512f")
+static void _ctb_pbkdf2_sha256_x16_avx512(const void *istate, const void *ostate,
+										  void *u, void *t, uint32_t rounds)
+{
+	const __m512i *is = (const __m512i *) istate, *os = (const __m512i *) ostate;
+	__m512i *pu = (__m512i *) u, *pt = (__m512i *) t;
+	__m512i ih[8], oh[8], uv[8], tv[8], s[8], w[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		ih[i] = _mm512_loadu_si512((const void *) &is[i]);
+		oh[i] = _mm512_loadu_si512((const void *) &os[i]);
+		uv[i] = _mm512_loadu_si512((const void *) &pu[i]);
+		tv[i] = _mm512_loadu_si512((const void *) &pt[i]);
+	}
+	for (; rounds > 0; rounds--) {
+		for (i = 0; i < 8; i++) {
+			w[i] = uv[i];
+			s[i] = ih[i];
+			w[8 + i] = _mm512_setzero_si512();
+		}
+		w[8] = _mm512_set1_epi32((int) 0x80000000);
+		w[15] = _mm512_set1_epi32((_CTB_SHA256_BLOCK_SIZE + _CTB_SHA256_DIGEST_SIZE) * 8);
+		_ctb_sha256_x16_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			w[i] = _mm512_add_epi32(s[i], ih[i]);
+			s[i] = oh[i];
+			w[8 + i] = _mm512_setzero_si512();
+		}
+		w[8] = _mm512_set1_epi32((int) 0x80000000);
+		w[15] = _mm512_set1_epi32((_CTB_SHA256_BLOCK_SIZE + _CTB_SHA256_DIGEST_SIZE) * 8);
+		_ctb_sha256_x16_rounds(s, w);
+
+		for (i = 0; i < 8; i++) {
+			uv[i] = _mm512_add_epi32(s[i], oh[i]);
+			tv[i] = _mm512_xor_si512(tv[i], uv[i]);
+		}
+	}
+	for (i = 0; i < 8; i++) {
+		_mm512_storeu_si512((void *) &pu[i], uv[i]);
+		_mm512_storeu_si512((void *) &pt[i], tv[i]);
+	}
+}
+
+_CTB_HASH_AVX512_DIAG_END
+#endif /* _CTB_HASH_X86 */
+
+/* Batch PBKDF2: every (password, output block) pair becomes one lane task.
+ * Lane setup (key midstates and U1, which covers the salt) uses the HMAC
+ * context API; iterations 2..c run in the table's iteration kernel.
+ */
+#define DECL_PBKDF2_MANY_FN(NAME,                                               \
+HMAC_CTX_T, HMAC_INIT, HMAC_UPDATE, HMAC_FINAL,                                 \
+WORD_T, PACK, UNPACK, DIGEST_LEN, KT_ITER, KT_LANES)                            \
+void NAME(const uint8_t *const *password, const size_t *password_len,           \
+		  const uint8_t *const *salt,     const size_t *salt_len,               \
+		  uint32_t iterations,                                                  \
+		  uint8_t *out, size_t out_len, size_t count)                           \
+{                                                                               \
+const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();                         \
+const size_t hLen = (size_t)(DIGEST_LEN);                                       \
+const size_t ws = sizeof(WORD_T);                                               \
+unsigned int lanes = kt->KT_LANES;                                              \
+size_t blocks, tasks, k, l, j;                                                  \
+\
+if (!out || out_len == 0 || iterations == 0)                                    \
+	return;                                                                     \
+blocks = (out_len + hLen - 1) / hLen;                                           \
+tasks = count * blocks;                                                         \
+\
+WORD_T is[8 * _CTB_MB_MAX_LANES], os[8 * _CTB_MB_MAX_LANES];                    \
+WORD_T U[8 * _CTB_MB_MAX_LANES], T[8 * _CTB_MB_MAX_LANES];                      \
+uint8_t mac[DIGEST_LEN], cnt[4];                                                \
+HMAC_CTX_T ctx;                                                                 \
+\
+for (k = 0; k < tasks; k += lanes) {                                            \
+	size_t m = (tasks - k < lanes) ? tasks - k : lanes;                         \
+	\
+	memset(is, 0, sizeof(is)); memset(os, 0, sizeof(os));                       \
+	memset(U, 0, sizeof(U));   memset(T, 0, sizeof(T));                         \
+	for (l = 0; l < m; l++) {                                                   \
+		size_t i = (k + l) / blocks, b = (k + l) % blocks;                      \
+		\
+		HMAC_INIT(&ctx, password[i], (unsigned int)password_len[i]);           \
+		for (j = 0; j < 8; j++) {                                               \
+			is[j * lanes + l] = ctx.ctx_inside.h[j];                            \
+			os[j * lanes + l] = ctx.ctx_outside.h[j];                           \
+		}                                                                       \
+		/* U1 = PRF(P, S || INT(b + 1)) */                                      \
+		be32((uint32_t)(b + 1), cnt);                                           \
+		if (salt_len[i])                                                        \
+			HMAC_UPDATE(&ctx, salt[i], salt_len[i]);                            \
+		HMAC_UPDATE(&ctx, cnt, 4);                                              \
+		HMAC_FINAL(&ctx, mac, (unsigned int)hLen);                              \
+		for (j = 0; j < 8; j++) {                                               \
+			PACK(&mac[j * ws], &U[j * lanes + l]);                              \
+			T[j * lanes + l] = U[j * lanes + l];                                \
+		}                                                                       \
+	}                                                                           \
+	\
+	if (iterations > 1)                                                         \
+		kt->KT_ITER(is, os, U, T, iterations - 1);                              \
+	\
+	for (l = 0; l < m; l++) {                                                   \
+		size_t i = (k + l) / blocks, b = (k + l) % blocks;                      \
+		size_t off = b * hLen;                                                  \
+		size_t take = (out_len - off < hLen) ? (out_len - off) : hLen;          \
+		\
+		for (j = 0; j < 8; j++)                                                 \
+			UNPACK(T[j * lanes + l], &mac[j * ws]);                             \
+		memcpy(out + i * out_len + off, mac, take);                             \
+	}                                                                           \
+}                                                                               \
+\
+/* wipe */                                                                      \
+memset(is, 0, sizeof(is)); memset(os, 0, sizeof(os));                           \
+memset(U, 0, sizeof(U));   memset(T, 0, sizeof(T));                             \
+memset(mac, 0, sizeof(mac)); memset(&ctx, 0, sizeof(ctx));                      \
+}
+
+DECL_PBKDF2_MANY_FN(ctb_pbkdf2_hmac_sha256_many,
+					ctb_hmac_sha256_ctx,
+					ctb_hmac_sha256_init, ctb_hmac_sha256_update, ctb_hmac_sha256_final,
+					uint32, PACK32, UNPACK32, _CTB_SHA256_DIGEST_SIZE,
+					pbkdf2_sha256, pbkdf2_sha256_lanes)
+
+DECL_PBKDF2_MANY_FN(ctb_pbkdf2_hmac_sha512_many,
+					ctb_hmac_sha512_ctx,
+					ctb_hmac_sha512_init, ctb_hmac_sha512_update, ctb_hmac_sha512_final,
+					uint64, PACK64, UNPACK64, _CTB_SHA512_DIGEST_SIZE,
+					pbkdf2_sha512, pbkdf2_sha512_lanes)
+
+
+/* =========================================================================
+   GENERIC HASH IMPLEMENTATION
+   ========================================================================= */
+
+#define _CTB_HASH_ALGO_WRAP(NAME, CTX_T, DIGEST_LEN)                               \
+static void _ctb_algo_##NAME##_init(void *ctx)                                     \
+{                                                                                  \
+	ctb_##NAME##_init((CTX_T *) ctx);                                              \
+}                                                                                  \
+static void _ctb_algo_##NAME##_update(void *ctx, const uint8_t *data, size_t len) \
+{                                                                                  \
+	ctb_##NAME##_update((CTX_T *) ctx, data, len);                                 \
+}                                                                                  \
+static void _ctb_algo_##NAME##_final(void *ctx, uint8_t *digest)                   \
+{                                                                                  \
+	ctb_##NAME##_final((CTX_T *) ctx, digest);                                     \
+}                                                                                  \
+static void _ctb_algo_##NAME##_many(const uint8_t *const *msg, const size_t *len,  \
+									uint8_t *digest, size_t count)                 \
+{                                                                                  \
+	ctb_##NAME##_many(msg, len, (uint8_t (*)[DIGEST_LEN]) digest, count);          \
+}
+
+_CTB_HASH_ALGO_WRAP(sha224, ctb_sha224_ctx, _CTB_SHA224_DIGEST_SIZE)
+_CTB_HASH_ALGO_WRAP(sha256, ctb_sha256_ctx, _CTB_SHA256_DIGEST_SIZE)
+_CTB_HASH_ALGO_WRAP(sha384, ctb_sha384_ctx, _CTB_SHA384_DIGEST_SIZE)
+_CTB_HASH_ALGO_WRAP(sha512, ctb_sha512_ctx, _CTB_SHA512_DIGEST_SIZE)
+_CTB_HASH_ALGO_WRAP(ripemd160, ctb_ripemd160_ctx, _CTB_RIPEMD160_DIGEST_LENGTH)
+
+#undef _CTB_HASH_ALGO_WRAP
+
+/* SHA-1 has its digest first and no multi-buffer kernel. */
+static void _ctb_algo_sha1_init(void *ctx)
+{
+	ctb_sha1_init((ctb_sha1_ctx *) ctx);
+}
+
+static void _ctb_algo_sha1_update(void *ctx, const uint8_t *data, size_t len)
+{
+	ctb_sha1_update((ctb_sha1_ctx *) ctx, data, len);
+}
+
+static void _ctb_algo_sha1_final(void *ctx, uint8_t *digest)
+{
+	ctb_sha1_final(digest, (ctb_sha1_ctx *) ctx);
+}
+
+static void _ctb_algo_sha1_many(const uint8_t *const *msg, const size_t *len,
+								uint8_t *digest, size_t count)
+{
+	ctb_sha1_ctx ctx;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		ctb_sha1_init(&ctx);
+		ctb_sha1_update(&ctx, msg[i], len[i]);
+		ctb_sha1_final(digest + i * 20, &ctx);
+	}
+}
+
+/* BLAKE3 spreads one message over its SIMD lanes instead of several. */
+static void _ctb_algo_blake3_init(void *ctx)
+{
+	ctb_blake3_init((ctb_blake3_ctx *) ctx);
+}
+
+static void _ctb_algo_blake3_update(void *ctx, const uint8_t *data, size_t len)
+{
+	ctb_blake3_update((ctb_blake3_ctx *) ctx, data, len);
+}
+
+static void _ctb_algo_blake3_final(void *ctx, uint8_t *digest)
+{
+	ctb_blake3_final((const ctb_blake3_ctx *) ctx, digest);
+}
+
+static void _ctb_algo_blake3_many(const uint8_t *const *msg, const size_t *len,
+								  uint8_t *digest, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		ctb_blake3(msg[i], len[i], digest + i * CTB_BLAKE3_DIGEST_SIZE);
+}
+
+/* BLAKE2 at its full digest length; no multi-buffer kernel either. */
+#define _CTB_HASH_ALGO_BLAKE2(NAME, CTX_T, DIGEST_LEN)                             \
+static void _ctb_algo_##NAME##_init(void *ctx)                                     \
+{                                                                                  \
+	(void) ctb_##NAME##_init((CTX_T *) ctx, DIGEST_LEN);                           \
+}                                                                                  \
+static void _ctb_algo_##NAME##_update(void *ctx, const uint8_t *data, size_t len) \
+{                                                                                  \
+	ctb_##NAME##_update((CTX_T *) ctx, data, len);                                 \
+}                                                                                  \
+static void _ctb_algo_##NAME##_final(void *ctx, uint8_t *digest)                   \
+{                                                                                  \
+	ctb_##NAME##_final((CTX_T *) ctx, digest);                                     \
+}                                                                                  \
+static void _ctb_algo_##NAME##_many(const uint8_t *const *msg, const size_t *len,  \
+									uint8_t *digest, size_t count)                 \
+{                                                                                  \
+	size_t i;                                                                      \
+                                                                                   \
+	for (i = 0; i < count; i++)                                                    \
+		(void) ctb_##NAME(msg[i], len[i], NULL, 0, digest + i * (DIGEST_LEN),      \
+						  DIGEST_LEN);                                             \
+}
+
+_CTB_HASH_ALGO_BLAKE2(blake2b, ctb_blake2b_ctx, CTB_BLAKE2B_DIGEST_SIZE)
+_CTB_HASH_ALGO_BLAKE2(blake2s, ctb_blake2s_ctx, CTB_BLAKE2S_DIGEST_SIZE)
+_CTB_HASH_ALGO_BLAKE2(blake2bp, ctb_blake2bp_ctx, CTB_BLAKE2B_DIGEST_SIZE)
+_CTB_HASH_ALGO_BLAKE2(blake2sp, ctb_blake2sp_ctx, CTB_BLAKE2S_DIGEST_SIZE)
+
+#undef _CTB_HASH_ALGO_BLAKE2
+
+/* Indexed by ctb_hash_id; kernel and lanes are set by _ctb_hash_algo_bind. */
+static ctb_hash_algo _ctb_hash_algos[CTB_HASH_ALGO_COUNT] =
+{
+	{ CTB_HASH_SHA1, "sha1", sizeof(ctb_sha1_ctx), 64, 20,
+	  _ctb_algo_sha1_init, _ctb_algo_sha1_update, _ctb_algo_sha1_final,
+	  _ctb_algo_sha1_many, "scalar", 1 },
+	{ CTB_HASH_SHA224, "sha224", sizeof(ctb_sha224_ctx), _CTB_SHA224_BLOCK_SIZE, _CTB_SHA224_DIGEST_SIZE,
+	  _ctb_algo_sha224_init, _ctb_algo_sha224_update, _ctb_algo_sha224_final,
+	  _ctb_algo_sha224_many, "scalar", 1 },
+	{ CTB_HASH_SHA256, "sha256", sizeof(ctb_sha256_ctx), _CTB_SHA256_BLOCK_SIZE, _CTB_SHA256_DIGEST_SIZE,
+	  _ctb_algo_sha256_init, _ctb_algo_sha256_update, _ctb_algo_sha256_final,
+	  _ctb_algo_sha256_many, "scalar", 1 },
+	{ CTB_HASH_SHA384, "sha384", sizeof(ctb_sha384_ctx), _CTB_SHA384_BLOCK_SIZE, _CTB_SHA384_DIGEST_SIZE,
+	  _ctb_algo_sha384_init, _ctb_algo_sha384_update, _ctb_algo_sha384_final,
+	  _ctb_algo_sha384_many, "scalar", 1 },
+	{ CTB_HASH_SHA512, "sha512", sizeof(ctb_sha512_ctx), _CTB_SHA512_BLOCK_SIZE, _CTB_SHA512_DIGEST_SIZE,
+	  _ctb_algo_sha512_init, _ctb_algo_sha512_update, _ctb_algo_sha512_final,
+	  _ctb_algo_sha512_many, "scalar", 1 },
+	{ CTB_HASH_RIPEMD160, "ripemd160", sizeof(ctb_ripemd160_ctx), _CTB_RIPEMD160_BLOCK_LENGTH,
+	  _CTB_RIPEMD160_DIGEST_LENGTH,
+	  _ctb_algo_ripemd160_init, _ctb_algo_ripemd160_update, _ctb_algo_ripemd160_final,
+	  _ctb_algo_ripemd160_many, "scalar", 1 },
+	{ CTB_HASH_BLAKE3, "blake3", sizeof(ctb_blake3_ctx), CTB_BLAKE3_BLOCK_SIZE, CTB_BLAKE3_DIGEST_SIZE,
+	  _ctb_algo_blake3_init, _ctb_algo_blake3_update, _ctb_algo_blake3_final,
+	  _ctb_algo_blake3_many, "scalar", 1 },
+	{ CTB_HASH_BLAKE2B, "blake2b", sizeof(ctb_blake2b_ctx), CTB_BLAKE2B_BLOCK_SIZE, CTB_BLAKE2B_DIGEST_SIZE,
+	  _ctb_algo_blake2b_init, _ctb_algo_blake2b_update, _ctb_algo_blake2b_final,
+	  _ctb_algo_blake2b_many, "scalar", 1 },
+	{ CTB_HASH_BLAKE2S, "blake2s", sizeof(ctb_blake2s_ctx), CTB_BLAKE2S_BLOCK_SIZE, CTB_BLAKE2S_DIGEST_SIZE,
+	  _ctb_algo_blake2s_init, _ctb_algo_blake2s_update, _ctb_algo_blake2s_final,
+	  _ctb_algo_blake2s_many, "scalar", 1 },
+	{ CTB_HASH_BLAKE2BP, "blake2bp", sizeof(ctb_blake2bp_ctx), CTB_BLAKE2B_BLOCK_SIZE, CTB_BLAKE2B_DIGEST_SIZE,
+	  _ctb_algo_blake2bp_init, _ctb_algo_blake2bp_update, _ctb_algo_blake2bp_final,
+	  _ctb_algo_blake2bp_many, "scalar", 1 },
+	{ CTB_HASH_BLAKE2SP, "blake2sp", sizeof(ctb_blake2sp_ctx), CTB_BLAKE2S_BLOCK_SIZE, CTB_BLAKE2S_DIGEST_SIZE,
+	  _ctb_algo_blake2sp_init, _ctb_algo_blake2sp_update, _ctb_algo_blake2sp_final,
+	  _ctb_algo_blake2sp_many, "scalar", 1 }
+};
+
+/* Called by _ctb_hash_resolve with the freshly selected kernels. */
+static void _ctb_hash_algo_bind(const _ctb_hash_kernel_table *kt)
+{
+	const char *sha256 = kt->sha256_compress == _ctb_sha256_compress_scalar ? "scalar" : "sha-ni";
+	const char *sha512 = kt->sha512_compress == _ctb_sha512_compress_scalar ? "scalar" : "avx2";
+
+	_ctb_hash_algos[CTB_HASH_SHA1].kernel =
+		kt->sha1_compress == _ctb_sha1_compress_scalar ? "scalar" : "sha-ni";
+	_ctb_hash_algos[CTB_HASH_SHA224].kernel = sha256;
+	_ctb_hash_algos[CTB_HASH_SHA224].lanes = kt->sha256_mb_lanes;
+	_ctb_hash_algos[CTB_HASH_SHA256].kernel = sha256;
+	_ctb_hash_algos[CTB_HASH_SHA256].lanes = kt->sha256_mb_lanes;
+	_ctb_hash_algos[CTB_HASH_SHA384].kernel = sha512;
+	_ctb_hash_algos[CTB_HASH_SHA384].lanes = kt->sha512_mb_lanes;
+	_ctb_hash_algos[CTB_HASH_SHA512].kernel = sha512;
+	_ctb_hash_algos[CTB_HASH_SHA512].lanes = kt->sha512_mb_lanes;
+	_ctb_hash_algos[CTB_HASH_RIPEMD160].lanes = kt->ripemd160_mb_lanes;
+	_ctb_hash_algos[CTB_HASH_BLAKE3].kernel =
+		kt->blake3_lanes == 16 ? "avx512" : kt->blake3_lanes == 8 ? "avx2"
+		: kt->blake3_lanes == 4 ? "sse4.1" : "scalar";
+	_ctb_hash_algos[CTB_HASH_BLAKE2B].kernel =
+		kt->blake2b_compress == _ctb_blake2b_compress_scalar ? "scalar" : "avx2";
+	_ctb_hash_algos[CTB_HASH_BLAKE2S].kernel =
+		kt->blake2s_compress == _ctb_blake2s_compress_scalar ? "scalar" : "sse4.1";
+	_ctb_hash_algos[CTB_HASH_BLAKE2BP].kernel = kt->blake2bp_many ? "avx2" : "scalar";
+	_ctb_hash_algos[CTB_HASH_BLAKE2SP].kernel =
+		kt->blake2sp_many ? "avx2" : _ctb_hash_algos[CTB_HASH_BLAKE2S].kernel;
+}
+
+const ctb_hash_algo *ctb_hash_algo_get(ctb_hash_id id)
+{
+	if ((unsigned int) id >= CTB_HASH_ALGO_COUNT)
+		return NULL;
+	_ctb_hash_kernels();
+	return &_ctb_hash_algos[id];
+}
+
+const ctb_hash_algo *ctb_hash_algo_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < CTB_HASH_ALGO_COUNT; i++) {
+		if (strcmp(_ctb_hash_algos[i].name, name) == 0)
+			return ctb_hash_algo_get((ctb_hash_id) i);
+	}
+	return NULL;
+}
+
+void ctb_hash_digest(const ctb_hash_algo *algo, const uint8_t *msg, size_t len, uint8_t *digest)
+{
+	ctb_hash_ctx ctx;
+
+	algo->init(&ctx);
+	algo->update(&ctx, msg, len);
+	algo->final(&ctx, digest);
+}
+
+void ctb_hmac_init(ctb_hmac_ctx *ctx, const ctb_hash_algo *algo, const uint8_t *key, size_t key_len)
+{
+	uint8_t pad[_CTB_SHA512_BLOCK_SIZE];
+	size_t i;
+
+	ctx->algo = algo;
+	memset(pad, 0, algo->block_size);
+	if (key_len > algo->block_size)
+		ctb_hash_digest(algo, key, key_len, pad);
+	else if (key_len)
+		memcpy(pad, key, key_len);
+
+	for (i = 0; i < algo->block_size; i++)
+		pad[i] ^= 0x36;
+	algo->init(&ctx->inner);
+	algo->update(&ctx->inner, pad, algo->block_size);
+
+	for (i = 0; i < algo->block_size; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	algo->init(&ctx->outer);
+	algo->update(&ctx->outer, pad, algo->block_size);
+
+	memcpy(&ctx->work, &ctx->inner, algo->ctx_size);
+	ctb__memzero(pad, sizeof(pad));
+}
+
+void ctb_hmac_update(ctb_hmac_ctx *ctx, const uint8_t *msg, size_t len)
+{
+	ctx->algo->update(&ctx->work, msg, len);
+}
+
+void ctb_hmac_final(ctb_hmac_ctx *ctx, uint8_t *mac)
+{
+	const ctb_hash_algo *algo = ctx->algo;
+	uint8_t ih[_CTB_SHA512_DIGEST_SIZE];
+
+	algo->final(&ctx->work, ih);
+	memcpy(&ctx->work, &ctx->outer, algo->ctx_size);
+	algo->update(&ctx->work, ih, algo->digest_size);
+	algo->final(&ctx->work, mac);
+	memcpy(&ctx->work, &ctx->inner, algo->ctx_size);
+}
+
+void ctb_hmac(const ctb_hash_algo *algo, const uint8_t *key, size_t key_len,
+			  const uint8_t *msg, size_t len, uint8_t *mac)
+{
+	ctb_hmac_ctx ctx;
+
+	ctb_hmac_init(&ctx, algo, key, key_len);
+	ctb_hmac_update(&ctx, msg, len);
+	ctb_hmac_final(&ctx, mac);
+	ctb__memzero(&ctx, sizeof(ctx));
+}
+
+void ctb_pbkdf2_hmac(const ctb_hash_algo *algo,
+					 const uint8_t *password, size_t password_len,
+					 const uint8_t *salt,     size_t salt_len,
+					 uint32_t iterations,
+					 uint8_t *out, size_t out_len)
+{
+	const size_t hlen = algo->digest_size;
+	uint8_t u[_CTB_SHA512_DIGEST_SIZE], t[_CTB_SHA512_DIGEST_SIZE], cnt[4];
+	ctb_hmac_ctx ctx;
+	uint32_t b, c;
+	size_t off, j;
+
+	switch (algo->id) {
+	case CTB_HASH_SHA224:
+		ctb_pbkdf2_hmac_sha224(password, password_len, salt, salt_len, iterations, out, out_len);
+		return;
+	case CTB_HASH_SHA256:
+		ctb_pbkdf2_hmac_sha256(password, password_len, salt, salt_len, iterations, out, out_len);
+		return;
+	case CTB_HASH_SHA384:
+		ctb_pbkdf2_hmac_sha384(password, password_len, salt, salt_len, iterations, out, out_len);
+		return;
+	case CTB_HASH_SHA512:
+		ctb_pbkdf2_hmac_sha512(password, password_len, salt, salt_len, iterations, out, out_len);
+		return;
+	default:
+		break;
+	}
+
+	if (!out || out_len == 0 || iterations == 0)
+		return;
+
+	ctb_hmac_init(&ctx, algo, password, password_len);
+	for (b = 1, off = 0; off < out_len; b++, off += hlen) {
+		be32(b, cnt);
+		ctb_hmac_update(&ctx, salt, salt_len);
+		ctb_hmac_update(&ctx, cnt, 4);
+		ctb_hmac_final(&ctx, u);
+		memcpy(t, u, hlen);
+		for (c = 1; c < iterations; c++) {
+			ctb_hmac_update(&ctx, u, hlen);
+			ctb_hmac_final(&ctx, u);
+			for (j = 0; j < hlen; j++)
+				t[j] ^= u[j];
+		}
+		memcpy(out + off, t, out_len - off < hlen ? out_len - off : hlen);
+	}
+
+	ctb__memzero(u, sizeof(u));
+	ctb__memzero(t, sizeof(t));
+	ctb__memzero(&ctx, sizeof(ctx));
+}
+
+
+/* =========================================================================
+   FILE HASHING IMPLEMENTATION
+   ========================================================================= */
+
+#if defined(_WIN32)
+typedef HANDLE _ctb_hash_fd;
+#elif defined(__unix__) || defined(__APPLE__)
+#define _CTB_HASH_FILE_POSIX 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+typedef int _ctb_hash_fd;
+#else
+typedef FILE *_ctb_hash_fd;
+#endif
+
+#define _CTB_HASH_FILE_CHUNK	((size_t) 4 << 20)
+
+/* Where the file data goes: an algorithm's update, or the multi-hash one. */
+typedef struct
+{
+	void	(*update)(void *ctx, const uint8_t *data, size_t len);
+	void	*ctx;
+} _ctb_hash_stream;
+
+size_t ctb_hash_digest_size(ctb_hash_id id)
+{
+	const ctb_hash_algo *algo = ctb_hash_algo_get(id);
+
+	return algo ? algo->digest_size : 0;
+}
+
+static void _ctb_hash_stream_update(_ctb_hash_stream *s, const unsigned char *data, size_t len)
+{
+	s->update(s->ctx, data, len);
+}
+
+/* Reads until buf is full or the file ends. Returns the byte count, or
+ * (size_t) -1 on a read error.
+ */
+static size_t _ctb_hash_fd_read(_ctb_hash_fd fd, unsigned char *buf, size_t cap)
+{
+	size_t got = 0;
+
+	while (got < cap) {
+#if defined(_WIN32)
+		DWORD n = 0;
+
+		if (!ReadFile(fd, buf + got, (DWORD) (cap - got), &n, NULL)) {
+			if (GetLastError() == ERROR_BROKEN_PIPE)
+				break;
+			return (size_t) -1;
+		}
+#elif defined(_CTB_HASH_FILE_POSIX)
+		ssize_t n = read(fd, buf + got, cap - got);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (size_t) -1;
+		}
+#else
+		size_t n = fread(buf + got, 1, cap - got, fd);
+
+		if (n == 0 && ferror(fd))
+			return (size_t) -1;
+#endif
+		if (n == 0)
+			break;
+		got += (size_t) n;
+	}
+	return got;
+}
+
+/* Hashes a regular file through a read-only mapping. Returns 0 when done,
+ * 1 when the file cannot be mapped and has to be streamed instead.
+ */
+static int _ctb_hash_file_map(_ctb_hash_stream *s, _ctb_hash_fd fd)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER size;
+	HANDLE map;
+	const unsigned char *view;
+
+	if (GetFileType(fd) != FILE_TYPE_DISK || !GetFileSizeEx(fd, &size)
+		|| size.QuadPart <= 0 || (LONGLONG) (size_t) size.QuadPart != size.QuadPart)
+		return 1;
+	map = CreateFileMappingA(fd, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!map)
+		return 1;
+	view = (const unsigned char *) MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(map);
+	if (!view)
+		return 1;
+	_ctb_hash_stream_update(s, view, (size_t) size.QuadPart);
+	UnmapViewOfFile(view);
+	return 0;
+#elif defined(_CTB_HASH_FILE_POSIX)
+	struct stat st;
+	size_t size;
+	void *view;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0
+		|| (off_t) (size_t) st.st_size != st.st_size)
+		return 1;
+	size = (size_t) st.st_size;
+	view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+		return 1;
+#if defined(MADV_SEQUENTIAL)
+	madvise(view, size, MADV_SEQUENTIAL);
+#elif defined(POSIX_MADV_SEQUENTIAL)
+	posix_madvise(view, size, POSIX_MADV_SEQUENTIAL);
+#endif
+	_ctb_hash_stream_update(s, (const unsigned char *) view, size);
+	munmap(view, size);
+	return 0;
+#else
+	(void) s;
+	(void) fd;
+	return 1;
+#endif
+}
+
+/* Reads and hashes one chunk at a time on the calling thread. */
+static int _ctb_hash_file_serial(_ctb_hash_stream *s, _ctb_hash_fd fd, unsigned char *buf)
+{
+	for (;;) {
+		size_t n = _ctb_hash_fd_read(fd, buf, _CTB_HASH_FILE_CHUNK);
+
+		if (n == (size_t) -1)
+			return -1;
+		_ctb_hash_stream_update(s, buf, n);
+		if (n < _CTB_HASH_FILE_CHUNK)
+			return 0;
+	}
+}
+
+#if _CTB_HASH_THREADS
+/* Two chunk slots shared by the reader thread and the hashing caller.
+ * full[i] is set by the reader once buf[i] holds len[i] bytes and cleared
+ * by the caller once they are hashed; both wait on cv under lock.
+ */
+typedef struct
+{
+	_ctb_hash_fd			fd;
+	unsigned char			*buf[2];
+	size_t					len[2];
+	int						full[2];
+#if defined(_WIN32)
+	CRITICAL_SECTION		lock;
+	CONDITION_VARIABLE		cv;
+#else
+	pthread_mutex_t			lock;
+	pthread_cond_t			cv;
+#endif
+} _ctb_hash_file_pipe;
+
+#if defined(_WIN32)
+	#define _CTB_HASH_PIPE_LOCK(p)		EnterCriticalSection(&(p)->lock)
+	#define _CTB_HASH_PIPE_UNLOCK(p)	LeaveCriticalSection(&(p)->lock)
+	#define _CTB_HASH_PIPE_WAIT(p)		SleepConditionVariableCS(&(p)->cv, &(p)->lock, INFINITE)
+	#define _CTB_HASH_PIPE_WAKE(p)		WakeConditionVariable(&(p)->cv)
+#else
+	#define _CTB_HASH_PIPE_LOCK(p)		pthread_mutex_lock(&(p)->lock)
+	#define _CTB_HASH_PIPE_UNLOCK(p)	pthread_mutex_unlock(&(p)->lock)
+	#define _CTB_HASH_PIPE_WAIT(p)		pthread_cond_wait(&(p)->cv, &(p)->lock)
+	#define _CTB_HASH_PIPE_WAKE(p)		pthread_cond_signal(&(p)->cv)
+#endif
+
+/* Reader thread: fills the slots in turn until a short read (end of file)
+ * or a read error, which is handed over like any other chunk.
+ */
+static void _ctb_hash_file_reader(_ctb_hash_file_pipe *p)
+{
+	unsigned int slot = 0;
+	size_t n;
+
+	do {
+		_CTB_HASH_PIPE_LOCK(p);
+		while (p->full[slot])
+			_CTB_HASH_PIPE_WAIT(p);
+		_CTB_HASH_PIPE_UNLOCK(p);
+
+		n = _ctb_hash_fd_read(p->fd, p->buf[slot], _CTB_HASH_FILE_CHUNK);
+
+		_CTB_HASH_PIPE_LOCK(p);
+		p->len[slot] = n;
+		p->full[slot] = 1;
+		_CTB_HASH_PIPE_WAKE(p);
+		_CTB_HASH_PIPE_UNLOCK(p);
+		slot ^= 1;
+	} while (n == _CTB_HASH_FILE_CHUNK);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _ctb_hash_file_reader_main(LPVOID p)
+{
+	_ctb_hash_file_reader((_ctb_hash_file_pipe *) p);
+	return 0;
+}
+#else
+static void *_ctb_hash_file_reader_main(void *p)
+{
+	_ctb_hash_file_reader((_ctb_hash_file_pipe *) p);
+	return NULL;
+}
+#endif
+#endif
+
+/* Double-buffered read loop: one reader thread per file fills a chunk
+ * while the caller hashes the other. A short chunk means end of file.
+ * Without threads, or when the reader cannot be started, chunks are read
+ * and hashed in turn on the calling thread.
+ */
+static int _ctb_hash_file_stream(_ctb_hash_stream *s, _ctb_hash_fd fd)
+{
+	unsigned char *mem;
+	int ret = 0;
+#if _CTB_HASH_THREADS
+	_ctb_hash_file_pipe p;
+	unsigned int slot = 0;
+	size_t n;
+#if defined(_WIN32)
+	HANDLE th;
+#else
+	pthread_t th;
+#endif
+#endif
+
+	mem = (unsigned char *) malloc((_CTB_HASH_THREADS ? 2 : 1) * _CTB_HASH_FILE_CHUNK);
+	if (!mem)
+		return -1;
+
+#if _CTB_HASH_THREADS
+	p.fd = fd;
+	p.buf[0] = mem;
+	p.buf[1] = mem + _CTB_HASH_FILE_CHUNK;
+	p.full[0] = p.full[1] = 0;
+#if defined(_WIN32)
+	InitializeCriticalSection(&p.lock);
+	InitializeConditionVariable(&p.cv);
+	th = CreateThread(NULL, 0, _ctb_hash_file_reader_main, &p, 0, NULL);
+	if (!th) {
+		DeleteCriticalSection(&p.lock);
+		ret = _ctb_hash_file_serial(s, fd, mem);
+		free(mem);
+		return ret;
+	}
+#else
+	if (pthread_mutex_init(&p.lock, NULL) != 0) {
+		ret = _ctb_hash_file_serial(s, fd, mem);
+		free(mem);
+		return ret;
+	}
+	if (pthread_cond_init(&p.cv, NULL) != 0
+		|| pthread_create(&th, NULL, _ctb_hash_file_reader_main, &p) != 0) {
+		pthread_mutex_destroy(&p.lock);
+		ret = _ctb_hash_file_serial(s, fd, mem);
+		free(mem);
+		return ret;
+	}
+#endif
+
+	do {
+		_CTB_HASH_PIPE_LOCK(&p);
+		while (!p.full[slot])
+			_CTB_HASH_PIPE_WAIT(&p);
+		n = p.len[slot];
+		_CTB_HASH_PIPE_UNLOCK(&p);
+
+		if (n == (size_t) -1) {
+			ret = -1;
+			break;
+		}
+		_ctb_hash_stream_update(s, p.buf[slot], n);
+
+		_CTB_HASH_PIPE_LOCK(&p);
+		p.full[slot] = 0;
+		_CTB_HASH_PIPE_WAKE(&p);
+		_CTB_HASH_PIPE_UNLOCK(&p);
+		slot ^= 1;
+	} while (n == _CTB_HASH_FILE_CHUNK);
+
+	/* The reader has handed over its last chunk by now, so it exits. */
+#if defined(_WIN32)
+	WaitForSingleObject(th, INFINITE);
+	CloseHandle(th);
+	DeleteCriticalSection(&p.lock);
+#else
+	pthread_join(th, NULL);
+	pthread_cond_destroy(&p.cv);
+	pthread_mutex_destroy(&p.lock);
+#endif
+#else
+	ret = _ctb_hash_file_serial(s, fd, mem);
+#endif
+
+	free(mem);
+	return ret;
+}
+
+/* Opens path and feeds all of it to s. Returns 0, or -1 on an open/read
+ * error.
+ */
+static int _ctb_hash_file_run(const char *path, _ctb_hash_stream *s)
+{
+	_ctb_hash_fd fd;
+	int ret;
+
+#if defined(_WIN32)
+	fd = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+					 FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fd == INVALID_HANDLE_VALUE)
+		return -1;
+#elif defined(_CTB_HASH_FILE_POSIX)
+	do {
+		fd = open(path, O_RDONLY);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0)
+		return -1;
+#else
+	fd = fopen(path, "rb");
+	if (!fd)
+		return -1;
+#endif
+
+	ret = _ctb_hash_file_map(s, fd);
+	if (ret > 0)
+		ret = _ctb_hash_file_stream(s, fd);
+
+#if defined(_WIN32)
+	CloseHandle(fd);
+#elif defined(_CTB_HASH_FILE_POSIX)
+	close(fd);
+#else
+	fclose(fd);
+#endif
+	return ret;
+}
+
+int ctb_hash_file(const char *path, ctb_hash_id id, uint8_t *out)
+{
+	const ctb_hash_algo *algo = ctb_hash_algo_get(id);
+	ctb_hash_ctx ctx;
+	_ctb_hash_stream s;
+
+	if (!algo)
+		return -1;
+	algo->init(&ctx);
+	s.update = algo->update;
+	s.ctx = &ctx;
+	if (_ctb_hash_file_run(path, &s) != 0)
+		return -1;
+	algo->final(&ctx, out);
+	return 0;
+}
+
+
+/* =========================================================================
+   TREE HASH IMPLEMENTATION
+   ========================================================================= */
+
+/* Leaves go through the multi-buffer path with the domain block already
+ * absorbed into the IV (prefix_len = one block), so every chunk starts
+ * block-aligned. The stack holds the roots of complete subtrees, largest
+ * first; after c chunks it has popcount(c) entries, which is the merge
+ * rule. Each thread hashes a power-of-two run of chunks that starts at a
+ * multiple of its size and returns that subtree's root.
+ */
+#define _CTB_TREE_LEAF			0x00
+#define _CTB_TREE_NODE			0x01
+#define _CTB_TREE_MAX_RUN_LOG	10		/* at most 2^10 chunks per thread and pass */
+
+typedef void (*_ctb_tree_hash_fn)(const void *iv, const unsigned char *const *message,
+								  const size_t *len, unsigned char *cv, size_t count);
+
+typedef struct
+{
+	_ctb_tree_hash_fn	hash;
+	const void			*leaf_iv;
+	const void			*node_iv;
+	unsigned int		cv_len;
+	unsigned int		threads;
+	uint64_t			*chunks;
+	unsigned int		*depth;
+	unsigned char		*stack;			/* _CTB_HASH_TREE_MAX_DEPTH * cv_len */
+} _ctb_tree;
+
+typedef struct
+{
+	const _ctb_tree		*t;
+	const unsigned char	*data;
+	size_t				run;			/* chunks per thread, a power of two */
+	unsigned char		cv[_CTB_HASH_MAX_THREADS * _CTB_SHA512_DIGEST_SIZE];
+} _ctb_tree_job;
+
+static unsigned int _ctb_tree_popcount(uint64_t x)
+{
+	unsigned int n = 0;
+
+	for (; x; x &= x - 1)
+		n++;
+	return n;
+}
+
+/* Replaces the top two stack entries with their parent until the stack
+ * has `keep` entries.
+ */
+static void _ctb_tree_merge(const _ctb_tree *t, unsigned char *stack, unsigned int *depth,
+							unsigned int keep)
+{
+	const unsigned int cv_len = t->cv_len;
+	unsigned char parent[_CTB_SHA512_DIGEST_SIZE];
+
+	while (*depth > keep) {
+		const unsigned char *pair = stack + (*depth - 2) * cv_len;
+		size_t len = 2 * cv_len;
+
+		t->hash(t->node_iv, &pair, &len, parent, 1);
+		memcpy(stack + (*depth - 2) * cv_len, parent, cv_len);
+		(*depth)--;
+	}
+}
+
+/* Root of the subtree over run chunks starting at data. */
+static void _ctb_tree_run(const _ctb_tree *t, const unsigned char *data, size_t run,
+						  unsigned char *cv)
+{
+	const unsigned int cv_len = t->cv_len;
+	unsigned char stack[(_CTB_TREE_MAX_RUN_LOG + 1) * _CTB_SHA512_DIGEST_SIZE];
+	unsigned char leaves[_CTB_MB_MAX_LANES * _CTB_SHA512_DIGEST_SIZE];
+	const unsigned char *msg[_CTB_MB_MAX_LANES];
+	size_t len[_CTB_MB_MAX_LANES];
+	unsigned int depth = 0;
+	size_t done = 0;
+
+	while (done < run) {
+		size_t k = run - done < _CTB_MB_MAX_LANES ? run - done : _CTB_MB_MAX_LANES;
+		size_t j;
+
+		for (j = 0; j < k; j++) {
+			msg[j] = data + (done + j) * CTB_HASH_TREE_CHUNK_SIZE;
+			len[j] = CTB_HASH_TREE_CHUNK_SIZE;
+		}
+		t->hash(t->leaf_iv, msg, len, leaves, k);
+
+		for (j = 0; j < k; j++) {
+			memcpy(stack + depth * cv_len, leaves + j * cv_len, cv_len);
+			depth++;
+			done++;
+			_ctb_tree_merge(t, stack, &depth, _ctb_tree_popcount(done));
+		}
+	}
+	memcpy(cv, stack, cv_len);
+}
+
+static void _ctb_tree_worker(void *arg, unsigned int index)
+{
+	_ctb_tree_job *job = (_ctb_tree_job *) arg;
+
+	_ctb_tree_run(job->t, job->data + index * job->run * CTB_HASH_TREE_CHUNK_SIZE,
+				  job->run, job->cv + index * job->t->cv_len);
+}
+
+/* Folds n full chunks into the stack. Each pass hands every thread one
+ * aligned run of chunks; runs shrink towards the end of the input so that
+ * all threads stay busy.
+ */
+static void _ctb_tree_chunks(const _ctb_tree *t, const unsigned char *data, size_t n)
+{
+	_ctb_tree_job job;
+
+	job.t = t;
+	while (n) {
+		size_t run = (size_t) 1 << _CTB_TREE_MAX_RUN_LOG;
+		unsigned int parts, i;
+
+		while (run > 1 && ((*t->chunks & (run - 1)) || run * t->threads > n))
+			run >>= 1;
+		parts = (unsigned int) (n / run < t->threads ? n / run : t->threads);
+
+		job.data = data;
+		job.run = run;
+		_ctb_hash_parallel(_ctb_tree_worker, &job, parts);
+
+		for (i = 0; i < parts; i++) {
+			memcpy(t->stack + *t->depth * t->cv_len, job.cv + i * t->cv_len, t->cv_len);
+			(*t->depth)++;
+			*t->chunks += run;
+			_ctb_tree_merge(t, t->stack, t->depth, _ctb_tree_popcount(*t->chunks));
+		}
+		data += parts * run * CTB_HASH_TREE_CHUNK_SIZE;
+		n -= parts * run;
+	}
+}
+
+/* Appends the last chunk's digest (if any) and folds the stack right to
+ * left into the root.
+ */
+static void _ctb_tree_root(const _ctb_tree *t, const unsigned char *last, unsigned char *digest)
+{
+	if (last) {
+		memcpy(t->stack + *t->depth * t->cv_len, last, t->cv_len);
+		(*t->depth)++;
+	}
+	_ctb_tree_merge(t, t->stack, t->depth, 1);
+	memcpy(digest, t->stack, t->cv_len);
+}
+
+static unsigned int _ctb_tree_threads(unsigned int threads)
+{
+	if (threads == 0)
+		return _ctb_hash_cpu_count();
+	return threads < _CTB_HASH_MAX_THREADS ? threads : _CTB_HASH_MAX_THREADS;
+}
+
+/* SHA-256 tree */
+
+static void _ctb_tree_sha256_hash(const void *iv, const unsigned char *const *message,
+								  const size_t *len, unsigned char *cv, size_t count)
+{
+	_ctb_sha256_mb((const uint32 *) iv, _CTB_SHA256_BLOCK_SIZE, _CTB_SHA256_DIGEST_SIZE,
+				   message, len, cv, count);
+}
+
+static void _ctb_tree_sha256_iv(unsigned char tag, uint32 iv[8])
+{
+	unsigned char block[_CTB_SHA256_BLOCK_SIZE] = {0};
+
+	block[0] = tag;
+	memcpy(iv, sha256_h0, 8 * sizeof(uint32));
+	_ctb_hash_kernels()->sha256_compress(iv, block, 1);
+}
+
+static void _ctb_tree_sha256_view(ctb_sha256_tree_ctx *ctx, _ctb_tree *t)
+{
+	t->hash = _ctb_tree_sha256_hash;
+	t->leaf_iv = ctx->leaf_iv;
+	t->node_iv = ctx->node_iv;
+	t->cv_len = _CTB_SHA256_DIGEST_SIZE;
+	t->threads = ctx->threads;
+	t->chunks = &ctx->chunks;
+	t->depth = &ctx->depth;
+	t->stack = &ctx->stack[0][0];
+}
+
+static void _ctb_tree_sha256_leaf_reset(ctb_sha256_tree_ctx *ctx)
+{
+	memcpy(ctx->leaf.h, ctx->leaf_iv, sizeof(ctx->leaf.h));
+	ctx->leaf.tot_len = _CTB_SHA256_BLOCK_SIZE;
+	ctx->leaf.len = 0;
+	ctx->leaf_len = 0;
+}
+
+void ctb_sha256_tree_init(ctb_sha256_tree_ctx *ctx, unsigned int threads)
+{
+	_ctb_tree_sha256_iv(_CTB_TREE_LEAF, ctx->leaf_iv);
+	_ctb_tree_sha256_iv(_CTB_TREE_NODE, ctx->node_iv);
+	_ctb_tree_sha256_leaf_reset(ctx);
+	ctx->threads = _ctb_tree_threads(threads);
+	ctx->chunks = 0;
+	ctx->depth = 0;
+}
+
+void ctb_sha256_tree_update(ctb_sha256_tree_ctx *ctx, const unsigned char *message, size_t len)
+{
+	_ctb_tree t;
+	size_t n;
+
+	_ctb_tree_sha256_view(ctx, &t);
+
+	if (ctx->leaf_len) {
+		size_t take = CTB_HASH_TREE_CHUNK_SIZE - ctx->leaf_len;
+		unsigned char cv[_CTB_SHA256_DIGEST_SIZE];
+
+		if (len < take) {
+			ctb_sha256_update(&ctx->leaf, message, len);
+			ctx->leaf_len += (unsigned int) len;
+			return;
+		}
+		ctb_sha256_update(&ctx->leaf, message, take);
+		ctb_sha256_final(&ctx->leaf, cv);
+		_ctb_tree_sha256_leaf_reset(ctx);
+		memcpy(ctx->stack[ctx->depth++], cv, sizeof(cv));
+		ctx->chunks++;
+		_ctb_tree_merge(&t, t.stack, t.depth, _ctb_tree_popcount(ctx->chunks));
+		message += take;
+		len -= take;
+	}
+
+	n = len / CTB_HASH_TREE_CHUNK_SIZE;
+	if (n) {
+		_ctb_tree_chunks(&t, message, n);
+		message += n * CTB_HASH_TREE_CHUNK_SIZE;
+		len -= n * CTB_HASH_TREE_CHUNK_SIZE;
+	}
+	if (len) {
+		ctb_sha256_update(&ctx->leaf, message, len);
+		ctx->leaf_len = (unsigned int) len;
+	}
+}
+
+void ctb_sha256_tree_final(ctb_sha256_tree_ctx *ctx, unsigned char *digest)
+{
+	unsigned char cv[_CTB_SHA256_DIGEST_SIZE];
+	_ctb_tree t;
+
+	_ctb_tree_sha256_view(ctx, &t);
+	if (ctx->leaf_len || ctx->chunks == 0) {
+		ctb_sha256_final(&ctx->leaf, cv);
+		_ctb_tree_root(&t, cv, digest);
+	} else {
+		_ctb_tree_root(&t, NULL, digest);
+	}
+}
+
+void ctb_sha256_tree(const unsigned char *message, size_t len, unsigned char *digest,
+					 unsigned int threads)
+{
+	ctb_sha256_tree_ctx ctx;
+
+	ctb_sha256_tree_init(&ctx, threads);
+	ctb_sha256_tree_update(&ctx, message, len);
+	ctb_sha256_tree_final(&ctx, digest);
+}
+
+/* SHA-512 tree */
+
+static void _ctb_tree_sha512_hash(const void *iv, const unsigned char *const *message,
+								  const size_t *len, unsigned char *cv, size_t count)
+{
+	_ctb_sha512_mb((const uint64 *) iv, _CTB_SHA512_BLOCK_SIZE, _CTB_SHA512_DIGEST_SIZE,
+				   message, len, cv, count);
+}
+
+static void _ctb_tree_sha512_iv(unsigned char tag, uint64 iv[8])
+{
+	unsigned char block[_CTB_SHA512_BLOCK_SIZE] = {0};
+
+	block[0] = tag;
+	memcpy(iv, sha512_h0, 8 * sizeof(uint64));
+	_ctb_hash_kernels()->sha512_compress(iv, block, 1);
+}
+
+static void _ctb_tree_sha512_view(ctb_sha512_tree_ctx *ctx, _ctb_tree *t)
+{
+	t->hash = _ctb_tree_sha512_hash;
+	t->leaf_iv = ctx->leaf_iv;
+	t->node_iv = ctx->node_iv;
+	t->cv_len = _CTB_SHA512_DIGEST_SIZE;
+	t->threads = ctx->threads;
+	t->chunks = &ctx->chunks;
+	t->depth = &ctx->depth;
+	t->stack = &ctx->stack[0][0];
+}
+
+static void _ctb_tree_sha512_leaf_reset(ctb_sha512_tree_ctx *ctx)
+{
+	memcpy(ctx->leaf.h, ctx->leaf_iv, sizeof(ctx->leaf.h));
+	ctx->leaf.tot_len = _CTB_SHA512_BLOCK_SIZE;
+	ctx->leaf.len = 0;
+	ctx->leaf_len = 0;
+}
+
+void ctb_sha512_tree_init(ctb_sha512_tree_ctx *ctx, unsigned int threads)
+{
+	_ctb_tree_sha512_iv(_CTB_TREE_LEAF, ctx->leaf_iv);
+	_ctb_tree_sha512_iv(_CTB_TREE_NODE, ctx->node_iv);
+	_ctb_tree_sha512_leaf_reset(ctx);
+	ctx->threads = _ctb_tree_threads(threads);
+	ctx->chunks = 0;
+	ctx->depth = 0;
+}
+
+void ctb_sha512_tree_update(ctb_sha512_tree_ctx *ctx, const unsigned char *message, size_t len)
+{
+	_ctb_tree t;
+	size_t n;
+
+	_ctb_tree_sha512_view(ctx, &t);
+
+	if (ctx->leaf_len) {
+		size_t take = CTB_HASH_TREE_CHUNK_SIZE - ctx->leaf_len;
+		unsigned char cv[_CTB_SHA512_DIGEST_SIZE];
+
+		if (len < take) {
+			ctb_sha512_update(&ctx->leaf, message, len);
+			ctx->leaf_len += (unsigned int) len;
+			return;
+		}
+		ctb_sha512_update(&ctx->leaf, message, take);
+		ctb_sha512_final(&ctx->leaf, cv);
+		_ctb_tree_sha512_leaf_reset(ctx);
+		memcpy(ctx->stack[ctx->depth++], cv, sizeof(cv));
+		ctx->chunks++;
+		_ctb_tree_merge(&t, t.stack, t.depth, _ctb_tree_popcount(ctx->chunks));
+		message += take;
+		len -= take;
+	}
+
+	n = len / CTB_HASH_TREE_CHUNK_SIZE;
+	if (n) {
+		_ctb_tree_chunks(&t, message, n);
+		message += n * CTB_HASH_TREE_CHUNK_SIZE;
+		len -= n * CTB_HASH_TREE_CHUNK_SIZE;
+	}
+	if (len) {
+		ctb_sha512_update(&ctx->leaf, message, len);
+		ctx->leaf_len = (unsigned int) len;
+	}
+}
+
+void ctb_sha512_tree_final(ctb_sha512_tree_ctx *ctx, unsigned char *digest)
+{
+	unsigned char cv[_CTB_SHA512_DIGEST_SIZE];
+	_ctb_tree t;
+
+	_ctb_tree_sha512_view(ctx, &t);
+	if (ctx->leaf_len || ctx->chunks == 0) {
+		ctb_sha512_final(&ctx->leaf, cv);
+		_ctb_tree_root(&t, cv, digest);
+	} else {
+		_ctb_tree_root(&t, NULL, digest);
+	}
+}
+
+void ctb_sha512_tree(const unsigned char *message, size_t len, unsigned char *digest,
+					 unsigned int threads)
+{
+	ctb_sha512_tree_ctx ctx;
+
+	ctb_sha512_tree_init(&ctx, threads);
+	ctb_sha512_tree_update(&ctx, message, len);
+	ctb_sha512_tree_final(&ctx, digest);
+}
+
+#undef _CTB_TREE_LEAF
+#undef _CTB_TREE_NODE
+
+
+/* =========================================================================
+   MERKLE IMPLEMENTATION
+   ========================================================================= */
+
+/* Level l holds the capacity >> l complete nodes it can ever have; with
+ * n leaves the first n >> l of them are filled. The nodes on the right
+ * edge that cover an unfinished tail are never stored, they are rebuilt
+ * from the stored ones when a root or proof is asked for.
+ */
+#define _CTB_MERKLE_MAGIC	0x314c4b524d425443ull	/* "CTBMRKL1" */
+
+typedef struct
+{
+	uint64_t	magic;
+	uint64_t	capacity;
+	uint64_t	count;
+	uint64_t	reserved;
+} _ctb_merkle_header;
+
+/* Fills the level table and returns the bytes needed, 0 on overflow. */
+static size_t _ctb_merkle_layout(ctb_merkle *m, uint64_t capacity)
+{
+	uint64_t nodes = 0;
+	unsigned int l;
+
+	if (capacity == 0 || capacity > ((size_t) -1 - sizeof(_ctb_merkle_header)) / 64)
+		return 0;
+	for (l = 0; (capacity >> l) != 0; l++) {
+		m->level[l] = nodes;
+		nodes += capacity >> l;
+	}
+	m->levels = l;
+	m->capacity = capacity;
+	return sizeof(_ctb_merkle_header) + (size_t) nodes * 32;
+}
+
+static uint8_t *_ctb_merkle_node(const ctb_merkle *m, unsigned int level, uint64_t index)
+{
+	return m->mem + sizeof(_ctb_merkle_header) + (size_t) (m->level[level] + index) * 32;
+}
+
+static void _ctb_merkle_parent(const uint8_t *left, const uint8_t *right, uint8_t *out)
+{
+	uint8_t pair[64];
+
+	memcpy(pair, left, 32);
+	memcpy(pair + 32, right, 32);
+	ctb_sha256d_64(pair, out);
+}
+
+/* Walks the right edge of the tree of n leaves. edge[l] receives the
+ * level-l node covering the unfinished tail, if there is one (has[l]);
+ * returns the root's level.
+ */
+static unsigned int _ctb_merkle_edge(const ctb_merkle *m, uint64_t n,
+									 uint8_t (*edge)[32], int *has)
+{
+	unsigned int l = 0;
+	int p = 0;
+
+	for (;;) {
+		uint64_t s = n >> l;
+
+		has[l] = p;
+		if (s + (uint64_t) p == 1)
+			return l;
+		if (p && (s & 1))
+			_ctb_merkle_parent(_ctb_merkle_node(m, l, s - 1), edge[l], edge[l + 1]);
+		else if (p)
+			_ctb_merkle_parent(edge[l], edge[l], edge[l + 1]);
+		else if (s & 1)
+			_ctb_merkle_parent(_ctb_merkle_node(m, l, s - 1), _ctb_merkle_node(m, l, s - 1),
+							   edge[l + 1]);
+		p = p || (s & 1);
+		l++;
+	}
+}
+
+size_t ctb_merkle_size(uint64_t capacity)
+{
+	ctb_merkle m;
+
+	return _ctb_merkle_layout(&m, capacity);
+}
+
+int ctb_merkle_init(ctb_merkle *m, void *mem, size_t size, uint64_t capacity)
+{
+	_ctb_merkle_header *hd = (_ctb_merkle_header *) mem;
+	size_t need = _ctb_merkle_layout(m, capacity);
+
+	if (need == 0 || size < need)
+		return -1;
+	m->mem = (uint8_t *) mem;
+	hd->magic = _CTB_MERKLE_MAGIC;
+	hd->capacity = capacity;
+	hd->count = 0;
+	hd->reserved = 0;
+	return 0;
+}
+
+int ctb_merkle_open(ctb_merkle *m, void *mem, size_t size)
+{
+	const _ctb_merkle_header *hd = (const _ctb_merkle_header *) mem;
+	size_t need;
+
+	if (size < sizeof(*hd) || hd->magic != _CTB_MERKLE_MAGIC || hd->count > hd->capacity)
+		return -1;
+	need = _ctb_merkle_layout(m, hd->capacity);
+	if (need == 0 || size < need)
+		return -1;
+	m->mem = (uint8_t *) mem;
+	return 0;
+}
+
+uint64_t ctb_merkle_count(const ctb_merkle *m)
+{
+	return ((const _ctb_merkle_header *) m->mem)->count;
+}
+
+int ctb_merkle_append_many(ctb_merkle *m, const uint8_t (*leaf)[32], size_t count)
+{
+	_ctb_merkle_header *hd = (_ctb_merkle_header *) m->mem;
+	const uint8_t (*pairs)[64];
+	uint8_t (*out)[32];
+	uint64_t a = hd->count, b;
+	unsigned int l;
+
+	if (count > m->capacity - a)
+		return -1;
+	b = a + count;
+	if (count)
+		memcpy(_ctb_merkle_node(m, 0, a), leaf, count * 32);
+
+	/* parents [lo, hi) of level l + 1 became complete */
+	for (l = 0; l + 1 < m->levels; l++) {
+		uint64_t lo = (a >> l) >> 1, hi = (b >> l) >> 1;
+
+		if (hi == lo)
+			break;
+		pairs = (const uint8_t (*)[64]) _ctb_merkle_node(m, l, lo << 1);
+		out = (uint8_t (*)[32]) _ctb_merkle_node(m, l + 1, lo);
+		if (hi - lo == 1)
+			ctb_sha256d_64(pairs[0], out[0]);
+		else
+			ctb_sha256d_64_many(pairs, out, (size_t) (hi - lo));
+	}
+
+	hd->count = b;
+	return 0;
+}
+
+int ctb_merkle_append(ctb_merkle *m, const uint8_t leaf[32])
+{
+	return ctb_merkle_append_many(m, (const uint8_t (*)[32]) leaf, 1);
+}
+
+int ctb_merkle_root(const ctb_merkle *m, uint8_t root[32])
+{
+	uint8_t edge[CTB_MERKLE_MAX_DEPTH][32];
+	int has[CTB_MERKLE_MAX_DEPTH];
+	uint64_t n = ctb_merkle_count(m);
+	unsigned int top;
+
+	if (n == 0)
+		return -1;
+	top = _ctb_merkle_edge(m, n, edge, has);
+	memcpy(root, has[top] ? edge[top] : _ctb_merkle_node(m, top, 0), 32);
+	return 0;
+}
+
+int ctb_merkle_proof(const ctb_merkle *m, uint64_t index, uint8_t (*proof)[32])
+{
+	uint8_t edge[CTB_MERKLE_MAX_DEPTH][32];
+	int has[CTB_MERKLE_MAX_DEPTH];
+	uint64_t n = ctb_merkle_count(m);
+	unsigned int top, l;
+
+	if (index >= n)
+		return -1;
+	top = _ctb_merkle_edge(m, n, edge, has);
+
+	for (l = 0; l < top; l++) {
+		uint64_t s = n >> l;
+		uint64_t sib = (index >> l) ^ 1;
+
+		if (sib >= s + (uint64_t) has[l])
+			sib = index >> l;
+		memcpy(proof[l], sib < s ? _ctb_merkle_node(m, l, sib) : edge[l], 32);
+	}
+	return (int) top;
+}
+
+int ctb_merkle_verify(const uint8_t leaf[32], uint64_t index,
+					  const uint8_t (*proof)[32], unsigned int depth, const uint8_t root[32])
+{
+	uint8_t h[32];
+	unsigned int l;
+
+	if (depth > CTB_MERKLE_MAX_DEPTH || (depth < 64 && (index >> depth) != 0))
+		return 0;
+	memcpy(h, leaf, 32);
+	for (l = 0; l < depth; l++) {
+		if ((index >> l) & 1)
+			_ctb_merkle_parent(proof[l], h, h);
+		else
+			_ctb_merkle_parent(h, proof[l], h);
+	}
+	return memcmp(h, root, 32) == 0;
+}
+
+#undef _CTB_MERKLE_MAGIC
+
+
+/* =========================================================================
+   XXH3 IMPLEMENTATION
+   ========================================================================= */
+
+/* Follows the xxHash 0.8 reference (xxhash.h, XXH3 section) step for step;
+ * names of the length classes and helpers match it. Inputs over 240 bytes
+ * are cut into 1 KiB blocks of 16 stripes; each stripe feeds eight 64-bit
+ * accumulators (the dispatched accumulate kernel) and each block ends with
+ * a scramble. A nonzero seed moves the secret for long inputs and is mixed
+ * in directly for short ones.
+ */
+#define _CTB_XXH_PRIME32_1	0x9E3779B1U
+#define _CTB_XXH_PRIME32_2	0x85EBCA77U
+#define _CTB_XXH_PRIME32_3	0xC2B2AE3DU
+#define _CTB_XXH_PRIME64_1	0x9E3779B185EBCA87ULL
+#define _CTB_XXH_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define _CTB_XXH_PRIME64_3	0x165667B19E3779F9ULL
+#define _CTB_XXH_PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define _CTB_XXH_PRIME64_5	0x27D4EB2F165667C5ULL
+#define _CTB_XXH_PRIME_MX1	0x165667919E3779F9ULL
+#define _CTB_XXH_PRIME_MX2	0x9FB21C651E98DF25ULL
+
+#define _CTB_XXH3_SECRET_SIZE		192
+#define _CTB_XXH3_SECRET_SIZE_MIN	136
+#define _CTB_XXH3_STRIPE_LEN		64
+#define _CTB_XXH3_STRIPES_PER_BLOCK	((_CTB_XXH3_SECRET_SIZE - _CTB_XXH3_STRIPE_LEN) / 8)
+#define _CTB_XXH3_BLOCK_LEN			(_CTB_XXH3_STRIPE_LEN * _CTB_XXH3_STRIPES_PER_BLOCK)
+
+static const uint8_t _ctb_xxh3_secret[_CTB_XXH3_SECRET_SIZE] =
+	{
+		0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+		0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+		0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+		0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+		0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+		0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+		0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+		0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+		0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+		0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+		0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+		0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+	};
+
+static inline uint32_t _ctb_xxh_read32(const uint8_t *p)
+{
+#if defined(_CTB_HASH_LITTLE_ENDIAN) && _CTB_HASH_LITTLE_ENDIAN
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+#else
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+#endif
+}
+
+static inline uint64_t _ctb_xxh_read64(const uint8_t *p)
+{
+#if defined(_CTB_HASH_LITTLE_ENDIAN) && _CTB_HASH_LITTLE_ENDIAN
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+#else
+	return (uint64_t) _ctb_xxh_read32(p) | (uint64_t) _ctb_xxh_read32(p + 4) << 32;
+#endif
+}
+
+static inline void _ctb_xxh_write64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (uint8_t) (v >> (8 * i));
+}
+
+static inline uint32_t _ctb_xxh_swap32(uint32_t x)
+{
+	return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+static inline uint64_t _ctb_xxh_swap64(uint64_t x)
+{
+	return (uint64_t) _ctb_xxh_swap32((uint32_t) x) << 32 | _ctb_xxh_swap32((uint32_t) (x >> 32));
+}
+
+static inline uint64_t _ctb_xxh_rotl64(uint64_t x, unsigned int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* 64x64 -> 128 multiply */
+static inline void _ctb_xxh_mul128(uint64_t a, uint64_t b, uint64_t *lo, uint64_t *hi)
+{
+#if defined(__SIZEOF_INT128__)
+	__extension__ unsigned __int128 p = (unsigned __int128) a * b;
+
+	*lo = (uint64_t) p;
+	*hi = (uint64_t) (p >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64) && _CTB_HASH_X86
+	*lo = _umul128(a, b, hi);
+#else
+	uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+	*hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	*lo = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+static inline uint64_t _ctb_xxh_fold64(uint64_t a, uint64_t b)
+{
+	uint64_t lo, hi;
+
+	_ctb_xxh_mul128(a, b, &lo, &hi);
+	return lo ^ hi;
+}
+
+static inline uint64_t _ctb_xxh64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= _CTB_XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= _CTB_XXH_PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t _ctb_xxh3_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= _CTB_XXH_PRIME_MX1;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t _ctb_xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+	h ^= _ctb_xxh_rotl64(h, 49) ^ _ctb_xxh_rotl64(h, 24);
+	h *= _CTB_XXH_PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= _CTB_XXH_PRIME_MX2;
+	return h ^ (h >> 28);
+}
+
+static inline uint64_t _ctb_xxh3_mix16(const uint8_t *in, const uint8_t *secret, uint64_t seed)
+{
+	return _ctb_xxh_fold64(_ctb_xxh_read64(in) ^ (_ctb_xxh_read64(secret) + seed),
+						   _ctb_xxh_read64(in + 8) ^ (_ctb_xxh_read64(secret + 8) - seed));
+}
+
+/* 64-bit, by length class */
+
+static uint64_t _ctb_xxh3_64_0to16(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	if (len > 8) {
+		uint64_t lo = _ctb_xxh_read64(in)
+			^ ((_ctb_xxh_read64(secret + 24) ^ _ctb_xxh_read64(secret + 32)) + seed);
+		uint64_t hi = _ctb_xxh_read64(in + len - 8)
+			^ ((_ctb_xxh_read64(secret + 40) ^ _ctb_xxh_read64(secret + 48)) - seed);
+
+		return _ctb_xxh3_avalanche(len + _ctb_xxh_swap64(lo) + hi + _ctb_xxh_fold64(lo, hi));
+	}
+	if (len >= 4) {
+		uint64_t s = seed ^ (uint64_t) _ctb_xxh_swap32((uint32_t) seed) << 32;
+		uint64_t v = _ctb_xxh_read32(in + len - 4) + ((uint64_t) _ctb_xxh_read32(in) << 32);
+
+		v ^= (_ctb_xxh_read64(secret + 8) ^ _ctb_xxh_read64(secret + 16)) - s;
+		return _ctb_xxh3_rrmxmx(v, len);
+	}
+	if (len) {
+		uint32_t combined = (uint32_t) in[0] << 16 | (uint32_t) in[len >> 1] << 24
+			| (uint32_t) in[len - 1] | (uint32_t) len << 8;
+
+		return _ctb_xxh64_avalanche((uint64_t) combined
+			^ ((uint64_t) (_ctb_xxh_read32(secret) ^ _ctb_xxh_read32(secret + 4)) + seed));
+	}
+	return _ctb_xxh64_avalanche(seed ^ _ctb_xxh_read64(secret + 56) ^ _ctb_xxh_read64(secret + 64));
+}
+
+static uint64_t _ctb_xxh3_64_17to128(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	uint64_t acc = len * _CTB_XXH_PRIME64_1;
+
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96) {
+				acc += _ctb_xxh3_mix16(in + 48, secret + 96, seed);
+				acc += _ctb_xxh3_mix16(in + len - 64, secret + 112, seed);
+			}
+			acc += _ctb_xxh3_mix16(in + 32, secret + 64, seed);
+			acc += _ctb_xxh3_mix16(in + len - 48, secret + 80, seed);
+		}
+		acc += _ctb_xxh3_mix16(in + 16, secret + 32, seed);
+		acc += _ctb_xxh3_mix16(in + len - 32, secret + 48, seed);
+	}
+	acc += _ctb_xxh3_mix16(in, secret, seed);
+	acc += _ctb_xxh3_mix16(in + len - 16, secret + 16, seed);
+	return _ctb_xxh3_avalanche(acc);
+}
+
+static uint64_t _ctb_xxh3_64_129to240(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	uint64_t acc = len * _CTB_XXH_PRIME64_1, acc_end;
+	size_t i, rounds = len / 16;
+
+	for (i = 0; i < 8; i++)
+		acc += _ctb_xxh3_mix16(in + 16 * i, secret + 16 * i, seed);
+	acc_end = _ctb_xxh3_mix16(in + len - 16, secret + _CTB_XXH3_SECRET_SIZE_MIN - 17, seed);
+	acc = _ctb_xxh3_avalanche(acc);
+	for (i = 8; i < rounds; i++)
+		acc_end += _ctb_xxh3_mix16(in + 16 * i, secret + 16 * (i - 8) + 3, seed);
+	return _ctb_xxh3_avalanche(acc + acc_end);
+}
+
+/* Long inputs. The kernels take the accumulators in memory and keep them
+ * in registers across the stripes of a block. */
+
+static void _ctb_xxh3_accumulate_scalar(uint64_t acc[8], const unsigned char *input,
+										const unsigned char *secret, size_t nb_stripes)
+{
+	size_t n;
+	int i;
+
+	for (n = 0; n < nb_stripes; n++) {
+		const unsigned char *in = input + n * _CTB_XXH3_STRIPE_LEN;
+		const unsigned char *sec = secret + n * 8;
+
+		for (i = 0; i < 8; i++) {
+			uint64_t v = _ctb_xxh_read64(in + 8 * i);
+			uint64_t k = v ^ _ctb_xxh_read64(sec + 8 * i);
+
+			acc[i ^ 1] += v;
+			acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+		}
+	}
+}
+
+static void _ctb_xxh3_scramble_scalar(uint64_t acc[8], const unsigned char *secret)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t a = acc[i];
+
+		a ^= a >> 47;
+		a ^= _ctb_xxh_read64(secret + 8 * i);
+		acc[i] = a * _CTB_XXH_PRIME32_1;
+	}
+}
+
+#if _CTB_HASH_X86
+/* Per 64-bit lane: acc += lo32(d ^ k) * hi32(d ^ k) + d of the swapped lane;
+ * scramble multiplies by PRIME32_1 as lo * P + (hi * P << 32). */
+_CTB_HASH_TARGET("sse2")
+static void _ctb_xxh3_accumulate_sse2(uint64_t acc[8], const unsigned char *input,
+									  const unsigned char *secret, size_t nb_stripes)
+{
+	__m128i a[4];
+	size_t n;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		a[i] = _mm_loadu_si128((const __m128i *) acc + i);
+	for (n = 0; n < nb_stripes; n++) {
+		const unsigned char *in = input + n * _CTB_XXH3_STRIPE_LEN;
+		const unsigned char *sec = secret + n * 8;
+
+		for (i = 0; i < 4; i++) {
+			__m128i d = _mm_loadu_si128((const __m128i *) (in + 16 * i));
+			__m128i k = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *) (sec + 16 * i)));
+			__m128i p = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(p, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+		}
+	}
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i *) acc + i, a[i]);
+}
+
+_CTB_HASH_TARGET("sse2")
+static void _ctb_xxh3_scramble_sse2(uint64_t acc[8], const unsigned char *secret)
+{
+	const __m128i prime = _mm_set1_epi32((int) _CTB_XXH_PRIME32_1);
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		__m128i a = _mm_loadu_si128((const __m128i *) acc + i);
+
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *) (secret + 16 * i)));
+		a = _mm_add_epi64(_mm_mul_epu32(a, prime),
+						  _mm_slli_epi64(_mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime), 32));
+		_mm_storeu_si128((__m128i *) acc + i, a);
+	}
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_xxh3_accumulate_avx2(uint64_t acc[8], const unsigned char *input,
+									  const unsigned char *secret, size_t nb_stripes)
+{
+	__m256i a0 = _mm256_loadu_si256((const __m256i *) acc);
+	__m256i a1 = _mm256_loadu_si256((const __m256i *) acc + 1);
+	size_t n;
+
+	for (n = 0; n < nb_stripes; n++) {
+		const unsigned char *in = input + n * _CTB_XXH3_STRIPE_LEN;
+		const unsigned char *sec = secret + n * 8;
+		__m256i d0 = _mm256_loadu_si256((const __m256i *) in);
+		__m256i d1 = _mm256_loadu_si256((const __m256i *) (in + 32));
+		__m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i *) sec));
+		__m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256((const __m256i *) (sec + 32)));
+
+		a0 = _mm256_add_epi64(a0, _mm256_add_epi64(
+			_mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)),
+			_mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+		a1 = _mm256_add_epi64(a1, _mm256_add_epi64(
+			_mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)),
+			_mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	_mm256_storeu_si256((__m256i *) acc, a0);
+	_mm256_storeu_si256((__m256i *) acc + 1, a1);
+}
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_xxh3_scramble_avx2(uint64_t acc[8], const unsigned char *secret)
+{
+	const __m256i prime = _mm256_set1_epi32((int) _CTB_XXH_PRIME32_1);
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) acc + i);
+
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *) (secret + 32 * i)));
+		a = _mm256_add_epi64(_mm256_mul_epu32(a, prime),
+							 _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32));
+		_mm256_storeu_si256((__m256i *) acc + i, a);
+	}
+}
+
+_CTB_HASH_AVX512_DIAG_BEGIN
+
+_CTB_HASH_TARGET("avx512f")
+static void _ctb_xxh3_accumulate_avx512(uint64_t acc[8], const unsigned char *input,
+										const unsigned char *secret, size_t nb_stripes)
+{
+	__m512i a = _mm512_loadu_si512((const void *) acc);
+	size_t n;
+
+	for (n = 0; n < nb_stripes; n++) {
+		__m512i d = _mm512_loadu_si512((const void *) (input + n * _CTB_XXH3_STRIPE_LEN));
+		__m512i k = _mm512_xor_si512(d, _mm512_loadu_si512((const void *) (secret + n * 8)));
+
+		a = _mm512_add_epi64(a, _mm512_add_epi64(
+			_mm512_mul_epu32(k, _mm512_srli_epi64(k, 32)),
+			_mm512_shuffle_epi32(d, (_MM_PERM_ENUM) _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	_mm512_storeu_si512((void *) acc, a);
+}
+
+_CTB_HASH_TARGET("avx512f")
+static void _ctb_xxh3_scramble_avx512(uint64_t acc[8], const unsigned char *secret)
+{
+	const __m512i prime = _mm512_set1_epi32((int) _CTB_XXH_PRIME32_1);
+	__m512i a = _mm512_loadu_si512((const void *) acc);
+
+	a = _mm512_xor_si512(a, _mm512_srli_epi64(a, 47));
+	a = _mm512_xor_si512(a, _mm512_loadu_si512((const void *) secret));
+	a = _mm512_add_epi64(_mm512_mul_epu32(a, prime),
+						 _mm512_slli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(a, 32), prime), 32));
+	_mm512_storeu_si512((void *) acc, a);
+}
+
+_CTB_HASH_AVX512_DIAG_END
+#endif /* _CTB_HASH_X86 */
+
+static void _ctb_xxh3_long(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t acc[8])
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	size_t nb_blocks = (len - 1) / _CTB_XXH3_BLOCK_LEN, n;
+
+	acc[0] = _CTB_XXH_PRIME32_3;
+	acc[1] = _CTB_XXH_PRIME64_1;
+	acc[2] = _CTB_XXH_PRIME64_2;
+	acc[3] = _CTB_XXH_PRIME64_3;
+	acc[4] = _CTB_XXH_PRIME64_4;
+	acc[5] = _CTB_XXH_PRIME32_2;
+	acc[6] = _CTB_XXH_PRIME64_5;
+	acc[7] = _CTB_XXH_PRIME32_1;
+
+	for (n = 0; n < nb_blocks; n++) {
+		kt->xxh3_accumulate(acc, in + n * _CTB_XXH3_BLOCK_LEN, secret, _CTB_XXH3_STRIPES_PER_BLOCK);
+		kt->xxh3_scramble(acc, secret + _CTB_XXH3_SECRET_SIZE - _CTB_XXH3_STRIPE_LEN);
+	}
+	/* partial block, then the last stripe (which may overlap it) */
+	kt->xxh3_accumulate(acc, in + nb_blocks * _CTB_XXH3_BLOCK_LEN, secret,
+						((len - 1) - nb_blocks * _CTB_XXH3_BLOCK_LEN) / _CTB_XXH3_STRIPE_LEN);
+	kt->xxh3_accumulate(acc, in + len - _CTB_XXH3_STRIPE_LEN,
+						secret + _CTB_XXH3_SECRET_SIZE - _CTB_XXH3_STRIPE_LEN - 7, 1);
+}
+
+static uint64_t _ctb_xxh3_merge(const uint64_t acc[8], const uint8_t *secret, uint64_t start)
+{
+	uint64_t h = start;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		h += _ctb_xxh_fold64(acc[2 * i] ^ _ctb_xxh_read64(secret + 16 * i),
+							 acc[2 * i + 1] ^ _ctb_xxh_read64(secret + 16 * i + 8));
+	return _ctb_xxh3_avalanche(h);
+}
+
+/* Long inputs with a seed run on the default secret shifted by it. */
+static const uint8_t *_ctb_xxh3_long_secret(uint64_t seed, uint8_t custom[_CTB_XXH3_SECRET_SIZE])
+{
+	int i;
+
+	if (seed == 0)
+		return _ctb_xxh3_secret;
+	for (i = 0; i < _CTB_XXH3_SECRET_SIZE; i += 16) {
+		_ctb_xxh_write64(custom + i, _ctb_xxh_read64(_ctb_xxh3_secret + i) + seed);
+		_ctb_xxh_write64(custom + i + 8, _ctb_xxh_read64(_ctb_xxh3_secret + i + 8) - seed);
+	}
+	return custom;
+}
+
+uint64_t ctb_xxh3_64(const uint8_t *data, size_t len, uint64_t seed)
+{
+	uint8_t custom[_CTB_XXH3_SECRET_SIZE];
+	const uint8_t *secret;
+	uint64_t acc[8];
+
+	if (len <= 16)
+		return _ctb_xxh3_64_0to16(data, len, _ctb_xxh3_secret, seed);
+	if (len <= 128)
+		return _ctb_xxh3_64_17to128(data, len, _ctb_xxh3_secret, seed);
+	if (len <= 240)
+		return _ctb_xxh3_64_129to240(data, len, _ctb_xxh3_secret, seed);
+
+	secret = _ctb_xxh3_long_secret(seed, custom);
+	_ctb_xxh3_long(data, len, secret, acc);
+	return _ctb_xxh3_merge(acc, secret + 11, (uint64_t) len * _CTB_XXH_PRIME64_1);
+}
+
+/* 128-bit, by length class */
+
+static ctb_hash128 _ctb_xxh3_128_0to16(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	ctb_hash128 h;
+
+	if (len > 8) {
+		uint64_t bitflipl = (_ctb_xxh_read64(secret + 32) ^ _ctb_xxh_read64(secret + 40)) - seed;
+		uint64_t bitfliph = (_ctb_xxh_read64(secret + 48) ^ _ctb_xxh_read64(secret + 56)) + seed;
+		uint64_t lo = _ctb_xxh_read64(in);
+		uint64_t hi = _ctb_xxh_read64(in + len - 8);
+		uint64_t m_lo, m_hi, r_lo, r_hi;
+
+		_ctb_xxh_mul128(lo ^ hi ^ bitflipl, _CTB_XXH_PRIME64_1, &m_lo, &m_hi);
+		m_lo += (uint64_t) (len - 1) << 54;
+		hi ^= bitfliph;
+		m_hi += hi + (uint64_t) (uint32_t) hi * (_CTB_XXH_PRIME32_2 - 1);
+		m_lo ^= _ctb_xxh_swap64(m_hi);
+
+		_ctb_xxh_mul128(m_lo, _CTB_XXH_PRIME64_2, &r_lo, &r_hi);
+		r_hi += m_hi * _CTB_XXH_PRIME64_2;
+		h.low64 = _ctb_xxh3_avalanche(r_lo);
+		h.high64 = _ctb_xxh3_avalanche(r_hi);
+		return h;
+	}
+	if (len >= 4) {
+		uint64_t s = seed ^ (uint64_t) _ctb_xxh_swap32((uint32_t) seed) << 32;
+		uint64_t v = _ctb_xxh_read32(in) + ((uint64_t) _ctb_xxh_read32(in + len - 4) << 32);
+		uint64_t m_lo, m_hi;
+
+		v ^= (_ctb_xxh_read64(secret + 16) ^ _ctb_xxh_read64(secret + 24)) + s;
+		_ctb_xxh_mul128(v, _CTB_XXH_PRIME64_1 + ((uint64_t) len << 2), &m_lo, &m_hi);
+		m_hi += m_lo << 1;
+		m_lo ^= m_hi >> 3;
+		m_lo ^= m_lo >> 35;
+		m_lo *= _CTB_XXH_PRIME_MX2;
+		m_lo ^= m_lo >> 28;
+		h.low64 = m_lo;
+		h.high64 = _ctb_xxh3_avalanche(m_hi);
+		return h;
+	}
+	if (len) {
+		uint32_t combinedl = (uint32_t) in[0] << 16 | (uint32_t) in[len >> 1] << 24
+			| (uint32_t) in[len - 1] | (uint32_t) len << 8;
+		uint32_t swapped = _ctb_xxh_swap32(combinedl);
+		uint32_t combinedh = (swapped << 13) | (swapped >> 19);
+
+		h.low64 = _ctb_xxh64_avalanche((uint64_t) combinedl
+			^ ((uint64_t) (_ctb_xxh_read32(secret) ^ _ctb_xxh_read32(secret + 4)) + seed));
+		h.high64 = _ctb_xxh64_avalanche((uint64_t) combinedh
+			^ ((uint64_t) (_ctb_xxh_read32(secret + 8) ^ _ctb_xxh_read32(secret + 12)) - seed));
+		return h;
+	}
+	h.low64 = _ctb_xxh64_avalanche(seed ^ _ctb_xxh_read64(secret + 64) ^ _ctb_xxh_read64(secret + 72));
+	h.high64 = _ctb_xxh64_avalanche(seed ^ _ctb_xxh_read64(secret + 80) ^ _ctb_xxh_read64(secret + 88));
+	return h;
+}
+
+static inline void _ctb_xxh3_mix32(ctb_hash128 *acc, const uint8_t *in1, const uint8_t *in2,
+								   const uint8_t *secret, uint64_t seed)
+{
+	acc->low64 += _ctb_xxh3_mix16(in1, secret, seed);
+	acc->low64 ^= _ctb_xxh_read64(in2) + _ctb_xxh_read64(in2 + 8);
+	acc->high64 += _ctb_xxh3_mix16(in2, secret + 16, seed);
+	acc->high64 ^= _ctb_xxh_read64(in1) + _ctb_xxh_read64(in1 + 8);
+}
+
+static ctb_hash128 _ctb_xxh3_128_finish(ctb_hash128 acc, size_t len, uint64_t seed)
+{
+	ctb_hash128 h;
+
+	h.low64 = _ctb_xxh3_avalanche(acc.low64 + acc.high64);
+	h.high64 = 0 - _ctb_xxh3_avalanche(acc.low64 * _CTB_XXH_PRIME64_1 + acc.high64 * _CTB_XXH_PRIME64_4
+									   + ((uint64_t) len - seed) * _CTB_XXH_PRIME64_2);
+	return h;
+}
+
+static ctb_hash128 _ctb_xxh3_128_17to128(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	ctb_hash128 acc;
+
+	acc.low64 = len * _CTB_XXH_PRIME64_1;
+	acc.high64 = 0;
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96)
+				_ctb_xxh3_mix32(&acc, in + 48, in + len - 64, secret + 96, seed);
+			_ctb_xxh3_mix32(&acc, in + 32, in + len - 48, secret + 64, seed);
+		}
+		_ctb_xxh3_mix32(&acc, in + 16, in + len - 32, secret + 32, seed);
+	}
+	_ctb_xxh3_mix32(&acc, in, in + len - 16, secret, seed);
+	return _ctb_xxh3_128_finish(acc, len, seed);
+}
+
+static ctb_hash128 _ctb_xxh3_128_129to240(const uint8_t *in, size_t len, const uint8_t *secret, uint64_t seed)
+{
+	ctb_hash128 acc;
+	size_t i;
+
+	acc.low64 = len * _CTB_XXH_PRIME64_1;
+	acc.high64 = 0;
+	for (i = 32; i < 160; i += 32)
+		_ctb_xxh3_mix32(&acc, in + i - 32, in + i - 16, secret + i - 32, seed);
+	acc.low64 = _ctb_xxh3_avalanche(acc.low64);
+	acc.high64 = _ctb_xxh3_avalanche(acc.high64);
+	for (i = 160; i <= len; i += 32)
+		_ctb_xxh3_mix32(&acc, in + i - 32, in + i - 16, secret + 3 + i - 160, seed);
+	_ctb_xxh3_mix32(&acc, in + len - 16, in + len - 32,
+					secret + _CTB_XXH3_SECRET_SIZE_MIN - 17 - 16, 0 - seed);
+	return _ctb_xxh3_128_finish(acc, len, seed);
+}
+
+ctb_hash128 ctb_xxh3_128(const uint8_t *data, size_t len, uint64_t seed)
+{
+	uint8_t custom[_CTB_XXH3_SECRET_SIZE];
+	const uint8_t *secret;
+	uint64_t acc[8];
+	ctb_hash128 h;
+
+	if (len <= 16)
+		return _ctb_xxh3_128_0to16(data, len, _ctb_xxh3_secret, seed);
+	if (len <= 128)
+		return _ctb_xxh3_128_17to128(data, len, _ctb_xxh3_secret, seed);
+	if (len <= 240)
+		return _ctb_xxh3_128_129to240(data, len, _ctb_xxh3_secret, seed);
+
+	secret = _ctb_xxh3_long_secret(seed, custom);
+	_ctb_xxh3_long(data, len, secret, acc);
+	h.low64 = _ctb_xxh3_merge(acc, secret + 11, (uint64_t) len * _CTB_XXH_PRIME64_1);
+	h.high64 = _ctb_xxh3_merge(acc, secret + _CTB_XXH3_SECRET_SIZE - _CTB_XXH3_STRIPE_LEN - 11,
+							   ~((uint64_t) len * _CTB_XXH_PRIME64_2));
+	return h;
+}
+
+void ctb_xxh3_64_canonical(uint64_t hash, uint8_t out[8])
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		out[i] = (uint8_t) (hash >> (56 - 8 * i));
+}
+
+void ctb_xxh3_128_canonical(ctb_hash128 hash, uint8_t out[16])
+{
+	ctb_xxh3_64_canonical(hash.high64, out);
+	ctb_xxh3_64_canonical(hash.low64, out + 8);
+}
+
+
+/* =========================================================================
+   CRC IMPLEMENTATION
+   ========================================================================= */
+
+/* All three CRCs are reflected (least significant bit first): a byte of
+ * input is one step of the register, slicing-by-8 looks up eight bytes at
+ * once, and the polynomial arithmetic below keeps x^0 in the top bit.
+ * Kernels take and return the raw register; the public functions invert
+ * it on the way in and out (init and xorout of all ones).
+ */
+#define _CTB_CRC32_POLY		0xEDB88320u				/* 0x04C11DB7 reflected */
+#define _CTB_CRC32C_POLY	0x82F63B78u				/* 0x1EDC6F41 reflected */
+#define _CTB_CRC64_POLY		0xC96C5795D7870F42ULL	/* 0x42F0E1EBA9EA3693 reflected */
+
+static uint32_t	_ctb_crc32_table[8][256];
+static uint32_t	_ctb_crc32c_table[8][256];
+static uint64_t	_ctb_crc64_table[8][256];
+
+/* Called once, by the first _ctb_hash_resolve(). Table k maps a byte to
+ * its register contribution when followed by k more bytes.
+ */
+static void _ctb_crc_tables_init(void)
+{
+	uint32_t a, c;
+	uint64_t q;
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		a = c = i;
+		q = i;
+		for (k = 0; k < 8; k++) {
+			a = a & 1 ? (a >> 1) ^ _CTB_CRC32_POLY : a >> 1;
+			c = c & 1 ? (c >> 1) ^ _CTB_CRC32C_POLY : c >> 1;
+			q = q & 1 ? (q >> 1) ^ _CTB_CRC64_POLY : q >> 1;
+		}
+		_ctb_crc32_table[0][i] = a;
+		_ctb_crc32c_table[0][i] = c;
+		_ctb_crc64_table[0][i] = q;
+	}
+	for (k = 1; k < 8; k++)
+		for (i = 0; i < 256; i++) {
+			a = _ctb_crc32_table[k - 1][i];
+			c = _ctb_crc32c_table[k - 1][i];
+			q = _ctb_crc64_table[k - 1][i];
+			_ctb_crc32_table[k][i] = (a >> 8) ^ _ctb_crc32_table[0][a & 0xff];
+			_ctb_crc32c_table[k][i] = (c >> 8) ^ _ctb_crc32c_table[0][c & 0xff];
+			_ctb_crc64_table[k][i] = (q >> 8) ^ _ctb_crc64_table[0][q & 0xff];
+		}
+}
+
+static uint32_t _ctb_crc32_slice8(uint32_t t[8][256], uint32_t c, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		v = _ctb_xxh_read64(p) ^ c;
+		c = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff]
+			^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+	}
+	for (; len; p++, len--)
+		c = (c >> 8) ^ t[0][(c ^ *p) & 0xff];
+	return c;
+}
+
+static uint32_t _ctb_crc32_scalar(uint32_t c, const unsigned char *p, size_t len)
+{
+	return _ctb_crc32_slice8(_ctb_crc32_table, c, p, len);
+}
+
+static uint32_t _ctb_crc32c_scalar(uint32_t c, const unsigned char *p, size_t len)
+{
+	return _ctb_crc32_slice8(_ctb_crc32c_table, c, p, len);
+}
+
+static uint64_t _ctb_crc64_scalar(uint64_t c, const unsigned char *p, size_t len)
+{
+	uint64_t (*t)[256] = _ctb_crc64_table;
+	uint64_t v;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		v = _ctb_xxh_read64(p) ^ c;
+		c = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff]
+			^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+	}
+	for (; len; p++, len--)
+		c = (c >> 8) ^ t[0][(c ^ *p) & 0xff];
+	return c;
+}
+
+#if _CTB_HASH_X86
+/* CRC-32C on the crc32 instruction. It has a latency of three cycles and
+ * a throughput of one, so a single dependency chain runs at a third of
+ * its speed: long inputs are cut into three adjacent stripes whose CRCs
+ * are computed together, then merged by shifting the running register
+ * over the next stripe (a multiply by x^(8 * stripe) mod P, on PCLMULQDQ)
+ * and adding the stripe's own CRC.
+ */
+#if defined(__x86_64__) || defined(_M_X64)
+	#define _CTB_CRC32C_WORD(c, p) ((uint32_t) _mm_crc32_u64((c), _ctb_xxh_read64(p)))
+#else
+	#define _CTB_CRC32C_WORD(c, p) _mm_crc32_u32(_mm_crc32_u32((c), _ctb_xxh_read32(p)), _ctb_xxh_read32((p) + 4))
+#endif
+
+#define _CTB_CRC32C_LONG	2048
+#define _CTB_CRC32C_SHORT	256
+
+_CTB_HASH_TARGET("sse4.2")
+static uint32_t _ctb_crc32c_sse42(uint32_t c, const unsigned char *p, size_t len)
+{
+	for (; len >= 8; p += 8, len -= 8)
+		c = _CTB_CRC32C_WORD(c, p);
+	for (; len; p++, len--)
+		c = _mm_crc32_u8(c, *p);
+	return c;
+}
+
+/* c * k mod P: the carry-less product of two reflected 32-bit values is
+ * one bit short of the reflected 64-bit product; its low half (the high
+ * powers) is reduced by the crc32 instruction itself.
+ */
+_CTB_HASH_TARGET("sse4.2,pclmul")
+static inline uint32_t _ctb_crc32c_mul(uint32_t c, uint32_t k)
+{
+	__m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int) c), _mm_cvtsi32_si128((int) k), 0x00);
+
+	r = _mm_slli_epi64(r, 1);
+	return _mm_crc32_u32(0, (uint32_t) _mm_cvtsi128_si32(r)) ^ (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(r, 4));
+}
+
+_CTB_HASH_TARGET("sse4.2,pclmul")
+static uint32_t _ctb_crc32c_sse42_x3(uint32_t c0, const unsigned char *p, size_t len)
+{
+	/* x^(8 * n) mod P, reflected */
+	static const struct { size_t n; uint32_t k; } stripe[2] =
+		{ { _CTB_CRC32C_LONG, 0x0d65762a }, { _CTB_CRC32C_SHORT, 0x88e56f72 } };
+	uint32_t c1, c2;
+	size_t n, i;
+	int s;
+
+	for (s = 0; s < 2; s++) {
+		n = stripe[s].n;
+		for (; len >= 3 * n; p += 3 * n, len -= 3 * n) {
+			c1 = c2 = 0;
+			for (i = 0; i < n; i += 8) {
+				c0 = _CTB_CRC32C_WORD(c0, p + i);
+				c1 = _CTB_CRC32C_WORD(c1, p + n + i);
+				c2 = _CTB_CRC32C_WORD(c2, p + 2 * n + i);
+			}
+			c0 = _ctb_crc32c_mul(c0, stripe[s].k) ^ c1;
+			c0 = _ctb_crc32c_mul(c0, stripe[s].k) ^ c2;
+		}
+	}
+	return _ctb_crc32c_sse42(c0, p, len);
+}
+
+/* CRC-32 and CRC-64 by folding (Gopal et al., "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ"): four 128-bit accumulators move
+ * 64 bytes forward per step, each half multiplied by x^n mod P for its
+ * distance, then fold into one. What is left is 16 bytes congruent to the
+ * whole input, so the table code finishes from a zero register instead
+ * of a Barrett reduction. k holds x^(512+63), x^(512-1), x^(128+63) and
+ * x^(128-1) mod P, reflected to 64 bits; len is a multiple of 16, >= 64.
+ */
+_CTB_HASH_TARGET("sse2,pclmul")
+static inline __m128i _ctb_crc_fold16(__m128i x, __m128i k, __m128i next)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+_CTB_HASH_TARGET("sse2,pclmul")
+static void _ctb_crc_fold_pclmul(const unsigned char *p, size_t len, __m128i reg, const uint64_t k[4],
+								 unsigned char out[16])
+{
+	__m128i k4 = _mm_set_epi64x((long long) k[1], (long long) k[0]);
+	__m128i k1 = _mm_set_epi64x((long long) k[3], (long long) k[2]);
+	__m128i x0, x1, x2, x3;
+
+	x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), reg);
+	x1 = _mm_loadu_si128((const __m128i *) (p + 16));
+	x2 = _mm_loadu_si128((const __m128i *) (p + 32));
+	x3 = _mm_loadu_si128((const __m128i *) (p + 48));
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+		x0 = _ctb_crc_fold16(x0, k4, _mm_loadu_si128((const __m128i *) p));
+		x1 = _ctb_crc_fold16(x1, k4, _mm_loadu_si128((const __m128i *) (p + 16)));
+		x2 = _ctb_crc_fold16(x2, k4, _mm_loadu_si128((const __m128i *) (p + 32)));
+		x3 = _ctb_crc_fold16(x3, k4, _mm_loadu_si128((const __m128i *) (p + 48)));
+	}
+	x0 = _ctb_crc_fold16(x0, k1, x1);
+	x0 = _ctb_crc_fold16(x0, k1, x2);
+	x0 = _ctb_crc_fold16(x0, k1, x3);
+	for (; len >= 16; p += 16, len -= 16)
+		x0 = _ctb_crc_fold16(x0, k1, _mm_loadu_si128((const __m128i *) p));
+	_mm_storeu_si128((__m128i *) out, x0);
+}
+
+_CTB_HASH_TARGET("sse2,pclmul")
+static uint32_t _ctb_crc32_pclmul(uint32_t c, const unsigned char *p, size_t len)
+{
+	static const uint64_t k[4] =
+		{ 0x653d982200000000ULL, 0xcad38e8f00000000ULL, 0x65673b4600000000ULL, 0x9ba54c6f00000000ULL };
+	unsigned char folded[16];
+	size_t n = len & ~(size_t) 15;
+
+	if (len < 64)
+		return _ctb_crc32_scalar(c, p, len);
+	_ctb_crc_fold_pclmul(p, n, _mm_cvtsi32_si128((int) c), k, folded);
+	c = _ctb_crc32_scalar(0, folded, 16);
+	return _ctb_crc32_scalar(c, p + n, len - n);
+}
+
+_CTB_HASH_TARGET("sse2,pclmul")
+static uint64_t _ctb_crc64_pclmul(uint64_t c, const unsigned char *p, size_t len)
+{
+	static const uint64_t k[4] =
+		{ 0x6ae3efbb9dd441f3ULL, 0x081f6054a7842df4ULL, 0xe05dd497ca393ae4ULL, 0xdabe95afc7875f40ULL };
+	unsigned char folded[16];
+	size_t n = len & ~(size_t) 15;
+
+	if (len < 64)
+		return _ctb_crc64_scalar(c, p, len);
+	_ctb_crc_fold_pclmul(p, n, _mm_set_epi64x(0, (long long) c), k, folded);
+	c = _ctb_crc64_scalar(0, folded, 16);
+	return _ctb_crc64_scalar(c, p + n, len - n);
+}
+
+#undef _CTB_CRC32C_WORD
+#endif /* _CTB_HASH_X86 */
+
+/* a * b mod P for reflected polynomials of the given width (zlib's
+ * multmodp); a must be nonzero.
+ */
+static uint64_t _ctb_crc_multmodp(uint64_t a, uint64_t b, uint64_t poly, unsigned int width)
+{
+	uint64_t m = (uint64_t) 1 << (width - 1), p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ poly : b >> 1;
+	}
+	return p;
+}
+
+/* CRC(A || B) = CRC(A) * x^(8 * len(B)) + CRC(B) mod P; the all-ones
+ * init and xorout cancel out, so this works on the final values.
+ */
+static uint64_t _ctb_crc_combine(uint64_t crc1, uint64_t crc2, uint64_t len2, uint64_t poly, unsigned int width)
+{
+	uint64_t one = (uint64_t) 1 << (width - 1);
+	uint64_t x = one >> 8, xn = one;	/* x^8, x^0 */
+
+	for (; len2; len2 >>= 1) {
+		if (len2 & 1)
+			xn = _ctb_crc_multmodp(x, xn, poly, width);
+		x = _ctb_crc_multmodp(x, x, poly, width);
+	}
+	return _ctb_crc_multmodp(xn, crc1, poly, width) ^ crc2;
+}
+
+uint32_t ctb_crc32c(uint32_t crc, const uint8_t *data, size_t len)
+{
+	return ~_ctb_hash_kernels()->crc32c(~crc, data, len);
+}
+
+uint32_t ctb_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+	return ~_ctb_hash_kernels()->crc32(~crc, data, len);
+}
+
+uint64_t ctb_crc64(uint64_t crc, const uint8_t *data, size_t len)
+{
+	return ~_ctb_hash_kernels()->crc64(~crc, data, len);
+}
+
+uint32_t ctb_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	return (uint32_t) _ctb_crc_combine(crc1, crc2, len2, _CTB_CRC32C_POLY, 32);
+}
+
+uint32_t ctb_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	return (uint32_t) _ctb_crc_combine(crc1, crc2, len2, _CTB_CRC32_POLY, 32);
+}
+
+uint64_t ctb_crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2)
+{
+	return _ctb_crc_combine(crc1, crc2, len2, _CTB_CRC64_POLY, 64);
+}
+
+
+/* =========================================================================
+   MULTI-HASH IMPLEMENTATION
+   ========================================================================= */
+
+/* Threads meet after every window, so none runs more than a window ahead
+ * and the window is still in the shared cache when the slowest gets there.
+ */
+#define _CTB_MULTIHASH_WINDOW		((size_t) 1 << 20)
+#define _CTB_MULTIHASH_PARALLEL_MIN	((size_t) 64 << 10)
+
+typedef struct
+{
+	ctb_multihash_ctx	*ctx;
+	const uint8_t		*data;
+	size_t				len;
+	unsigned int		group[CTB_HASH_ALGO_COUNT];	/* algorithm mask per thread */
+} _ctb_multihash_job;
+
+/* Feeds data to the algorithms in mask, one tile at a time. The first tile
+ * is cut short so the following ones start on a block boundary of every
+ * algorithm (128 bytes covers them all) and reach the kernels uncopied.
+ */
+static void _ctb_multihash_tiles(ctb_multihash_ctx *ctx, unsigned int mask,
+								 const uint8_t *data, size_t len)
+{
+	size_t n = CTB_MULTIHASH_TILE - (size_t) (ctx->total % _CTB_SHA512_BLOCK_SIZE);
+	unsigned int id;
+
+	while (len) {
+		if (n > len)
+			n = len;
+		for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+			if (mask & CTB_HASH_MASK(id))
+				_ctb_hash_algos[id].update(&ctx->ctx[id], data, n);
+		}
+		data += n;
+		len -= n;
+		n = CTB_MULTIHASH_TILE;
+	}
+}
+
+static void _ctb_multihash_step(void *arg, unsigned int index)
+{
+	_ctb_multihash_job *job = (_ctb_multihash_job *) arg;
+
+	_ctb_multihash_tiles(job->ctx, job->group[index], job->data, job->len);
+}
+
+void ctb_multihash_init(ctb_multihash_ctx *ctx, unsigned int mask, unsigned int threads)
+{
+	unsigned int id, count = 0;
+
+	_ctb_hash_kernels();
+	mask &= CTB_HASH_MASK_ALL;
+	for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+		if (mask & CTB_HASH_MASK(id)) {
+			_ctb_hash_algos[id].init(&ctx->ctx[id]);
+			count++;
+		}
+	}
+	if (threads == 0)
+		threads = _ctb_hash_cpu_count();
+	ctx->total = 0;
+	ctx->mask = mask;
+	ctx->threads = threads < count ? threads : count;
+}
+
+void ctb_multihash_update(ctb_multihash_ctx *ctx, const uint8_t *data, size_t len)
+{
+	_ctb_multihash_job job;
+	unsigned int id, k = 0;
+
+	if (ctx->threads < 2 || len < _CTB_MULTIHASH_PARALLEL_MIN) {
+		_ctb_multihash_tiles(ctx, ctx->mask, data, len);
+		ctx->total += len;
+		return;
+	}
+
+	memset(job.group, 0, sizeof(job.group));
+	for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+		if (ctx->mask & CTB_HASH_MASK(id))
+			job.group[k++ % ctx->threads] |= CTB_HASH_MASK(id);
+	}
+	job.ctx = ctx;
+
+	while (len) {
+		job.data = data;
+		job.len = len < _CTB_MULTIHASH_WINDOW ? len : _CTB_MULTIHASH_WINDOW;
+		_ctb_hash_parallel(_ctb_multihash_step, &job, ctx->threads);
+		ctx->total += job.len;
+		data += job.len;
+		len -= job.len;
+	}
+}
+
+void ctb_multihash_final(ctb_multihash_ctx *ctx, uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE])
+{
+	unsigned int id;
+
+	for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+		if (ctx->mask & CTB_HASH_MASK(id))
+			_ctb_hash_algos[id].final(&ctx->ctx[id], digest[id]);
+	}
+}
+
+void ctb_multihash(const uint8_t *msg, size_t len, unsigned int mask, unsigned int threads,
+				   uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE])
+{
+	ctb_multihash_ctx ctx;
+
+	ctb_multihash_init(&ctx, mask, threads);
+	ctb_multihash_update(&ctx, msg, len);
+	ctb_multihash_final(&ctx, digest);
+}
+
+static void _ctb_multihash_stream_update(void *ctx, const uint8_t *data, size_t len)
+{
+	ctb_multihash_update((ctb_multihash_ctx *) ctx, data, len);
+}
+
+int ctb_multihash_file(const char *path, unsigned int mask, unsigned int threads,
+					   uint8_t (*digest)[CTB_HASH_MAX_DIGEST_SIZE])
+{
+	ctb_multihash_ctx ctx;
+	_ctb_hash_stream s;
+
+	ctb_multihash_init(&ctx, mask, threads);
+	s.update = _ctb_multihash_stream_update;
+	s.ctx = &ctx;
+	if (_ctb_hash_file_run(path, &s) != 0)
+		return -1;
+	ctb_multihash_final(&ctx, digest);
+	return 0;
+}
+
+
+/* =========================================================================
+   BLAKE3 IMPLEMENTATION
+   ========================================================================= */
+
+#define _CTB_BLAKE3_CHUNK_START		(1u << 0)
+#define _CTB_BLAKE3_CHUNK_END		(1u << 1)
+#define _CTB_BLAKE3_PARENT			(1u << 2)
+#define _CTB_BLAKE3_ROOT			(1u << 3)
+#define _CTB_BLAKE3_KEYED_HASH		(1u << 4)
+#define _CTB_BLAKE3_DERIVE_CONTEXT	(1u << 5)
+#define _CTB_BLAKE3_DERIVE_MATERIAL	(1u << 6)
+
+/* Widest lane kernel; a subtree leaf holds at most this many chunks. */
+#define _CTB_BLAKE3_MAX_LANES		16
+/* A subtree goes to two threads only if its right half is this long. */
+#define _CTB_BLAKE3_PARALLEL_MIN	((size_t) 256 << 10)
+
+static const uint32_t _ctb_blake3_iv[8] =
+	{ 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+static const unsigned char _ctb_blake3_schedule[7][16] =
+{
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+	{  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+	{ 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+	{ 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+	{  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+	{ 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 }
+};
+
+static void _ctb_blake3_load_words(uint32_t *w, const unsigned char *p, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		w[i] = _ctb_xxh_read32(p + 4 * i);
+}
+
+static void _ctb_blake3_store_words(unsigned char *p, const uint32_t *w, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		p[4 * i + 0] = (unsigned char) (w[i]);
+		p[4 * i + 1] = (unsigned char) (w[i] >> 8);
+		p[4 * i + 2] = (unsigned char) (w[i] >> 16);
+		p[4 * i + 3] = (unsigned char) (w[i] >> 24);
+	}
+}
+
+/* Single-block compression. out[0..7] is the next chaining value and
+ * out[8..15] the second half of the 64-byte extended output.
+ */
+#define _CTB_BLAKE3_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+#define _CTB_BLAKE3_G(a, b, c, d, x, y)                                       \
+{                                                                             \
+	v[a] = v[a] + v[b] + (x);                                                 \
+	v[d] = _CTB_BLAKE3_ROTR(v[d] ^ v[a], 16);                                 \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE3_ROTR(v[b] ^ v[c], 12);                                 \
+	v[a] = v[a] + v[b] + (y);                                                 \
+	v[d] = _CTB_BLAKE3_ROTR(v[d] ^ v[a], 8);                                  \
+	v[c] = v[c] + v[d];                                                       \
+	v[b] = _CTB_BLAKE3_ROTR(v[b] ^ v[c], 7);                                  \
+}
+
+static void _ctb_blake3_compress_scalar(const uint32_t cv[8], const unsigned char block[64],
+										uint32_t block_len, uint64_t counter, uint32_t flags,
+										uint32_t out[16])
+{
+	uint32_t v[16], m[16];
+	int r, i;
+
+	_ctb_blake3_load_words(m, block, 16);
+	for (i = 0; i < 8; i++)
+		v[i] = cv[i];
+	for (i = 0; i < 4; i++)
+		v[8 + i] = _ctb_blake3_iv[i];
+	v[12] = (uint32_t) counter;
+	v[13] = (uint32_t) (counter >> 32);
+	v[14] = block_len;
+	v[15] = flags;
+
+	for (r = 0; r < 7; r++) {
+		const unsigned char *s = _ctb_blake3_schedule[r];
+
+		_CTB_BLAKE3_G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+		_CTB_BLAKE3_G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+		_CTB_BLAKE3_G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+		_CTB_BLAKE3_G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+		_CTB_BLAKE3_G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+		_CTB_BLAKE3_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+		_CTB_BLAKE3_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+		_CTB_BLAKE3_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+#undef _CTB_BLAKE3_G
+
+#if _CTB_HASH_X86
+/* The lane kernels hash `lanes` inputs of `blocks` full blocks side by
+ * side, one input per 32-bit lane: input i runs with counter
+ * counter + i * increment, its first block adds flags_start and its last
+ * flags_end. The chaining values go to out, 32 bytes per input. The round
+ * listing is shared through the _CTB_BV_* ops; SSE4.1 and AVX2 do the
+ * 16- and 8-bit rotates with a byte shuffle, AVX-512 all four with vprord.
+ */
+#define _CTB_BLAKE3_VG(a, b, c, d, x, y)                                      \
+{                                                                             \
+	v[a] = _CTB_BV_ADD(_CTB_BV_ADD(v[a], v[b]), m[x]);                        \
+	v[d] = _CTB_BV_ROTR16(_CTB_BV_XOR(v[d], v[a]));                           \
+	v[c] = _CTB_BV_ADD(v[c], v[d]);                                           \
+	v[b] = _CTB_BV_ROTR12(_CTB_BV_XOR(v[b], v[c]));                           \
+	v[a] = _CTB_BV_ADD(_CTB_BV_ADD(v[a], v[b]), m[y]);                        \
+	v[d] = _CTB_BV_ROTR8(_CTB_BV_XOR(v[d], v[a]));                            \
+	v[c] = _CTB_BV_ADD(v[c], v[d]);                                           \
+	v[b] = _CTB_BV_ROTR7(_CTB_BV_XOR(v[b], v[c]));                            \
+}
+
+#define _CTB_BLAKE3_V_ROUND(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15) \
+	_CTB_BLAKE3_VG(0, 4,  8, 12, s0,  s1);                                    \
+	_CTB_BLAKE3_VG(1, 5,  9, 13, s2,  s3);                                    \
+	_CTB_BLAKE3_VG(2, 6, 10, 14, s4,  s5);                                    \
+	_CTB_BLAKE3_VG(3, 7, 11, 15, s6,  s7);                                    \
+	_CTB_BLAKE3_VG(0, 5, 10, 15, s8,  s9);                                    \
+	_CTB_BLAKE3_VG(1, 6, 11, 12, s10, s11);                                   \
+	_CTB_BLAKE3_VG(2, 7,  8, 13, s12, s13);                                   \
+	_CTB_BLAKE3_VG(3, 4,  9, 14, s14, s15)
+
+#define _CTB_BLAKE3_V_ROUNDS                                                  \
+	_CTB_BLAKE3_V_ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15); \
+	_CTB_BLAKE3_V_ROUND( 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8); \
+	_CTB_BLAKE3_V_ROUND( 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1); \
+	_CTB_BLAKE3_V_ROUND(10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6); \
+	_CTB_BLAKE3_V_ROUND(12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4); \
+	_CTB_BLAKE3_V_ROUND( 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7); \
+	_CTB_BLAKE3_V_ROUND(11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13)
+
+/* Per-lane counter words */
+static void _ctb_blake3_counters(uint64_t counter, int increment, unsigned int lanes,
+								 uint32_t lo[_CTB_BLAKE3_MAX_LANES], uint32_t hi[_CTB_BLAKE3_MAX_LANES])
+{
+	unsigned int i;
+
+	for (i = 0; i < lanes; i++) {
+		uint64_t c = counter + (increment ? i : 0);
+
+		lo[i] = (uint32_t) c;
+		hi[i] = (uint32_t) (c >> 32);
+	}
+}
+
+/* SSE4.1: four lanes */
+#define _CTB_BV_ADD(a, b)	_mm_add_epi32(a, b)
+#define _CTB_BV_XOR(a, b)	_mm_xor_si128(a, b)
+#define _CTB_BV_ROTR16(x)	_mm_shuffle_epi8(x, rot16)
+#define _CTB_BV_ROTR12(x)	_mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20))
+#define _CTB_BV_ROTR8(x)	_mm_shuffle_epi8(x, rot8)
+#define _CTB_BV_ROTR7(x)	_mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25))
+
+_CTB_HASH_TARGET("sse4.1")
+static void _ctb_blake3_x4_sse41(const unsigned char *const *input, size_t blocks,
+								 const uint32_t key[8], uint64_t counter, int increment,
+								 uint32_t flags, uint32_t flags_start, uint32_t flags_end,
+								 unsigned char *out)
+{
+	const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	uint32_t lo[_CTB_BLAKE3_MAX_LANES], hi[_CTB_BLAKE3_MAX_LANES];
+	uint32_t f = flags | flags_start;
+	__m128i h[8], v[16], m[16];
+	size_t b;
+	int i, l;
+
+	_ctb_blake3_counters(counter, increment, 4, lo, hi);
+	for (i = 0; i < 8; i++)
+		h[i] = _mm_set1_epi32((int) key[i]);
+
+	for (b = 0; b < blocks; b++) {
+		if (b + 1 == blocks)
+			f |= flags_end;
+		for (i = 0; i < 4; i++) {
+			for (l = 0; l < 4; l++)
+				m[(i << 2) + l] = _mm_loadu_si128((const __m128i *) (input[l] + (b << 6) + (i << 4)));
+			_ctb_transpose4x4_epi32(&m[i << 2]);
+		}
+		for (i = 0; i < 8; i++)
+			v[i] = h[i];
+		for (i = 0; i < 4; i++)
+			v[8 + i] = _mm_set1_epi32((int) _ctb_blake3_iv[i]);
+		v[12] = _mm_loadu_si128((const __m128i *) lo);
+		v[13] = _mm_loadu_si128((const __m128i *) hi);
+		v[14] = _mm_set1_epi32(64);
+		v[15] = _mm_set1_epi32((int) f);
+		_CTB_BLAKE3_V_ROUNDS;
+		for (i = 0; i < 8; i++)
+			h[i] = _mm_xor_si128(v[i], v[i + 8]);
+		f = flags;
+	}
+
+	_ctb_transpose4x4_epi32(&h[0]);
+	_ctb_transpose4x4_epi32(&h[4]);
+	for (l = 0; l < 4; l++) {
+		_mm_storeu_si128((__m128i *) (out + (l << 5)), h[l]);
+		_mm_storeu_si128((__m128i *) (out + (l << 5) + 16), h[4 + l]);
+	}
+}
+
+/* Row-wise single block: the four G calls of a column (then diagonal)
+ * step run in one register each, and the diagonal is formed by rotating
+ * rows 1-3.
+ */
+#define _CTB_BLAKE3_RG(x, y)                                                  \
+{                                                                             \
+	r0 = _mm_add_epi32(_mm_add_epi32(r0, r1), x);                             \
+	r3 = _CTB_BV_ROTR16(_mm_xor_si128(r3, r0));                               \
+	r2 = _mm_add_epi32(r2, r3);                                               \
+	r1 = _CTB_BV_ROTR12(_mm_xor_si128(r1, r2));                               \
+	r0 = _mm_add_epi32(_mm_add_epi32(r0, r1), y);                             \
+	r3 = _CTB_BV_ROTR8(_mm_xor_si128(r3, r0));                                \
+	r2 = _mm_add_epi32(r2, r3);                                               \
+	r1 = _CTB_BV_ROTR7(_mm_xor_si128(r1, r2));                                \
+}
+
+_CTB_HASH_TARGET("sse4.1")
+static void _ctb_blake3_compress_sse41(const uint32_t cv[8], const unsigned char block[64],
+									   uint32_t block_len, uint64_t counter, uint32_t flags,
+									   uint32_t out[16])
+{
+	const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	const __m128i c0 = _mm_loadu_si128((const __m128i *) cv);
+	const __m128i c1 = _mm_loadu_si128((const __m128i *) (cv + 4));
+	__m128i r0 = c0, r1 = c1, r2 = _mm_loadu_si128((const __m128i *) _ctb_blake3_iv), r3;
+	uint32_t m[16];
+	int r;
+
+	_ctb_blake3_load_words(m, block, 16);
+	r3 = _mm_setr_epi32((int) (uint32_t) counter, (int) (uint32_t) (counter >> 32),
+						(int) block_len, (int) flags);
+
+	for (r = 0; r < 7; r++) {
+		const unsigned char *s = _ctb_blake3_schedule[r];
+
+		_CTB_BLAKE3_RG(_mm_setr_epi32((int) m[s[0]], (int) m[s[2]], (int) m[s[4]], (int) m[s[6]]),
+					   _mm_setr_epi32((int) m[s[1]], (int) m[s[3]], (int) m[s[5]], (int) m[s[7]]));
+		r1 = _mm_shuffle_epi32(r1, 0x39);
+		r2 = _mm_shuffle_epi32(r2, 0x4E);
+		r3 = _mm_shuffle_epi32(r3, 0x93);
+		_CTB_BLAKE3_RG(_mm_setr_epi32((int) m[s[8]], (int) m[s[10]], (int) m[s[12]], (int) m[s[14]]),
+					   _mm_setr_epi32((int) m[s[9]], (int) m[s[11]], (int) m[s[13]], (int) m[s[15]]));
+		r1 = _mm_shuffle_epi32(r1, 0x93);
+		r2 = _mm_shuffle_epi32(r2, 0x4E);
+		r3 = _mm_shuffle_epi32(r3, 0x39);
+	}
+
+	_mm_storeu_si128((__m128i *) out, _mm_xor_si128(r0, r2));
+	_mm_storeu_si128((__m128i *) (out + 4), _mm_xor_si128(r1, r3));
+	_mm_storeu_si128((__m128i *) (out + 8), _mm_xor_si128(r2, c0));
+	_mm_storeu_si128((__m128i *) (out + 12), _mm_xor_si128(r3, c1));
+}
+
+#undef _CTB_BLAKE3_RG
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR16
+#undef _CTB_BV_ROTR12
+#undef _CTB_BV_ROTR8
+#undef _CTB_BV_ROTR7
+
+/* AVX2: eight lanes */
+#define _CTB_BV_ADD(a, b)	_mm256_add_epi32(a, b)
+#define _CTB_BV_XOR(a, b)	_mm256_xor_si256(a, b)
+#define _CTB_BV_ROTR16(x)	_mm256_shuffle_epi8(x, rot16)
+#define _CTB_BV_ROTR12(x)	_mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20))
+#define _CTB_BV_ROTR8(x)	_mm256_shuffle_epi8(x, rot8)
+#define _CTB_BV_ROTR7(x)	_mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25))
+
+_CTB_HASH_TARGET("avx2")
+static void _ctb_blake3_x8_avx2(const unsigned char *const *input, size_t blocks,
+								const uint32_t key[8], uint64_t counter, int increment,
+								uint32_t flags, uint32_t flags_start, uint32_t flags_end,
+								unsigned char *out)
+{
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+										   2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+										  1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	uint32_t lo[_CTB_BLAKE3_MAX_LANES], hi[_CTB_BLAKE3_MAX_LANES];
+	uint32_t f = flags | flags_start;
+	__m256i h[8], v[16], m[16];
+	size_t b;
+	int i, half;
+
+	_ctb_blake3_counters(counter, increment, 8, lo, hi);
+	for (i = 0; i < 8; i++)
+		h[i] = _mm256_set1_epi32((int) key[i]);
+
+	for (b = 0; b < blocks; b++) {
+		if (b + 1 == blocks)
+			f |= flags_end;
+		for (half = 0; half < 2; half++) {
+			for (i = 0; i < 8; i++)
+				m[(half << 3) + i] = _mm256_loadu_si256((const __m256i *) (input[i] + (b << 6) + (half << 5)));
+			_ctb_transpose8x8_epi32(&m[half << 3]);
+		}
+		for (i = 0; i < 8; i++)
+			v[i] = h[i];
+		for (i = 0; i < 4; i++)
+			v[8 + i] = _mm256_set1_epi32((int) _ctb_blake3_iv[i]);
+		v[12] = _mm256_loadu_si256((const __m256i *) lo);
+		v[13] = _mm256_loadu_si256((const __m256i *) hi);
+		v[14] = _mm256_set1_epi32(64);
+		v[15] = _mm256_set1_epi32((int) f);
+		_CTB_BLAKE3_V_ROUNDS;
+		for (i = 0; i < 8; i++)
+			h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+		f = flags;
+	}
+
+	_ctb_transpose8x8_epi32(h);
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *) (out + (i << 5)), h[i]);
+}
+
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR16
+#undef _CTB_BV_ROTR12
+#undef _CTB_BV_ROTR8
+#undef _CTB_BV_ROTR7
+
+_CTB_HASH_AVX512_DIAG_BEGIN
+
+/* AVX-512F: sixteen lanes */
+#define _CTB_BV_ADD(a, b)	_mm512_add_epi32(a, b)
+#define _CTB_BV_XOR(a, b)	_mm512_xor_si512(a, b)
+#define _CTB_BV_ROTR16(x)	_mm512_ror_epi32(x, 16)
+#define _CTB_BV_ROTR12(x)	_mm512_ror_epi32(x, 12)
+#define _CTB_BV_ROTR8(x)	_mm512_ror_epi32(x, 8)
+#define _CTB_BV_ROTR7(x)	_mm512_ror_epi32(x, 7)
+
+_CTB_HASH_TARGET("avx512f")
+static void _ctb_blake3_x16_avx512(const unsigned char *const *input, size_t blocks,
+								   const uint32_t key[8], uint64_t counter, int increment,
+								   uint32_t flags, uint32_t flags_start, uint32_t flags_end,
+								   unsigned char *out)
+{
+	uint32_t lo[_CTB_BLAKE3_MAX_LANES], hi[_CTB_BLAKE3_MAX_LANES];
+	uint32_t f = flags | flags_start;
+	__m512i h[16], v[16], m[16];
+	size_t b;
+	int i;
+
+	_ctb_blake3_counters(counter, increment, 16, lo, hi);
+	for (i = 0; i < 8; i++)
+		h[i] = _mm512_set1_epi32((int) key[i]);
+
+	for (b = 0; b < blocks; b++) {
+		if (b + 1 == blocks)
+			f |= flags_end;
+		for (i = 0; i < 16; i++)
+			m[i] = _mm512_loadu_si512((const void *) (input[i] + (b << 6)));
+		_ctb_transpose16x16_epi32(m);
+		for (i = 0; i < 8; i++)
+			v[i] = h[i];
+		for (i = 0; i < 4; i++)
+			v[8 + i] = _mm512_set1_epi32((int) _ctb_blake3_iv[i]);
+		v[12] = _mm512_loadu_si512((const void *) lo);
+		v[13] = _mm512_loadu_si512((const void *) hi);
+		v[14] = _mm512_set1_epi32(64);
+		v[15] = _mm512_set1_epi32((int) f);
+		_CTB_BLAKE3_V_ROUNDS;
+		for (i = 0; i < 8; i++)
+			h[i] = _mm512_xor_si512(v[i], v[i + 8]);
+		f = flags;
+	}
+
+	/* rows 8-15 only pad the transpose; each lane's 8 words land in the low half */
+	for (i = 8; i < 16; i++)
+		h[i] = _mm512_setzero_si512();
+	_ctb_transpose16x16_epi32(h);
+	for (i = 0; i < 16; i++)
+		_mm256_storeu_si256((__m256i *) (out + (i << 5)), _mm512_castsi512_si256(h[i]));
+}
+
+#undef _CTB_BV_ADD
+#undef _CTB_BV_XOR
+#undef _CTB_BV_ROTR16
+#undef _CTB_BV_ROTR12
+#undef _CTB_BV_ROTR8
+#undef _CTB_BV_ROTR7
+
+_CTB_HASH_AVX512_DIAG_END
+
+#undef _CTB_BLAKE3_V_ROUNDS
+#undef _CTB_BLAKE3_V_ROUND
+#undef _CTB_BLAKE3_VG
+#endif /* _CTB_HASH_X86 */
+
+/* Hashes count inputs of `blocks` full blocks each, as the lane kernels
+ * do. A short group still takes the lane kernel, padded with repeats of
+ * its last input, when it fills at least a quarter of the lanes; smaller
+ * ones are cheaper one block at a time.
+ */
+static void _ctb_blake3_hash_many(const unsigned char *const *input, size_t count, size_t blocks,
+								  const uint32_t key[8], uint64_t counter, int increment,
+								  uint32_t flags, uint32_t flags_start, uint32_t flags_end,
+								  unsigned char *out)
+{
+	const _ctb_hash_kernel_table *kt = _ctb_hash_kernels();
+	const size_t lanes = kt->blake3_lanes;
+	size_t i, b;
+
+	if (kt->blake3_many) {
+		for (; count >= lanes; count -= lanes) {
+			kt->blake3_many(input, blocks, key, counter, increment, flags, flags_start, flags_end, out);
+			input += lanes;
+			counter += increment ? lanes : 0;
+			out += lanes * CTB_BLAKE3_DIGEST_SIZE;
+		}
+		if (count && count * 4 >= lanes) {
+			const unsigned char *pad[_CTB_BLAKE3_MAX_LANES];
+			unsigned char cv[_CTB_BLAKE3_MAX_LANES * CTB_BLAKE3_DIGEST_SIZE];
+
+			for (i = 0; i < lanes; i++)
+				pad[i] = input[i < count ? i : count - 1];
+			kt->blake3_many(pad, blocks, key, counter, increment, flags, flags_start, flags_end, cv);
+			memcpy(out, cv, count * CTB_BLAKE3_DIGEST_SIZE);
+			return;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		uint32_t cv[8], st[16];
+		uint32_t f = flags | flags_start;
+
+		memcpy(cv, key, sizeof(cv));
+		for (b = 0; b < blocks; b++) {
+			if (b + 1 == blocks)
+				f |= flags_end;
+			kt->blake3_compress(cv, input[i] + (b << 6), CTB_BLAKE3_BLOCK_SIZE, counter, f, st);
+			memcpy(cv, st, sizeof(cv));
+			f = flags;
+		}
+		_ctb_blake3_store_words(out + i * CTB_BLAKE3_DIGEST_SIZE, cv, 8);
+		counter += increment ? 1 : 0;
+	}
+}
+
+/* A node whose chaining value or root output is still to be computed:
+ * the last block of a chunk, or a parent block of two child CVs.
+ */
+typedef struct
+{
+	uint32_t		cv[8];
+	unsigned char	block[CTB_BLAKE3_BLOCK_SIZE];
+	uint64_t		counter;
+	uint32_t		len;
+	uint32_t		flags;
+} _ctb_blake3_node;
+
+static void _ctb_blake3_chunk_node(const ctb_blake3_ctx *ctx, _ctb_blake3_node *n)
+{
+	memcpy(n->cv, ctx->cv, sizeof(n->cv));
+	memcpy(n->block, ctx->block, ctx->len);
+	memset(n->block + ctx->len, 0, CTB_BLAKE3_BLOCK_SIZE - ctx->len);
+	n->counter = ctx->chunk;
+	n->len = ctx->len;
+	n->flags = ctx->flags | _CTB_BLAKE3_CHUNK_END | (ctx->blocks ? 0 : _CTB_BLAKE3_CHUNK_START);
+}
+
+static void _ctb_blake3_parent_node(const uint32_t key[8], uint32_t flags,
+									const unsigned char children[2 * CTB_BLAKE3_DIGEST_SIZE],
+									_ctb_blake3_node *n)
+{
+	memcpy(n->cv, key, sizeof(n->cv));
+	memcpy(n->block, children, CTB_BLAKE3_BLOCK_SIZE);
+	n->counter = 0;
+	n->len = CTB_BLAKE3_BLOCK_SIZE;
+	n->flags = flags | _CTB_BLAKE3_PARENT;
+}
+
+static void _ctb_blake3_node_cv(const _ctb_blake3_node *n, unsigned char cv[CTB_BLAKE3_DIGEST_SIZE])
+{
+	uint32_t st[16];
+
+	_ctb_hash_kernels()->blake3_compress(n->cv, n->block, n->len, n->counter, n->flags, st);
+	_ctb_blake3_store_words(cv, st, 8);
+}
+
+/* Extended output of the root node, from byte `seek` on. */
+static void _ctb_blake3_node_root(const _ctb_blake3_node *n, uint64_t seek,
+								  unsigned char *out, size_t out_len)
+{
+	const _ctb_blake3_compress_fn compress = _ctb_hash_kernels()->blake3_compress;
+	uint64_t counter = seek / CTB_BLAKE3_BLOCK_SIZE;
+	size_t skip = (size_t) (seek % CTB_BLAKE3_BLOCK_SIZE);
+	unsigned char block[CTB_BLAKE3_BLOCK_SIZE];
+	uint32_t st[16];
+
+	while (out_len) {
+		size_t take = CTB_BLAKE3_BLOCK_SIZE - skip;
+
+		if (take > out_len)
+			take = out_len;
+		compress(n->cv, n->block, n->len, counter++, n->flags | _CTB_BLAKE3_ROOT, st);
+		_ctb_blake3_store_words(block, st, 16);
+		memcpy(out, block + skip, take);
+		out += take;
+		out_len -= take;
+		skip = 0;
+	}
+}
+
+/* Chaining value of a whole chunk of 1..1024 bytes that is not the root. */
+static void _ctb_blake3_chunk_cv(const unsigned char *in, size_t len, const uint32_t key[8],
+								 uint64_t chunk, uint32_t flags, unsigned char cv[CTB_BLAKE3_DIGEST_SIZE])
+{
+	const _ctb_blake3_compress_fn compress = _ctb_hash_kernels()->blake3_compress;
+	unsigned char block[CTB_BLAKE3_BLOCK_SIZE];
+	uint32_t h[8], st[16];
+	uint32_t f = flags | _CTB_BLAKE3_CHUNK_START;
+
+	memcpy(h, key, sizeof(h));
+	for (; len > CTB_BLAKE3_BLOCK_SIZE; len -= CTB_BLAKE3_BLOCK_SIZE, in += CTB_BLAKE3_BLOCK_SIZE) {
+		compress(h, in, CTB_BLAKE3_BLOCK_SIZE, chunk, f, st);
+		memcpy(h, st, sizeof(h));
+		f = flags;
+	}
+	memcpy(block, in, len);
+	memset(block + len, 0, CTB_BLAKE3_BLOCK_SIZE - len);
+	compress(h, block, (uint32_t) len, chunk, f | _CTB_BLAKE3_CHUNK_END, st);
+	_ctb_blake3_store_words(cv, st, 8);
+}
+
+/* Chaining values of up to lanes chunks, the last of which may be partial. */
+static size_t _ctb_blake3_chunks(const unsigned char *in, size_t len, const uint32_t key[8],
+								 uint64_t chunk, uint32_t flags, unsigned char *out)
+{
+	const unsigned char *ptr[_CTB_BLAKE3_MAX_LANES];
+	size_t n = 0;
+
+	for (; len >= CTB_BLAKE3_CHUNK_SIZE; len -= CTB_BLAKE3_CHUNK_SIZE, in += CTB_BLAKE3_CHUNK_SIZE)
+		ptr[n++] = in;
+	_ctb_blake3_hash_many(ptr, n, CTB_BLAKE3_CHUNK_SIZE / CTB_BLAKE3_BLOCK_SIZE, key, chunk, 1, flags,
+						  _CTB_BLAKE3_CHUNK_START, _CTB_BLAKE3_CHUNK_END, out);
+	if (len) {
+		_ctb_blake3_chunk_cv(in, len, key, chunk + n, flags, out + n * CTB_BLAKE3_DIGEST_SIZE);
+		n++;
+	}
+	return n;
+}
+
+/* Parents of adjacent pairs of n chaining values; an odd last one is
+ * passed through.
+ */
+static size_t _ctb_blake3_parents(const unsigned char *cv, size_t n, const uint32_t key[8],
+								  uint32_t flags, unsigned char *out)
+{
+	const unsigned char *ptr[_CTB_BLAKE3_MAX_LANES];
+	size_t i, pairs = n / 2;
+
+	for (i = 0; i < pairs; i++)
+		ptr[i] = cv + i * 2 * CTB_BLAKE3_DIGEST_SIZE;
+	_ctb_blake3_hash_many(ptr, pairs, 1, key, 0, 0, flags | _CTB_BLAKE3_PARENT, 0, 0, out);
+	if (n & 1) {
+		memcpy(out + pairs * CTB_BLAKE3_DIGEST_SIZE, cv + pairs * 2 * CTB_BLAKE3_DIGEST_SIZE,
+			   CTB_BLAKE3_DIGEST_SIZE);
+		pairs++;
+	}
+	return pairs;
+}
+
+/* Left part of a subtree of len > 1 chunk: the largest power-of-two
+ * number of chunks that leaves at least one byte on the right.
+ */
+static size_t _ctb_blake3_left_len(size_t len)
+{
+	size_t chunks = (len - 1) / CTB_BLAKE3_CHUNK_SIZE, p = 1;
+
+	while (p <= chunks / 2)
+		p <<= 1;
+	return p * CTB_BLAKE3_CHUNK_SIZE;
+}
+
+static size_t _ctb_blake3_subtree(const unsigned char *in, size_t len, const uint32_t key[8],
+								  uint64_t chunk, uint32_t flags, unsigned int threads,
+								  unsigned char *out);
+
+typedef struct
+{
+	const unsigned char	*in[2];
+	size_t				len[2];
+	uint64_t			chunk[2];
+	unsigned int		threads[2];
+	unsigned char		*out[2];
+	size_t				n[2];
+	const uint32_t		*key;
+	uint32_t			flags;
+} _ctb_blake3_split;
+
+static void _ctb_blake3_split_step(void *arg, unsigned int index)
+{
+	_ctb_blake3_split *sp = (_ctb_blake3_split *) arg;
+
+	sp->n[index] = _ctb_blake3_subtree(sp->in[index], sp->len[index], sp->key, sp->chunk[index],
+									   sp->flags, sp->threads[index], sp->out[index]);
+}
+
+/* Chaining values of a subtree of more than one chunk, reduced to at most
+ * max(lanes, 2) so each level of parents fills the lane kernel. With
+ * threads > 1 the two halves of a large enough subtree are hashed on
+ * separate threads, which then split their own halves in turn.
+ */
+static size_t _ctb_blake3_subtree(const unsigned char *in, size_t len, const uint32_t key[8],
+								  uint64_t chunk, uint32_t flags, unsigned int threads,
+								  unsigned char *out)
+{
+	unsigned char cv[2 * _CTB_BLAKE3_MAX_LANES * CTB_BLAKE3_DIGEST_SIZE];
+	size_t lanes = _ctb_hash_kernels()->blake3_lanes;
+	size_t left, degree;
+	_ctb_blake3_split sp;
+
+	if (len <= lanes * CTB_BLAKE3_CHUNK_SIZE)
+		return _ctb_blake3_chunks(in, len, key, chunk, flags, out);
+
+	left = _ctb_blake3_left_len(len);
+	degree = lanes == 1 && left > CTB_BLAKE3_CHUNK_SIZE ? 2 : lanes;
+	sp.in[0] = in;
+	sp.in[1] = in + left;
+	sp.len[0] = left;
+	sp.len[1] = len - left;
+	sp.chunk[0] = chunk;
+	sp.chunk[1] = chunk + left / CTB_BLAKE3_CHUNK_SIZE;
+	sp.out[0] = cv;
+	sp.out[1] = cv + degree * CTB_BLAKE3_DIGEST_SIZE;
+	sp.key = key;
+	sp.flags = flags;
+
+	if (threads > 1 && sp.len[1] >= _CTB_BLAKE3_PARALLEL_MIN) {
+		sp.threads[0] = threads - threads / 2;
+		sp.threads[1] = threads / 2;
+		_ctb_hash_parallel(_ctb_blake3_split_step, &sp, 2);
+	} else {
+		sp.threads[0] = sp.threads[1] = 1;
+		_ctb_blake3_split_step(&sp, 0);
+		_ctb_blake3_split_step(&sp, 1);
+	}
+
+	/* One CV a side happens only for scalar lanes; return both as they are */
+	if (sp.n[0] == 1) {
+		memcpy(out, cv, 2 * CTB_BLAKE3_DIGEST_SIZE);
+		return 2;
+	}
+	return _ctb_blake3_parents(cv, sp.n[0] + sp.n[1], key, flags, out);
+}
+
+/* Reduces a subtree to the two children of its top node. The top node
+ * itself is left to the caller, as it may turn out to be the root.
+ */
+static void _ctb_blake3_subtree_pair(const unsigned char *in, size_t len, const uint32_t key[8],
+									 uint64_t chunk, uint32_t flags, unsigned int threads,
+									 unsigned char pair[2 * CTB_BLAKE3_DIGEST_SIZE])
+{
+	unsigned char cv[_CTB_BLAKE3_MAX_LANES * CTB_BLAKE3_DIGEST_SIZE];
+	unsigned char up[_CTB_BLAKE3_MAX_LANES * CTB_BLAKE3_DIGEST_SIZE];
+	size_t n = _ctb_blake3_subtree(in, len, key, chunk, flags, threads, cv);
+
+	while (n > 2) {
+		n = _ctb_blake3_parents(cv, n, key, flags, up);
+		memcpy(cv, up, n * CTB_BLAKE3_DIGEST_SIZE);
+	}
+	memcpy(pair, cv, 2 * CTB_BLAKE3_DIGEST_SIZE);
+}
+
+/* The stack holds the CVs of complete subtrees, largest first, and is
+ * merged lazily: only when more input arrives is it certain that the top
+ * entries are not the root's children. After c chunks the merged stack has
+ * popcount(c) entries.
+ */
+static void _ctb_blake3_merge(ctb_blake3_ctx *ctx, uint64_t chunks)
+{
+	unsigned int keep = _ctb_tree_popcount(chunks);
+	_ctb_blake3_node n;
+
+	while (ctx->depth > keep) {
+		_ctb_blake3_parent_node(ctx->key, ctx->flags, ctx->stack[ctx->depth - 2], &n);
+		_ctb_blake3_node_cv(&n, ctx->stack[ctx->depth - 2]);
+		ctx->depth--;
+	}
+}
+
+static void _ctb_blake3_push(ctb_blake3_ctx *ctx, const unsigned char cv[CTB_BLAKE3_DIGEST_SIZE],
+							 uint64_t chunk)
+{
+	_ctb_blake3_merge(ctx, chunk);
+	memcpy(ctx->stack[ctx->depth++], cv, CTB_BLAKE3_DIGEST_SIZE);
+}
+
+/* Adds up to the rest of the current chunk. The chunk's last block stays
+ * in ctx->block, since it gets the CHUNK_END flag (and maybe ROOT).
+ */
+static void _ctb_blake3_chunk_update(ctb_blake3_ctx *ctx, const unsigned char *in, size_t len)
+{
+	const _ctb_blake3_compress_fn compress = _ctb_hash_kernels()->blake3_compress;
+	uint32_t st[16];
+	size_t take;
+
+	if (ctx->len) {
+		take = CTB_BLAKE3_BLOCK_SIZE - ctx->len;
+		if (take > len)
+			take = len;
+		memcpy(ctx->block + ctx->len, in, take);
+		ctx->len += (unsigned int) take;
+		in += take;
+		len -= take;
+		if (!len)
+			return;
+		compress(ctx->cv, ctx->block, CTB_BLAKE3_BLOCK_SIZE, ctx->chunk,
+				 ctx->flags | (ctx->blocks ? 0 : _CTB_BLAKE3_CHUNK_START), st);
+		memcpy(ctx->cv, st, sizeof(ctx->cv));
+		ctx->blocks++;
+		ctx->len = 0;
+	}
+	for (; len > CTB_BLAKE3_BLOCK_SIZE; len -= CTB_BLAKE3_BLOCK_SIZE, in += CTB_BLAKE3_BLOCK_SIZE) {
+		compress(ctx->cv, in, CTB_BLAKE3_BLOCK_SIZE, ctx->chunk,
+				 ctx->flags | (ctx->blocks ? 0 : _CTB_BLAKE3_CHUNK_START), st);
+		memcpy(ctx->cv, st, sizeof(ctx->cv));
+		ctx->blocks++;
+	}
+	memcpy(ctx->block, in, len);
+	ctx->len = (unsigned int) len;
+}
+
+static void _ctb_blake3_update(ctb_blake3_ctx *ctx, const unsigned char *in, size_t len,
+							   unsigned int threads)
+{
+	unsigned char cv[2 * CTB_BLAKE3_DIGEST_SIZE];
+
+	if (!len)
+		return;
+
+	/* Finish a partial chunk; it is not the root if more input follows */
+	if (ctx->len || ctx->blocks) {
+		size_t take = CTB_BLAKE3_CHUNK_SIZE - (ctx->blocks * CTB_BLAKE3_BLOCK_SIZE + ctx->len);
+		_ctb_blake3_node n;
+
+		if (take > len)
+			take = len;
+		_ctb_blake3_chunk_update(ctx, in, take);
+		in += take;
+		len -= take;
+		if (!len)
+			return;
+		_ctb_blake3_chunk_node(ctx, &n);
+		_ctb_blake3_node_cv(&n, cv);
+		_ctb_blake3_push(ctx, cv, ctx->chunk);
+		memcpy(ctx->cv, ctx->key, sizeof(ctx->cv));
+		ctx->chunk++;
+		ctx->blocks = 0;
+		ctx->len = 0;
+	}
+
+	/* Whole subtrees straight from the input: the largest power-of-two
+	 * number of chunks that fits and keeps the tree aligned. The last
+	 * chunk is held back in case it is the root.
+	 */
+	while (len > CTB_BLAKE3_CHUNK_SIZE) {
+		uint64_t done = ctx->chunk * CTB_BLAKE3_CHUNK_SIZE;
+		size_t sub = CTB_BLAKE3_CHUNK_SIZE;
+
+		while (sub <= len / 2)
+			sub <<= 1;
+		while ((uint64_t) (sub - 1) & done)
+			sub >>= 1;
+
+		if (sub == CTB_BLAKE3_CHUNK_SIZE) {
+			_ctb_blake3_chunk_cv(in, sub, ctx->key, ctx->chunk, ctx->flags, cv);
+			_ctb_blake3_push(ctx, cv, ctx->chunk);
+		} else {
+			_ctb_blake3_subtree_pair(in, sub, ctx->key, ctx->chunk, ctx->flags, threads, cv);
+			_ctb_blake3_push(ctx, cv, ctx->chunk);
+			_ctb_blake3_push(ctx, cv + CTB_BLAKE3_DIGEST_SIZE,
+							 ctx->chunk + sub / CTB_BLAKE3_CHUNK_SIZE / 2);
+		}
+		ctx->chunk += sub / CTB_BLAKE3_CHUNK_SIZE;
+		in += sub;
+		len -= sub;
+	}
+
+	if (len) {
+		_ctb_blake3_chunk_update(ctx, in, len);
+		_ctb_blake3_merge(ctx, ctx->chunk);
+	}
+}
+
+static void _ctb_blake3_init(ctb_blake3_ctx *ctx, const uint32_t key[8], uint32_t flags)
+{
+	memcpy(ctx->key, key, sizeof(ctx->key));
+	memcpy(ctx->cv, key, sizeof(ctx->cv));
+	ctx->chunk = 0;
+	ctx->len = 0;
+	ctx->blocks = 0;
+	ctx->flags = flags;
+	ctx->depth = 0;
+}
+
+void ctb_blake3_init(ctb_blake3_ctx *ctx)
+{
+	_ctb_blake3_init(ctx, _ctb_blake3_iv, 0);
+}
+
+void ctb_blake3_init_keyed(ctb_blake3_ctx *ctx, const unsigned char key[CTB_BLAKE3_KEY_SIZE])
+{
+	uint32_t k[8];
+
+	_ctb_blake3_load_words(k, key, 8);
+	_ctb_blake3_init(ctx, k, _CTB_BLAKE3_KEYED_HASH);
+	ctb__memzero(k, sizeof(k));
+}
+
+void ctb_blake3_init_derive_key(ctb_blake3_ctx *ctx, const char *context)
+{
+	unsigned char key[CTB_BLAKE3_KEY_SIZE];
+	uint32_t k[8];
+
+	_ctb_blake3_init(ctx, _ctb_blake3_iv, _CTB_BLAKE3_DERIVE_CONTEXT);
+	_ctb_blake3_update(ctx, (const unsigned char *) context, strlen(context), 1);
+	ctb_blake3_final(ctx, key);
+	_ctb_blake3_load_words(k, key, 8);
+	_ctb_blake3_init(ctx, k, _CTB_BLAKE3_DERIVE_MATERIAL);
+	ctb__memzero(key, sizeof(key));
+	ctb__memzero(k, sizeof(k));
+}
+
+void ctb_blake3_update(ctb_blake3_ctx *ctx, const unsigned char *message, size_t len)
+{
+	_ctb_blake3_update(ctx, message, len, 1);
+}
+
+void ctb_blake3_update_parallel(ctb_blake3_ctx *ctx, const unsigned char *message, size_t len,
+								unsigned int threads)
+{
+	_ctb_blake3_update(ctx, message, len, _ctb_tree_threads(threads));
+}
+
+void ctb_blake3_final_xof(const ctb_blake3_ctx *ctx, uint64_t seek, unsigned char *out, size_t out_len)
+{
+	unsigned char block[2 * CTB_BLAKE3_DIGEST_SIZE];
+	_ctb_blake3_node n;
+	unsigned int i;
+
+	if (!out_len)
+		return;
+
+	/* Roll the stack up into the current chunk, or into the top two
+	 * entries when the input ended on a subtree boundary.
+	 */
+	if (ctx->depth == 0 || ctx->len || ctx->blocks) {
+		i = ctx->depth;
+		_ctb_blake3_chunk_node(ctx, &n);
+	} else {
+		i = ctx->depth - 2;
+		_ctb_blake3_parent_node(ctx->key, ctx->flags, ctx->stack[i], &n);
+	}
+	while (i > 0) {
+		i--;
+		memcpy(block, ctx->stack[i], CTB_BLAKE3_DIGEST_SIZE);
+		_ctb_blake3_node_cv(&n, block + CTB_BLAKE3_DIGEST_SIZE);
+		_ctb_blake3_parent_node(ctx->key, ctx->flags, block, &n);
+	}
+	_ctb_blake3_node_root(&n, seek, out, out_len);
+}
+
+void ctb_blake3_final(const ctb_blake3_ctx *ctx, unsigned char *digest)
+{
+	ctb_blake3_final_xof(ctx, 0, digest, CTB_BLAKE3_DIGEST_SIZE);
+}
+
+void ctb_blake3(const unsigned char *message, size_t len, unsigned char *digest)
+{
+	ctb_blake3_ctx ctx;
+
+	ctb_blake3_init(&ctx);
+	ctb_blake3_update(&ctx, message, len);
+	ctb_blake3_final(&ctx, digest);
+}
+
+
+/* =========================================================================
+   CPU DISPATCH IMPLEMENTATION
+   ========================================================================= */
+
+#if _CTB_HASH_X86
+static void _ctb_hash_cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4])
+{
+#if defined(_MSC_VER)
+	int regs[4];
+
+	__cpuidex(regs, (int) leaf, (int) sub);
+	r[0] = (uint32_t) regs[0]; r[1] = (uint32_t) regs[1];
+	r[2] = (uint32_t) regs[2]; r[3] = (uint32_t) regs[3];
+#else
+	r[0] = r[1] = r[2] = r[3] = 0;
+	if (__get_cpuid_max(leaf & 0x80000000u, NULL) >= leaf)
+		__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static uint64_t _ctb_hash_xgetbv(void)
+{
+#if defined(_MSC_VER)
+	return (uint64_t) _xgetbv(0);
+#else
+	uint32_t lo, hi;
+
+	__asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t) hi << 32) | lo;
+#endif
+}
+#endif /* _CTB_HASH_X86 */
+
+static unsigned int _ctb_hash_detect_cpu(void)
+{
+	unsigned int features = 0;
+
+#if _CTB_HASH_X86
+	uint32_t r[4];
+	uint64_t xcr0 = 0;
+
+	_ctb_hash_cpuid(1, 0, r);
+	if (r[3] & (1u << 26)) features |= CTB_HASH_CPU_SSE2;
+	if (r[2] & (1u <<  9)) features |= CTB_HASH_CPU_SSSE3;
+	if (r[2] & (1u << 19)) features |= CTB_HASH_CPU_SSE41;
+	if (r[2] & (1u << 20)) features |= CTB_HASH_CPU_SSE42;
+	if (r[2] & (1u <<  1)) features |= CTB_HASH_CPU_PCLMUL;
+
+	/* AVX state must be enabled by the OS, not just present */
+	if (r[2] & (1u << 27))
+		xcr0 = _ctb_hash_xgetbv();
+	if ((r[2] & (1u << 28)) && (xcr0 & 0x6) == 0x6)
+		features |= CTB_HASH_CPU_AVX;
+
+	_ctb_hash_cpuid(7, 0, r);
+	if (r[1] & (1u << 29)) features |= CTB_HASH_CPU_SHA;
+	if (r[1] & (1u <<  8)) features |= CTB_HASH_CPU_BMI2;
+	if (features & CTB_HASH_CPU_AVX) {
+		if (r[1] & (1u << 5)) features |= CTB_HASH_CPU_AVX2;
+		if ((xcr0 & 0xE6) == 0xE6 && (r[1] & (1u << 16))) {
+			features |= CTB_HASH_CPU_AVX512F;
+			if (r[1] & (1u << 31)) features |= CTB_HASH_CPU_AVX512VL;
+			if (r[1] & (1u << 30)) features |= CTB_HASH_CPU_AVX512BW;
+		}
+	}
+#endif
+	return features;
+}
+
+#define _CTB_HASH_HAS(f, need) (((f) & (need)) == (need))
+
+static void _ctb_hash_resolve(unsigned int mask)
+{
+	static unsigned int detected = ~0u;
+	_ctb_hash_kernel_table kt;
+	unsigned int f;
+
+	if (detected == ~0u) {
+		detected = _ctb_hash_detect_cpu();
+		_ctb_crc_tables_init();
+	}
+	f = detected & mask;
+
+	kt.features = f;
+	kt.sha1_compress = _ctb_sha1_compress_scalar;
+	kt.sha256_compress = _ctb_sha256_compress_scalar;
+	kt.sha256_words = _ctb_sha256_words_scalar;
+	kt.sha256_mb = NULL;
+	kt.sha256_mb_lanes = 1;
+	kt.sha512_compress = _ctb_sha512_compress_scalar;
+	kt.sha512_mb = NULL;
+	kt.sha512_mb_lanes = 1;
+	kt.ripemd160_mb = NULL;
+	kt.ripemd160_mb_lanes = 1;
+	kt.ripemd160_32 = NULL;
+	kt.pbkdf2_sha256 = _ctb_pbkdf2_sha256_x1;
+	kt.pbkdf2_sha256_lanes = 1;
+	kt.pbkdf2_sha512 = _ctb_pbkdf2_sha512_x1;
+	kt.pbkdf2_sha512_lanes = 1;
+	kt.xxh3_accumulate = _ctb_xxh3_accumulate_scalar;
+	kt.xxh3_scramble = _ctb_xxh3_scramble_scalar;
+	kt.crc32c = _ctb_crc32c_scalar;
+	kt.crc32 = _ctb_crc32_scalar;
+	kt.crc64 = _ctb_crc64_scalar;
+	kt.blake3_compress = _ctb_blake3_compress_scalar;
+	kt.blake3_many = NULL;
+	kt.blake3_lanes = 1;
+	kt.blake2b_compress = _ctb_blake2b_compress_scalar;
+	kt.blake2s_compress = _ctb_blake2s_compress_scalar;
+	kt.blake2bp_many = NULL;
+	kt.blake2sp_many = NULL;
+
+#if _CTB_HASH_X86
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SHA | CTB_HASH_CPU_SSE41)) {
+		kt.sha1_compress = _ctb_sha1_compress_shani;
+		kt.sha256_compress = _ctb_sha256_compress_shani;
+		kt.sha256_words = _ctb_sha256_words_shani;
+	}
+	/* sixteen AVX-512 lanes outrun one SHA-NI stream, eight AVX2 lanes do not */
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX512F)) {
+		kt.sha256_mb = _ctb_sha256_x16_avx512;
+		kt.sha256_mb_lanes = 16;
+		kt.pbkdf2_sha256 = _ctb_pbkdf2_sha256_x16_avx512;
+		kt.pbkdf2_sha256_lanes = 16;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2) && !(f & CTB_HASH_CPU_SHA)) {
+		kt.sha256_mb = _ctb_sha256_x8_avx2;
+		kt.sha256_mb_lanes = 8;
+		kt.pbkdf2_sha256 = _ctb_pbkdf2_sha256_x8_avx2;
+		kt.pbkdf2_sha256_lanes = 8;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2 | CTB_HASH_CPU_BMI2))
+		kt.sha512_compress = _ctb_sha512_compress_avx2;
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2)) {
+		kt.sha512_mb = _ctb_sha512_x4_avx2;
+		kt.sha512_mb_lanes = 4;
+		kt.pbkdf2_sha512 = _ctb_pbkdf2_sha512_x4_avx2;
+		kt.pbkdf2_sha512_lanes = 4;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2)) {
+		kt.ripemd160_mb = _ctb_ripemd160_x8_avx2;
+		kt.ripemd160_32 = _ctb_ripemd160_32_x8_avx2;
+		kt.ripemd160_mb_lanes = 8;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE41)) {
+		kt.ripemd160_mb = _ctb_ripemd160_x4_sse41;
+		kt.ripemd160_32 = _ctb_ripemd160_32_x4_sse41;
+		kt.ripemd160_mb_lanes = 4;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX512F)) {
+		kt.xxh3_accumulate = _ctb_xxh3_accumulate_avx512;
+		kt.xxh3_scramble = _ctb_xxh3_scramble_avx512;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2)) {
+		kt.xxh3_accumulate = _ctb_xxh3_accumulate_avx2;
+		kt.xxh3_scramble = _ctb_xxh3_scramble_avx2;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE2)) {
+		kt.xxh3_accumulate = _ctb_xxh3_accumulate_sse2;
+		kt.xxh3_scramble = _ctb_xxh3_scramble_sse2;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE42 | CTB_HASH_CPU_PCLMUL))
+		kt.crc32c = _ctb_crc32c_sse42_x3;
+	else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE42))
+		kt.crc32c = _ctb_crc32c_sse42;
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE2 | CTB_HASH_CPU_PCLMUL)) {
+		kt.crc32 = _ctb_crc32_pclmul;
+		kt.crc64 = _ctb_crc64_pclmul;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE41))
+		kt.blake3_compress = _ctb_blake3_compress_sse41;
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX512F)) {
+		kt.blake3_many = _ctb_blake3_x16_avx512;
+		kt.blake3_lanes = 16;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2)) {
+		kt.blake3_many = _ctb_blake3_x8_avx2;
+		kt.blake3_lanes = 8;
+	} else if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE41)) {
+		kt.blake3_many = _ctb_blake3_x4_sse41;
+		kt.blake3_lanes = 4;
+	}
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_SSE41))
+		kt.blake2s_compress = _ctb_blake2s_compress_sse41;
+	if (_CTB_HASH_HAS(f, CTB_HASH_CPU_AVX2)) {
+		kt.blake2b_compress = _ctb_blake2b_compress_avx2;
+		kt.blake2bp_many = _ctb_blake2bp_x4_avx2;
+		kt.blake2sp_many = _ctb_blake2sp_x8_avx2;
+	}
+#endif
+
+	_ctb_hash_kt = kt;
+	_ctb_hash_algo_bind(&_ctb_hash_kt);
+	_CTB_HASH_STORE_RELEASE(&_ctb_hash_kt_ready, 1);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+static void _ctb_hash_startup(void)
+{
+	_ctb_hash_kernels();
+}
+#endif
+
+unsigned int ctb_hash_cpu_features(void)
+{
+	return _ctb_hash_kernels()->features;
+}
+
+void ctb_hash_set_cpu_features(unsigned int mask)
+{
+	/* run the one-time default resolve first, so it cannot undo the mask */
+	_ctb_hash_kernels();
+	_ctb_hash_resolve(mask);
+}
+
+#undef _CTB_HASH_HAS
+
+#ifdef CTB_HASH_TEST_VECTORS
+
+/* Known-answer tests, run once per kernel set: each profile below is
+ * passed to ctb_hash_set_cpu_features, so every scalar, SHA-NI, SSE,
+ * AVX2 and AVX-512 path the CPU offers has to give the reference output.
+ * Profiles the CPU lacks fall back to the kernels it has. Generated inputs
+ * are the BLAKE3 test vector bytes, i % 251. Define CTB_HASH_TEST_VECTORS next to
+ * CTB_HASH_IMPLEMENTATION in one file to build the test program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _CTB_HASH_TEST_INPUT	(9 * CTB_HASH_TREE_CHUNK_SIZE)
+
+void test(const char *vector, const unsigned char *digest, unsigned int digest_size)
+{
+	char output[2 * 256 + 1];
+	int i;
+
+	output[2 * digest_size] = '\0';
+
+	for (i = 0; i < (int) digest_size ; i++) {
+		sprintf(output + 2 * i, "%02x", digest[i]);
+	}
+
+	printf("H: %s\n", output);
+	if (strcmp(vector, output)) {
+		fprintf(stderr, "Test failed.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Feeds msg to a descriptor's update in chunks of every awkward size:
+ * single bytes, just under and over a block, and unaligned runs.
+ */
+static void test_stream(const ctb_hash_algo *algo, const unsigned char *msg, size_t len,
+						unsigned char *digest)
+{
+	static const size_t chunk[] = { 1, 55, 64, 65, 127, 1000, 4093 };
+	ctb_hash_ctx ctx;
+	size_t off = 0, k = 0, n;
+
+	algo->init(&ctx);
+	while (off < len) {
+		n = chunk[k++ % (sizeof(chunk) / sizeof(chunk[0]))];
+		if (n > len - off)
+			n = len - off;
+		algo->update(&ctx, msg + off, n);
+		off += n;
+	}
+	algo->final(&ctx, digest);
+}
+
+/* FIPS 180-4 examples: the empty string, "abc", the 448-bit message and
+ * one million 'a', one-shot and streamed in odd-sized chunks.
+ */
+static void test_sha(void)
+{
+	static const char *vectors[5][4] =
+	{
+		{	/* SHA-1 */
+			"da39a3ee5e6b4b0d3255bfef95601890afd80709",
+			"a9993e364706816aba3e25717850c26c9cd0d89d",
+			"84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+			"34aa973cd4c4daa4f61eeb2bdbad27316534016f"
+		},
+		{	/* SHA-224 */
+			"d14a028c2a3a2bc9476102bb288234c415a2b01f828ea62ac5b3e42f",
+			"23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7",
+			"75388b16512776cc5dba5da1fd890150b0c6455cb4f58b1952522525",
+			"20794655980c91d8bbb4c1ea97618a4bf03f42581948b2ee4ee7ad67"
+		},
+		{	/* SHA-256 */
+			"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+			"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+		},
+		{	/* SHA-384 */
+			"38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da"
+			"274edebfe76f65fbd51ad2f14898b95b",
+			"cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+			"8086072ba1e7cc2358baeca134c825a7",
+			"3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05abfe8f450de5f36bc6"
+			"b0455a8520bc4e6f5fe95b1fe3c8452b",
+			"9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+			"07b8b3dc38ecc4ebae97ddd87f3d8985"
+		},
+		{	/* SHA-512 */
+			"cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+			"47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e",
+			"ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+			"2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+			"204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+			"96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445",
+			"e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+			"de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b"
+		}
+	};
+	static const char *messages[3] =
+	{
+		"", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+	};
+	unsigned char *million, digest[_CTB_SHA512_DIGEST_SIZE];
+	const unsigned char *msg;
+	size_t i, len;
+	unsigned int id;
+
+	million = (unsigned char *) malloc(1000000);
+	if (million == NULL) {
+		fprintf(stderr, "Can't allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(million, 'a', 1000000);
+
+	printf("SHA-1/SHA-2 FIPS 180-4 Test vectors\n");
+	for (i = 0; i < 4; i++) {
+		msg = i < 3 ? (const unsigned char *) messages[i] : million;
+		len = i < 3 ? strlen(messages[i]) : 1000000;
+
+		ctb_sha1((char *) digest, (const char *) msg, len);
+		test(vectors[0][i], digest, 20);
+		ctb_sha224(msg, len, digest);
+		test(vectors[1][i], digest, _CTB_SHA224_DIGEST_SIZE);
+		ctb_sha256(msg, len, digest);
+		test(vectors[2][i], digest, _CTB_SHA256_DIGEST_SIZE);
+		ctb_sha384(msg, len, digest);
+		test(vectors[3][i], digest, _CTB_SHA384_DIGEST_SIZE);
+		ctb_sha512(msg, len, digest);
+		test(vectors[4][i], digest, _CTB_SHA512_DIGEST_SIZE);
+
+		for (id = CTB_HASH_SHA1; id <= CTB_HASH_SHA512; id++) {
+			test_stream(ctb_hash_algo_get((ctb_hash_id) id), msg, len, digest);
+			test(vectors[id - CTB_HASH_SHA1][i], digest, (unsigned int) ctb_hash_digest_size((ctb_hash_id) id));
+		}
+	}
+	printf("\n");
+	free(million);
+}
+
+/* Checks got against a digest computed another way. */
+#if defined(__cplusplus) && (__cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L))
+#define _CTB_HASH_TEST_CT	1
+
+/* FIPS 180-4 "abc", folded by the compiler. */
+static_assert(ctb_sha1_ct("abc")[0] == 0xa9 && ctb_sha1_ct("abc")[19] == 0x9d, "SHA-1 abc");
+static_assert(ctb_sha224_ct("abc")[0] == 0x23 && ctb_sha224_ct("abc")[27] == 0xa7, "SHA-224 abc");
+static_assert(ctb_sha256_ct("abc") == ctb_hash_ct_digest<32>{ {
+				  0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+				  0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+			  } }, "SHA-256 abc");
+static_assert(ctb_sha384_ct("abc")[0] == 0xcb && ctb_sha384_ct("abc")[47] == 0xa7, "SHA-384 abc");
+static_assert(ctb_sha512_ct("abc")[0] == 0xdd && ctb_sha512_ct("abc")[63] == 0x9f, "SHA-512 abc");
+static_assert(ctb_sha256_ct("abc") != ctb_sha256_ct("abd"), "SHA-256 abd");
+
+#define _CTB_HASH_TEST_A10		"aaaaaaaaaa"
+#define _CTB_HASH_TEST_A130		_CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 \
+								_CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 \
+								_CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 _CTB_HASH_TEST_A10 \
+								_CTB_HASH_TEST_A10
+
+/* Constexpr digests of the FIPS 180-4 two-block message, and midstates of
+ * 130 'a' (past a block for every width) finished on the runtime kernels
+ * over the rest of one million 'a'. Then the other way round: a runtime
+ * context finished by the constexpr code.
  */
-#define DECL_PBKDF2_FN(NAME,                        \
-HMAC_CTX_T,                  \
-HMAC_INIT, HMAC_REINIT,      \
-HMAC_UPDATE, HMAC_FINAL,     \
-DIGEST_LEN)                  \
-void NAME(const uint8_t *password, size_t password_len, \
-		  const uint8_t *salt,     size_t salt_len,     \
-		  uint32_t iterations,                          \
-		  uint8_t *out, size_t out_len)                 \
-{                                                       \
-if (!out || out_len == 0 || iterations == 0)        \
-	return;                                         \
-\
-const size_t hLen = (size_t)(DIGEST_LEN);           \
-uint32_t blocks = (uint32_t)((out_len + hLen - 1) / hLen); \
-\
-/* salt || INT_32_BE(i) buffer */                   \
-uint8_t *salt_cnt = (uint8_t*)malloc(salt_len + 4); \
-if (!salt_cnt) return;                              \
-if (salt_len) memcpy(salt_cnt, salt, salt_len);     \
-\
-HMAC_CTX_T ctx;                                     \
-HMAC_INIT(&ctx, password, (unsigned int)password_len); \
-\
-uint8_t *U = (uint8_t*)malloc(hLen);                \
-uint8_t *T = (uint8_t*)malloc(hLen);                \
-if (!U || !T) {                                     \
-	free(salt_cnt);                                 \
-	free(U); free(T);                               \
-	return;                                         \
-}                                                   \
-\
-size_t off = 0;                                     \
-for (uint32_t i = 1; i <= blocks; ++i) {            \
-	be32(i, salt_cnt + salt_len);                   \
-	\
-	/* U1 = PRF(P, S || INT(i)) */                  \
-	HMAC_REINIT(&ctx);                              \
-	HMAC_UPDATE(&ctx, salt_cnt, (unsigned int)(salt_len + 4)); \
-	HMAC_FINAL(&ctx, U, (unsigned int)hLen);        \
-	memcpy(T, U, hLen);                             \
-	\
-	/* U2..Uc */                                    \
-	for (uint32_t j = 2; j <= iterations; ++j) {    \
-		HMAC_REINIT(&ctx);                          \
-		HMAC_UPDATE(&ctx, U, (unsigned int)hLen);   \
-		HMAC_FINAL(&ctx, U, (unsigned int)hLen);    \
-		for (size_t k = 0; k < hLen; ++k)           \
-			T[k] ^= U[k];                           \
-	}                                               \
-	\
-	size_t take = (out_len - off < hLen) ? (out_len - off) : hLen; \
-	memcpy(out + off, T, take);											\
-	off += take;                                    \
-}                                                   \
-\
-/* wipe & free */                                   \
-if (U) { memset(U, 0, hLen); free(U); }             \
-if (T) { memset(T, 0, hLen); free(T); }             \
-if (salt_cnt) { memset(salt_cnt, 0, salt_len + 4); free(salt_cnt); } \
+static void test_constexpr(void)
+{
+	static constexpr ctb_hash_ct_digest<20> sha1 =
+		ctb_sha1_ct("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+	static constexpr ctb_hash_ct_digest<_CTB_SHA256_DIGEST_SIZE> sha256 =
+		ctb_sha256_ct("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+	static constexpr ctb_hash_ct_digest<_CTB_SHA512_DIGEST_SIZE> sha512 =
+		ctb_sha512_ct("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+	static constexpr ctb_sha1_ctx sha1_a = ctb_sha1_ct_init(_CTB_HASH_TEST_A130);
+	static constexpr ctb_sha224_ctx sha224_a = ctb_sha224_ct_init(_CTB_HASH_TEST_A130);
+	static constexpr ctb_sha256_ctx sha256_a = ctb_sha256_ct_init(_CTB_HASH_TEST_A130);
+	static constexpr ctb_sha384_ctx sha384_a = ctb_sha384_ct_init(_CTB_HASH_TEST_A130);
+	static constexpr ctb_sha512_ctx sha512_a = ctb_sha512_ct_init(_CTB_HASH_TEST_A130);
+	unsigned char *million, digest[_CTB_SHA512_DIGEST_SIZE];
+	ctb_sha1_ctx ctx1;
+	ctb_sha224_ctx ctx224;
+	ctb_sha256_ctx ctx256;
+	ctb_sha384_ctx ctx384;
+	ctb_sha512_ctx ctx512;
+
+	million = (unsigned char *) malloc(1000000);
+	if (million == NULL) {
+		fprintf(stderr, "Can't allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(million, 'a', 1000000);
+
+	printf("Constexpr Test vectors\n");
+	test("84983e441c3bd26ebaae4aa1f95129e5e54670f1", sha1.data(), 20);
+	test("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", sha256.data(),
+		 _CTB_SHA256_DIGEST_SIZE);
+	test("204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+		 "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445", sha512.data(),
+		 _CTB_SHA512_DIGEST_SIZE);
+
+	ctx1 = sha1_a;
+	ctb_sha1_update(&ctx1, million + 130, 1000000 - 130);
+	ctb_sha1_final(digest, &ctx1);
+	test("34aa973cd4c4daa4f61eeb2bdbad27316534016f", digest, 20);
+	ctx224 = sha224_a;
+	ctb_sha224_update(&ctx224, million + 130, 1000000 - 130);
+	ctb_sha224_final(&ctx224, digest);
+	test("20794655980c91d8bbb4c1ea97618a4bf03f42581948b2ee4ee7ad67", digest, _CTB_SHA224_DIGEST_SIZE);
+	ctx256 = sha256_a;
+	ctb_sha256_update(&ctx256, million + 130, 1000000 - 130);
+	ctb_sha256_final(&ctx256, digest);
+	test("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", digest, _CTB_SHA256_DIGEST_SIZE);
+	ctx384 = sha384_a;
+	ctb_sha384_update(&ctx384, million + 130, 1000000 - 130);
+	ctb_sha384_final(&ctx384, digest);
+	test("9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+		 "07b8b3dc38ecc4ebae97ddd87f3d8985", digest, _CTB_SHA384_DIGEST_SIZE);
+	ctx512 = sha512_a;
+	ctb_sha512_update(&ctx512, million + 130, 1000000 - 130);
+	ctb_sha512_final(&ctx512, digest);
+	test("e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+		 "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b", digest, _CTB_SHA512_DIGEST_SIZE);
+
+	ctb_sha256_init(&ctx256);
+	ctb_sha256_update(&ctx256, million, 999997);
+	test("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+		 ctb_sha256_ct_final(ctb_sha256_ct_update(ctx256, "aaa")).data(), _CTB_SHA256_DIGEST_SIZE);
+	ctb_sha512_init(&ctx512);
+	ctb_sha512_update(&ctx512, million, 999997);
+	test("e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+		 "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b",
+		 ctb_sha512_ct_final(ctb_sha512_ct_update(ctx512, "aaa")).data(), _CTB_SHA512_DIGEST_SIZE);
+	printf("\n");
+	free(million);
 }
 
-/* Instantiate four PBKDF2 functions (HMAC-SHA2 variants) */
-DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha224,
-			   ctb_hmac_sha224_ctx,
-			   ctb_hmac_sha224_init, ctb_hmac_sha224_reinit,
-			   ctb_hmac_sha224_update, ctb_hmac_sha224_final,
-			   _CTB_SHA224_DIGEST_SIZE)
+#undef _CTB_HASH_TEST_A130
+#undef _CTB_HASH_TEST_A10
 
-DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha256,
-			   ctb_hmac_sha256_ctx,
-			   ctb_hmac_sha256_init, ctb_hmac_sha256_reinit,
-			   ctb_hmac_sha256_update, ctb_hmac_sha256_final,
-			   _CTB_SHA256_DIGEST_SIZE)
+#endif /* C++14 */
 
-DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha384,
-			   ctb_hmac_sha384_ctx,
-			   ctb_hmac_sha384_init, ctb_hmac_sha384_reinit,
-			   ctb_hmac_sha384_update, ctb_hmac_sha384_final,
-			   _CTB_SHA384_DIGEST_SIZE)
+static void test_same(const unsigned char *want, const unsigned char *got, unsigned int size)
+{
+	char vector[2 * 256 + 1];
+	unsigned int i;
 
-DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha512,
-			   ctb_hmac_sha512_ctx,
-			   ctb_hmac_sha512_init, ctb_hmac_sha512_reinit,
-			   ctb_hmac_sha512_update, ctb_hmac_sha512_final,
-			   _CTB_SHA512_DIGEST_SIZE)
+	for (i = 0; i < size; i++)
+		sprintf(vector + 2 * i, "%02x", want[i]);
+	test(vector, got, size);
+}
+
+#define _CTB_HASH_TEST_JOBS		37
+
+/* Multi-buffer batches against one-shot hashing of the same messages.
+ * Lengths straddle the padding edges (55/56, 63/64, 119) and run past
+ * 1000 bytes, messages start unaligned, and no count is a multiple of a
+ * lane width, so lane refill and the partly filled last round both run.
+ */
+static void test_many(const unsigned char *input)
+{
+	static const size_t lengths[] = { 0, 55, 56, 63, 64, 119, 1000, 4099 };
+	static const size_t counts[] = { 1, 3, 9, 17, _CTB_HASH_TEST_JOBS };
+	const unsigned char *msg[_CTB_HASH_TEST_JOBS];
+	size_t len[_CTB_HASH_TEST_JOBS];
+	unsigned char want[_CTB_SHA512_DIGEST_SIZE];
+	unsigned char d224[_CTB_HASH_TEST_JOBS][_CTB_SHA224_DIGEST_SIZE];
+	unsigned char d256[_CTB_HASH_TEST_JOBS][_CTB_SHA256_DIGEST_SIZE];
+	unsigned char d384[_CTB_HASH_TEST_JOBS][_CTB_SHA384_DIGEST_SIZE];
+	unsigned char d512[_CTB_HASH_TEST_JOBS][_CTB_SHA512_DIGEST_SIZE];
+	uint8_t r160[_CTB_HASH_TEST_JOBS][_CTB_RIPEMD160_DIGEST_LENGTH];
+	size_t c, i, count;
+
+	for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+		msg[i] = input + 7 * i;
+		len[i] = lengths[(5 * i) % (sizeof(lengths) / sizeof(lengths[0]))];
+	}
+
+	printf("Multi-buffer Test vectors\n");
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		count = counts[c];
+		ctb_sha224_many(msg, len, d224, count);
+		ctb_sha256_many(msg, len, d256, count);
+		ctb_sha384_many(msg, len, d384, count);
+		ctb_sha512_many(msg, len, d512, count);
+		ctb_ripemd160_many(msg, len, r160, count);
+		for (i = 0; i < count; i++) {
+			ctb_sha224(msg[i], len[i], want);
+			test_same(want, d224[i], _CTB_SHA224_DIGEST_SIZE);
+			ctb_sha256(msg[i], len[i], want);
+			test_same(want, d256[i], _CTB_SHA256_DIGEST_SIZE);
+			ctb_sha384(msg[i], len[i], want);
+			test_same(want, d384[i], _CTB_SHA384_DIGEST_SIZE);
+			ctb_sha512(msg[i], len[i], want);
+			test_same(want, d512[i], _CTB_SHA512_DIGEST_SIZE);
+			ctb_ripemd160(msg[i], len[i], want);
+			test_same(want, r160[i], _CTB_RIPEMD160_DIGEST_LENGTH);
+		}
+	}
+
+	/* the fixed-count forms, on the first lanes of the same jobs */
+	ctb_sha256_x8(msg, len, d256);
+	ctb_sha256_x16(msg, len, d256 + 8);
+	ctb_sha224_x16(msg, len, d224);
+	ctb_sha512_x4(msg, len, d512);
+	ctb_sha384_x4(msg, len, d384);
+	ctb_ripemd160_x4(msg, len, r160);
+	ctb_ripemd160_x8(msg, len, r160 + 4);
+	for (i = 0; i < 16; i++) {
+		ctb_sha256(msg[i], len[i], want);
+		if (i < 8)
+			test_same(want, d256[i], _CTB_SHA256_DIGEST_SIZE);
+		test_same(want, d256[8 + i], _CTB_SHA256_DIGEST_SIZE);
+		ctb_sha224(msg[i], len[i], want);
+		test_same(want, d224[i], _CTB_SHA224_DIGEST_SIZE);
+		ctb_ripemd160(msg[i], len[i], want);
+		if (i < 4)
+			test_same(want, r160[i], _CTB_RIPEMD160_DIGEST_LENGTH);
+		if (i < 8)
+			test_same(want, r160[4 + i], _CTB_RIPEMD160_DIGEST_LENGTH);
+		if (i < 4) {
+			ctb_sha512(msg[i], len[i], want);
+			test_same(want, d512[i], _CTB_SHA512_DIGEST_SIZE);
+			ctb_sha384(msg[i], len[i], want);
+			test_same(want, d384[i], _CTB_SHA384_DIGEST_SIZE);
+		}
+	}
+
+	/* contiguous 32-byte messages, padding precomputed */
+	ctb_ripemd160_32_many((const uint8_t (*)[32]) input, r160, _CTB_HASH_TEST_JOBS);
+	for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+		ctb_ripemd160(input + 32 * i, 32, want);
+		test_same(want, r160[i], _CTB_RIPEMD160_DIGEST_LENGTH);
+	}
+	printf("\n");
+}
+
+/* HASH160 and SHA-256d known answers (the Bitcoin wiki's compressed public
+ * key, the genesis block header), then the fixed-length and batch forms
+ * against the general ones on unaligned input.
+ */
+static void test_composite(const unsigned char *input)
+{
+	static const uint8_t pubkey[33] =
+	{
+		0x02, 0x50, 0x86, 0x3a, 0xd6, 0x4a, 0x87, 0xae, 0x8a, 0x2f, 0xe8, 0x3c, 0x1a, 0xf1, 0xa8, 0x40,
+		0x3c, 0xb5, 0x3f, 0x53, 0xe4, 0x86, 0xd8, 0x51, 0x1d, 0xad, 0x8a, 0x04, 0x88, 0x7e, 0x5b, 0x23,
+		0x52
+	};
+	static const uint8_t genesis[80] =
+	{
+		0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e,
+		0x67, 0x76, 0x8f, 0x61, 0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa,
+		0x4b, 0x1e, 0x5e, 0x4a, 0x29, 0xab, 0x5f, 0x49, 0xff, 0xff, 0x00, 0x1d, 0x1d, 0xac, 0x2b, 0x7c
+	};
+	static const size_t lengths[] = { 0, 32, 55, 56, 64, 80, 119, 1000 };
+	static const size_t counts[] = { 1, 3, 9, 17, _CTB_HASH_TEST_JOBS };
+	const uint8_t *msg[_CTB_HASH_TEST_JOBS];
+	size_t len[_CTB_HASH_TEST_JOBS];
+	uint8_t want[_CTB_SHA256_DIGEST_SIZE], got[_CTB_SHA256_DIGEST_SIZE];
+	uint8_t d256[_CTB_HASH_TEST_JOBS][_CTB_SHA256_DIGEST_SIZE];
+	uint8_t r160[_CTB_HASH_TEST_JOBS][_CTB_RIPEMD160_DIGEST_LENGTH];
+	size_t c, i, count;
+
+	printf("HASH160/SHA-256d Test vectors\n");
+	ctb_hash160((const uint8_t *) "", 0, r160[0]);
+	test("b472a266d0bd89c13706a4132ccfb16f7c3b9fcb", r160[0], _CTB_RIPEMD160_DIGEST_LENGTH);
+	ctb_hash160((const uint8_t *) "abc", 3, r160[0]);
+	test("bb1be98c142444d7a56aa3981c3942a978e4dc33", r160[0], _CTB_RIPEMD160_DIGEST_LENGTH);
+	ctb_hash160(pubkey, sizeof(pubkey), r160[0]);
+	test("f54a5851e9372b87810a8e60cdd2e7cfd80b6e31", r160[0], _CTB_RIPEMD160_DIGEST_LENGTH);
+
+	ctb_sha256d((const uint8_t *) "", 0, got);
+	test("5df6e0e2761359d30a8275058e299fcc0381534545f55cf43e41983f5d4c9456", got, _CTB_SHA256_DIGEST_SIZE);
+	ctb_sha256d((const uint8_t *) "abc", 3, got);
+	test("4f8b42c22dd3729b519ba6f68d2da7cc5b2d606d05daed5ad5128cc03e6c6358", got, _CTB_SHA256_DIGEST_SIZE);
+	ctb_sha256d(genesis, sizeof(genesis), got);
+	test("6fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000", got, _CTB_SHA256_DIGEST_SIZE);
+	ctb_sha256d_80(genesis, got);
+	test("6fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000", got, _CTB_SHA256_DIGEST_SIZE);
+
+	/* fixed-length forms, from every alignment */
+	for (i = 0; i < 16; i++) {
+		ctb_sha256d(input + i, 32, want);
+		ctb_sha256d_32(input + i, got);
+		test_same(want, got, _CTB_SHA256_DIGEST_SIZE);
+		ctb_sha256d(input + i, 64, want);
+		ctb_sha256d_64(input + i, got);
+		test_same(want, got, _CTB_SHA256_DIGEST_SIZE);
+		ctb_sha256d(input + i, 80, want);
+		ctb_sha256d_80(input + i, got);
+		test_same(want, got, _CTB_SHA256_DIGEST_SIZE);
+	}
+
+	for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+		msg[i] = input + 11 * i;
+		len[i] = lengths[(3 * i) % (sizeof(lengths) / sizeof(lengths[0]))];
+	}
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		count = counts[c];
+		ctb_hash160_many(msg, len, r160, count);
+		ctb_sha256d_many(msg, len, d256, count);
+		for (i = 0; i < count; i++) {
+			ctb_hash160(msg[i], len[i], want);
+			test_same(want, r160[i], _CTB_RIPEMD160_DIGEST_LENGTH);
+			ctb_sha256d(msg[i], len[i], want);
+			test_same(want, d256[i], _CTB_SHA256_DIGEST_SIZE);
+		}
+	}
+
+	/* contiguous 64-byte messages (Merkle nodes), off alignment */
+	ctb_sha256d_64_many((const uint8_t (*)[64]) (input + 1), d256, _CTB_HASH_TEST_JOBS);
+	for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+		ctb_sha256d(input + 1 + 64 * i, 64, want);
+		test_same(want, d256[i], _CTB_SHA256_DIGEST_SIZE);
+	}
+	printf("\n");
+}
+
+/* PBKDF2: RFC 6070 (HMAC-SHA-1, through the descriptor; the 16777216
+ * iteration case is left out for time) and RFC 7914 section 11
+ * (HMAC-SHA-256, also threaded). A 200-byte password and a 1000-byte salt,
+ * both longer than a block, run through every SHA-2 width with keys that
+ * end in a partial block (reference: Python hashlib). The batch forms are
+ * checked against single derivations over ragged jobs and lane counts.
+ */
+static void test_pbkdf2(const unsigned char *input)
+{
+	static const struct
+	{
+		const char	*password;
+		size_t		password_len;
+		const char	*salt;
+		size_t		salt_len;
+		uint32_t	iterations;
+		size_t		out_len;
+		const char	*key;
+	} rfc6070[] =
+	{
+		{ "password", 8, "salt", 4, 1, 20, "0c60c80f961f0e71f3a9b524af6012062fe037a6" },
+		{ "password", 8, "salt", 4, 2, 20, "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" },
+		{ "password", 8, "salt", 4, 4096, 20, "4b007901b765489abead49d926f721d065a429c1" },
+		{ "passwordPASSWORDpassword", 24, "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36, 4096, 25,
+		  "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038" },
+		{ "pass\0word", 9, "sa\0lt", 5, 4096, 16, "56fa6aa75548099dcc37d7f03425e0c3" }
+	}, rfc7914[] =
+	{
+		{ "passwd", 6, "salt", 4, 1, 64,
+		  "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+		  "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783" },
+		{ "Password", 8, "NaCl", 4, 80000, 64,
+		  "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+		  "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d" }
+	};
+	static const char *wide[4] =
+	{
+		"e26a30a44996b24eb2c62c94fc112668a7c1e4405edca134ad79ad57896944b5"
+		"6a5cf690e6809b2a89384b44b03854dd643e4ee7744be8faa137423e992132d0"
+		"c69adb48b139",
+		"4cba2ee10c889caf76760110287b5e0977d3f45816408f9c56ecfef1fd8c8c71"
+		"11e1f10b8277ae1d7672f2d2d8fd62795e76b05472eb3398ae3eb37ad19261da"
+		"5c5867daccdcf318eb0c74d53b14fdd8759f3c03b72fef048fe260da1e7e883f"
+		"a1b86895",
+		"b0fc508ce9cfa723f35baf27cbced6b84e1dd2731a27e8b931d924a6527e5dee"
+		"68c559d4c776fd5ab8c70098649ebf0d4e3927762aa71bf1de219b42af21f66d"
+		"a43260106fc72e8c235446946902f5c8b126413853e981636ca4c620139126c5"
+		"2481e930",
+		"ec9fd97e060c5434e197a0263526f480ca5ddcd8ff7563fb06aa6fae970a8461"
+		"36d7d1b77e5cd84287c0c04e3494033561927a3b2279ff3fd7d0f8c374220baa"
+		"0585a3884a350eb4b4d2277646c29536a854187051a523c2b82f5410b11f0d09"
+		"e88fc0feb00633f19fa52c4ceb5e3ab2e1a3f02638dd1b545cf3abcfb5a682ce"
+		"c7e09cd5f21bf910e3a49d7d0680c0a93c13aa48bff3"
+	};
+	static const size_t password_lengths[] = { 0, 8, 64, 65, 200 };
+	static const size_t salt_lengths[] = { 4, 0, 124, 1000 };
+	static const uint32_t iterations[] = { 1, 257 };
+	static const size_t counts[] = { 1, 3, 9, 17 };
+	const uint8_t *password[17], *salt[17];
+	size_t password_len[17], salt_len[17];
+	uint8_t key[150], keys[17][150];
+	size_t c, i, n;
+	unsigned int threads;
+
+	printf("PBKDF2 RFC 6070/7914 Test vectors\n");
+	for (i = 0; i < sizeof(rfc6070) / sizeof(rfc6070[0]); i++) {
+		ctb_pbkdf2_hmac(ctb_hash_algo_get(CTB_HASH_SHA1),
+						(const uint8_t *) rfc6070[i].password, rfc6070[i].password_len,
+						(const uint8_t *) rfc6070[i].salt, rfc6070[i].salt_len,
+						rfc6070[i].iterations, key, rfc6070[i].out_len);
+		test(rfc6070[i].key, key, (unsigned int) rfc6070[i].out_len);
+	}
+	for (i = 0; i < sizeof(rfc7914) / sizeof(rfc7914[0]); i++) {
+		ctb_pbkdf2_hmac_sha256((const uint8_t *) rfc7914[i].password, rfc7914[i].password_len,
+							   (const uint8_t *) rfc7914[i].salt, rfc7914[i].salt_len,
+							   rfc7914[i].iterations, key, rfc7914[i].out_len);
+		test(rfc7914[i].key, key, (unsigned int) rfc7914[i].out_len);
+		for (threads = 2; threads <= 3; threads++) {
+			ctb_pbkdf2_hmac_sha256_mt((const uint8_t *) rfc7914[i].password, rfc7914[i].password_len,
+									  (const uint8_t *) rfc7914[i].salt, rfc7914[i].salt_len,
+									  rfc7914[i].iterations, key, rfc7914[i].out_len, threads);
+			test(rfc7914[i].key, key, (unsigned int) rfc7914[i].out_len);
+		}
+	}
+
+	ctb_pbkdf2_hmac_sha224(input, 200, input + 300, 1000, 3, key, 70);
+	test(wide[0], key, 70);
+	ctb_pbkdf2_hmac_sha256(input, 200, input + 300, 1000, 3, key, 100);
+	test(wide[1], key, 100);
+	ctb_pbkdf2_hmac_sha384(input, 200, input + 300, 1000, 3, key, 100);
+	test(wide[2], key, 100);
+	ctb_pbkdf2_hmac_sha512(input, 200, input + 300, 1000, 3, key, 150);
+	test(wide[3], key, 150);
+	ctb_pbkdf2_hmac_sha224_mt(input, 200, input + 300, 1000, 3, key, 70, 3);
+	test(wide[0], key, 70);
+	ctb_pbkdf2_hmac_sha256_mt(input, 200, input + 300, 1000, 3, key, 100, 4);
+	test(wide[1], key, 100);
+	ctb_pbkdf2_hmac_sha384_mt(input, 200, input + 300, 1000, 3, key, 100, 2);
+	test(wide[2], key, 100);
+	ctb_pbkdf2_hmac_sha512_mt(input, 200, input + 300, 1000, 3, key, 150, 3);
+	test(wide[3], key, 150);
+
+	/* batches: three output blocks per job, the last one partial */
+	for (i = 0; i < 17; i++) {
+		password[i] = input + 3 * i;
+		password_len[i] = password_lengths[i % (sizeof(password_lengths) / sizeof(password_lengths[0]))];
+		salt[i] = input + 500 + 5 * i;
+		salt_len[i] = salt_lengths[i % (sizeof(salt_lengths) / sizeof(salt_lengths[0]))];
+	}
+	for (n = 0; n < sizeof(iterations) / sizeof(iterations[0]); n++) {
+		for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			ctb_pbkdf2_hmac_sha256_many(password, password_len, salt, salt_len, iterations[n],
+										keys[0], 70, counts[c]);
+			for (i = 0; i < counts[c]; i++) {
+				ctb_pbkdf2_hmac_sha256(password[i], password_len[i], salt[i], salt_len[i],
+									   iterations[n], key, 70);
+				test_same(key, keys[0] + 70 * i, 70);
+			}
+			ctb_pbkdf2_hmac_sha512_many(password, password_len, salt, salt_len, iterations[n],
+										keys[0], 150, counts[c]);
+			for (i = 0; i < counts[c]; i++) {
+				ctb_pbkdf2_hmac_sha512(password[i], password_len[i], salt[i], salt_len[i],
+									   iterations[n], key, 150);
+				test_same(key, keys[0] + 150 * i, 150);
+			}
+		}
+	}
+	printf("\n");
+}
+
+static void test_true(const char *what, int ok)
+{
+	printf("T: %s\n", what);
+	if (!ok) {
+		fprintf(stderr, "Test failed.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Every descriptor: lookup by id and name, "abc", HMAC on RFC 4231 test
+ * cases 1 and 6 (a key longer than the block, hashed first), a reused HMAC
+ * context, and the batch hook over ragged lengths. SHA-1 and RIPEMD-160
+ * HMAC match RFC 2202 and RFC 2286; the BLAKE values are from Python's
+ * hashlib, blake3 and hmac over the same block sizes.
+ */
+static void test_generic(const unsigned char *input)
+{
+	static const char *vectors[CTB_HASH_ALGO_COUNT][3] =
+	{
+		{	/* sha1 */
+			"a9993e364706816aba3e25717850c26c9cd0d89d",
+			"b617318655057264e28bc0b6fb378c8ef146be00",
+			"90d0dace1c1bdc957339307803160335bde6df2b"
+		},
+		{	/* sha224 */
+			"23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7",
+			"896fb1128abbdf196832107cd49df33f47b4b1169912ba4f53684b22",
+			"95e9a0db962095adaebe9b2d6f0dbce2d499f112f2d2b7273fa6870e"
+		},
+		{	/* sha256 */
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+			"b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+			"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"
+		},
+		{	/* sha384 */
+			"cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+			"8086072ba1e7cc2358baeca134c825a7",
+			"afd03944d84895626b0825f4ab46907f15f9dadbe4101ec682aa034c7cebc59c"
+			"faea9ea9076ede7f4af152e8b2fa9cb6",
+			"4ece084485813e9088d2c63a041bc5b44f9ef1012a2b588f3cd11f05033ac4c6"
+			"0c2ef6ab4030fe8296248df163f44952"
+		},
+		{	/* sha512 */
+			"ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+			"2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+			"87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+			"daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854",
+			"80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+			"6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598"
+		},
+		{	/* ripemd160 */
+			"8eb208f7e05d987a9b044a8e98c6b087f15a0bfc",
+			"24cb4bd67d20fc1a5d2ed7732dcc39377f0a5668",
+			"71bb52d26408e5a221393d5811b03cc7f94bcd3a"
+		},
+		{	/* blake3 */
+			"6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85",
+			"0bd71bad2f522a89551e0246a42cd24e960641c71195f33df08ead6af3bbeccb",
+			"206553225c4716b9b4f6fc279d4d67d5a033e3b6520f2c0aad2d6f91ff06762a"
+		},
+		{	/* blake2b */
+			"ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+			"7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923",
+			"358a6a184924894fc34bee5680eedf57d84a37bb38832f288e3b27dc63a98cc8"
+			"c91e76da476b508bc6b2d408a248857452906e4a20b48c6b4b55d2df0fe1dd24",
+			"a54b2943b2a20227d41ca46c0945af09bc1faefb2f49894c23aebc557fb79c48"
+			"89dca74408dc865086667aedee4a3185c53a49c80b814c4c5813ea0c8b38a8f8"
+		},
+		{	/* blake2s */
+			"508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982",
+			"65a8b7c5cc9136d424e82c37e2707e74e913c0655b99c75f40edf387453a3260",
+			"d23d79394f53d536a096e6514447eeaabb05ded01be32c1937da6a8f7103bc4e"
+		},
+		{	/* blake2bp */
+			"b91a6b66ae87526c400b0a8b53774dc65284ad8f6575f8148ff93dff943a6ecd"
+			"8362130f22d6dae633aa0f91df4ac89aaff31d0f1b923c898e82025dedbdad6e",
+			"3926d3c23f1480c07b0f963977d6a5838c95e90589fd81b9d12697c5fa834d30"
+			"16b4d780a85e433b4c66644db0772409011e0603ee54a9899ca6177871111fc0",
+			"c7d0b38c1cfef42c93d4327510c6e42ff207009734e206f5eec81b876b201e6c"
+			"5b8db98a7f9e028799ab423187f2dbad3f10f5f2aff77ea43b477dcbcbd4f64e"
+		},
+		{	/* blake2sp */
+			"70f75b58f1fecab821db43c88ad84edde5a52600616cd22517b7bb14d440a7d5",
+			"81efdff138874ca327a20a6cc6eb7ddec376b13150f5c6f8d6d6aec679b2d481",
+			"5fe96a6b719bf6b0ce14d7b9a06921c112ecb575700100baf83c85c455faef24"
+		}
+	};
+	static const char long_key_msg[] = "Test Using Larger Than Block-Size Key - Hash Key First";
+	static const size_t lengths[] = { 0, 1, 63, 64, 65, 128, 1025, 4099 };
+	uint8_t short_key[20], long_key[131];
+	uint8_t digest[CTB_HASH_MAX_DIGEST_SIZE], many[_CTB_HASH_TEST_JOBS][CTB_HASH_MAX_DIGEST_SIZE];
+	const uint8_t *msg[_CTB_HASH_TEST_JOBS];
+	size_t len[_CTB_HASH_TEST_JOBS];
+	const ctb_hash_algo *algo;
+	ctb_hmac_ctx hmac;
+	unsigned int id;
+	size_t i, size;
+
+	memset(short_key, 0x0b, sizeof(short_key));
+	memset(long_key, 0xaa, sizeof(long_key));
+	for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+		msg[i] = input + 13 * i;
+		len[i] = lengths[i % (sizeof(lengths) / sizeof(lengths[0]))];
+	}
+
+	printf("Generic descriptor and HMAC Test vectors\n");
+	test_true("unknown id and name", ctb_hash_algo_get((ctb_hash_id) CTB_HASH_ALGO_COUNT) == NULL
+			  && ctb_hash_algo_find("md5") == NULL
+			  && ctb_hash_digest_size((ctb_hash_id) CTB_HASH_ALGO_COUNT) == 0);
+	for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+		algo = ctb_hash_algo_get((ctb_hash_id) id);
+		test_true("descriptor", algo != NULL && algo->id == (ctb_hash_id) id
+				  && ctb_hash_algo_find(algo->name) == algo
+				  && algo->digest_size == ctb_hash_digest_size((ctb_hash_id) id)
+				  && algo->ctx_size <= sizeof(ctb_hash_ctx) && algo->lanes >= 1);
+		size = algo->digest_size;
+
+		ctb_hash_digest(algo, (const uint8_t *) "abc", 3, digest);
+		test(vectors[id][0], digest, (unsigned int) size);
+		test_stream(algo, (const unsigned char *) "abc", 3, digest);
+		test(vectors[id][0], digest, (unsigned int) size);
+
+		ctb_hmac(algo, short_key, sizeof(short_key), (const uint8_t *) "Hi There", 8, digest);
+		test(vectors[id][1], digest, (unsigned int) size);
+		ctb_hmac_init(&hmac, algo, long_key, sizeof(long_key));
+		ctb_hmac_update(&hmac, (const uint8_t *) long_key_msg, 17);
+		ctb_hmac_update(&hmac, (const uint8_t *) long_key_msg + 17, sizeof(long_key_msg) - 1 - 17);
+		ctb_hmac_final(&hmac, digest);
+		test(vectors[id][2], digest, (unsigned int) size);
+		ctb_hmac_update(&hmac, (const uint8_t *) long_key_msg, sizeof(long_key_msg) - 1);
+		ctb_hmac_final(&hmac, digest);
+		test(vectors[id][2], digest, (unsigned int) size);
+
+		algo->many(msg, len, many[0], _CTB_HASH_TEST_JOBS);
+		for (i = 0; i < _CTB_HASH_TEST_JOBS; i++) {
+			ctb_hash_digest(algo, msg[i], len[i], digest);
+			test_same(digest, many[0] + i * size, (unsigned int) size);
+		}
+	}
+	printf("\n");
+}
+
+/* ctb_hash_file and ctb_multihash_file on a mapped regular file, an empty
+ * file, a pipe (read by the reader thread) and a missing path, against
+ * the in-memory digests.
+ */
+static void test_file(const unsigned char *input)
+{
+	static const char path[] = "ctb_hash_test.tmp";
+	static const size_t lengths[] = { 0, _CTB_HASH_TEST_INPUT };
+	uint8_t want[CTB_HASH_MAX_DIGEST_SIZE], got[CTB_HASH_MAX_DIGEST_SIZE];
+	uint8_t rows[CTB_HASH_ALGO_COUNT][CTB_HASH_MAX_DIGEST_SIZE];
+	const ctb_hash_algo *algo;
+	unsigned int id;
+	size_t i, size;
+	FILE *f;
+#ifdef _CTB_HASH_FILE_POSIX
+	char name[32];
+	int fd[2];
+#endif
+
+	printf("File hashing Test vectors\n");
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		f = fopen(path, "wb");
+		test_true("create file", f != NULL && fwrite(input, 1, lengths[i], f) == lengths[i]);
+		fclose(f);
+		test_true("multihash file", ctb_multihash_file(path, CTB_HASH_MASK_ALL, 2, rows) == 0);
+		for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+			algo = ctb_hash_algo_get((ctb_hash_id) id);
+			size = algo->digest_size;
+			ctb_hash_digest(algo, input, lengths[i], want);
+			test_true("hash file", ctb_hash_file(path, (ctb_hash_id) id, got) == 0);
+			test_same(want, got, (unsigned int) size);
+			test_same(want, rows[id], (unsigned int) size);
+		}
+	}
+	test_true("unknown id", ctb_hash_file(path, (ctb_hash_id) CTB_HASH_ALGO_COUNT, got) == -1);
+	remove(path);
+	test_true("missing file", ctb_hash_file(path, CTB_HASH_SHA256, got) == -1
+			  && ctb_multihash_file(path, CTB_HASH_MASK_ALL, 1, rows) == -1);
+
+#ifdef _CTB_HASH_FILE_POSIX
+	/* less than a pipe buffer, so it is written in full before the read */
+	for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+		algo = ctb_hash_algo_get((ctb_hash_id) id);
+		test_true("pipe", pipe(fd) == 0 && write(fd[1], input, 4099) == 4099);
+		close(fd[1]);
+		sprintf(name, "/dev/fd/%d", fd[0]);
+		test_true("hash pipe", ctb_hash_file(name, (ctb_hash_id) id, got) == 0);
+		close(fd[0]);
+		ctb_hash_digest(algo, input, 4099, want);
+		test_same(want, got, (unsigned int) algo->digest_size);
+	}
+#endif
+	printf("\n");
+}
+
+/* Tree roots for 1 to 9 leaves, full and partial last chunks, from a
+ * direct Python transcription of the RFC 6962 construction; one-shot on
+ * several thread counts and streamed in odd pieces.
+ */
+static void test_tree(const unsigned char *input)
+{
+	static const struct
+	{
+		size_t		len;
+		const char	*sha256;
+		const char	*sha512;
+	} vectors[] =
+	{
+		{ 0,
+		  "f5a5fd42d16a20302798ef6ed309979b43003d2320d9f0e8ea9831a92759fb4b",
+		  "ab942f526272e456ed68a979f50202905ca903a141ed98443567b11ef0bf25a5"
+		  "52d639051a01be58558122c58e3de07d749ee59ded36acf0c55cd91924d6ba11" },
+		{ 1,
+		  "98ce42deef51d40269d542f5314bef2c7468d401ad5d85168bfab4c0108f75f7",
+		  "b1f542f68a48608ae53904fbe2105bd8f3e544941abb38ec9d24cb7a26f916ef"
+		  "94cfb431cce0c64077dc2934913130d78492914a5e9ffc52f311e68217caef15" },
+		{ CTB_HASH_TREE_CHUNK_SIZE,
+		  "c24dcb5b013f9e86efcc79a790ac648712fef59679681edef86f4bb2ac914889",
+		  "81fabb59aa4c86ccd697cfd61d20c43a621218ddc541c33fa7753543416c9451"
+		  "b5c544de4de466d9ba8839d724fa664eec9836178587baf4e577dbd111c79f48" },
+		{ CTB_HASH_TREE_CHUNK_SIZE + 1,
+		  "6d1d56eeb1a750516876b53d7f81ebb6b7bdcde57c62a67d1588510cadee365a",
+		  "191494cb33859dc77468fb81630c5ae6f8a9274f2b319ab33160acf13766d549"
+		  "3facd88ede72732c3a9daf2390972b1e859a10b148461f0d056976363a97932e" },
+		{ 3 * CTB_HASH_TREE_CHUNK_SIZE - 1,
+		  "c6a6fa3e6bdf1d2187fe39e5cd3f707d5129f71061cb38a92608b28ec6dfcef7",
+		  "999e6f967abeae7fc0f2240f20623ca5ae110737ee5b31683e757b8dca72e194"
+		  "c85d866f0468287a3b768ec84c43f002c644794eed2ca21f90d9dc1357f584cc" },
+		{ 4 * CTB_HASH_TREE_CHUNK_SIZE,
+		  "369ded2c0b314f21d569feb5dc74330e7af8b597ce5e35a0832af56ff293aa65",
+		  "e687244a4d0616095b2d8a76f7279faae57546e2a9e092123c958becc820ecaa"
+		  "700c2748cc8d01abead9f4d6cb7be6a020cfb4b44874224ac75a38e7f7cd85bd" },
+		{ 5 * CTB_HASH_TREE_CHUNK_SIZE - 4093,
+		  "db3b5c7238beb3c078f64de47b3d426b75c8f8aac5ad7dc3d995fbaaf91a1587",
+		  "564a345748234121407f0b8be5f431ec5b660cd8dbc86eebb2726e5357c8e0b3"
+		  "24dbd8c044c393a2fecb62ec35f7c42e5cc349a2b3be38c1c618d377d9d215c2" },
+		{ 6 * CTB_HASH_TREE_CHUNK_SIZE,
+		  "0420d802da77c987b797de3812962d9f4abc2850a2be3172cdeeaa9aa333927c",
+		  "b2924e3cc6af8ea1e31ddc72af0aea1db921ad20983d13864ecd4b80fc405118"
+		  "dc922af0d5c081dd12f0c328e0cd1c91f0d2cbb5204594855da498a70ad6586c" },
+		{ 6 * CTB_HASH_TREE_CHUNK_SIZE + 1,
+		  "77a7471cd9ba962552bb786c569a83cd57d913d652f6768e4868761e026307e9",
+		  "077ba94d1bccbde1e0d240bedcc00b2e324fde52ac88c383dc82364deb636446"
+		  "b3e7b60084a6da3ce5c51e0def87702068a4c6db766f8b20d3f5119128db6a9e" },
+		{ 8 * CTB_HASH_TREE_CHUNK_SIZE,
+		  "cc7ffb8d0f5bca4e3920aa0b62ecfa3c3cda749d724e2afbb6798712c9d31af4",
+		  "860d3b1ef54e9d69cd8f7a7719b1ede40a6c16cc60e4a2b52dd51f71a73c75c1"
+		  "f6c30ee3ec94b4ba8447d4b2b9d27a792c8a45c06a251a5bb8fbc5236a3bd2ce" },
+		{ 9 * CTB_HASH_TREE_CHUNK_SIZE,
+		  "5f362af102f9dcf9ae006e0f243ffb4ec2d38013a34cd2cd5ab5afe46e5e4db5",
+		  "859481b2d7dd94920b82d57e4b700e5fa90f4facafda3a0c879f0210b8dff11f"
+		  "258b94dedc69ca83f9a9b1c81a16d69bce07830cf9636c930cced19d22008d4b" }
+	};
+	static const size_t pieces[] = { 1, 65535, 4093, 65537, 200000 };
+	static const unsigned int threads[] = { 1, 2, 3, 0 };
+	unsigned char digest[_CTB_SHA512_DIGEST_SIZE];
+	ctb_sha256_tree_ctx ctx256;
+	ctb_sha512_tree_ctx ctx512;
+	size_t i, t, off, k, n;
+
+	printf("Tree hash Test vectors\n");
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			ctb_sha256_tree(input, vectors[i].len, digest, threads[t]);
+			test(vectors[i].sha256, digest, _CTB_SHA256_DIGEST_SIZE);
+			ctb_sha512_tree(input, vectors[i].len, digest, threads[t]);
+			test(vectors[i].sha512, digest, _CTB_SHA512_DIGEST_SIZE);
+		}
+
+		ctb_sha256_tree_init(&ctx256, 2);
+		ctb_sha512_tree_init(&ctx512, 2);
+		for (off = 0, k = 0; off < vectors[i].len; off += n) {
+			n = pieces[k++ % (sizeof(pieces) / sizeof(pieces[0]))];
+			if (n > vectors[i].len - off)
+				n = vectors[i].len - off;
+			ctb_sha256_tree_update(&ctx256, input + off, n);
+			ctb_sha512_tree_update(&ctx512, input + off, n);
+		}
+		ctb_sha256_tree_final(&ctx256, digest);
+		test(vectors[i].sha256, digest, _CTB_SHA256_DIGEST_SIZE);
+		ctb_sha512_tree_final(&ctx512, digest);
+		test(vectors[i].sha512, digest, _CTB_SHA512_DIGEST_SIZE);
+	}
+	printf("\n");
+}
+
+/* Reference Merkle root: fold levels with SHA-256d, pairing an odd last
+ * node with itself. Overwrites leaf.
+ */
+static void test_merkle_root(uint8_t (*leaf)[32], size_t count, uint8_t root[32])
+{
+	uint8_t pair[64];
+	size_t i;
+
+	while (count > 1) {
+		for (i = 0; i < count; i += 2) {
+			memcpy(pair, leaf[i], 32);
+			memcpy(pair + 32, leaf[i + 1 < count ? i + 1 : i], 32);
+			ctb_sha256d(pair, 64, leaf[i / 2]);
+		}
+		count = (count + 1) / 2;
+	}
+	memcpy(root, leaf[0], 32);
+}
+
+/* The root of Bitcoin block 100000 from its four txids (internal byte
+ * order; the block explorer shows both reversed), then trees of 1 to 37
+ * leaves built by single and batched appends against a plain level fold,
+ * every proof, reopening and a full tree.
+ */
+static void test_merkle(const unsigned char *input)
+{
+	static const uint8_t block100000[4][32] =
+	{
+		{
+			0x87, 0x6d, 0xd0, 0xa3, 0xef, 0x4a, 0x28, 0x16, 0xff, 0xd1, 0xc1, 0x2a, 0xb6, 0x49, 0x82, 0x5a,
+			0x95, 0x8b, 0x0f, 0xf3, 0xbb, 0x3d, 0x6f, 0x3e, 0x12, 0x50, 0xf1, 0x3d, 0xdb, 0xf0, 0x14, 0x8c
+		},
+		{
+			0xc4, 0x02, 0x97, 0xf7, 0x30, 0xdd, 0x7b, 0x5a, 0x99, 0x56, 0x7e, 0xb8, 0xd2, 0x7b, 0x78, 0x75,
+			0x8f, 0x60, 0x75, 0x07, 0xc5, 0x22, 0x92, 0xd0, 0x2d, 0x40, 0x31, 0x89, 0x5b, 0x52, 0xf2, 0xff
+		},
+		{
+			0xc4, 0x6e, 0x23, 0x9a, 0xb7, 0xd2, 0x8e, 0x2c, 0x01, 0x9b, 0x6d, 0x66, 0xad, 0x8f, 0xae, 0x98,
+			0xa5, 0x6e, 0xf1, 0xf2, 0x1a, 0xee, 0xcb, 0x94, 0xd1, 0xb1, 0x71, 0x81, 0x86, 0xf0, 0x59, 0x63
+		},
+		{
+			0x1d, 0x0c, 0xb8, 0x37, 0x21, 0x52, 0x9a, 0x06, 0x2d, 0x96, 0x75, 0xb9, 0x8d, 0x6e, 0x5c, 0x58,
+			0x7e, 0x4a, 0x77, 0x0f, 0xc8, 0x4e, 0xd0, 0x0a, 0xbc, 0x5a, 0x5d, 0xe0, 0x45, 0x68, 0xa6, 0xe9
+		}
+	};
+	const uint8_t (*leaves)[32] = (const uint8_t (*)[32]) input;
+	uint8_t scratch[_CTB_HASH_TEST_JOBS][32], want[32], root[32], leaf[32];
+	uint8_t proof[CTB_MERKLE_MAX_DEPTH][32];
+	ctb_merkle m, reopened;
+	size_t size, count, i;
+	void *mem;
+	int depth;
+
+	printf("Merkle Test vectors\n");
+	size = ctb_merkle_size(_CTB_HASH_TEST_JOBS);
+	mem = malloc(size);
+	test_true("merkle memory", mem != NULL);
+
+	test_true("merkle init", ctb_merkle_init(&m, mem, size, 4) == 0
+			  && ctb_merkle_root(&m, root) == -1
+			  && ctb_merkle_append_many(&m, block100000, 4) == 0);
+	ctb_merkle_root(&m, root);
+	test("6657a9252aacd5c0b2940996ecff952228c3067cc38d4885efb5a4ac4247e9f3", root, 32);
+	test_true("merkle full", ctb_merkle_append(&m, block100000[0]) == -1 && ctb_merkle_count(&m) == 4);
+
+	for (count = 1; count <= _CTB_HASH_TEST_JOBS; count++) {
+		test_true("merkle init", ctb_merkle_init(&m, mem, size, _CTB_HASH_TEST_JOBS) == 0);
+		/* a single append, then batches of growing size */
+		for (i = 0; i < count; i += i + 1) {
+			if (i == 0)
+				test_true("merkle append", ctb_merkle_append(&m, leaves[0]) == 0);
+			else
+				test_true("merkle append", ctb_merkle_append_many(&m, leaves + i,
+						  i + i + 1 <= count ? i + 1 : count - i) == 0);
+		}
+		memcpy(scratch, leaves, count * 32);
+		test_merkle_root(scratch, count, want);
+		test_true("merkle root", ctb_merkle_count(&m) == count && ctb_merkle_root(&m, root) == 0);
+		test_same(want, root, 32);
+
+		test_true("merkle open", ctb_merkle_open(&reopened, mem, size) == 0
+				  && ctb_merkle_count(&reopened) == count && ctb_merkle_root(&reopened, leaf) == 0
+				  && memcmp(leaf, root, 32) == 0);
+		for (i = 0; i < count; i++) {
+			depth = ctb_merkle_proof(&m, i, proof);
+			memcpy(leaf, leaves[i], 32);
+			test_true("merkle proof", depth >= 0
+					  && ctb_merkle_verify(leaf, i, (const uint8_t (*)[32]) proof, (unsigned int) depth, root));
+			leaf[i % 32] ^= 1;
+			test_true("merkle bad leaf", !ctb_merkle_verify(leaf, i, (const uint8_t (*)[32]) proof,
+															 (unsigned int) depth, root));
+		}
+		test_true("merkle proof range", ctb_merkle_proof(&m, count, proof) == -1);
+	}
+	free(mem);
+	printf("\n");
+}
+
+/* Multi-hash rows against the single-algorithm digests, for several masks
+ * and thread counts, one-shot and streamed across tile and window edges;
+ * rows outside the mask are left alone.
+ */
+static void test_multihash(const unsigned char *input)
+{
+	static const unsigned int masks[] =
+	{
+		CTB_HASH_MASK_ALL,
+		CTB_HASH_MASK(CTB_HASH_SHA256) | CTB_HASH_MASK(CTB_HASH_BLAKE3),
+		CTB_HASH_MASK(CTB_HASH_RIPEMD160)
+	};
+	static const unsigned int threads[] = { 1, 2, 0 };
+	static const size_t lengths[] = { 0, 3, CTB_MULTIHASH_TILE + 1, _CTB_HASH_TEST_INPUT };
+	static const size_t pieces[] = { 1, CTB_MULTIHASH_TILE - 1, 65536, 100003 };
+	uint8_t rows[CTB_HASH_ALGO_COUNT][CTB_HASH_MAX_DIGEST_SIZE];
+	uint8_t want[CTB_HASH_MAX_DIGEST_SIZE], untouched[CTB_HASH_MAX_DIGEST_SIZE];
+	ctb_multihash_ctx ctx;
+	unsigned int id;
+	size_t m, t, i, off, k, n, len;
+
+	printf("Multi-hash Test vectors\n");
+	memset(untouched, 0x5a, sizeof(untouched));
+	for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+		for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			for (i = 0; i <= sizeof(lengths) / sizeof(lengths[0]); i++) {
+				memset(rows, 0x5a, sizeof(rows));
+				if (i < sizeof(lengths) / sizeof(lengths[0])) {
+					len = lengths[i];
+					ctb_multihash(input, len, masks[m], threads[t], rows);
+				} else {
+					len = _CTB_HASH_TEST_INPUT;
+					ctb_multihash_init(&ctx, masks[m], threads[t]);
+					for (off = 0, k = 0; off < len; off += n) {
+						n = pieces[k++ % (sizeof(pieces) / sizeof(pieces[0]))];
+						if (n > len - off)
+							n = len - off;
+						ctb_multihash_update(&ctx, input + off, n);
+					}
+					ctb_multihash_final(&ctx, rows);
+				}
+				for (id = 0; id < CTB_HASH_ALGO_COUNT; id++) {
+					if (masks[m] & CTB_HASH_MASK(id)) {
+						ctb_hash_digest(ctb_hash_algo_get((ctb_hash_id) id), input, len, want);
+						test_same(want, rows[id], (unsigned int) ctb_hash_digest_size((ctb_hash_id) id));
+					} else {
+						test_same(untouched, rows[id], CTB_HASH_MAX_DIGEST_SIZE);
+					}
+				}
+			}
+		}
+	}
+	printf("\n");
+}
+
+#define _CTB_HASH_TEST_HMAC_KEY(NAME, SIZE, VECTOR)                             \
+	do {                                                                        \
+		ctb_hmac_##NAME##_key pk;                                               \
+		unsigned char mac[SIZE], macs[_CTB_HASH_TEST_JOBS][SIZE];               \
+		unsigned int size = cases[i].mac_size ? cases[i].mac_size : (SIZE);     \
+                                                                                \
+		ctb_hmac_##NAME##_key_init(&pk, key, cases[i].key_len);                 \
+		ctb_hmac_##NAME##_mac(&pk, msg[0], len[0], mac);                        \
+		test(VECTOR, mac, size);                                                \
+		ctb_hmac_##NAME##_mac_many(&pk, msg, len, macs, counts[i]);             \
+		for (j = 0; j < counts[i]; j++) {                                       \
+			if (j % 4 == 0) {                                                   \
+				test(VECTOR, macs[j], size);                                    \
+			} else {                                                            \
+				ctb_hmac_##NAME(key, (unsigned int) cases[i].key_len,           \
+								msg[j], len[j], mac, SIZE);                     \
+				test_same(mac, macs[j], SIZE);                                  \
+			}                                                                   \
+		}                                                                       \
+	} while (0)
+
+/* RFC 4231 test cases 1-7 through the prepared-key path (case 5 is
+ * truncated to 128 bits). The batches put the test case message in every
+ * fourth job and ragged messages in between, which must match the
+ * context-based HMAC.
+ */
+static void test_hmac_key(const unsigned char *input)
+{
+	static const struct
+	{
+		const char		*key;		/* NULL: key_len bytes of key_fill */
+		unsigned char	key_fill;
+		size_t			key_len;
+		const char		*msg;		/* NULL: 50 bytes of msg_fill */
+		unsigned char	msg_fill;
+		unsigned int	mac_size;	/* 0: full length */
+	} cases[7] =
+	{
+		{ NULL, 0x0b, 20, "Hi There", 0, 0 },
+		{ "Jefe", 0, 4, "what do ya want for nothing?", 0, 0 },
+		{ NULL, 0xaa, 20, NULL, 0xdd, 0 },
+		{ "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19",
+		  0, 25, NULL, 0xcd, 0 },
+		{ NULL, 0x0c, 20, "Test With Truncation", 0, 16 },
+		{ NULL, 0xaa, 131, "Test Using Larger Than Block-Size Key - Hash Key First", 0, 0 },
+		{ NULL, 0xaa, 131, "This is a test using a larger than block-size key and a larger than block-size data. "
+		  "The key needs to be hashed before being used by the HMAC algorithm.", 0, 0 }
+	};
+	static const char *vectors[7][4] =
+	{
+		{	/* test case 1 */
+			"896fb1128abbdf196832107cd49df33f47b4b1169912ba4f53684b22",
+			"b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+			"afd03944d84895626b0825f4ab46907f15f9dadbe4101ec682aa034c7cebc59c"
+			"faea9ea9076ede7f4af152e8b2fa9cb6",
+			"87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+			"daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854"
+		},
+		{	/* test case 2 */
+			"a30e01098bc6dbbf45690f3a7e9e6d0f8bbea2a39e6148008fd05e44",
+			"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+			"af45d2e376484031617f78d2b58a6b1b9c7ef464f5a01b47e42ec3736322445e"
+			"8e2240ca5e69e2c78b3239ecfab21649",
+			"164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+			"9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737"
+		},
+		{	/* test case 3 */
+			"7fb3cb3588c6c1f6ffa9694d7d6ad2649365b0c1f65d69d1ec8333ea",
+			"773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe",
+			"88062608d3e6ad8a0aa2ace014c8a86f0aa635d947ac9febe83ef4e55966144b"
+			"2a5ab39dc13814b94e3ab6e101a34f27",
+			"fa73b0089d56a284efb0f0756c890be9b1b5dbdd8ee81a3655f83e33b2279d39"
+			"bf3e848279a722c806b485a47e67c807b946a337bee8942674278859e13292fb"
+		},
+		{	/* test case 4 */
+			"6c11506874013cac6a2abc1bb382627cec6a90d86efc012de7afec5a",
+			"82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b",
+			"3e8a69b7783c25851933ab6290af6ca77a9981480850009cc5577c6e1f573b4e"
+			"6801dd23c4a7d679ccf8a386c674cffb",
+			"b0ba465637458c6990e5a8c5f61d4af7e576d97ff94b872de76f8050361ee3db"
+			"a91ca5c11aa25eb4d679275cc5788063a5f19741120c4f2de2adebeb10a298dd"
+		},
+		{	/* test case 5 */
+			"0e2aea68a90c8d37c988bcdb9fca6fa8",
+			"a3b6167473100ee06e0c796c2955552b",
+			"3abf34c3503b2a23a46efc619baef897",
+			"415fad6271580a531d4179bc891d87a6"
+		},
+		{	/* test case 6 */
+			"95e9a0db962095adaebe9b2d6f0dbce2d499f112f2d2b7273fa6870e",
+			"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+			"4ece084485813e9088d2c63a041bc5b44f9ef1012a2b588f3cd11f05033ac4c6"
+			"0c2ef6ab4030fe8296248df163f44952",
+			"80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+			"6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598"
+		},
+		{	/* test case 7 */
+			"3a854166ac5d9f023f54d517d0b39dbd946770db9c2b95c9f6f565d1",
+			"9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2",
+			"6617178e941f020d351e2f254e8fd32c602420feb0b8fb9adccebb82461e99c5"
+			"a678cc31e799176d3860e6110c46523e",
+			"e37b6a775dc87dbaa4dfa9f96e5e3ffddebd71f8867289865df5a32d20cdc944"
+			"b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58"
+		}
+	};
+	static const size_t lengths[] = { 0, 55, 56, 64, 119, 1000 };
+	static const size_t counts[7] = { 1, 3, 9, 17, _CTB_HASH_TEST_JOBS, 5, 16 };
+	unsigned char key[131], fill[50];
+	const unsigned char *msg[_CTB_HASH_TEST_JOBS];
+	size_t len[_CTB_HASH_TEST_JOBS];
+	size_t i, j;
+
+	printf("HMAC prepared key RFC 4231 Test vectors\n");
+	for (i = 0; i < 7; i++) {
+		if (cases[i].key)
+			memcpy(key, cases[i].key, cases[i].key_len);
+		else
+			memset(key, cases[i].key_fill, cases[i].key_len);
+		memset(fill, cases[i].msg_fill, sizeof(fill));
+		for (j = 0; j < _CTB_HASH_TEST_JOBS; j++) {
+			if (j % 4 == 0) {
+				msg[j] = cases[i].msg ? (const unsigned char *) cases[i].msg : fill;
+				len[j] = cases[i].msg ? strlen(cases[i].msg) : sizeof(fill);
+			} else {
+				msg[j] = input + 7 * j;
+				len[j] = lengths[j % (sizeof(lengths) / sizeof(lengths[0]))];
+			}
+		}
+		_CTB_HASH_TEST_HMAC_KEY(sha224, _CTB_SHA224_DIGEST_SIZE, vectors[i][0]);
+		_CTB_HASH_TEST_HMAC_KEY(sha256, _CTB_SHA256_DIGEST_SIZE, vectors[i][1]);
+		_CTB_HASH_TEST_HMAC_KEY(sha384, _CTB_SHA384_DIGEST_SIZE, vectors[i][2]);
+		_CTB_HASH_TEST_HMAC_KEY(sha512, _CTB_SHA512_DIGEST_SIZE, vectors[i][3]);
+	}
+	printf("\n");
+}
+
+#undef _CTB_HASH_TEST_HMAC_KEY
+
+/* Midstate round trips: export after whole-block prefixes, import into a
+ * scrapped context, finish on ragged tails and compare with the one-shot
+ * digest of the whole message. Partial blocks are refused both ways.
+ */
+static void test_midstate(const unsigned char *input)
+{
+	static const size_t blocks[] = { 0, 1, 3, 64 };
+	static const size_t tails[] = { 0, 1, 55, 128, 1000 };
+	unsigned char record[CTB_SHA512_MIDSTATE_SIZE], want[_CTB_SHA512_DIGEST_SIZE];
+	unsigned char digest[_CTB_SHA512_DIGEST_SIZE];
+	ctb_sha256_ctx ctx256;
+	ctb_sha512_ctx ctx512;
+	ctb_ripemd160_ctx ctx160;
+	size_t b, t, prefix, len;
+
+	printf("Midstate export/import Test vectors\n");
+	for (b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+		for (t = 0; t < sizeof(tails) / sizeof(tails[0]); t++) {
+			/* SHA-256 and SHA-224 */
+			prefix = 64 * blocks[b];
+			len = prefix + tails[t];
+			ctb_sha256_init(&ctx256);
+			ctb_sha256_update(&ctx256, input + 1, prefix);
+			test_true("sha256 export", ctb_sha256_export(&ctx256, record) == 0);
+			memset(&ctx256, 0xa5, sizeof(ctx256));
+			test_true("sha256 import", ctb_sha256_import(&ctx256, record) == 0);
+			ctb_sha256_update(&ctx256, input + 1 + prefix, tails[t]);
+			ctb_sha256_final(&ctx256, digest);
+			ctb_sha256(input + 1, len, want);
+			test_same(want, digest, _CTB_SHA256_DIGEST_SIZE);
+
+			ctb_sha224_init(&ctx256);
+			ctb_sha224_update(&ctx256, input + 1, prefix);
+			test_true("sha224 export", ctb_sha256_export(&ctx256, record) == 0);
+			memset(&ctx256, 0xa5, sizeof(ctx256));
+			test_true("sha224 import", ctb_sha256_import(&ctx256, record) == 0);
+			ctb_sha224_update(&ctx256, input + 1 + prefix, tails[t]);
+			ctb_sha224_final(&ctx256, digest);
+			ctb_sha224(input + 1, len, want);
+			test_same(want, digest, _CTB_SHA224_DIGEST_SIZE);
+
+			/* SHA-512 and SHA-384 */
+			prefix = 128 * blocks[b];
+			len = prefix + tails[t];
+			ctb_sha512_init(&ctx512);
+			ctb_sha512_update(&ctx512, input + 1, prefix);
+			test_true("sha512 export", ctb_sha512_export(&ctx512, record) == 0);
+			memset(&ctx512, 0xa5, sizeof(ctx512));
+			test_true("sha512 import", ctb_sha512_import(&ctx512, record) == 0);
+			ctb_sha512_update(&ctx512, input + 1 + prefix, tails[t]);
+			ctb_sha512_final(&ctx512, digest);
+			ctb_sha512(input + 1, len, want);
+			test_same(want, digest, _CTB_SHA512_DIGEST_SIZE);
+
+			ctb_sha384_init(&ctx512);
+			ctb_sha384_update(&ctx512, input + 1, prefix);
+			test_true("sha384 export", ctb_sha512_export(&ctx512, record) == 0);
+			memset(&ctx512, 0xa5, sizeof(ctx512));
+			test_true("sha384 import", ctb_sha512_import(&ctx512, record) == 0);
+			ctb_sha384_update(&ctx512, input + 1 + prefix, tails[t]);
+			ctb_sha384_final(&ctx512, digest);
+			ctb_sha384(input + 1, len, want);
+			test_same(want, digest, _CTB_SHA384_DIGEST_SIZE);
+
+			/* RIPEMD-160 */
+			prefix = 64 * blocks[b];
+			len = prefix + tails[t];
+			ctb_ripemd160_init(&ctx160);
+			ctb_ripemd160_update(&ctx160, input + 1, prefix);
+			test_true("ripemd160 export", ctb_ripemd160_export(&ctx160, record) == 0);
+			memset(&ctx160, 0xa5, sizeof(ctx160));
+			test_true("ripemd160 import", ctb_ripemd160_import(&ctx160, record) == 0);
+			ctb_ripemd160_update(&ctx160, input + 1 + prefix, tails[t]);
+			ctb_ripemd160_final(&ctx160, digest);
+			ctb_ripemd160(input + 1, len, want);
+			test_same(want, digest, _CTB_RIPEMD160_DIGEST_LENGTH);
+		}
+	}
+
+	ctb_sha256_init(&ctx256);
+	ctb_sha256_update(&ctx256, input, 65);
+	test_true("sha256 partial export", ctb_sha256_export(&ctx256, record) == -1);
+	ctb_sha512_init(&ctx512);
+	ctb_sha512_update(&ctx512, input, 129);
+	test_true("sha512 partial export", ctb_sha512_export(&ctx512, record) == -1);
+	ctb_ripemd160_init(&ctx160);
+	ctb_ripemd160_update(&ctx160, input, 65);
+	test_true("ripemd160 partial export", ctb_ripemd160_export(&ctx160, record) == -1);
+
+	/* a count that is not a whole number of blocks */
+	memset(record, 0, sizeof(record));
+	record[CTB_SHA256_MIDSTATE_SIZE - 1] = 1;
+	test_true("sha256 partial import", ctb_sha256_import(&ctx256, record) == -1);
+	memset(record, 0, sizeof(record));
+	record[CTB_SHA512_MIDSTATE_SIZE - 1] = 1;
+	test_true("sha512 partial import", ctb_sha512_import(&ctx512, record) == -1);
+	memset(record, 0, sizeof(record));
+	record[CTB_RIPEMD160_MIDSTATE_SIZE - 8] = 1;
+	test_true("ripemd160 partial import", ctb_ripemd160_import(&ctx160, record) == -1);
+	printf("\n");
+}
+
+/* Updates that start block-aligned in the context (the direct path) and
+ * ones that first top up a buffered partial block, from unaligned
+ * addresses, against the one-shot digest. Each step is blocks * block
+ * size + bytes.
+ */
+static void test_zero_copy(const unsigned char *input)
+{
+	static const int steps[][4][2] =
+	{
+		{ { 1, 0 }, { 3, 0 }, { 0, 5 }, { 0, 0 } },
+		{ { 0, 1 }, { 1, -1 }, { 2, 0 }, { 0, 7 } },
+		{ { 1, -1 }, { 1, 1 }, { 4, 0 }, { 0, 0 } },
+		{ { 0, 0 }, { 8, 0 }, { 0, 0 }, { 2, 3 } },
+		{ { 0, 3 }, { 16, 0 }, { 0, 0 }, { 0, 0 } }
+	};
+	static const size_t offsets[] = { 0, 1, 3, 8 };
+	unsigned char want[CTB_HASH_MAX_DIGEST_SIZE], digest[CTB_HASH_MAX_DIGEST_SIZE];
+	const ctb_hash_algo *algo;
+	const unsigned char *msg;
+	ctb_hash_ctx ctx;
+	unsigned int id;
+	size_t s, o, k, n, total;
+
+	printf("Zero-copy update Test vectors\n");
+	for (id = CTB_HASH_SHA224; id <= CTB_HASH_RIPEMD160; id++) {
+		algo = ctb_hash_algo_get((ctb_hash_id) id);
+		for (s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+			for (o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+				msg = input + offsets[o];
+				algo->init(&ctx);
+				for (k = 0, total = 0; k < 4; k++) {
+					n = (size_t) ((int) algo->block_size * steps[s][k][0] + steps[s][k][1]);
+					algo->update(&ctx, msg + total, n);
+					total += n;
+				}
+				algo->final(&ctx, digest);
+				ctb_hash_digest(algo, msg, total, want);
+				test_same(want, digest, (unsigned int) algo->digest_size);
+			}
+		}
+	}
+	printf("\n");
+}
+
+/* XXH3 64/128 from the reference xxHash 0.8, unseeded and with seed
+ * 0x9e3779b185ebca87, across the short-input, 240-byte and stripe/block
+ * boundaries.
+ */
+static void test_xxh3(const unsigned char *input)
+{
+	static const struct
+	{
+		size_t		len;
+		const char	*h64, *h64_seed, *h128, *h128_seed;
+	} vectors[] =
+	{
+		{ 0,
+		  "2d06800538d394c2", "07f70f819703314d",
+		  "99aa06d3014798d86001c324468d497f",
+		  "45ef6ddc7afb225af9ece1036ecbb2ed" },
+		{ 3,
+		  "5f4299fc161c9cbb", "34481ed89cfeb771",
+		  "e3b55f57945a17cf5f4299fc161c9cbb",
+		  "a3a5b8052066699334481ed89cfeb771" },
+		{ 16,
+		  "8355e3a6f61770db", "263dd6e9bc1f2223",
+		  "72950631827607e2842812cc870dcae2",
+		  "991c9a0bc602c60771eb5291dbe1fc79" },
+		{ 17,
+		  "9ef341a99de37328", "02543ca1ec0b3317",
+		  "685bc458b37d057fc06e233df7729217",
+		  "2c39f1afbef53f68c4aa2a95ee5a8c48" },
+		{ 128,
+		  "85c6174c7ff4c46b", "63594fc148ffa4b1",
+		  "14792fc3af88dc6c05321a0b64d67b41",
+		  "2a2b180b35ec970389c242eeca9f0987" },
+		{ 129,
+		  "ec7642b431ba3e5a", "94f0990c96479b3e",
+		  "dd5e74ac6b45f54ebc30b63382b09a3b",
+		  "81f054399ddf648c699e52492cc19f2c" },
+		{ 240,
+		  "375a384d957fe865", "d66ca608f5fb5095",
+		  "65b5be86da5540e7c92b68e16f83bbb6",
+		  "821e1b288dadd465621ae55b1df3e91a" },
+		{ 241,
+		  "02e8cd95421c6d02", "f264339b9a9fe928",
+		  "1da1cb61bcb8a2a102e8cd95421c6d02",
+		  "d16c4e4e559732aff264339b9a9fe928" },
+		{ 1024,
+		  "e5d78bafa45b2aa5", "85df4429fa45a071",
+		  "d0ac1f7b93bf57b9e5d78bafa45b2aa5",
+		  "124d4f17a3891ab385df4429fa45a071" },
+		{ 2240,
+		  "475ef79d9b116bc6", "01ec5239b282f034",
+		  "325364c68cb36d19475ef79d9b116bc6",
+		  "f400bfad2255242001ec5239b282f034" },
+		{ 102400,
+		  "1428e17f1cac2837", "8b1eae6c463662a9",
+		  "ecd387d36185351b1428e17f1cac2837",
+		  "87a68260bacfbd8a8b1eae6c463662a9" }
+	};
+	const uint64_t seed = 0x9e3779b185ebca87ULL;
+	unsigned char out[16];
+	size_t i;
+
+	printf("XXH3 Test vectors\n");
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		ctb_xxh3_64_canonical(ctb_xxh3_64(input, vectors[i].len, 0), out);
+		test(vectors[i].h64, out, 8);
+		ctb_xxh3_64_canonical(ctb_xxh3_64(input, vectors[i].len, seed), out);
+		test(vectors[i].h64_seed, out, 8);
+		ctb_xxh3_128_canonical(ctb_xxh3_128(input, vectors[i].len, 0), out);
+		test(vectors[i].h128, out, 16);
+		ctb_xxh3_128_canonical(ctb_xxh3_128(input, vectors[i].len, seed), out);
+		test(vectors[i].h128_seed, out, 16);
+	}
+	printf("\n");
+}
+
+/* Writes a CRC out big-endian, so it reads like the usual hex check value. */
+static void test_crc_value(const char *vector, uint64_t crc, unsigned int size)
+{
+	unsigned char out[8];
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		out[i] = (unsigned char) (crc >> (8 * (size - 1 - i)));
+	test(vector, out, size);
+}
+
+/* The CRC catalogue check values over "123456789", then longer inputs
+ * that reach the folding kernels, each also hashed in two pieces and
+ * merged with _combine.
+ */
+static void test_crc(const unsigned char *input)
+{
+	static const struct
+	{
+		size_t		len;
+		const char	*crc32c, *crc32, *crc64;
+	} vectors[] =
+	{
+		{ 0, "e3069283", "cbf43926", "995dc9bbdf1939fa" },	/* "123456789" */
+		{ 1, "527d5351", "d202ef8d", "1fada17364673f59" },
+		{ 15, "68ef03f6", "a06c675e", "edb6371293e5b0ca" },
+		{ 64, "fb6d36eb", "100ece8c", "d098e69b0b93f24b" },
+		{ 255, "ebbd63b3", "6f7c9956", "54a4a93ef9eb987f" },
+		{ 1000, "11f66220", "721746a6", "3aa4c90fe06cddbb" },
+		{ 4109, "b3c77253", "87d606b4", "1a450bf93b5dac58" },
+		{ 102400, "7957da17", "5cc1ce13", "4b11c0d1c0580595" }
+	};
+	static const char check[] = "123456789";
+	size_t i, a;
+
+	printf("CRC Test vectors\n");
+	test_crc_value(vectors[0].crc32c, ctb_crc32c(0, (const uint8_t *) check, 9), 4);
+	test_crc_value(vectors[0].crc32, ctb_crc32(0, (const uint8_t *) check, 9), 4);
+	test_crc_value(vectors[0].crc64, ctb_crc64(0, (const uint8_t *) check, 9), 8);
+	for (i = 1; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		const size_t len = vectors[i].len;
+
+		a = len / 3;
+		test_crc_value(vectors[i].crc32c, ctb_crc32c(0, input, len), 4);
+		test_crc_value(vectors[i].crc32c, ctb_crc32c(ctb_crc32c(0, input, a), input + a, len - a), 4);
+		test_crc_value(vectors[i].crc32c, ctb_crc32c_combine(ctb_crc32c(0, input, a),
+							ctb_crc32c(0, input + a, len - a), len - a), 4);
+		test_crc_value(vectors[i].crc32, ctb_crc32(0, input, len), 4);
+		test_crc_value(vectors[i].crc32, ctb_crc32_combine(ctb_crc32(0, input, a),
+							ctb_crc32(0, input + a, len - a), len - a), 4);
+		test_crc_value(vectors[i].crc64, ctb_crc64(0, input, len), 8);
+		test_crc_value(vectors[i].crc64, ctb_crc64_combine(ctb_crc64(0, input, a),
+							ctb_crc64(0, input + a, len - a), len - a), 8);
+	}
+	printf("\n");
+}
+
+/* Checks `len` bytes that start `offset` bytes into a longer vector. */
+static void test_part(const char *vector, size_t offset, const unsigned char *digest, unsigned int len)
+{
+	char part[2 * 256 + 1];
+
+	memcpy(part, vector + 2 * offset, 2 * len);
+	part[2 * len] = '\0';
+	test(part, digest, len);
+}
+
+/* The BLAKE3 test_vectors.json entries: 131 bytes of extendable output in
+ * each mode, keyed with "whats the Elvish word for friend" and deriving
+ * under the context string below. The default hash is the first 32 bytes.
+ */
+static void test_blake3(const unsigned char *input)
+{
+	static const struct
+	{
+		size_t		len;
+		const char	*hash, *keyed_hash, *derive_key;
+	} vectors[] =
+	{
+		{ 0,
+		  "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"
+		  "e00f03e7b69af26b7faaf09fcd333050338ddfe085b8cc869ca98b206c08243a"
+		  "26f5487789e8f660afe6c99ef9e0c52b92e7393024a80459cf91f476f9ffdbda"
+		  "7001c22e159b402631f277ca96f2defdf1078282314e763699a31c5363165421"
+		  "cce14d",
+		  "92b2b75604ed3c761f9d6f62392c8a9227ad0ea3f09573e783f1498a4ed60d26"
+		  "b18171a2f22a4b94822c701f107153dba24918c4bae4d2945c20ece13387627d"
+		  "3b73cbf97b797d5e59948c7ef788f54372df45e45e4293c7dc18c1d41144a975"
+		  "8be58960856be1eabbe22c2653190de560ca3b2ac4aa692a9210694254c371e8"
+		  "51bc8f",
+		  "2cc39783c223154fea8dfb7c1b1660f2ac2dcbd1c1de8277b0b0dd39b7e50d7d"
+		  "905630c8be290dfcf3e6842f13bddd573c098c3f17361f1f206b8cad9d088aa4"
+		  "a3f746752c6b0ce6a83b0da81d59649257cdf8eb3e9f7d4998e41021fac119de"
+		  "efb896224ac99f860011f73609e6e0e4540f93b273e56547dfd3aa1a035ba668"
+		  "9d89a0" },
+		{ 1,
+		  "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"
+		  "c3a6cb8bf623e20cdb535f8d1a5ffb86342d9c0b64aca3bce1d31f60adfa137b"
+		  "358ad4d79f97b47c3d5e79f179df87a3b9776ef8325f8329886ba42f07fb138b"
+		  "b502f4081cbcec3195c5871e6c23e2cc97d3c69a613eba131e5f1351f3f1da78"
+		  "6545e5",
+		  "6d7878dfff2f485635d39013278ae14f1454b8c0a3a2d34bc1ab38228a80c95b"
+		  "6568c0490609413006fbd428eb3fd14e7756d90f73a4725fad147f7bf70fd61c"
+		  "4e0cf7074885e92b0e3f125978b4154986d4fb202a3f331a3fb6cf349a3a70e4"
+		  "9990f98fe4289761c8602c4e6ab1138d31d3b62218078b2f3ba9a88e1d08d0dd"
+		  "4cea11",
+		  "b3e2e340a117a499c6cf2398a19ee0d29cca2bb7404c73063382693bf66cb06c"
+		  "5827b91bf889b6b97c5477f535361caefca0b5d8c4746441c576171119331589"
+		  "50670f9aa8a05d791daae10ac683cbef8faf897c84e6114a59d2173c3f417023"
+		  "a35d6983f2c7dfa57e7fc559ad751dbfb9ffab39c2ef8c4aafebc9ae973a64f0"
+		  "c76551" },
+		{ 1023,
+		  "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"
+		  "a182d27a591b05592b15607500e1e8dd56bc6c7fc063715b7a1d737df5bad333"
+		  "9c56778957d870eb9717b57ea3d9fb68d1b55127bba6a906a4a24bbd5acb2d12"
+		  "3a37b28f9e9a81bbaae360d58f85e5fc9d75f7c370a0cc09b6522d9c8d822f2f"
+		  "28f485",
+		  "c951ecdf03288d0fcc96ee3413563d8a6d3589547f2c2fb36d9786470f1b9d6e"
+		  "890316d2e6d8b8c25b0a5b2180f94fb1a158ef508c3cde45e2966bd796a696d3"
+		  "e13efd86259d756387d9becf5c8bf1ce2192b87025152907b6d8cc33d17826d8"
+		  "b7b9bc97e38c3c85108ef09f013e01c229c20a83d9e8efac5b37470da28575fd"
+		  "755a10",
+		  "74a16c1c3d44368a86e1ca6df64be6a2f64cce8f09220787450722d85725dea5"
+		  "9c413264404661e9e4d955409dfe4ad3aa487871bcd454ed12abfe2c2b1eb775"
+		  "7588cf6cb18d2eccad49e018c0d0fec323bec82bf1644c6325717d13ea712e68"
+		  "40d3e6e730d35553f59eff5377a9c350bcc1556694b924b858f329c44ee64b88"
+		  "4ef00d" },
+		{ 1024,
+		  "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"
+		  "1cf8107265ecdaf8505b95d8fcec83a98a6a96ea5109d2c179c47a387ffbb404"
+		  "756f6eeae7883b446b70ebb144527c2075ab8ab204c0086bb22b7c93d465efc5"
+		  "7f8d917f0b385c6df265e77003b85102967486ed57db5c5ca170ba441427ed9a"
+		  "fa684e",
+		  "75c46f6f3d9eb4f55ecaaee480db732e6c2105546f1e675003687c31719c7ba4"
+		  "a78bc838c72852d4f49c864acb7adafe2478e824afe51c8919d06168414c265f"
+		  "298a8094b1ad813a9b8614acabac321f24ce61c5a5346eb519520d38ecc43e89"
+		  "b5000236df0597243e4d2493fd626730e2ba17ac4d8824d09d1a4a8f57b82277"
+		  "78e2de",
+		  "7356cd7720d5b66b6d0697eb3177d9f8d73a4a5c5e968896eb6a689684302706"
+		  "6c23b601d3ddfb391e90d5c8eccdef4ae2a264bce9e612ba15e2bc9d654af148"
+		  "1b2e75dbabe615974f1070bba84d56853265a34330b4766f8e75edd1f4a16504"
+		  "76c10802f22b64bd3919d246ba20a17558bc51c199efdec67e80a227251808d8"
+		  "ce5bad" },
+		{ 1025,
+		  "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"
+		  "f4c4a22b4b399155358a994e52bf255de60035742ec71bd08ac275a1b51cc6bf"
+		  "e332b0ef84b409108cda080e6269ed4b3e2c3f7d722aa4cdc98d16deb554e562"
+		  "7be8f955c98e1d5f9565a9194cad0c4285f93700062d9595adb992ae68ff1280"
+		  "0ab67a",
+		  "357dc55de0c7e382c900fd6e320acc04146be01db6a8ce7210b7189bd664ea69"
+		  "362396b77fdc0d2634a552970843722066c3c15902ae5097e00ff53f1e116f1c"
+		  "d5352720113a837ab2452cafbde4d54085d9cf5d21ca613071551b25d52e69d6"
+		  "c81123872b6f19cd3bc1333edf0c52b94de23ba772cf82636cff4542540a7738"
+		  "d5b930",
+		  "effaa245f065fbf82ac186839a249707c3bddf6d3fdda22d1b95a3c970379bcb"
+		  "5d31013a167509e9066273ab6e2123bc835b408b067d88f96addb550d96b6852"
+		  "dad38e320b9d940f86db74d398c770f462118b35d2724efa13da97194491d96d"
+		  "d37c3c09cbef665953f2ee85ec83d88b88d11547a6f911c8217cca46defa2751"
+		  "e7f3ad" },
+		{ 2049,
+		  "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"
+		  "96de31d71d74103403822a2e0bc1eb193e7aecc9643a76b7bbc0c9f9c52e8783"
+		  "aae98764ca468962b5c2ec92f0c74eb5448d519713e09413719431c802f948dd"
+		  "5d90425a4ecdadece9eb178d80f26efccae630734dff63340285adec2aed3b51"
+		  "073ad3",
+		  "9f29700902f7c86e514ddc4df1e3049f258b2472b6dd5267f61bf13983b78dd5"
+		  "f9a88abfefdfa1e00b418971f2b39c64ca621e8eb37fceac57fd0c8fc8e117d4"
+		  "3b81447be22d5d8186f8f5919ba6bcc6846bd7d50726c06d245672c2ad4f6170"
+		  "2c646499ee1173daa061ffe15bf45a631e2946d616a4c345822f1151284712f7"
+		  "6b2b0e",
+		  "2ea477c5515cc3dd606512ee72bb3e0e758cfae7232826f35fb98ca1bcbdf273"
+		  "16d8e9e79081a80b046b60f6a263616f33ca464bd78d79fa18200d06c7fc9bff"
+		  "d808cc4755277a7d5e09da0f29ed150f6537ea9bed946227ff184cc66a72a5f8"
+		  "c1e4bd8b04e81cf40fe6dc4427ad5678311a61f4ffc39d195589bdbc670f63ae"
+		  "70f4b6" },
+		{ 4097,
+		  "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"
+		  "05f91b0b5600a11251652eacfa9497b31cd3c409ce2e45cfe6c0a016967316c4"
+		  "26bd26f619eab5d70af9a418b845c608840390f361630bd497b1ab4401931635"
+		  "7c61dbe091ce72fc16dc340ac3d6e009e050b3adac4b5b2c92e722cffdc46501"
+		  "531956",
+		  "00df940cd36bb9fa7cbbc3556744e0dbc8191401afe70520ba292ee3ca80abbc"
+		  "606db4976cfdd266ae0abf667d9481831ff12e0caa268e7d3e57260c0824115a"
+		  "54ce595ccc897786d9dcbf495599cfd90157186a46ec800a6763f1c59e36197e"
+		  "9939e900809f7077c102f888caaf864b253bc41eea812656d46742e4ea42769f"
+		  "89b83f",
+		  "aca51029626b55fda7117b42a7c211f8c6e9ba4fe5b7a8ca922f34299500ead8"
+		  "a897f66a400fed9198fd61dd2d58d382458e64e100128075fc54b860934e8de2"
+		  "e84170734b06e1d212a117100820dbc48292d148afa50567b8b84b1ec336ae10"
+		  "d40c8c975a624996e12de31abbe135d9d159375739c333798a80c64ae895e51e"
+		  "22f3ad" },
+		{ 8193,
+		  "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"
+		  "b2282aa69be089359ea1154b9a9286c4a56af4de975a9aa4a5c497654914d279"
+		  "bea60bb6d2cf7225a2fa0ff5ef56bbe4b149f3ed15860f78b4e2ad04e158e375"
+		  "c1e0c0b551cd7dfc82f1b155c11b6b3ed51ec9edb30d133653bb5709d1dbd55f"
+		  "4e1ff6",
+		  "954a2a75420c8d6547e3ba5b98d963e6fa6491addc8c023189cc519821b4a1f5"
+		  "f03228648fd983aef045c2fa8290934b0866b615f585149587dda22990399653"
+		  "28835a2b18f1d63b7e300fc76ff260b571839fe44876a4eae66cbac8c6769441"
+		  "1ed7e09df51068a22c6e67d6d3dd2cca8ff12e3275384006c80f4db68023f24e"
+		  "ebba57",
+		  "af1e0346e389b17c23200270a64aa4e1ead98c61695d917de7d5b00491c9b0f1"
+		  "2f20a01d6d622edf3de026a4db4e4526225debb93c1237934d71c7340bb59161"
+		  "58cbdafe9ac3225476b6ab57a12357db3abbad7a26c6e66290e44034fb08a20a"
+		  "8d0ec264f309994d2810c49cfba6989d7abb095897459f5425adb48aba07c5fb"
+		  "3c83c0" },
+		{ 31744,
+		  "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"
+		  "860cc51f2b0c28a7b77304bd55fe73af663c02d3f52ea053ba43431ca5bab7bf"
+		  "ea2f5e9d7121770d88f70ae9649ea713087d1914f7f312147e247f87eb2d4ffe"
+		  "f0ac978bf7b6579d57d533355aa20b8b77b13fd09748728a5cc327a8ec470f40"
+		  "13226f",
+		  "efa53b389ab67c593dba624d898d0f7353ab99e4ac9d42302ee64cbf9939a419"
+		  "3a7258db2d9cd32a7a3ecfce46144114b15c2fcb68a618a976bd74515d47be08"
+		  "b628be420b5e830fade7c080e351a076fbc38641ad80c736c8a18fe3c66ce12f"
+		  "95c61c2462a9770d60d0f77115bbcd3782b593016a4e728d4c06cee4505cb0c0"
+		  "8a42ec",
+		  "39772aef80e0ebe60596361e45b061e8f417429d529171b6764468c22928e28e"
+		  "9759adeb797a3fbf771b1bcea30150a020e317982bf0d6e7d14dd9f064bc1102"
+		  "5c25f31e81bd78a921db0174f03dd481d30e93fd8e90f8b2fee209f849f2d2a5"
+		  "2f31719a490fb0ba7aea1e09814ee912eba111a9fde9d5c274185f7bae8ba85d"
+		  "300a2b" },
+		{ 102400,
+		  "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"
+		  "e01c59dab908c04c3342b816941a26d69c2605ebee5ec5291cc55e15b76146e6"
+		  "745f0601156c3596cb75065a9c57f35585a52e1ac70f69131c23d611ce11ee4a"
+		  "b1ec2c009012d236648e77be9295dd0426f29b764d65de58eb7d01dd42248204"
+		  "f45f8e",
+		  "1c35d1a5811083fd7119f5d5d1ba027b4d01c0c6c49fb6ff2cf75393ea5db4a7"
+		  "f9dbdd3e1d81dcbca3ba241bb18760f207710b751846faaeb9dff8262710999a"
+		  "59b2aa1aca298a032d94eacfadf1aa192418eb54808db23b56e34213266aa084"
+		  "99a16b354f018fc4967d05f8b9d2ad87a7278337be9693fc638a3bfdbe314574"
+		  "ee6fc4",
+		  "4652cff7a3f385a6103b5c260fc1593e13c778dbe608efb092fe7ee69df6e9c6"
+		  "d83a3e041bc3a48df2879f4a0a3ed40e7c961c73eff740f3117a0504c2dff478"
+		  "6d44fb17f1549eb0ba585e40ec29bf7732f0b7e286ff8acddc4cb1e23b87ff5d"
+		  "824a986458dcc6a04ac83969b80637562953df51ed1a7e90a7926924d2763778"
+		  "be8560" }
+	};
+	static const unsigned char key[CTB_BLAKE3_KEY_SIZE + 1] = "whats the Elvish word for friend";
+	static const char context[] = "BLAKE3 2019-12-27 16:29:52 test vectors context";
+	unsigned char out[131];
+	ctb_blake3_ctx ctx;
+	size_t i, len;
+
+	printf("BLAKE3 Test vectors\n");
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		len = vectors[i].len;
+
+		ctb_blake3_init(&ctx);
+		ctb_blake3_update(&ctx, input, len);
+		ctb_blake3_final_xof(&ctx, 0, out, sizeof(out));
+		test(vectors[i].hash, out, sizeof(out));
+		ctb_blake3_final(&ctx, out);
+		test_part(vectors[i].hash, 0, out, CTB_BLAKE3_DIGEST_SIZE);
+		ctb_blake3_final_xof(&ctx, 67, out, 64);
+		test_part(vectors[i].hash, 67, out, 64);
+
+		ctb_blake3_init(&ctx);
+		ctb_blake3_update_parallel(&ctx, input, len, 4);
+		ctb_blake3_final(&ctx, out);
+		test_part(vectors[i].hash, 0, out, CTB_BLAKE3_DIGEST_SIZE);
+
+		ctb_blake3_init_keyed(&ctx, key);
+		ctb_blake3_update(&ctx, input, len / 2);
+		ctb_blake3_update(&ctx, input + len / 2, len - len / 2);
+		ctb_blake3_final_xof(&ctx, 0, out, sizeof(out));
+		test(vectors[i].keyed_hash, out, sizeof(out));
+
+		ctb_blake3_init_derive_key(&ctx, context);
+		ctb_blake3_update(&ctx, input, len);
+		ctb_blake3_final_xof(&ctx, 0, out, sizeof(out));
+		test(vectors[i].derive_key, out, sizeof(out));
+	}
+	printf("\n");
+}
+
+/* One-shot, then streamed in two updates, against the same vector. */
+#define _CTB_HASH_TEST_BLAKE2(NAME, VECTOR, MSG, LEN, KEY, KEYLEN, OUTLEN)      \
+	do {                                                                        \
+		ctb_##NAME##_ctx ctx;                                                   \
+                                                                                \
+		ctb_##NAME(MSG, LEN, KEY, KEYLEN, out, OUTLEN);                         \
+		test(VECTOR, out, OUTLEN);                                              \
+		ctb_##NAME##_init_key(&ctx, OUTLEN, KEY, KEYLEN);                       \
+		ctb_##NAME##_update(&ctx, MSG, (LEN) / 3);                              \
+		ctb_##NAME##_update(&ctx, (MSG) + (LEN) / 3, (LEN) - (LEN) / 3);        \
+		ctb_##NAME##_final(&ctx, out);                                          \
+		test(VECTOR, out, OUTLEN);                                              \
+                                                                                \
+	} while (0)
+
+/* Keyed BLAKE2b/s/bp/sp. The first vectors are the blake2-kat.json entries
+ * (key bytes 0, 1, 2, ... at the full key size, input bytes 0, 1, 2, ...);
+ * BLAKE2bp/sp hold back up to two block rows, so the longer inputs after
+ * them, from the reference implementations, are the ones that reach the
+ * AVX2 leaf kernels.
+ */
+static void test_blake2(const unsigned char *input)
+{
+	static const struct
+	{
+		size_t		len;
+		const char	*b, *s, *bp, *sp;
+	} vectors[] =
+	{
+		{ 0,
+		  "10ebb67700b1868efb4417987acf4690ae9d972fb7a590c2f02871799aaa4786"
+		  "b5e996e8f0f4eb981fc214b005f42d2ff4233499391653df7aefcbc13fc51568",
+		  "48a8997da407876b3d79c0d92325ad3b89cbb754d86ab71aee047ad345fd2c49",
+		  "9d9461073e4eb640a255357b839f394b838c6ff57c9b686a3f76107c1066728f"
+		  "3c9956bd785cbc3bf79dc2ab578c5a0c063b9d9c405848de1dbe821cd05c940a",
+		  "715cb13895aeb678f6124160bff21465b30f4f6874193fc851b4621043f09cc6" },
+		{ 1,
+		  "961f6dd1e4dd30f63901690c512e78e4b45e4742ed197c3c5e45c549fd25f2e4"
+		  "187b0bc9fe30492b16b0d0bc4ef9b0f34c7003fac09a5ef1532e69430234cebd",
+		  "40d15fee7c328830166ac3f918650f807e7e01e177258cdc0a39b11f598066f1",
+		  "ff8e90a37b94623932c59f7559f26035029c376732cb14d41602001cbb73adb7"
+		  "9293a2dbda5f60703025144d158e2735529596251c73c0345ca6fccb1fb1e97e",
+		  "40578ffa52bf51ae1866f4284d3a157fc1bcd36ac13cbdcb0377e4d0cd0b6603" },
+		{ 63,
+		  "bd965bf31e87d70327536f2a341cebc4768eca275fa05ef98f7f1b71a0351298"
+		  "de006fba73fe6733ed01d75801b4a928e54231b38e38c562b2e33ea1284992fa",
+		  "c65382513f07460da39833cb666c5ed82e61b9e998f4b0c4287cee56c3cc9bcd",
+		  "714ad185f1eec43f46b67e992d2d38bc3149e37da7b44748d4d14c161e087802"
+		  "0442149579a865d804b049cd0155ba983378757a1388301bdc0fae2ceaea07dd",
+		  "e85594700e3922a1e8e41eb8b064e7ac6d949d13b5a34523e5a6beac03c8ab29" },
+		{ 64,
+		  "65676d800617972fbd87e4b9514e1c67402b7a331096d3bfac22f1abb95374ab"
+		  "c942f16e9ab0ead33b87c91968a6e509e119ff07787b3ef483e1dcdccf6e3022",
+		  "8975b0577fd35566d750b362b0897a26c399136df07bababbde6203ff2954ed4",
+		  "22b8249eaf722964ce424f71a74d038ff9b615fba5c7c22cb62797f5398224c3"
+		  "f072ebc1dacba32fc6f66360b3e1658d0fa0da1ed1c1da662a2037da823a3383",
+		  "1d3701a5661bd31ab20562bd07b74dd19ac8f3524b73ce7bc996b788afd2f317" },
+		{ 65,
+		  "939fa189699c5d2c81ddd1ffc1fa207c970b6a3685bb29ce1d3e99d42f2f7442"
+		  "da53e95a72907314f4588399a3ff5b0a92beb3f6be2694f9f86ecf2952d5b41c",
+		  "21fe0ceb0052be7fb0f004187cacd7de67fa6eb0938d927677f2398c132317a8",
+		  "b8e903e691b992782528f8db964d08e3baafbd08ba60c72aec0c28ec6bfeca4b"
+		  "2ec4c46f22bf621a5d74f75c0d29693e56c5c584f4399e942f3bd8d38613e639",
+		  "874e1938033d7d383597a2a65f58b554e41106f6d1d50e9ba0eb685f6b6da071" },
+		{ 127,
+		  "76d2d819c92bce55fa8e092ab1bf9b9eab237a25267986cacf2b8ee14d214d73"
+		  "0dc9a5aa2d7b596e86a1fd8fa0804c77402d2fcd45083688b218b1cdfa0dcbcb",
+		  "ddbfea75cc467882eb3483ce5e2e756a4f4701b76b445519e89f22d60fa86e06",
+		  "7926708859e6e2ab68f604da69a9fb5087bb33f4e8d895730e301ab2d7df748b"
+		  "67df0b6b8622e52dd57d8d3ad87d5820d4ecfd24178b2d2b78d64f4fbd387582",
+		  "44cb6311d0750b7e33f7333aa78aaca9c34ad5f79c1b1591ec33951e69c4c461" },
+		{ 128,
+		  "72065ee4dd91c2d8509fa1fc28a37c7fc9fa7d5b3f8ad3d0d7a25626b57b1b44"
+		  "788d4caf806290425f9890a3a2a35a905ab4b37acfd0da6e4517b2525c9651e4",
+		  "0c311f38c35a4fb90d651c289d486856cd1413df9b0677f53ece2cd9e477c60a",
+		  "9280f4d1157032ab315c100d636283fbf4fba2fbad0f8bc020721d76bc1c8973"
+		  "ced28871cc907dab60e59756987b0e0f867fa2fe9d9041f2c9618074e44fe5e9",
+		  "0c6ce32a3ea05612c5f8090f6a7e87f5ab30e41b707dcbe54155620ad770a340" },
+		{ 129,
+		  "64475dfe7600d7171bea0b394e27c9b00d8e74dd1e416a79473682ad3dfdbb70"
+		  "6631558055cfc8a40e07bd015a4540dcdea15883cbbf31412df1de1cd4152b91",
+		  "46a73a8dd3e70f59d3942c01df599def783c9da82fd83222cd662b53dce7dbdf",
+		  "5530c2d59f144872e987e4e258a7d8c38ce844e2cc2eed940ffc683b498815e5"
+		  "3adb1faaf568946122805ac3b8e2fed435fed6162e76f564e586ba464424e885",
+		  "c65938dd3a053c729cf5b7c89f390bfebb5112766bb00aa5fa3164dfdf3b5647" },
+		{ 255,
+		  "142709d62e28fcccd0af97fad0f8465b971e82201dc51070faa0372aa43e9248"
+		  "4be1c1e73ba10906d5d1853db6a4106e0a7bf9800d373d6dee2d46d62ef2a461",
+		  "3fb735061abc519dfe979e54c1ee5bfad0a9d858b3315bad34bde999efd724dd",
+		  "96fbcbb60bd313b8845033e5bc058a38027438572d7e7957f3684f6268aadd3a"
+		  "d08d21767ed6878685331ba98571487e12470aad669326716e46667f69f8d7e8",
+		  "0c8a36597d7461c63a94732821c941856c668376606c86a52de0ee4104c615db" },
+		/* input bytes i % 251 from here on */
+		{ 1536,
+		  "23db30ba11e6cd25d8bc7dfc3c8652815226b99d49032f7da77c200ab4057a26"
+		  "0720c57f98d974878041a30fef260f85d0bcec7d5d9f710f252554c8faf64aef",
+		  "c0f51174f3be2c6642b8a8f84647421495802bc188f368f878dcca820942d738",
+		  "4dd4aeb9fea8c786d4c0bc274c5e0013ae74e328f25e552f23c062f512e44e02"
+		  "c1884a5fb947d6142e6a268cb2494720f35f94362abca68cdfa6f90a894b7dff",
+		  "ff935a476d5cff2c20abd0620316d1c528acb2ec08089be20c32d683eabb6903" },
+		{ 4099,
+		  "83994a97a4b774cef358274f8f7d58def1a8200379fe7600cf88080e4370ecb5"
+		  "37ec322e5eb286315482053191f3ad270b3df7fd157c686f43c77c6ed9cee752",
+		  "6e96ee0707bd07ea841a3d0e8138fe32404aaeca31cdbce49e23467460044ab7",
+		  "b2721b70499dd12a146ee50f7ce26750e4e4d10fb4b71fe5338377b85b858045"
+		  "877df0c4a62df492e780b773de6de9816fe1fc4b5fb3fb5bf1f6b5112b5d1b17",
+		  "687ece045315ef6e891ab7d46c15659a9158999dd2e89d075f9a189678e8907c" },
+		{ 102400,
+		  "f292e203cb85cbd998db45731af371279a7957ba574eec482f4fa8130f424f4e"
+		  "16eb0c785a3e026e22f52eb7cdb2dd585fbf7fa749c87dc9bcf847344512d690",
+		  "c58ad5536196f3019da2d1ee40ea87432bb02de85a6297578439983662cac67b",
+		  "a179c5a39663e900cf8ce0a3b753a63ede8deb61cd5cd65f9cfea06dd6aba627"
+		  "e065461958c6783ade89318530723adbb5d399674fb8990aca50928f3b0c1418",
+		  "45527dfef4c339c8bdf34ca587d0a3e5803f7024a88a6606329cf881066ae812" }
+	};
+	unsigned char kat[256], key[CTB_BLAKE2B_KEY_SIZE], out[CTB_BLAKE2B_DIGEST_SIZE];
+	const unsigned char *msg;
+	size_t i, len;
+
+	for (i = 0; i < sizeof(kat); i++)
+		kat[i] = (unsigned char) i;
+	memcpy(key, kat, sizeof(key));
+
+	printf("BLAKE2 Test vectors\n");
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		len = vectors[i].len;
+		msg = len < sizeof(kat) ? kat : input;
+
+		_CTB_HASH_TEST_BLAKE2(blake2b, vectors[i].b, msg, len, key, CTB_BLAKE2B_KEY_SIZE,
+							  CTB_BLAKE2B_DIGEST_SIZE);
+		_CTB_HASH_TEST_BLAKE2(blake2s, vectors[i].s, msg, len, key, CTB_BLAKE2S_KEY_SIZE,
+							  CTB_BLAKE2S_DIGEST_SIZE);
+		_CTB_HASH_TEST_BLAKE2(blake2bp, vectors[i].bp, msg, len, key, CTB_BLAKE2B_KEY_SIZE,
+							  CTB_BLAKE2B_DIGEST_SIZE);
+		_CTB_HASH_TEST_BLAKE2(blake2sp, vectors[i].sp, msg, len, key, CTB_BLAKE2S_KEY_SIZE,
+							  CTB_BLAKE2S_DIGEST_SIZE);
+	}
+	printf("\n");
+}
+
+#undef _CTB_HASH_TEST_BLAKE2
+
+#define _CTB_HASH_TEST_SSE		(CTB_HASH_CPU_SSE2 | CTB_HASH_CPU_SSSE3 | CTB_HASH_CPU_SSE41 | CTB_HASH_CPU_SSE42)
+#define _CTB_HASH_TEST_SHA		(_CTB_HASH_TEST_SSE | CTB_HASH_CPU_SHA)
+#define _CTB_HASH_TEST_PCLMUL	(_CTB_HASH_TEST_SSE | CTB_HASH_CPU_PCLMUL)
+#define _CTB_HASH_TEST_AVX2		(_CTB_HASH_TEST_PCLMUL | CTB_HASH_CPU_AVX | CTB_HASH_CPU_AVX2 | CTB_HASH_CPU_BMI2)
+#define _CTB_HASH_TEST_AVX512	(_CTB_HASH_TEST_AVX2 | CTB_HASH_CPU_AVX512F | CTB_HASH_CPU_AVX512VL \
+								 | CTB_HASH_CPU_AVX512BW)
+
+int main(void)
+{
+	static const struct
+	{
+		const char		*name;
+		unsigned int	mask;
+	} profiles[] =
+	{
+		{ "scalar",		0 },
+		{ "sse4.2",		_CTB_HASH_TEST_SSE },
+		{ "sha-ni",		_CTB_HASH_TEST_SHA },
+		{ "pclmul",		_CTB_HASH_TEST_PCLMUL },
+		{ "avx2",		_CTB_HASH_TEST_AVX2 },
+		{ "avx512",		_CTB_HASH_TEST_AVX512 },
+		{ "native",		~0u },
+	};
+	unsigned char *input;
+	size_t i;
+
+	input = (unsigned char *) malloc(_CTB_HASH_TEST_INPUT);
+	if (input == NULL) {
+		fprintf(stderr, "Can't allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < _CTB_HASH_TEST_INPUT; i++)
+		input[i] = (unsigned char) (i % 251);
+
+	for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+		ctb_hash_set_cpu_features(profiles[i].mask);
+		printf("Profile %s (cpu features 0x%03x)\n\n", profiles[i].name, ctb_hash_cpu_features());
+		test_sha();
+#ifdef _CTB_HASH_TEST_CT
+		test_constexpr();
+#endif
+		test_many(input);
+		test_composite(input);
+		test_pbkdf2(input);
+		test_generic(input);
+		test_file(input);
+		test_tree(input);
+		test_merkle(input);
+		test_multihash(input);
+		test_hmac_key(input);
+		test_midstate(input);
+		test_zero_copy(input);
+		test_xxh3(input);
+		test_crc(input);
+		test_blake3(input);
+		test_blake2(input);
+	}
+	ctb_hash_set_cpu_features(~0u);
+
+	printf("All tests passed.\n");
+	free(input);
+
+	return 0;
+}
+
+#endif /* TEST_VECTORS */
 
 
 #endif /* CTB_HASH_IMPLEMENTATION */
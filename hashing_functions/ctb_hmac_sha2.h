@@ -59,34 +59,34 @@ typedef struct {
 
 void ctb_hmac_sha224_init(ctb_hmac_sha224_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha224_reinit(ctb_hmac_sha224_ctx *ctx);
-void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha224_final(ctb_hmac_sha224_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha224(const unsigned char *key, unsigned int key_size,
-                 const unsigned char *message, unsigned int message_len,
+                 const unsigned char *message, size_t message_len,
                  unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha256_init(ctb_hmac_sha256_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha256_reinit(ctb_hmac_sha256_ctx *ctx);
-void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha256_final(ctb_hmac_sha256_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha256(const unsigned char *key, unsigned int key_size,
-                 const unsigned char *message, unsigned int message_len,
+                 const unsigned char *message, size_t message_len,
                  unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha384_init(ctb_hmac_sha384_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha384_reinit(ctb_hmac_sha384_ctx *ctx);
-void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha384_final(ctb_hmac_sha384_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha384(const unsigned char *key, unsigned int key_size,
-                 const unsigned char *message, unsigned int message_len,
+                 const unsigned char *message, size_t message_len,
                  unsigned char *mac, unsigned mac_size);
 
 void ctb_hmac_sha512_init(ctb_hmac_sha512_ctx *ctx, const unsigned char *key, unsigned int key_size);
 void ctb_hmac_sha512_reinit(ctb_hmac_sha512_ctx *ctx);
-void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message, unsigned int message_len);
+void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message, size_t message_len);
 void ctb_hmac_sha512_final(ctb_hmac_sha512_ctx *ctx, unsigned char *mac, unsigned int mac_size);
 void ctb_hmac_sha512(const unsigned char *key, unsigned int key_size,
-                 const unsigned char *message, unsigned int message_len,
+                 const unsigned char *message, size_t message_len,
                  unsigned char *mac, unsigned mac_size);
 
 #ifdef CTB_HMAC_SHA2_NOPREFIX
@@ -183,7 +183,7 @@ void ctb_hmac_sha224_reinit(ctb_hmac_sha224_ctx *ctx)
 }
 
 void ctb_hmac_sha224_update(ctb_hmac_sha224_ctx *ctx, const unsigned char *message,
-                        unsigned int message_len)
+                        size_t message_len)
 {
     ctb_sha224_update(&ctx->ctx_inside, message, message_len);
 }
@@ -201,7 +201,7 @@ void ctb_hmac_sha224_final(ctb_hmac_sha224_ctx *ctx, unsigned char *mac,
 }
 
 void ctb_hmac_sha224(const unsigned char *key, unsigned int key_size,
-          const unsigned char *message, unsigned int message_len,
+          const unsigned char *message, size_t message_len,
           unsigned char *mac, unsigned mac_size)
 {
     ctb_hmac_sha224_ctx ctx;
@@ -269,7 +269,7 @@ void ctb_hmac_sha256_reinit(ctb_hmac_sha256_ctx *ctx)
 }
 
 void ctb_hmac_sha256_update(ctb_hmac_sha256_ctx *ctx, const unsigned char *message,
-                        unsigned int message_len)
+                        size_t message_len)
 {
     ctb_sha256_update(&ctx->ctx_inside, message, message_len);
 }
@@ -287,7 +287,7 @@ void ctb_hmac_sha256_final(ctb_hmac_sha256_ctx *ctx, unsigned char *mac,
 }
 
 void ctb_hmac_sha256(const unsigned char *key, unsigned int key_size,
-          const unsigned char *message, unsigned int message_len,
+          const unsigned char *message, size_t message_len,
           unsigned char *mac, unsigned mac_size)
 {
     ctb_hmac_sha256_ctx ctx;
@@ -355,7 +355,7 @@ void ctb_hmac_sha384_reinit(ctb_hmac_sha384_ctx *ctx)
 }
 
 void ctb_hmac_sha384_update(ctb_hmac_sha384_ctx *ctx, const unsigned char *message,
-                        unsigned int message_len)
+                        size_t message_len)
 {
     ctb_sha384_update(&ctx->ctx_inside, message, message_len);
 }
@@ -373,7 +373,7 @@ void ctb_hmac_sha384_final(ctb_hmac_sha384_ctx *ctx, unsigned char *mac,
 }
 
 void ctb_hmac_sha384(const unsigned char *key, unsigned int key_size,
-          const unsigned char *message, unsigned int message_len,
+          const unsigned char *message, size_t message_len,
           unsigned char *mac, unsigned mac_size)
 {
     ctb_hmac_sha384_ctx ctx;
@@ -441,7 +441,7 @@ void ctb_hmac_sha512_reinit(ctb_hmac_sha512_ctx *ctx)
 }
 
 void ctb_hmac_sha512_update(ctb_hmac_sha512_ctx *ctx, const unsigned char *message,
-                        unsigned int message_len)
+                        size_t message_len)
 {
     ctb_sha512_update(&ctx->ctx_inside, message, message_len);
 }
@@ -459,7 +459,7 @@ void ctb_hmac_sha512_final(ctb_hmac_sha512_ctx *ctx, unsigned char *mac,
 }
 
 void ctb_hmac_sha512(const unsigned char *key, unsigned int key_size,
-          const unsigned char *message, unsigned int message_len,
+          const unsigned char *message, size_t message_len,
           unsigned char *mac, unsigned mac_size)
 {
     ctb_hmac_sha512_ctx ctx;
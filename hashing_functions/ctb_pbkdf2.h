@@ -59,14 +59,75 @@ static inline void be32(uint32_t x, uint8_t out[4]) {
     out[3] = (uint8_t)(x);
 }
 
-/* Core PBKDF2 loop using the provided HMAC context API (init/reinit/update/final).
- * We use *_reinit so the keyed ipad/opad are reused for each HMAC invocation.
+/* Midstate iteration loops. istate/ostate are the keyed ipad/opad
+ * midstates; each iteration runs two raw compressions over a block that
+ * holds U (dw words) followed by constant padding, set up once:
+ *     u = H(ostate, H(istate, u || pad) || pad),  t ^= u
+ */
+static void _ctb_pbkdf2_sha256_loop(const uint32 istate[8], const uint32 ostate[8],
+                                    uint32 u[8], uint32 t[8], uint32_t rounds, unsigned int dw)
+{
+    ctb_sha256_ctx work;
+    unsigned int i;
+
+    memset(work.block, 0, _CTB_SHA256_BLOCK_SIZE);
+    work.block[dw << 2] = 0x80;
+    UNPACK32((uint32) (_CTB_SHA256_BLOCK_SIZE + (dw << 2)) << 3, &work.block[60]);
+    for (; rounds > 0; rounds--) {
+        for (i = 0; i < dw; i++)
+            UNPACK32(u[i], &work.block[i << 2]);
+        memcpy(work.h, istate, sizeof(work.h));
+        _ctb_sha256_transf(&work, work.block, 1);
+
+        for (i = 0; i < dw; i++)
+            UNPACK32(work.h[i], &work.block[i << 2]);
+        memcpy(work.h, ostate, sizeof(work.h));
+        _ctb_sha256_transf(&work, work.block, 1);
+        for (i = 0; i < dw; i++) {
+            u[i] = work.h[i];
+            t[i] ^= u[i];
+        }
+    }
+    memset(&work, 0, sizeof(work));
+}
+
+static void _ctb_pbkdf2_sha512_loop(const uint64 istate[8], const uint64 ostate[8],
+                                    uint64 u[8], uint64 t[8], uint32_t rounds, unsigned int dw)
+{
+    ctb_sha512_ctx work;
+    unsigned int i;
+
+    memset(work.block, 0, _CTB_SHA512_BLOCK_SIZE);
+    work.block[dw << 3] = 0x80;
+    UNPACK64((uint64) (_CTB_SHA512_BLOCK_SIZE + (dw << 3)) << 3, &work.block[120]);
+    for (; rounds > 0; rounds--) {
+        for (i = 0; i < dw; i++)
+            UNPACK64(u[i], &work.block[i << 3]);
+        memcpy(work.h, istate, sizeof(work.h));
+        ctb_sha512_transf(&work, work.block, 1);
+
+        for (i = 0; i < dw; i++)
+            UNPACK64(work.h[i], &work.block[i << 3]);
+        memcpy(work.h, ostate, sizeof(work.h));
+        ctb_sha512_transf(&work, work.block, 1);
+        for (i = 0; i < dw; i++) {
+            u[i] = work.h[i];
+            t[i] ^= u[i];
+        }
+    }
+    memset(&work, 0, sizeof(work));
+}
+
+/* PBKDF2 on the keyed midstates. HMAC init runs once per call and the
+ * context API is used for U1 only (it covers the salt); U2..Uc run in the
+ * midstate loop with no context copies and no heap.
  */
 #define DECL_PBKDF2_FN(NAME,                        \
                        HMAC_CTX_T,                  \
                        HMAC_INIT, HMAC_REINIT,      \
                        HMAC_UPDATE, HMAC_FINAL,     \
-                       DIGEST_LEN)                  \
+                       DIGEST_LEN,                  \
+                       WORD_T, PACK, UNPACK, LOOP)  \
 void NAME(const uint8_t *password, size_t password_len, \
           const uint8_t *salt,     size_t salt_len,     \
           uint32_t iterations,                          \
@@ -76,78 +137,76 @@ void NAME(const uint8_t *password, size_t password_len, \
         return;                                         \
                                                         \
     const size_t hLen = (size_t)(DIGEST_LEN);           \
-    uint32_t blocks = (uint32_t)((out_len + hLen - 1) / hLen); \
-                                                        \
-    /* salt || INT_32_BE(i) buffer */                   \
-    uint8_t *salt_cnt = (uint8_t*)malloc(salt_len + 4); \
-    if (!salt_cnt) return;                              \
-    if (salt_len) memcpy(salt_cnt, salt, salt_len);     \
+    const size_t ws = sizeof(WORD_T);                   \
+    const unsigned int dw = (unsigned int)(hLen / ws);  \
                                                         \
     HMAC_CTX_T ctx;                                     \
+    WORD_T U[8], T[8];                                  \
+    uint8_t mac[DIGEST_LEN], cnt[4];                    \
     HMAC_INIT(&ctx, password, (unsigned int)password_len); \
                                                         \
-    uint8_t *U = (uint8_t*)malloc(hLen);                \
-    uint8_t *T = (uint8_t*)malloc(hLen);                \
-    if (!U || !T) {                                     \
-        free(salt_cnt);                                 \
-        free(U); free(T);                               \
-        return;                                         \
-    }                                                   \
-                                                        \
     size_t off = 0;                                     \
-    for (uint32_t i = 1; i <= blocks; ++i) {            \
-        be32(i, salt_cnt + salt_len);                   \
+    for (uint32_t i = 1; off < out_len; ++i) {          \
+        be32(i, cnt);                                   \
                                                         \
         /* U1 = PRF(P, S || INT(i)) */                  \
         HMAC_REINIT(&ctx);                              \
-        HMAC_UPDATE(&ctx, salt_cnt, (unsigned int)(salt_len + 4)); \
-        HMAC_FINAL(&ctx, U, (unsigned int)hLen);        \
-        memcpy(T, U, hLen);                             \
+        if (salt_len)                                   \
+            HMAC_UPDATE(&ctx, salt, salt_len); \
+        HMAC_UPDATE(&ctx, cnt, 4);                      \
+        HMAC_FINAL(&ctx, mac, (unsigned int)hLen);      \
+        for (unsigned int j = 0; j < dw; ++j) {         \
+            PACK(&mac[j * ws], &U[j]);                  \
+            T[j] = U[j];                                \
+        }                                               \
                                                         \
         /* U2..Uc */                                    \
-        for (uint32_t j = 2; j <= iterations; ++j) {    \
-            HMAC_REINIT(&ctx);                          \
-            HMAC_UPDATE(&ctx, U, (unsigned int)hLen);   \
-            HMAC_FINAL(&ctx, U, (unsigned int)hLen);    \
-            for (size_t k = 0; k < hLen; ++k)           \
-                T[k] ^= U[k];                           \
-        }                                               \
+        if (iterations > 1)                             \
+            LOOP(ctx.ctx_inside_reinit.h, ctx.ctx_outside_reinit.h, \
+                 U, T, iterations - 1, dw);             \
                                                         \
+        for (unsigned int j = 0; j < dw; ++j)           \
+            UNPACK(T[j], &mac[j * ws]);                 \
         size_t take = (out_len - off < hLen) ? (out_len - off) : hLen; \
-        memcpy(out + off, T, take);                     \
+        memcpy(out + off, mac, take);                   \
         off += take;                                    \
     }                                                   \
                                                         \
-    /* wipe & free */                                    \
-    if (U) { memset(U, 0, hLen); free(U); }             \
-    if (T) { memset(T, 0, hLen); free(T); }             \
-    if (salt_cnt) { memset(salt_cnt, 0, salt_len + 4); free(salt_cnt); } \
+    /* wipe */                                          \
+    memset(U, 0, sizeof(U));                            \
+    memset(T, 0, sizeof(T));                            \
+    memset(mac, 0, sizeof(mac));                        \
+    memset(&ctx, 0, sizeof(ctx));                       \
 }
 
 /* Instantiate four PBKDF2 functions (HMAC-SHA2 variants) */
 DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha224,
-               hmac_sha224_ctx,
-               hmac_sha224_init, hmac_sha224_reinit,
-               hmac_sha224_update, hmac_sha224_final,
-               SHA224_DIGEST_SIZE)
+               ctb_hmac_sha224_ctx,
+               ctb_hmac_sha224_init, ctb_hmac_sha224_reinit,
+               ctb_hmac_sha224_update, ctb_hmac_sha224_final,
+               _CTB_SHA224_DIGEST_SIZE,
+               uint32, PACK32, UNPACK32, _ctb_pbkdf2_sha256_loop)
 
 DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha256,
-               hmac_sha256_ctx,
-               hmac_sha256_init, hmac_sha256_reinit,
-               hmac_sha256_update, hmac_sha256_final,
-               SHA256_DIGEST_SIZE)
+               ctb_hmac_sha256_ctx,
+               ctb_hmac_sha256_init, ctb_hmac_sha256_reinit,
+               ctb_hmac_sha256_update, ctb_hmac_sha256_final,
+               _CTB_SHA256_DIGEST_SIZE,
+               uint32, PACK32, UNPACK32, _ctb_pbkdf2_sha256_loop)
 
 DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha384,
-               hmac_sha384_ctx,
-               hmac_sha384_init, hmac_sha384_reinit,
-               hmac_sha384_update, hmac_sha384_final,
-               SHA384_DIGEST_SIZE)
+               ctb_hmac_sha384_ctx,
+               ctb_hmac_sha384_init, ctb_hmac_sha384_reinit,
+               ctb_hmac_sha384_update, ctb_hmac_sha384_final,
+               _CTB_SHA384_DIGEST_SIZE,
+               uint64, PACK64, UNPACK64, _ctb_pbkdf2_sha512_loop)
 
 DECL_PBKDF2_FN(ctb_pbkdf2_hmac_sha512,
-               hmac_sha512_ctx,
-               hmac_sha512_init, hmac_sha512_reinit,
-               hmac_sha512_update, hmac_sha512_final,
-               SHA512_DIGEST_SIZE)
+               ctb_hmac_sha512_ctx,
+               ctb_hmac_sha512_init, ctb_hmac_sha512_reinit,
+               ctb_hmac_sha512_update, ctb_hmac_sha512_final,
+               _CTB_SHA512_DIGEST_SIZE,
+               uint64, PACK64, UNPACK64, _ctb_pbkdf2_sha512_loop)
 
 #endif
 
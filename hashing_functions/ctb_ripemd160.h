@@ -2,21 +2,31 @@
 #define _CTB_RIPEMD160_H
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define _CTB_RIPEMD160_BLOCK_LENGTH 64
 #define _CTB_RIPEMD160_DIGEST_LENGTH 20
 
 typedef struct _ctb_ripemd160_ctx {
+  uint8_t buffer[_CTB_RIPEMD160_BLOCK_LENGTH]; /*!< data block being processed */
   uint32_t total[2];                      /*!< number of bytes processed  */
   uint32_t state[5];                      /*!< intermediate digest state  */
-  uint8_t buffer[_CTB_RIPEMD160_BLOCK_LENGTH]; /*!< data block being processed */
 } ctb_ripemd160_ctx;
 
 void ctb_ripemd160_init(ctb_ripemd160_ctx *ctx);
-void ctb_ripemd160_update(ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_t ilen);
+void ctb_ripemd160_update(ctb_ripemd160_ctx *ctx, const uint8_t *input, size_t ilen);
 void ctb_ripemd160_final(ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_DIGEST_LENGTH]);
-void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH]);
+void ctb_ripemd160(const uint8_t *msg, size_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH]);
+
+/* Midstate after a whole number of 64-byte blocks: the five state words
+ * and the 64-bit byte count, little-endian. _export returns -1 on a
+ * partial block, _import on a count that is not a whole number of blocks.
+ */
+#define CTB_RIPEMD160_MIDSTATE_SIZE (5 * 4 + 8)
+
+int ctb_ripemd160_export(const ctb_ripemd160_ctx *ctx, uint8_t out[CTB_RIPEMD160_MIDSTATE_SIZE]);
+int ctb_ripemd160_import(ctb_ripemd160_ctx *ctx, const uint8_t in[CTB_RIPEMD160_MIDSTATE_SIZE]);
 
 
 #ifdef CTB_RIPEMD160_NOPREFIX
@@ -25,6 +35,8 @@ void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEM
 	#define ripemd160_update	ctb_ripemd160_update
 	#define ripemd160_final		ctb_ripemd160_final
 	#define ripemd160			ctb_ripemd160
+	#define ripemd160_export	ctb_ripemd160_export
+	#define ripemd160_import	ctb_ripemd160_import
 #endif
 
 
@@ -356,7 +368,7 @@ void ripemd160_process( ctb_ripemd160_ctx *ctx, const uint8_t data[_CTB_RIPEMD16
 /*
  * RIPEMD-160 process buffer
  */
-void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_t ilen )
+void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, size_t ilen )
 {
     uint32_t fill;
     uint32_t left;
@@ -372,6 +384,7 @@ void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_
 
     if( ctx->total[0] < (uint32_t) ilen )
         ctx->total[1]++;
+    ctx->total[1] += (uint32_t) ( (uint64_t) ilen >> 32 );
 
     if( left && ilen >= fill )
     {
@@ -395,35 +408,32 @@ void ctb_ripemd160_update( ctb_ripemd160_ctx *ctx, const uint8_t *input, uint32_
     }
 }
 
-static const uint8_t ripemd160_padding[_CTB_RIPEMD160_BLOCK_LENGTH] =
-{
- 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
-
 /*
- * RIPEMD-160 final digest
+ * RIPEMD-160 final digest (padded in place, in ctx->buffer)
  */
 void ctb_ripemd160_final( ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_DIGEST_LENGTH] )
 {
-    uint32_t last, padn;
+    uint32_t last;
     uint32_t high, low;
-    uint8_t msglen[8];
 
     high = ( ctx->total[0] >> 29 )
          | ( ctx->total[1] <<  3 );
     low  = ( ctx->total[0] <<  3 );
 
-    PUT_UINT32_LE( low,  msglen, 0 );
-    PUT_UINT32_LE( high, msglen, 4 );
-
     last = ctx->total[0] & 0x3F;
-    padn = ( last < 56 ) ? ( 56 - last ) : ( 120 - last );
+    ctx->buffer[last++] = 0x80;
+
+    if( last > 56 )
+    {
+        memset( ctx->buffer + last, 0, _CTB_RIPEMD160_BLOCK_LENGTH - last );
+        ripemd160_process( ctx, ctx->buffer );
+        last = 0;
+    }
 
-    ctb_ripemd160_update( ctx, ripemd160_padding, padn );
-    ctb_ripemd160_update( ctx, msglen, 8 );
+    memset( ctx->buffer + last, 0, 56 - last );
+    PUT_UINT32_LE( low,  ctx->buffer, 56 );
+    PUT_UINT32_LE( high, ctx->buffer, 60 );
+    ripemd160_process( ctx, ctx->buffer );
 
     PUT_UINT32_LE( ctx->state[0], output,  0 );
     PUT_UINT32_LE( ctx->state[1], output,  4 );
@@ -437,7 +447,7 @@ void ctb_ripemd160_final( ctb_ripemd160_ctx *ctx, uint8_t output[_CTB_RIPEMD160_
 /*
  * output = RIPEMD-160( input buffer )
  */
-void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH])
+void ctb_ripemd160(const uint8_t *msg, size_t msg_len, uint8_t hash[_CTB_RIPEMD160_DIGEST_LENGTH])
 {
     ctb_ripemd160_ctx ctx;
     ctb_ripemd160_init( &ctx );
@@ -445,6 +455,37 @@ void ctb_ripemd160(const uint8_t *msg, uint32_t msg_len, uint8_t hash[_CTB_RIPEM
     ctb_ripemd160_final( &ctx, hash );
 }
 
+/*
+ * RIPEMD-160 midstate export / import
+ */
+int ctb_ripemd160_export( const ctb_ripemd160_ctx *ctx, uint8_t out[CTB_RIPEMD160_MIDSTATE_SIZE] )
+{
+    int i;
+
+    if( ctx->total[0] & 0x3F )
+        return( -1 );
+
+    for( i = 0; i < 5; i++ )
+        PUT_UINT32_LE( ctx->state[i], out, 4 * i );
+    PUT_UINT32_LE( ctx->total[0], out, 20 );
+    PUT_UINT32_LE( ctx->total[1], out, 24 );
+    return( 0 );
+}
+
+int ctb_ripemd160_import( ctb_ripemd160_ctx *ctx, const uint8_t in[CTB_RIPEMD160_MIDSTATE_SIZE] )
+{
+    int i;
+
+    if( in[20] & 0x3F )
+        return( -1 );
+
+    for( i = 0; i < 5; i++ )
+        GET_UINT32_LE( ctx->state[i], in, 4 * i );
+    GET_UINT32_LE( ctx->total[0], in, 20 );
+    GET_UINT32_LE( ctx->total[1], in, 24 );
+    return( 0 );
+}
+
 #endif
 
 
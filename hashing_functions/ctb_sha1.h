@@ -1,6 +1,7 @@
 #ifndef _CTB_ctb_sha1_H
 #define _CTB_ctb_sha1_H
 
+#include <stddef.h>
 #include "stdint.h"
 
 typedef struct
@@ -12,9 +13,9 @@ typedef struct
 
 void ctb_sha1_transform(uint32_t state[5], const unsigned char buffer[64]);
 void ctb_sha1_init(ctb_sha1_ctx * context);
-void ctb_sha1_update(ctb_sha1_ctx * context, const unsigned char *data, uint32_t len);
+void ctb_sha1_update(ctb_sha1_ctx * context, const unsigned char *data, size_t len);
 void ctb_sha1_final(unsigned char digest[20], ctb_sha1_ctx * context);
-void ctb_sha1(char *hash_out, const char *str, uint32_t len);
+void ctb_sha1(char *hash_out, const char *str, size_t len);
 
 #ifdef CTB_SHA1_NOPREFIX
 	typedef	ctb_sha1_ctx	sha1_ctx;
@@ -36,6 +37,36 @@ void ctb_sha1(char *hash_out, const char *str, uint32_t len);
 
 /* for uint32_t */
 #include <stdint.h>
+#include <stddef.h>
+
+#if !defined(CTB_SHA1_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) \
+    || defined(__i386__) || defined(_M_IX86))
+    #define _CTB_SHA1_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#else
+    #define _CTB_SHA1_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define _CTB_SHA1_TARGET(isa) __attribute__((target(isa)))
+#else
+    #define _CTB_SHA1_TARGET(isa)
+#endif
+
+/* Byte order, decided at compile time; undefined when unknown. */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define _CTB_SHA1_LITTLE_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define _CTB_SHA1_LITTLE_ENDIAN 0
+#elif defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64) \
+    || defined(__x86_64__) || defined(__i386__)
+    #define _CTB_SHA1_LITTLE_ENDIAN 1
+#endif
 
 
 
@@ -46,17 +77,16 @@ void ctb_sha1(char *hash_out, const char *str, uint32_t len);
 #define blk0_le(i) (block->l[i] = (rol(block->l[i],24)&0xFF00FF00) \
     |(rol(block->l[i],8)&0x00FF00FF))
 #define blk0_be(i) block->l[i]
-#if BYTE_ORDER == LITTLE_ENDIAN
+#define blk0_bytes(i) (block->l[i] = ((uint32_t) block->c[(i) * 4] << 24) \
+    | ((uint32_t) block->c[(i) * 4 + 1] << 16) | ((uint32_t) block->c[(i) * 4 + 2] << 8) \
+    | (uint32_t) block->c[(i) * 4 + 3])
+#if !defined(_CTB_SHA1_LITTLE_ENDIAN)
+/* Unknown byte order: assemble the big-endian words byte by byte */
+#define blk0(i) blk0_bytes(i)
+#elif _CTB_SHA1_LITTLE_ENDIAN
 #define blk0(i) blk0_le(i)
-#elif BYTE_ORDER == BIG_ENDIAN
-#define blk0(i) blk0_be(i)
 #else
-/* Fall back to a runtime endian check */
-const union {
-    long l;
-    char c;
-} sha1_endian = { 1 };
-#define blk0(i) (sha1_endian.c == 0 ? blk0_be(i) : blk0_le(i))
+#define blk0(i) blk0_be(i)
 #endif
 
 #define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15] \
@@ -72,7 +102,7 @@ const union {
 
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 
-void ctb_sha1_transform(
+static void _ctb_sha1_transform_scalar(
     uint32_t state[5],
     const unsigned char buffer[64]
 )
@@ -197,6 +227,140 @@ void ctb_sha1_transform(
 #endif
 }
 
+static void _ctb_sha1_compress_scalar(uint32_t state[5], const unsigned char *data, size_t block_nb)
+{
+    for (; block_nb > 0; block_nb--, data += 64)
+        _ctb_sha1_transform_scalar(state, data);
+}
+
+#if _CTB_SHA1_X86
+/* SHA-NI: four rounds per sha1rnds4. E is carried in the top lane of
+ * e0/e1 and folded into the next schedule group with sha1nexte; the
+ * schedule is expanded in place with sha1msg1/xor/sha1msg2.
+ */
+#define _CTB_SHA1_NI_GROUP(g, ecur, enext, cur, prev, next, next2)           \
+{                                                                             \
+    if ((g) == 0)                                                             \
+        ecur = _mm_add_epi32(ecur, cur);                                      \
+    else                                                                      \
+        ecur = _mm_sha1nexte_epu32(ecur, cur);                                \
+    enext = abcd;                                                             \
+    if ((g) >= 3 && (g) <= 18)                                                \
+        next = _mm_sha1msg2_epu32(next, cur);                                 \
+    abcd = _mm_sha1rnds4_epu32(abcd, ecur, (g) / 5);                          \
+    if ((g) >= 1 && (g) <= 16)                                                \
+        prev = _mm_sha1msg1_epu32(prev, cur);                                 \
+    if ((g) >= 2 && (g) <= 17)                                                \
+        next2 = _mm_xor_si128(next2, cur);                                    \
+}
+
+_CTB_SHA1_TARGET("sha,sse4.1")
+static void _ctb_sha1_compress_shani(uint32_t state[5], const unsigned char *data, size_t block_nb)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+
+    for (; block_nb > 0; block_nb--, data += 64) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data +  0)), bswap);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), bswap);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), bswap);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), bswap);
+
+        _CTB_SHA1_NI_GROUP( 0, e0, e1, m0, m3, m1, m2);
+        _CTB_SHA1_NI_GROUP( 1, e1, e0, m1, m0, m2, m3);
+        _CTB_SHA1_NI_GROUP( 2, e0, e1, m2, m1, m3, m0);
+        _CTB_SHA1_NI_GROUP( 3, e1, e0, m3, m2, m0, m1);
+        _CTB_SHA1_NI_GROUP( 4, e0, e1, m0, m3, m1, m2);
+        _CTB_SHA1_NI_GROUP( 5, e1, e0, m1, m0, m2, m3);
+        _CTB_SHA1_NI_GROUP( 6, e0, e1, m2, m1, m3, m0);
+        _CTB_SHA1_NI_GROUP( 7, e1, e0, m3, m2, m0, m1);
+        _CTB_SHA1_NI_GROUP( 8, e0, e1, m0, m3, m1, m2);
+        _CTB_SHA1_NI_GROUP( 9, e1, e0, m1, m0, m2, m3);
+        _CTB_SHA1_NI_GROUP(10, e0, e1, m2, m1, m3, m0);
+        _CTB_SHA1_NI_GROUP(11, e1, e0, m3, m2, m0, m1);
+        _CTB_SHA1_NI_GROUP(12, e0, e1, m0, m3, m1, m2);
+        _CTB_SHA1_NI_GROUP(13, e1, e0, m1, m0, m2, m3);
+        _CTB_SHA1_NI_GROUP(14, e0, e1, m2, m1, m3, m0);
+        _CTB_SHA1_NI_GROUP(15, e1, e0, m3, m2, m0, m1);
+        _CTB_SHA1_NI_GROUP(16, e0, e1, m0, m3, m1, m2);
+        _CTB_SHA1_NI_GROUP(17, e1, e0, m1, m0, m2, m3);
+        _CTB_SHA1_NI_GROUP(18, e0, e1, m2, m1, m3, m0);
+        _CTB_SHA1_NI_GROUP(19, e1, e0, m3, m2, m0, m1);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+#undef _CTB_SHA1_NI_GROUP
+#endif /* _CTB_SHA1_X86 */
+
+static void _ctb_sha1_compress_resolve(uint32_t state[5], const unsigned char *data, size_t block_nb);
+
+/* Selected on first use: SHA-NI when the CPU has it, scalar otherwise. */
+static void (*_ctb_sha1_compress)(uint32_t state[5], const unsigned char *data, size_t block_nb)
+    = _ctb_sha1_compress_resolve;
+
+/* Threads racing to the first call all store the same pointer; relaxed
+ * atomic accesses keep that well defined.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+    #define _CTB_SHA1_FN_LOAD(p)        __atomic_load_n(&(p), __ATOMIC_RELAXED)
+    #define _CTB_SHA1_FN_STORE(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+#else
+    #define _CTB_SHA1_FN_LOAD(p)        (p)
+    #define _CTB_SHA1_FN_STORE(p, v)    ((p) = (v))
+#endif
+
+static void _ctb_sha1_compress_resolve(uint32_t state[5], const unsigned char *data, size_t block_nb)
+{
+    void (*fn)(uint32_t state[5], const unsigned char *data, size_t block_nb) = _ctb_sha1_compress_scalar;
+
+#if _CTB_SHA1_X86
+    {
+        unsigned int a, b, c, d, leaf1_ecx = 0, leaf7_ebx = 0;
+    #if defined(_MSC_VER)
+        int r[4];
+
+        __cpuid(r, 0);
+        if (r[0] >= 7) {
+            __cpuidex(r, 1, 0); leaf1_ecx = (unsigned int) r[2];
+            __cpuidex(r, 7, 0); leaf7_ebx = (unsigned int) r[1];
+        }
+        (void) a; (void) b; (void) c; (void) d;
+    #else
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(1, 0, a, b, c, d); leaf1_ecx = c;
+            __cpuid_count(7, 0, a, b, c, d); leaf7_ebx = b;
+        }
+    #endif
+        /* SHA extensions (leaf 7 EBX[29]) and SSE4.1 (leaf 1 ECX[19]) */
+        if ((leaf7_ebx & (1u << 29)) && (leaf1_ecx & (1u << 19)))
+            fn = _ctb_sha1_compress_shani;
+    }
+#endif
+    _CTB_SHA1_FN_STORE(_ctb_sha1_compress, fn);
+    fn(state, data, block_nb);
+}
+
+void ctb_sha1_transform(
+    uint32_t state[5],
+    const unsigned char buffer[64]
+)
+{
+    _CTB_SHA1_FN_LOAD(_ctb_sha1_compress)(state, buffer, 1);
+}
+
 
 /* ctb_sha1_init - Initialize new context */
 
@@ -219,25 +383,26 @@ void ctb_sha1_init(
 void ctb_sha1_update(
     ctb_sha1_ctx * context,
     const unsigned char *data,
-    uint32_t len
+    size_t len
 )
 {
-    uint32_t i;
+    size_t i;
 
     uint32_t j;
 
     j = context->count[0];
-    if ((context->count[0] += len << 3) < j)
+    if ((context->count[0] += (uint32_t) (len << 3)) < j)
         context->count[1]++;
-    context->count[1] += (len >> 29);
+    context->count[1] += (uint32_t) ((uint64_t) len >> 29);
     j = (j >> 3) & 63;
     if ((j + len) > 63)
     {
         memcpy(&context->buffer[j], data, (i = 64 - j));
-        ctb_sha1_transform(context->state, context->buffer);
-        for (; i + 63 < len; i += 64)
+        _CTB_SHA1_FN_LOAD(_ctb_sha1_compress)(context->state, context->buffer, 1);
+        if (len - i >= 64)
         {
-            ctb_sha1_transform(context->state, &data[i]);
+            _CTB_SHA1_FN_LOAD(_ctb_sha1_compress)(context->state, &data[i], (len - i) >> 6);
+            i += (len - i) & ~(size_t) 63;
         }
         j = 0;
     }
@@ -254,11 +419,11 @@ void ctb_sha1_final(
     ctb_sha1_ctx * context
 )
 {
-    unsigned i;
+    static const unsigned char padding[64] = { 0200 };
 
-    unsigned char finalcount[8];
+    unsigned i, j;
 
-    unsigned char c;
+    unsigned char finalcount[8];
 
 #if 0    /* untested "improvement" by DHR */
     /* Convert context->count to a sequence of bytes
@@ -282,13 +447,9 @@ void ctb_sha1_final(
         finalcount[i] = (unsigned char) ((context->count[(i >= 4 ? 0 : 1)] >> ((3 - (i & 3)) * 8)) & 255);      /* Endian independent */
     }
 #endif
-    c = 0200;
-    ctb_sha1_update(context, &c, 1);
-    while ((context->count[0] & 504) != 448)
-    {
-        c = 0000;
-        ctb_sha1_update(context, &c, 1);
-    }
+    /* 0x80, then zeros up to 56 mod 64 */
+    j = (context->count[0] >> 3) & 63;
+    ctb_sha1_update(context, padding, (j < 56) ? 56 - j : 120 - j);
     ctb_sha1_update(context, finalcount, 8); /* Should cause a ctb_sha1_transform() */
     for (i = 0; i < 20; i++)
     {
@@ -303,14 +464,12 @@ void ctb_sha1_final(
 void ctb_sha1(
     char *hash_out,
     const char *str,
-    uint32_t len)
+    size_t len)
 {
     ctb_sha1_ctx ctx;
-    unsigned int ii;
 
     ctb_sha1_init(&ctx);
-    for (ii=0; ii<len; ii+=1)
-        ctb_sha1_update(&ctx, (const unsigned char*)str + ii, 1);
+    ctb_sha1_update(&ctx, (const unsigned char*)str, len);
     ctb_sha1_final((unsigned char *)hash_out, &ctx);
 }
 
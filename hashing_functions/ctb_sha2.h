@@ -1,6 +1,7 @@
 #ifndef _CTB_SHA2_H
 #define _CTB_SHA2_H
 
+#include <stddef.h>
 
 
 #define _CTB_SHA224_DIGEST_SIZE ( 224 / 8)
@@ -20,42 +21,60 @@ typedef unsigned int  uint32;
 typedef unsigned long long uint64;
 #endif
 
+/* One block buffer, placed first; whole blocks of input are compressed
+ * from the caller's memory and never copied here.
+ */
 typedef struct {
-	unsigned int tot_len;
-	unsigned int len;
-	unsigned char block[2 * _CTB_SHA256_BLOCK_SIZE];
+	unsigned char block[_CTB_SHA256_BLOCK_SIZE];
 	uint32 h[8];
+	uint64 tot_len;
+	unsigned int len;
 } ctb_sha256_ctx;
 
 typedef struct {
-	unsigned int tot_len;
-	unsigned int len;
-	unsigned char block[2 * _CTB_SHA512_BLOCK_SIZE];
+	unsigned char block[_CTB_SHA512_BLOCK_SIZE];
 	uint64 h[8];
+	uint64 tot_len;
+	unsigned int len;
 } ctb_sha512_ctx;
 
 typedef ctb_sha512_ctx ctb_sha384_ctx;
 typedef ctb_sha256_ctx ctb_sha224_ctx;
 
 void ctb_sha224_init(ctb_sha224_ctx *ctx);
-void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest);
-void ctb_sha224(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha224(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha256_init(ctb_sha256_ctx * ctx);
-void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest);
-void ctb_sha256(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha256(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha384_init(ctb_sha384_ctx *ctx);
-void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest);
-void ctb_sha384(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha384(const unsigned char *message, size_t len, unsigned char *digest);
 
 void ctb_sha512_init(ctb_sha512_ctx *ctx);
-void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int len);
+void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, size_t len);
 void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest);
-void ctb_sha512(const unsigned char *message, unsigned int len, unsigned char *digest);
+void ctb_sha512(const unsigned char *message, size_t len, unsigned char *digest);
+
+/* Midstates: after a whole number of blocks a context is its chaining
+ * value and byte count. _export writes them as a compact record (state
+ * words big-endian, then the 64-bit count), _import rebuilds a context
+ * from one. SHA-224/384 contexts use the SHA-256/512 functions. Return 0,
+ * or -1 on a partial block (export) or a count that is not a whole number
+ * of blocks (import).
+ */
+#define CTB_SHA256_MIDSTATE_SIZE	(8 * 4 + 8)
+#define CTB_SHA512_MIDSTATE_SIZE	(8 * 8 + 8)
+
+int ctb_sha256_export(const ctb_sha256_ctx *ctx, unsigned char out[CTB_SHA256_MIDSTATE_SIZE]);
+int ctb_sha256_import(ctb_sha256_ctx *ctx, const unsigned char in[CTB_SHA256_MIDSTATE_SIZE]);
+int ctb_sha512_export(const ctb_sha512_ctx *ctx, unsigned char out[CTB_SHA512_MIDSTATE_SIZE]);
+int ctb_sha512_import(ctb_sha512_ctx *ctx, const unsigned char in[CTB_SHA512_MIDSTATE_SIZE]);
 
 #ifdef CTB_SHA2_NOPREFIX
 typedef ctb_sha224_ctx	sha224_ctx;
@@ -69,6 +88,8 @@ typedef ctb_sha256_ctx	sha256_ctx;
 #define sha256_update	ctb_sha256_update
 #define sha256_final	ctb_sha256_final
 #define sha256			ctb_sha256
+#define sha256_export	ctb_sha256_export
+#define sha256_import	ctb_sha256_import
 
 typedef ctb_sha384_ctx	sha384_ctx;
 #define sha384_init		ctb_sha384_init
@@ -81,6 +102,8 @@ typedef ctb_sha512_ctx	sha512_ctx;
 #define sha512_update	ctb_sha512_update
 #define sha512_final	ctb_sha512_final
 #define sha512			ctb_sha512
+#define sha512_export	ctb_sha512_export
+#define sha512_import	ctb_sha512_import
 #endif
 
 
@@ -91,6 +114,26 @@ typedef ctb_sha512_ctx	sha512_ctx;
 #endif
 
 #include <string.h>
+#include <stddef.h>
+
+#if !defined(CTB_SHA2_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) \
+	|| defined(__i386__) || defined(_M_IX86))
+	#define _CTB_SHA2_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#else
+	#define _CTB_SHA2_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define _CTB_SHA2_TARGET(isa) __attribute__((target(isa)))
+#else
+	#define _CTB_SHA2_TARGET(isa)
+#endif
 
 #define SHFR(x, n)    (x >> n)
 #define ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
@@ -262,20 +305,18 @@ uint64 sha512_k[80] =
 
 /* SHA-256 functions */
 
-void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int block_nb)
+static void _ctb_sha256_compress_scalar(uint32 h[8], const unsigned char *message, size_t block_nb)
 {
 	uint32 w[64];
 	uint32 wv[8];
 	uint32 t1, t2;
 	const unsigned char *sub_block;
-	int i;
-
 #ifndef UNROLL_LOOPS
 	int j;
 #endif
 
-	for (i = 0; i < (int) block_nb; i++) {
-		sub_block = message + (i << 6);
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA256_BLOCK_SIZE) {
+		sub_block = message;
 
 #ifndef UNROLL_LOOPS
 		for (j = 0; j < 16; j++) {
@@ -287,7 +328,7 @@ void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsig
 		}
 
 		for (j = 0; j < 8; j++) {
-			wv[j] = ctx->h[j];
+			wv[j] = h[j];
 		}
 
 		for (j = 0; j < 64; j++) {
@@ -305,7 +346,7 @@ void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsig
 		}
 
 		for (j = 0; j < 8; j++) {
-			ctx->h[j] += wv[j];
+			h[j] += wv[j];
 		}
 #else
 		PACK32(&sub_block[ 0], &w[ 0]); PACK32(&sub_block[ 4], &w[ 1]);
@@ -330,10 +371,10 @@ void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsig
 		SHA256_SCR(56); SHA256_SCR(57); SHA256_SCR(58); SHA256_SCR(59);
 		SHA256_SCR(60); SHA256_SCR(61); SHA256_SCR(62); SHA256_SCR(63);
 
-		wv[0] = ctx->h[0]; wv[1] = ctx->h[1];
-		wv[2] = ctx->h[2]; wv[3] = ctx->h[3];
-		wv[4] = ctx->h[4]; wv[5] = ctx->h[5];
-		wv[6] = ctx->h[6]; wv[7] = ctx->h[7];
+		wv[0] = h[0]; wv[1] = h[1];
+		wv[2] = h[2]; wv[3] = h[3];
+		wv[4] = h[4]; wv[5] = h[5];
+		wv[6] = h[6]; wv[7] = h[7];
 
 		SHA256_EXP(0,1,2,3,4,5,6,7, 0); SHA256_EXP(7,0,1,2,3,4,5,6, 1);
 		SHA256_EXP(6,7,0,1,2,3,4,5, 2); SHA256_EXP(5,6,7,0,1,2,3,4, 3);
@@ -368,15 +409,145 @@ void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, unsig
 		SHA256_EXP(4,5,6,7,0,1,2,3,60); SHA256_EXP(3,4,5,6,7,0,1,2,61);
 		SHA256_EXP(2,3,4,5,6,7,0,1,62); SHA256_EXP(1,2,3,4,5,6,7,0,63);
 
-		ctx->h[0] += wv[0]; ctx->h[1] += wv[1];
-		ctx->h[2] += wv[2]; ctx->h[3] += wv[3];
-		ctx->h[4] += wv[4]; ctx->h[5] += wv[5];
-		ctx->h[6] += wv[6]; ctx->h[7] += wv[7];
+		h[0] += wv[0]; h[1] += wv[1];
+		h[2] += wv[2]; h[3] += wv[3];
+		h[4] += wv[4]; h[5] += wv[5];
+		h[6] += wv[6]; h[7] += wv[7];
 #endif /* !UNROLL_LOOPS */
 	}
 }
 
-void ctb_sha256(const unsigned char *message, unsigned int len, unsigned char *digest)
+#if _CTB_SHA2_X86
+/* SHA-NI: four rounds per group, two sha256rnds2 each. The state lives as
+ * ABEF/CDGH pairs for the whole call and the schedule is expanded in place
+ * with sha256msg1/sha256msg2, one group ahead of the rounds.
+ */
+#define _CTB_SHA256_NI_GROUP(g, cur, prev, next)                              \
+{                                                                             \
+	msg = _mm_add_epi32(cur,                                                  \
+		_mm_loadu_si128((const __m128i *) &sha256_k[(g) << 2]));              \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                      \
+	if ((g) >= 3 && (g) <= 14) {                                              \
+		tmp = _mm_alignr_epi8(cur, prev, 4);                                  \
+		next = _mm_add_epi32(next, tmp);                                      \
+		next = _mm_sha256msg2_epu32(next, cur);                               \
+	}                                                                         \
+	msg = _mm_shuffle_epi32(msg, 0x0E);                                       \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                      \
+	if ((g) >= 1 && (g) <= 12)                                                \
+		prev = _mm_sha256msg1_epu32(prev, cur);                               \
+}
+
+_CTB_SHA2_TARGET("sha,sse4.1")
+static void _ctb_sha256_compress_shani(uint32 h[8], const unsigned char *message, size_t block_nb)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp;
+	__m128i m0, m1, m2, m3;
+
+	tmp    = _mm_loadu_si128((const __m128i *) &h[0]);
+	state1 = _mm_loadu_si128((const __m128i *) &h[4]);
+	tmp    = _mm_shuffle_epi32(tmp, 0xB1);          /* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1B);       /* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);       /* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);    /* CDGH */
+
+	for (; block_nb > 0; block_nb--, message += _CTB_SHA256_BLOCK_SIZE) {
+		abef = state0;
+		cdgh = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message +  0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 48)), bswap);
+
+		_CTB_SHA256_NI_GROUP( 0, m0, m3, m1);
+		_CTB_SHA256_NI_GROUP( 1, m1, m0, m2);
+		_CTB_SHA256_NI_GROUP( 2, m2, m1, m3);
+		_CTB_SHA256_NI_GROUP( 3, m3, m2, m0);
+		_CTB_SHA256_NI_GROUP( 4, m0, m3, m1);
+		_CTB_SHA256_NI_GROUP( 5, m1, m0, m2);
+		_CTB_SHA256_NI_GROUP( 6, m2, m1, m3);
+		_CTB_SHA256_NI_GROUP( 7, m3, m2, m0);
+		_CTB_SHA256_NI_GROUP( 8, m0, m3, m1);
+		_CTB_SHA256_NI_GROUP( 9, m1, m0, m2);
+		_CTB_SHA256_NI_GROUP(10, m2, m1, m3);
+		_CTB_SHA256_NI_GROUP(11, m3, m2, m0);
+		_CTB_SHA256_NI_GROUP(12, m0, m3, m1);
+		_CTB_SHA256_NI_GROUP(13, m1, m0, m2);
+		_CTB_SHA256_NI_GROUP(14, m2, m1, m3);
+		_CTB_SHA256_NI_GROUP(15, m3, m2, m0);
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp    = _mm_shuffle_epi32(state0, 0x1B);       /* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);       /* HGFE */
+
+	_mm_storeu_si128((__m128i *) &h[0], state0);
+	_mm_storeu_si128((__m128i *) &h[4], state1);
+}
+
+#undef _CTB_SHA256_NI_GROUP
+#endif /* _CTB_SHA2_X86 */
+
+static void _ctb_sha256_compress_resolve(uint32 h[8], const unsigned char *message, size_t block_nb);
+
+/* Selected on first use: SHA-NI when the CPU has it, scalar otherwise. */
+static void (*_ctb_sha256_compress)(uint32 h[8], const unsigned char *message, size_t block_nb)
+	= _ctb_sha256_compress_resolve;
+
+/* Threads racing to the first call all store the same pointer; relaxed
+ * atomic accesses keep that well defined.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+	#define _CTB_SHA2_FN_LOAD(p)		__atomic_load_n(&(p), __ATOMIC_RELAXED)
+	#define _CTB_SHA2_FN_STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+#else
+	#define _CTB_SHA2_FN_LOAD(p)		(p)
+	#define _CTB_SHA2_FN_STORE(p, v)	((p) = (v))
+#endif
+
+static void _ctb_sha256_compress_resolve(uint32 h[8], const unsigned char *message, size_t block_nb)
+{
+	void (*fn)(uint32 h[8], const unsigned char *message, size_t block_nb) = _ctb_sha256_compress_scalar;
+
+#if _CTB_SHA2_X86
+	{
+		unsigned int a, b, c, d, leaf1_ecx = 0, leaf7_ebx = 0;
+	#if defined(_MSC_VER)
+		int r[4];
+
+		__cpuid(r, 0);
+		if (r[0] >= 7) {
+			__cpuidex(r, 1, 0); leaf1_ecx = (unsigned int) r[2];
+			__cpuidex(r, 7, 0); leaf7_ebx = (unsigned int) r[1];
+		}
+		(void) a; (void) b; (void) c; (void) d;
+	#else
+		if (__get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(1, 0, a, b, c, d); leaf1_ecx = c;
+			__cpuid_count(7, 0, a, b, c, d); leaf7_ebx = b;
+		}
+	#endif
+		/* SHA extensions (leaf 7 EBX[29]) and SSE4.1 (leaf 1 ECX[19]) */
+		if ((leaf7_ebx & (1u << 29)) && (leaf1_ecx & (1u << 19)))
+			fn = _ctb_sha256_compress_shani;
+	}
+#endif
+	_CTB_SHA2_FN_STORE(_ctb_sha256_compress, fn);
+	fn(h, message, block_nb);
+}
+
+void _ctb_sha256_transf(ctb_sha256_ctx *ctx, const unsigned char *message, size_t block_nb)
+{
+	_CTB_SHA2_FN_LOAD(_ctb_sha256_compress)(ctx->h, message, block_nb);
+}
+
+void ctb_sha256(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha256_ctx ctx;
 
@@ -403,60 +574,65 @@ void ctb_sha256_init(ctb_sha256_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, unsigned int len)
+/* Pads in place: 0x80, zeros and the bit count go into ctx->block, with
+ * one extra compression when fewer than 9 bytes of it are free.
+ */
+static void _ctb_sha256_pad(ctb_sha256_ctx *ctx)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA256_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA256_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	uint64 len_b = (ctx->tot_len + ctx->len) << 3;
+	unsigned int n = ctx->len;
+
+	ctx->block[n++] = 0x80;
+	if (n > _CTB_SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->block + n, 0, _CTB_SHA256_BLOCK_SIZE - n);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		n = 0;
 	}
-
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA256_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
+	memset(ctx->block + n, 0, _CTB_SHA256_BLOCK_SIZE - 8 - n);
+	UNPACK32((uint32) (len_b >> 32), ctx->block + _CTB_SHA256_BLOCK_SIZE - 8);
+	UNPACK32((uint32) len_b, ctx->block + _CTB_SHA256_BLOCK_SIZE - 4);
 	_ctb_sha256_transf(ctx, ctx->block, 1);
-	_ctb_sha256_transf(ctx, shifted_message, block_nb);
+}
 
-	rem_len = new_len % _CTB_SHA256_BLOCK_SIZE;
+void ctb_sha256_update(ctb_sha256_ctx *ctx, const unsigned char *message, size_t len)
+{
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA256_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA256_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
+	}
 
-	memcpy(ctx->block, &shifted_message[block_nb << 6],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA256_BLOCK_SIZE;
+	if (block_nb) {
+		_ctb_sha256_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 6;
+		message += block_nb << 6;
+		len -= block_nb << 6;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 6;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA256_BLOCK_SIZE - 9)
-		< (ctx->len % _CTB_SHA256_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 6;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	_ctb_sha256_transf(ctx, ctx->block, block_nb);
+	_ctb_sha256_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 8; i++) {
@@ -476,7 +652,7 @@ void ctb_sha256_final(ctb_sha256_ctx *ctx, unsigned char *digest)
 
 /* SHA-512 functions */
 
-void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int block_nb)
+void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, size_t block_nb)
 {
 	uint64 w[80];
 	uint64 wv[8];
@@ -570,7 +746,7 @@ void ctb_sha512_transf(ctb_sha512_ctx *ctx, const unsigned char *message, unsign
 	}
 }
 
-void ctb_sha512(const unsigned char *message, unsigned int len, unsigned char *digest)
+void ctb_sha512(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha512_ctx ctx;
 
@@ -597,60 +773,63 @@ void ctb_sha512_init(ctb_sha512_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, unsigned int len)
+/* As _ctb_sha256_pad, with a 128-bit bit count. */
+static void _ctb_sha512_pad(ctb_sha512_ctx *ctx)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA512_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA512_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	uint64 len_b = (ctx->tot_len + ctx->len) << 3;
+	unsigned int n = ctx->len;
+
+	ctx->block[n++] = 0x80;
+	if (n > _CTB_SHA512_BLOCK_SIZE - 16) {
+		memset(ctx->block + n, 0, _CTB_SHA512_BLOCK_SIZE - n);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		n = 0;
 	}
-
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA512_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
+	memset(ctx->block + n, 0, _CTB_SHA512_BLOCK_SIZE - 16 - n);
+	UNPACK64((ctx->tot_len + ctx->len) >> 61, ctx->block + _CTB_SHA512_BLOCK_SIZE - 16);
+	UNPACK64(len_b, ctx->block + _CTB_SHA512_BLOCK_SIZE - 8);
 	ctb_sha512_transf(ctx, ctx->block, 1);
-	ctb_sha512_transf(ctx, shifted_message, block_nb);
+}
 
-	rem_len = new_len % _CTB_SHA512_BLOCK_SIZE;
+void ctb_sha512_update(ctb_sha512_ctx *ctx, const unsigned char *message, size_t len)
+{
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA512_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA512_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
+	}
 
-	memcpy(ctx->block, &shifted_message[block_nb << 7],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA512_BLOCK_SIZE;
+	if (block_nb) {
+		ctb_sha512_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 7;
+		message += block_nb << 7;
+		len -= block_nb << 7;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 7;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = 1 + ((_CTB_SHA512_BLOCK_SIZE - 17)
-		< (ctx->len % _CTB_SHA512_BLOCK_SIZE));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 7;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	ctb_sha512_transf(ctx, ctx->block, block_nb);
+	_ctb_sha512_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 8; i++) {
@@ -670,7 +849,7 @@ void ctb_sha512_final(ctb_sha512_ctx *ctx, unsigned char *digest)
 
 /* SHA-384 functions */
 
-void ctb_sha384(const unsigned char *message, unsigned int len, unsigned char *digest)
+void ctb_sha384(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha384_ctx ctx;
 
@@ -697,60 +876,45 @@ void ctb_sha384_init(ctb_sha384_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, unsigned int len)
+void ctb_sha384_update(ctb_sha384_ctx *ctx, const unsigned char *message, size_t len)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA384_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA384_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA384_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		ctb_sha512_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA384_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
 	}
 
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA384_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
-	ctb_sha512_transf(ctx, ctx->block, 1);
-	ctb_sha512_transf(ctx, shifted_message, block_nb);
-
-	rem_len = new_len % _CTB_SHA384_BLOCK_SIZE;
-
-	memcpy(ctx->block, &shifted_message[block_nb << 7],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA384_BLOCK_SIZE;
+	if (block_nb) {
+		ctb_sha512_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 7;
+		message += block_nb << 7;
+		len -= block_nb << 7;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 7;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA384_BLOCK_SIZE - 17)
-		< (ctx->len % _CTB_SHA384_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 7;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	ctb_sha512_transf(ctx, ctx->block, block_nb);
+	_ctb_sha512_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 6; i++) {
@@ -768,7 +932,7 @@ void ctb_sha384_final(ctb_sha384_ctx *ctx, unsigned char *digest)
 
 /* SHA-224 functions */
 
-void ctb_sha224(const unsigned char *message, unsigned int len, unsigned char *digest)
+void ctb_sha224(const unsigned char *message, size_t len, unsigned char *digest)
 {
 	ctb_sha224_ctx ctx;
 
@@ -795,60 +959,45 @@ void ctb_sha224_init(ctb_sha224_ctx *ctx)
 	ctx->tot_len = 0;
 }
 
-void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, unsigned int len)
+void ctb_sha224_update(ctb_sha224_ctx *ctx, const unsigned char *message, size_t len)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-
-	tmp_len = _CTB_SHA224_BLOCK_SIZE - ctx->len;
-	rem_len = len < tmp_len ? len : tmp_len;
-
-	memcpy(&ctx->block[ctx->len], message, rem_len);
-
-	if (ctx->len + len < _CTB_SHA224_BLOCK_SIZE) {
-		ctx->len += len;
-		return;
+	size_t block_nb, fill;
+
+	if (ctx->len) {
+		fill = _CTB_SHA224_BLOCK_SIZE - ctx->len;
+		if (len < fill) {
+			memcpy(&ctx->block[ctx->len], message, len);
+			ctx->len += (unsigned int) len;
+			return;
+		}
+		memcpy(&ctx->block[ctx->len], message, fill);
+		_ctb_sha256_transf(ctx, ctx->block, 1);
+		ctx->tot_len += _CTB_SHA224_BLOCK_SIZE;
+		message += fill;
+		len -= fill;
 	}
 
-	new_len = len - rem_len;
-	block_nb = new_len / _CTB_SHA224_BLOCK_SIZE;
-
-	shifted_message = message + rem_len;
-
-	_ctb_sha256_transf(ctx, ctx->block, 1);
-	_ctb_sha256_transf(ctx, shifted_message, block_nb);
-
-	rem_len = new_len % _CTB_SHA224_BLOCK_SIZE;
-
-	memcpy(ctx->block, &shifted_message[block_nb << 6],
-		rem_len);
+	/* whole blocks straight from the caller's buffer */
+	block_nb = len / _CTB_SHA224_BLOCK_SIZE;
+	if (block_nb) {
+		_ctb_sha256_transf(ctx, message, block_nb);
+		ctx->tot_len += (uint64) block_nb << 6;
+		message += block_nb << 6;
+		len -= block_nb << 6;
+	}
 
-	ctx->len = rem_len;
-	ctx->tot_len += (block_nb + 1) << 6;
+	if (len)
+		memcpy(ctx->block, message, len);
+	ctx->len = (unsigned int) len;
 }
 
 void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest)
 {
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-
 #ifndef UNROLL_LOOPS
 	int i;
 #endif
 
-	block_nb = (1 + ((_CTB_SHA224_BLOCK_SIZE - 9)
-		< (ctx->len % _CTB_SHA224_BLOCK_SIZE)));
-
-	len_b = (ctx->tot_len + ctx->len) << 3;
-	pm_len = block_nb << 6;
-
-	memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
-	ctx->block[ctx->len] = 0x80;
-	UNPACK32(len_b, ctx->block + pm_len - 4);
-
-	_ctb_sha256_transf(ctx, ctx->block, block_nb);
+	_ctb_sha256_pad(ctx);
 
 #ifndef UNROLL_LOOPS
 	for (i = 0 ; i < 7; i++) {
@@ -865,6 +1014,60 @@ void ctb_sha224_final(ctb_sha224_ctx *ctx, unsigned char *digest)
 #endif /* !UNROLL_LOOPS */
 }
 
+int ctb_sha256_export(const ctb_sha256_ctx *ctx, unsigned char out[CTB_SHA256_MIDSTATE_SIZE])
+{
+	int i;
+
+	if (ctx->len != 0)
+		return -1;
+	for (i = 0; i < 8; i++)
+		UNPACK32(ctx->h[i], &out[i << 2]);
+	UNPACK64(ctx->tot_len, &out[32]);
+	return 0;
+}
+
+int ctb_sha256_import(ctb_sha256_ctx *ctx, const unsigned char in[CTB_SHA256_MIDSTATE_SIZE])
+{
+	uint64 tot_len;
+	int i;
+
+	PACK64(&in[32], &tot_len);
+	if (tot_len % _CTB_SHA256_BLOCK_SIZE)
+		return -1;
+	for (i = 0; i < 8; i++)
+		PACK32(&in[i << 2], &ctx->h[i]);
+	ctx->tot_len = tot_len;
+	ctx->len = 0;
+	return 0;
+}
+
+int ctb_sha512_export(const ctb_sha512_ctx *ctx, unsigned char out[CTB_SHA512_MIDSTATE_SIZE])
+{
+	int i;
+
+	if (ctx->len != 0)
+		return -1;
+	for (i = 0; i < 8; i++)
+		UNPACK64(ctx->h[i], &out[i << 3]);
+	UNPACK64(ctx->tot_len, &out[64]);
+	return 0;
+}
+
+int ctb_sha512_import(ctb_sha512_ctx *ctx, const unsigned char in[CTB_SHA512_MIDSTATE_SIZE])
+{
+	uint64 tot_len;
+	int i;
+
+	PACK64(&in[64], &tot_len);
+	if (tot_len % _CTB_SHA512_BLOCK_SIZE)
+		return -1;
+	for (i = 0; i < 8; i++)
+		PACK64(&in[i << 3], &ctx->h[i]);
+	ctx->tot_len = tot_len;
+	ctx->len = 0;
+	return 0;
+}
+
 #ifdef CTB_SHA2_TEST_VECTORS
 
 /* FIPS 180-2 Validation tests */